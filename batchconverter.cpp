@@ -0,0 +1,313 @@
+﻿#include "batchconverter.h"
+
+#include "dicomscanner.h"
+#include "dicomvolumeloader.h"
+#include "volumewriter.h"
+
+#include <itkExceptionObject.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <new>
+#include <set>
+#include <system_error>
+#include <thread>
+
+namespace
+{
+
+// 按字节计数的内存预算：占用之和不超过上限；单个请求超过上限时等到无人占用后独占运行
+class ByteBudget
+{
+public:
+    explicit ByteBudget(size_t limit) : m_limit(limit), m_used(0) {}
+
+    void Acquire(size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]() { return m_used == 0 || m_used + bytes <= m_limit; });
+        m_used += bytes;
+    }
+
+    void Release(size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_used -= bytes;
+        }
+        m_cond.notify_all();
+    }
+
+private:
+    size_t m_limit;
+    size_t m_used;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+// 计数信号量，限制同时读写磁盘的序列数
+class IoGate
+{
+public:
+    explicit IoGate(unsigned int slots) : m_free(std::max(1u, slots)) {}
+
+    void Acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]() { return m_free > 0; });
+        --m_free;
+    }
+
+    void Release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_free;
+        }
+        m_cond.notify_one();
+    }
+
+private:
+    unsigned int m_free;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+class IoSlot
+{
+public:
+    explicit IoSlot(IoGate &gate) : m_gate(gate) { m_gate.Acquire(); }
+    ~IoSlot() { m_gate.Release(); }
+
+    IoSlot(const IoSlot &) = delete;
+    IoSlot &operator=(const IoSlot &) = delete;
+
+private:
+    IoGate &m_gate;
+};
+
+class BudgetReservation
+{
+public:
+    BudgetReservation(ByteBudget &budget, size_t bytes) : m_budget(budget), m_bytes(bytes) { m_budget.Acquire(m_bytes); }
+    ~BudgetReservation() { m_budget.Release(m_bytes); }
+
+    BudgetReservation(const BudgetReservation &) = delete;
+    BudgetReservation &operator=(const BudgetReservation &) = delete;
+
+private:
+    ByteBudget &m_budget;
+    size_t m_bytes;
+};
+
+enum class ConvertOutcome
+{
+    Converted,
+    Skipped,
+    Failed
+};
+
+struct ConvertTask
+{
+    std::vector<std::string> fileNames;
+    bool multiFrame = false;
+    // 用于占用内存预算的体数据字节数（多帧按最大的 4 字节像素估计）
+    size_t estimatedBytes = 0;
+    std::filesystem::path outputPath;
+};
+
+std::string SanitizeName(const std::string &text)
+{
+    std::string result;
+    for (unsigned char c : text) {
+        result += (std::isalnum(c) || c == '-' || c == '.') ? static_cast<char>(c) : '_';
+    }
+    return result;
+}
+
+// 输出文件名：<PatientID>_S<SeriesNumber>_<Modality>，缺失时用 SeriesInstanceUID
+std::string SeriesBaseName(const DicomSeriesInfo &series)
+{
+    const DicomFileHeader &header = series.files.front();
+    std::string name;
+    if (!header.patientID.empty()) {
+        name += SanitizeName(header.patientID) + "_";
+    }
+    if (!header.seriesNumber.empty()) {
+        name += "S" + SanitizeName(header.seriesNumber);
+    } else {
+        name += SanitizeName(series.seriesUID);
+    }
+    if (!header.modality.empty()) {
+        name += "_" + SanitizeName(header.modality);
+    }
+    return name;
+}
+
+} // namespace
+
+BatchConvertSummary ConvertDicomTree(const BatchConvertOptions &options,
+                                     const std::function<void(const std::string &)> &log)
+{
+    BatchConvertSummary summary;
+    std::mutex logMutex;
+    auto report = [&](const std::string &message) {
+        if (log) {
+            std::lock_guard<std::mutex> lock(logMutex);
+            log(message);
+        }
+    };
+
+    // 与界面“打开目录”相同：有文件头无法快速解析时整棵树回退到 GDCM 扫描，不转换缺层的序列
+    std::vector<DicomSeriesInfo> seriesList;
+    size_t scannedFiles = 0;
+    if (!FindAllDicomSeries(options.inputDirectory, true, seriesList, &scannedFiles)) {
+        report("No DICOM series found in " + options.inputDirectory);
+        return summary;
+    }
+    summary.seriesFound = seriesList.size();
+    report("Found " + std::to_string(seriesList.size()) + " series in " +
+           std::to_string(scannedFiles) + " files");
+
+    // 输出路径在调度前统一确定，同名序列追加序号
+    std::filesystem::path inputRoot = std::filesystem::path(options.inputDirectory).lexically_normal();
+    if (!inputRoot.has_filename()) {
+        inputRoot = inputRoot.parent_path();
+    }
+    const std::filesystem::path outputRoot(options.outputDirectory);
+    std::set<std::filesystem::path> usedPaths;
+    std::vector<ConvertTask> tasks;
+    tasks.reserve(seriesList.size());
+    for (const DicomSeriesInfo &series : seriesList) {
+        if (series.files.empty()) {
+            continue;
+        }
+        ConvertTask task;
+        task.fileNames = series.FileNames();
+        const DicomFileHeader &first = series.files.front();
+        task.multiFrame = task.fileNames.size() == 1 && first.numberOfFrames > 1;
+
+        std::filesystem::path relative =
+            std::filesystem::path(first.fileName).parent_path().lexically_normal().lexically_relative(inputRoot);
+        if (relative.empty() || relative == "." || *relative.begin() == "..") {
+            relative.clear();
+        }
+        const std::string baseName = SeriesBaseName(series);
+        std::filesystem::path outputPath = outputRoot / relative / (baseName + options.extension);
+        for (int suffix = 2; !usedPaths.insert(outputPath).second; ++suffix) {
+            outputPath = outputRoot / relative / (baseName + "_" + std::to_string(suffix) + options.extension);
+        }
+        task.outputPath = outputPath;
+
+        const size_t slices = task.multiFrame ? static_cast<size_t>(first.numberOfFrames) : task.fileNames.size();
+        task.estimatedBytes = static_cast<size_t>(first.rows) * first.columns * slices * sizeof(float);
+        tasks.push_back(std::move(task));
+    }
+
+    size_t memoryBudget = options.memoryBudget;
+    if (memoryBudget == 0) {
+        const uint64_t physical = BrickedVolumeStore::PhysicalMemoryBytes();
+        memoryBudget = physical ? static_cast<size_t>(physical / 2) : static_cast<size_t>(4) << 30;
+    }
+    unsigned int workerCount = options.maxConcurrentSeries;
+    if (workerCount == 0) {
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        workerCount = std::clamp(cores / 2, 2u, 8u);
+    }
+    workerCount = std::min<unsigned int>(workerCount, static_cast<unsigned int>(tasks.size()));
+
+    ByteBudget memory(memoryBudget);
+    IoGate io(options.maxConcurrentIo);
+    std::atomic<size_t> nextTask(0);
+    std::atomic<size_t> finished(0);
+    std::atomic<size_t> outcomes[3] = { { 0 }, { 0 }, { 0 } };
+
+    auto convertOne = [&](ConvertTask &task) -> ConvertOutcome {
+        std::error_code ec;
+        if (!options.overwrite && std::filesystem::exists(task.outputPath, ec)) {
+            return ConvertOutcome::Skipped;
+        }
+
+        int scalarType = -1;
+        if (!task.multiFrame) {
+            // 读三个文件头即可确定原生像素类型，据此把估计值收紧到实际大小
+            scalarType = SelectDicomScalarType(task.fileNames);
+            const size_t voxelBytes = static_cast<size_t>(vtkDataArray::GetDataTypeSize(scalarType));
+            task.estimatedBytes = task.estimatedBytes / sizeof(float) * std::max<size_t>(1, voxelBytes);
+        }
+
+        BudgetReservation reservation(memory, task.estimatedBytes);
+
+        DicomVolumeMetadata metadata;
+        vtkSmartPointer<vtkImageData> image;
+        std::string error;
+        {
+            IoSlot slot(io);
+            if (task.multiFrame) {
+                image = LoadMultiFrameVolume(task.fileNames.front(), &metadata, &error);
+            } else {
+                try {
+                    image = LoadDicomSeries(task.fileNames, &metadata, scalarType);
+                } catch (const itk::ExceptionObject &e) {
+                    error = e.GetDescription();
+                } catch (const std::bad_alloc &) {
+                    error = "Out of memory.";
+                }
+            }
+        }
+        if (!image) {
+            report("Failed to read " + task.fileNames.front() + ": " + error);
+            return ConvertOutcome::Failed;
+        }
+
+        VolumeFileDescription description;
+        image->GetDimensions(description.dims);
+        image->GetSpacing(description.spacing);
+        image->GetOrigin(description.origin);
+        std::copy(std::begin(metadata.direction), std::end(metadata.direction), description.direction);
+        description.scalarType = image->GetScalarType();
+
+        std::filesystem::create_directories(task.outputPath.parent_path(), ec);
+        bool written = false;
+        {
+            IoSlot slot(io);
+            written = WriteCompressedVolume(task.outputPath, image->GetScalarPointer(), description, &error);
+        }
+        if (!written) {
+            std::filesystem::remove(task.outputPath, ec);
+            report("Failed to write " + task.outputPath.u8string() + ": " + error);
+            return ConvertOutcome::Failed;
+        }
+        return ConvertOutcome::Converted;
+    };
+
+    // 调度线程大部分时间阻塞在预算与 I/O 上，不占用共享线程池；解码与压缩仍在线程池上并行
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount);
+    for (unsigned int w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&]() {
+            for (size_t index = nextTask++; index < tasks.size(); index = nextTask++) {
+                ConvertTask &task = tasks[index];
+                const ConvertOutcome outcome = convertOne(task);
+                ++outcomes[static_cast<int>(outcome)];
+                const size_t done = ++finished;
+                const char *status = outcome == ConvertOutcome::Converted ? "ok"
+                                   : outcome == ConvertOutcome::Skipped ? "exists, skipped" : "failed";
+                report("[" + std::to_string(done) + "/" + std::to_string(tasks.size()) + "] " +
+                       task.outputPath.u8string() + " " + status);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    summary.converted = outcomes[static_cast<int>(ConvertOutcome::Converted)];
+    summary.skipped = outcomes[static_cast<int>(ConvertOutcome::Skipped)];
+    summary.failed = outcomes[static_cast<int>(ConvertOutcome::Failed)];
+    return summary;
+}
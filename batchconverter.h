@@ -0,0 +1,40 @@
+﻿#ifndef BATCHCONVERTER_H
+#define BATCHCONVERTER_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// 目录树批量转换参数
+struct BatchConvertOptions
+{
+    std::string inputDirectory;
+    std::string outputDirectory;
+    // 输出扩展名：.nii.gz / .nii / .mha
+    std::string extension = ".nii.gz";
+    // 同时处理的序列数，0 表示按 CPU 数量自动选择
+    unsigned int maxConcurrentSeries = 0;
+    // 同时读盘/写盘的序列数
+    unsigned int maxConcurrentIo = 2;
+    // 所有在处理序列的体数据总字节上限，0 表示物理内存的一半
+    size_t memoryBudget = 0;
+    bool overwrite = false;
+};
+
+struct BatchConvertSummary
+{
+    size_t seriesFound = 0;
+    size_t converted = 0;
+    size_t skipped = 0;
+    size_t failed = 0;
+};
+
+// 递归扫描 inputDirectory，按与界面“打开目录”相同的规则（UseSeriesDetails + 0008|0021）
+// 分组，每个序列转换为一个文件，输出保持输入的相对目录结构。
+// 调度器同时运行若干序列：每个序列先按估计大小占用内存预算（超出预算的单个序列独占运行），
+// 读取与写出阶段再受 I/O 并发上限约束；压缩在共享线程池上并行。
+// log 串行调用，可能来自任意线程。
+BatchConvertSummary ConvertDicomTree(const BatchConvertOptions &options,
+                                     const std::function<void(const std::string &)> &log = {});
+
+#endif // BATCHCONVERTER_H
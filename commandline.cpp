@@ -0,0 +1,467 @@
+﻿#include "commandline.h"
+
+#include "batchconverter.h"
+#include "dicomvolumeloader.h"
+#include "maskoverlay.h"
+#include "renderbenchmark.h"
+#include "sliceexporter.h"
+#include "volumehistogram.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QStringList>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <vtkSetGet.h>
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <itkExceptionObject.h>
+
+namespace
+{
+
+struct CommandLineOptions
+{
+    QCommandLineOption exportPng { QStringLiteral("export-png"),
+        QStringLiteral("Export slices of the first DICOM series in <dir> as PNG."), QStringLiteral("dir") };
+    QCommandLineOption convert { QStringLiteral("convert"),
+        QStringLiteral("Convert every DICOM series under <dir> (recursively) to NIfTI or MetaImage."), QStringLiteral("dir") };
+    QCommandLineOption output { QStringLiteral("output"),
+        QStringLiteral("Output directory."), QStringLiteral("dir") };
+    QCommandLineOption step { QStringLiteral("step"),
+        QStringLiteral("Export every Nth slice (default 1)."), QStringLiteral("N") };
+    QCommandLineOption window { QStringLiteral("window"),
+        QStringLiteral("Window width (default: automatic preset)."), QStringLiteral("W") };
+    QCommandLineOption level { QStringLiteral("level"),
+        QStringLiteral("Window level (default: automatic preset)."), QStringLiteral("L") };
+    QCommandLineOption mask { QStringLiteral("mask"),
+        QStringLiteral("Label volume to overlay; may be repeated."), QStringLiteral("file") };
+    QCommandLineOption axes { QStringLiteral("axes"),
+        QStringLiteral("Comma separated subset of axial,sagittal,coronal."), QStringLiteral("list") };
+    QCommandLineOption noSquarePixels { QStringLiteral("no-square-pixels"),
+        QStringLiteral("Write one pixel per voxel without spacing correction.") };
+    QCommandLineOption format { QStringLiteral("format"),
+        QStringLiteral("Conversion output format: nii.gz (default), nii or mha."), QStringLiteral("ext") };
+    QCommandLineOption jobs { QStringLiteral("jobs"),
+        QStringLiteral("Series converted at the same time (default: automatic)."), QStringLiteral("N") };
+    QCommandLineOption ioJobs { QStringLiteral("io-jobs"),
+        QStringLiteral("Series reading or writing at the same time (default 2)."), QStringLiteral("N") };
+    QCommandLineOption memory { QStringLiteral("memory-mb"),
+        QStringLiteral("Memory budget for volumes in flight (default: half of RAM)."), QStringLiteral("MB") };
+    QCommandLineOption overwrite { QStringLiteral("overwrite"),
+        QStringLiteral("Replace existing output files instead of skipping them.") };
+    QCommandLineOption benchmark { QStringLiteral("benchmark"),
+        QStringLiteral("Measure offscreen render latency of the first DICOM series in <dir>."), QStringLiteral("dir") };
+    QCommandLineOption benchmarkSynthetic { QStringLiteral("benchmark-synthetic"),
+        QStringLiteral("Measure offscreen render latency on a generated WxHxD int16 phantom."), QStringLiteral("WxHxD") };
+    QCommandLineOption frames { QStringLiteral("frames"),
+        QStringLiteral("Timed frames per benchmark operation (default 200)."), QStringLiteral("N") };
+    QCommandLineOption size { QStringLiteral("size"),
+        QStringLiteral("Offscreen render window size (default 512x512)."), QStringLiteral("WxH") };
+    QCommandLineOption json { QStringLiteral("json"),
+        QStringLiteral("Write benchmark results to <file> instead of standard output."), QStringLiteral("file") };
+};
+
+} // namespace
+
+bool IsCommandLineMode(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--export-png") == 0 || std::strcmp(argv[i], "--convert") == 0 ||
+            std::strcmp(argv[i], "--benchmark") == 0 || std::strcmp(argv[i], "--benchmark-synthetic") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 与界面相同：只读文件头找到第一个序列，多帧对象同步解码，其余按原生像素类型读入内存
+static vtkSmartPointer<vtkImageData> LoadVolume(const QString &directory, DicomVolumeMetadata &metadata)
+{
+    std::vector<std::string> seriesFiles;
+    bool isMultiFrame = false;
+    if (!FindDicomSeries(directory.toStdString(), seriesFiles, &isMultiFrame)) {
+        std::cerr << "No DICOM series found in " << directory.toStdString() << std::endl;
+        return nullptr;
+    }
+
+    if (isMultiFrame) {
+        std::string error;
+        vtkSmartPointer<vtkImageData> image = LoadMultiFrameVolume(seriesFiles.front(), &metadata, &error);
+        if (!image) {
+            std::cerr << "Failed to decode multi-frame DICOM: " << error << std::endl;
+        }
+        return image;
+    }
+
+    try {
+        return LoadDicomSeries(seriesFiles, &metadata);
+    } catch (const itk::ExceptionObject &e) {
+        std::cerr << "Failed to read DICOM series: " << e.GetDescription() << std::endl;
+    }
+    return nullptr;
+}
+
+// 未指定窗宽窗位时使用与界面相同的第一个预设（直方图自动窗）
+static bool DefaultWindowLevel(vtkImageData *image, const std::string &modality,
+                               double &window, double &level)
+{
+    VolumeHistogram histogram;
+    const void *scalars = image->GetScalarPointer();
+    const size_t count = static_cast<size_t>(image->GetNumberOfPoints());
+    switch (image->GetScalarType()) {
+        vtkTemplateMacro(histogram = VolumeHistogram::Compute(static_cast<const VTK_TT *>(scalars), count));
+    }
+    const std::vector<WindowLevelPreset> presets = BuildWindowLevelPresets(modality, histogram);
+    if (presets.empty()) {
+        return false;
+    }
+    window = presets.front().window;
+    level = presets.front().level;
+    return true;
+}
+
+static int RunExportPng(const QCommandLineParser &parser, const CommandLineOptions &opt)
+{
+    SliceExportOptions options;
+    options.outputDirectory = parser.value(opt.output);
+    if (options.outputDirectory.isEmpty()) {
+        std::cerr << "--output is required" << std::endl;
+        return 2;
+    }
+
+    bool ok = true;
+    if (parser.isSet(opt.step)) {
+        options.step = parser.value(opt.step).toInt(&ok);
+        if (!ok || options.step < 1) {
+            std::cerr << "--step must be a positive integer" << std::endl;
+            return 2;
+        }
+    }
+
+    if (parser.isSet(opt.axes)) {
+        options.axes[0] = options.axes[1] = options.axes[2] = false;
+        const QStringList axes = parser.value(opt.axes).split(QLatin1Char(','), Qt::SkipEmptyParts);
+        for (const QString &axis : axes) {
+            const QString name = axis.trimmed().toLower();
+            if (name == QLatin1String("sagittal")) {
+                options.axes[0] = true;
+            } else if (name == QLatin1String("coronal")) {
+                options.axes[1] = true;
+            } else if (name == QLatin1String("axial")) {
+                options.axes[2] = true;
+            } else {
+                std::cerr << "Unknown axis: " << name.toStdString() << std::endl;
+                return 2;
+            }
+        }
+    }
+    options.squarePixels = !parser.isSet(opt.noSquarePixels);
+
+    DicomVolumeMetadata metadata;
+    vtkSmartPointer<vtkImageData> image = LoadVolume(parser.value(opt.exportPng), metadata);
+    if (!image) {
+        return 1;
+    }
+
+    if (parser.isSet(opt.window) != parser.isSet(opt.level)) {
+        std::cerr << "--window and --level must be given together" << std::endl;
+        return 2;
+    }
+    if (parser.isSet(opt.window)) {
+        bool levelOk = true;
+        options.window = parser.value(opt.window).toDouble(&ok);
+        options.level = parser.value(opt.level).toDouble(&levelOk);
+        if (!ok || !levelOk || options.window <= 0.0) {
+            std::cerr << "Invalid window/level" << std::endl;
+            return 2;
+        }
+    } else if (!DefaultWindowLevel(image, metadata.modality, options.window, options.level)) {
+        std::cerr << "Cannot derive a default window/level" << std::endl;
+        return 1;
+    }
+
+    // 掩膜图层按命令行顺序由下往上合成；与图像网格不一致时按真实几何重采样到图像网格
+    int dims[3];
+    double spacing[3];
+    double origin[3];
+    image->GetDimensions(dims);
+    image->GetSpacing(spacing);
+    image->GetOrigin(origin);
+    std::vector<vtkSmartPointer<vtkImageData>> masks;
+    for (const QString &maskPath : parser.values(opt.mask)) {
+        double maskDirection[9];
+        vtkSmartPointer<vtkImageData> mask = ReadMaskVolume(maskPath.toStdString(), maskDirection);
+        if (!mask) {
+            std::cerr << "Failed to read mask file: " << maskPath.toStdString() << std::endl;
+            return 1;
+        }
+        int maskDims[3];
+        mask->GetDimensions(maskDims);
+        if (!MaskMatchesGrid(mask, maskDirection, dims, spacing, origin, metadata.direction)) {
+            size_t insideCount = 0;
+            mask = ResampleMaskToGrid(mask, maskDirection, dims, spacing, origin, metadata.direction, nullptr,
+                                      &insideCount);
+            if (!mask) {
+                std::cerr << "Invalid mask direction matrix: " << maskPath.toStdString() << std::endl;
+                return 1;
+            }
+            std::cout << "Resampled mask " << maskPath.toStdString() << " from " << maskDims[0] << "x"
+                      << maskDims[1] << "x" << maskDims[2] << std::endl;
+            if (insideCount == 0) {
+                std::cerr << "Warning: mask does not overlap the image: " << maskPath.toStdString() << std::endl;
+            }
+        }
+        MaskOverlayLayer layer;
+        layer.labels = mask->GetScalarPointer();
+        layer.wideLabels = mask->GetScalarType() == VTK_SHORT;
+        mask->GetDimensions(layer.dims);
+        options.masks.push_back(layer);
+        masks.push_back(mask);
+    }
+
+    std::cout << "Exporting " << dims[0] << "x" << dims[1] << "x" << dims[2]
+              << " volume, W/L " << options.window << "/" << options.level
+              << ", every " << options.step << " slice(s)" << std::endl;
+
+    int lastPercent = -1;
+    std::string error;
+    const bool exported = ExportSlicesToPng(image, options, &error, ThreadPool::Global(),
+        [&lastPercent](double fraction) {
+            const int percent = static_cast<int>(fraction * 100.0);
+            if (percent / 10 != lastPercent / 10) {
+                lastPercent = percent;
+                std::cout << percent << "%" << std::endl;
+            }
+        });
+    if (!exported) {
+        std::cerr << "Export failed: " << error << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int RunConvert(const QCommandLineParser &parser, const CommandLineOptions &opt)
+{
+    BatchConvertOptions options;
+    options.inputDirectory = parser.value(opt.convert).toStdString();
+    options.outputDirectory = parser.value(opt.output).toStdString();
+    if (options.outputDirectory.empty()) {
+        std::cerr << "--output is required" << std::endl;
+        return 2;
+    }
+
+    if (parser.isSet(opt.format)) {
+        const QString format = parser.value(opt.format).toLower();
+        if (format != QLatin1String("nii.gz") && format != QLatin1String("nii") && format != QLatin1String("mha")) {
+            std::cerr << "Unknown format: " << format.toStdString() << std::endl;
+            return 2;
+        }
+        options.extension = "." + format.toStdString();
+    }
+
+    // 数值参数须为正整数
+    const std::pair<const QCommandLineOption *, unsigned int *> counts[] = {
+        { &opt.jobs, &options.maxConcurrentSeries },
+        { &opt.ioJobs, &options.maxConcurrentIo },
+    };
+    for (const auto &count : counts) {
+        if (!parser.isSet(*count.first)) {
+            continue;
+        }
+        bool ok = false;
+        const int value = parser.value(*count.first).toInt(&ok);
+        if (!ok || value < 1) {
+            std::cerr << "--" << count.first->names().front().toStdString()
+                      << " must be a positive integer" << std::endl;
+            return 2;
+        }
+        *count.second = static_cast<unsigned int>(value);
+    }
+    if (parser.isSet(opt.memory)) {
+        bool ok = false;
+        const qlonglong megabytes = parser.value(opt.memory).toLongLong(&ok);
+        if (!ok || megabytes < 1) {
+            std::cerr << "--memory-mb must be a positive integer" << std::endl;
+            return 2;
+        }
+        options.memoryBudget = static_cast<size_t>(megabytes) << 20;
+    }
+    options.overwrite = parser.isSet(opt.overwrite);
+
+    const BatchConvertSummary summary = ConvertDicomTree(options, [](const std::string &message) {
+        std::cout << message << std::endl;
+    });
+    std::cout << "Converted " << summary.converted << ", skipped " << summary.skipped
+              << ", failed " << summary.failed << " of " << summary.seriesFound << " series" << std::endl;
+    if (summary.seriesFound == 0) {
+        return 1;
+    }
+    return summary.failed > 0 ? 1 : 0;
+}
+
+// 解析 "512x512x300" 形式的尺寸，各分量须为正整数
+static bool ParseSize(const QString &text, int *values, int count)
+{
+    const QStringList parts = text.split(QLatin1Char('x'));
+    if (parts.size() != count) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        bool ok = false;
+        values[i] = parts[i].trimmed().toInt(&ok);
+        if (!ok || values[i] < 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 没有样例数据的机器（CI）上使用的 int16 模体：空气背景中的椭圆柱体，内部带平滑起伏
+static vtkSmartPointer<vtkImageData> CreatePhantomVolume(const int dims[3])
+{
+    auto image = vtkSmartPointer<vtkImageData>::New();
+    image->SetDimensions(dims[0], dims[1], dims[2]);
+    image->SetSpacing(0.7, 0.7, 1.0);
+    image->AllocateScalars(VTK_SHORT, 1);
+    auto *voxels = static_cast<short *>(image->GetScalarPointer());
+    const size_t sliceSize = static_cast<size_t>(dims[0]) * dims[1];
+    ThreadPool::Global().ParallelFor(0, static_cast<size_t>(dims[2]), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            for (int j = 0; j < dims[1]; ++j) {
+                const double v = (j - 0.5 * dims[1]) / (0.4 * dims[1]);
+                short *row = voxels + sliceSize * k + static_cast<size_t>(j) * dims[0];
+                for (int i = 0; i < dims[0]; ++i) {
+                    const double u = (i - 0.5 * dims[0]) / (0.45 * dims[0]);
+                    const bool inside = u * u + v * v < 1.0;
+                    row[i] = inside ? static_cast<short>(40.0 + 300.0 * std::sin(0.05 * i) * std::cos(0.07 * j + 0.03 * k))
+                                    : static_cast<short>(-1000);
+                }
+            }
+        }
+    });
+    return image;
+}
+
+static int RunBenchmark(const QCommandLineParser &parser, const CommandLineOptions &opt)
+{
+    RenderBenchmarkOptions options;
+    if (parser.isSet(opt.frames)) {
+        bool ok = false;
+        options.frames = parser.value(opt.frames).toInt(&ok);
+        if (!ok || options.frames < 1) {
+            std::cerr << "--frames must be a positive integer" << std::endl;
+            return 2;
+        }
+    }
+    if (parser.isSet(opt.size)) {
+        int size[2];
+        if (!ParseSize(parser.value(opt.size), size, 2)) {
+            std::cerr << "--size must look like 512x512" << std::endl;
+            return 2;
+        }
+        options.width = size[0];
+        options.height = size[1];
+    }
+
+    vtkSmartPointer<vtkImageData> image;
+    QString source;
+    DicomVolumeMetadata metadata;
+    if (parser.isSet(opt.benchmark)) {
+        source = parser.value(opt.benchmark);
+        image = LoadVolume(source, metadata);
+        if (!image) {
+            return 1;
+        }
+    } else {
+        int dims[3];
+        if (!ParseSize(parser.value(opt.benchmarkSynthetic), dims, 3)) {
+            std::cerr << "--benchmark-synthetic must look like 512x512x300" << std::endl;
+            return 2;
+        }
+        source = QStringLiteral("synthetic");
+        metadata.modality = "CT";
+        image = CreatePhantomVolume(dims);
+    }
+    if (!DefaultWindowLevel(image, metadata.modality, options.window, options.level)) {
+        options.window = 0.0;
+    }
+
+    RenderBenchmarkReport report;
+    std::string error;
+    if (!RunRenderBenchmark(image, options, report, &error)) {
+        std::cerr << "Benchmark failed: " << error << std::endl;
+        return 1;
+    }
+
+    // 机器可读输出：每项操作一条记录，时间单位毫秒
+    int dims[3];
+    image->GetDimensions(dims);
+    QJsonObject root;
+    root.insert(QStringLiteral("source"), source);
+    root.insert(QStringLiteral("dimensions"), QJsonArray{ dims[0], dims[1], dims[2] });
+    root.insert(QStringLiteral("scalarType"), QString::fromLatin1(image->GetScalarTypeAsString()));
+    root.insert(QStringLiteral("windowSize"), QJsonArray{ options.width, options.height });
+    root.insert(QStringLiteral("renderWindow"), QString::fromStdString(report.renderWindowClass));
+    QJsonArray operations;
+    for (const RenderLatencyStats &stats : report.operations) {
+        QJsonObject entry;
+        entry.insert(QStringLiteral("operation"), QString::fromStdString(stats.operation));
+        entry.insert(QStringLiteral("frames"), static_cast<qint64>(stats.frames));
+        entry.insert(QStringLiteral("first_ms"), stats.firstFrame);
+        entry.insert(QStringLiteral("mean_ms"), stats.mean);
+        entry.insert(QStringLiteral("p50_ms"), stats.p50);
+        entry.insert(QStringLiteral("p95_ms"), stats.p95);
+        entry.insert(QStringLiteral("p99_ms"), stats.p99);
+        entry.insert(QStringLiteral("max_ms"), stats.max);
+        operations.append(entry);
+    }
+    root.insert(QStringLiteral("operations"), operations);
+    const QByteArray text = QJsonDocument(root).toJson(QJsonDocument::Indented);
+
+    if (!parser.isSet(opt.json)) {
+        std::cout << text.constData();
+        return 0;
+    }
+    QFile file(parser.value(opt.json));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(text) != text.size()) {
+        std::cerr << "Cannot write " << parser.value(opt.json).toStdString() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int RunCommandLine(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("myDicomViewer batch mode"));
+    parser.addHelpOption();
+
+    const CommandLineOptions opt;
+    parser.addOptions({ opt.exportPng, opt.convert, opt.output, opt.step, opt.window, opt.level,
+                        opt.mask, opt.axes, opt.noSquarePixels, opt.format, opt.jobs, opt.ioJobs,
+                        opt.memory, opt.overwrite, opt.benchmark, opt.benchmarkSynthetic, opt.frames,
+                        opt.size, opt.json });
+    parser.process(app);
+
+    if (parser.isSet(opt.exportPng)) {
+        return RunExportPng(parser, opt);
+    }
+    if (parser.isSet(opt.convert)) {
+        return RunConvert(parser, opt);
+    }
+    if (parser.isSet(opt.benchmark) || parser.isSet(opt.benchmarkSynthetic)) {
+        return RunBenchmark(parser, opt);
+    }
+    parser.showHelp(2);
+    return 2;
+}
@@ -0,0 +1,15 @@
+﻿#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+// 无界面批处理模式：命令行带有批处理参数时不创建 QApplication 与任何窗口，
+// 在 QCoreApplication 下执行后直接返回退出码，可在无显示的服务器上运行。
+//
+//   --export-png <DICOM 目录> --output <目录> [--step N] [--window W --level L]
+//                [--mask <文件>]... [--axes axial,sagittal,coronal] [--no-square-pixels]
+//   --convert <DICOM 根目录> --output <目录> [--format nii.gz|nii|mha] [--jobs N]
+//             [--io-jobs N] [--memory-mb M] [--overwrite]
+//   --benchmark <DICOM 目录> | --benchmark-synthetic WxHxD [--frames N] [--size WxH] [--json <文件>]
+bool IsCommandLineMode(int argc, char *argv[]);
+int RunCommandLine(int argc, char *argv[]);
+
+#endif // COMMANDLINE_H
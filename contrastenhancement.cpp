@@ -0,0 +1,218 @@
+﻿#include "contrastenhancement.h"
+#include "windowlevel.h"
+
+#include <vtkPointData.h>
+#include <vtkSetGet.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace
+{
+
+constexpr int GrayLevels = 256;
+
+template <typename T>
+void WindowPlane(const T *base, vtkIdType uStride, vtkIdType vStride, int width, int height,
+                 double lower, double scale, unsigned char *dst)
+{
+    for (int v = 0; v < height; ++v) {
+        WindowLevelRow(base + v * vStride, uStride, width, lower, scale, dst + static_cast<size_t>(v) * width);
+    }
+}
+
+// 一个方向上的分块：第 i 块覆盖 [start[i], start[i + 1])，中心用于插值权重
+struct TileAxis
+{
+    int count = 1;
+    std::vector<int> start;
+    std::vector<double> center;
+    // 每个像素左（下）侧的块号与右（上）侧块的权重
+    std::vector<int> lowTile;
+    std::vector<float> highWeight;
+
+    void Build(int length, int tiles)
+    {
+        count = std::clamp(tiles, 1, std::max(1, length));
+        start.resize(count + 1);
+        center.resize(count);
+        for (int i = 0; i <= count; ++i) {
+            start[i] = static_cast<int>(static_cast<long long>(length) * i / count);
+        }
+        for (int i = 0; i < count; ++i) {
+            center[i] = 0.5 * (start[i] + start[i + 1]);
+        }
+        lowTile.resize(length);
+        highWeight.resize(length);
+        int tile = 0;
+        for (int p = 0; p < length; ++p) {
+            const double position = p + 0.5;
+            while (tile + 1 < count && center[tile + 1] <= position) {
+                ++tile;
+            }
+            // 第一个中心之前与最后一个中心之后只用一块
+            if (position <= center[0] || tile + 1 >= count) {
+                lowTile[p] = position <= center[0] ? 0 : count - 1;
+                highWeight[p] = 0.0f;
+            } else {
+                lowTile[p] = tile;
+                highWeight[p] = static_cast<float>((position - center[tile]) / (center[tile + 1] - center[tile]));
+            }
+        }
+    }
+};
+
+} // namespace
+
+void ApplyClahe(const unsigned char *src, int width, int height, const ClaheParameters &parameters,
+                unsigned char *dst, ThreadPool &pool)
+{
+    if (!src || !dst || width <= 0 || height <= 0) {
+        return;
+    }
+    TileAxis uAxis;
+    TileAxis vAxis;
+    uAxis.Build(width, parameters.tiles);
+    vAxis.Build(height, parameters.tiles);
+
+    // 每块一张 256 项映射表，各块独立，可并行
+    const size_t tileCount = static_cast<size_t>(uAxis.count) * vAxis.count;
+    std::vector<std::array<unsigned char, GrayLevels>> maps(tileCount);
+    pool.ParallelFor(0, tileCount, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const int tu = static_cast<int>(t % uAxis.count);
+            const int tv = static_cast<int>(t / uAxis.count);
+            const int u0 = uAxis.start[tu];
+            const int u1 = uAxis.start[tu + 1];
+            const int v0 = vAxis.start[tv];
+            const int v1 = vAxis.start[tv + 1];
+            const size_t pixels = static_cast<size_t>(u1 - u0) * (v1 - v0);
+
+            size_t histogram[GrayLevels] = {};
+            for (int v = v0; v < v1; ++v) {
+                const unsigned char *row = src + static_cast<size_t>(v) * width;
+                for (int u = u0; u < u1; ++u) {
+                    ++histogram[row[u]];
+                }
+            }
+
+            // 削顶并把超出部分均匀摊回，余数从低灰度级起逐个补一
+            const size_t limit = std::max<size_t>(
+                1, static_cast<size_t>(parameters.clipLimit * static_cast<double>(pixels) / GrayLevels));
+            size_t excess = 0;
+            for (size_t &count : histogram) {
+                if (count > limit) {
+                    excess += count - limit;
+                    count = limit;
+                }
+            }
+            const size_t share = excess / GrayLevels;
+            const size_t remainder = excess % GrayLevels;
+            for (int i = 0; i < GrayLevels; ++i) {
+                histogram[i] += share + (static_cast<size_t>(i) < remainder ? 1 : 0);
+            }
+
+            size_t cumulative = 0;
+            const double scale = pixels > 0 ? 255.0 / static_cast<double>(pixels) : 0.0;
+            for (int i = 0; i < GrayLevels; ++i) {
+                cumulative += histogram[i];
+                maps[t][i] = static_cast<unsigned char>(std::min(255.0, cumulative * scale + 0.5));
+            }
+        }
+    });
+
+    // 每个像素在所在位置周围的四块映射之间双线性插值，消除块边界
+    pool.ParallelFor(0, static_cast<size_t>(height), [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; ++v) {
+            const int tv0 = vAxis.lowTile[v];
+            const int tv1 = std::min(tv0 + 1, vAxis.count - 1);
+            const float wv = vAxis.highWeight[v];
+            const unsigned char *row = src + v * static_cast<size_t>(width);
+            unsigned char *out = dst + v * static_cast<size_t>(width);
+            for (int u = 0; u < width; ++u) {
+                const int tu0 = uAxis.lowTile[u];
+                const int tu1 = std::min(tu0 + 1, uAxis.count - 1);
+                const float wu = uAxis.highWeight[u];
+                const unsigned char g = row[u];
+                const float low = (1.0f - wu) * maps[static_cast<size_t>(tv0) * uAxis.count + tu0][g] +
+                                  wu * maps[static_cast<size_t>(tv0) * uAxis.count + tu1][g];
+                const float high = (1.0f - wu) * maps[static_cast<size_t>(tv1) * uAxis.count + tu0][g] +
+                                   wu * maps[static_cast<size_t>(tv1) * uAxis.count + tu1][g];
+                out[u] = static_cast<unsigned char>((1.0f - wv) * low + wv * high + 0.5f);
+            }
+        }
+    }, 16);
+}
+
+bool WindowSlicePlane(vtkImageData *image, int axis, int slice, double window, double level,
+                      std::vector<unsigned char> &gray, int &width, int &height)
+{
+    if (!image || axis < 0 || axis > 2 || !image->GetPointData()->GetScalars() ||
+        image->GetNumberOfScalarComponents() != 1) {
+        return false;
+    }
+    int extent[6];
+    image->GetExtent(extent);
+    if (slice < extent[2 * axis] || slice > extent[2 * axis + 1]) {
+        return false;
+    }
+
+    const int uAxis = axis == 0 ? 1 : 0;
+    const int vAxis = axis == 2 ? 1 : 2;
+    width = extent[2 * uAxis + 1] - extent[2 * uAxis] + 1;
+    height = extent[2 * vAxis + 1] - extent[2 * vAxis] + 1;
+
+    vtkIdType increments[3];
+    image->GetIncrements(increments);
+    int ijk[3];
+    ijk[axis] = slice;
+    ijk[uAxis] = extent[2 * uAxis];
+    ijk[vAxis] = extent[2 * vAxis];
+    const void *base = image->GetScalarPointer(ijk);
+
+    window = std::max(std::abs(window), 1e-6);
+    const double lower = level - window / 2.0;
+    const double scale = 255.0 / window;
+    gray.resize(static_cast<size_t>(width) * height);
+    switch (image->GetScalarType()) {
+        vtkTemplateMacro(WindowPlane(static_cast<const VTK_TT *>(base), increments[uAxis], increments[vAxis],
+                                     width, height, lower, scale, gray.data()));
+    default:
+        return false;
+    }
+    return true;
+}
+
+const std::vector<unsigned char> *ClaheSliceCache::Get(vtkImageData *image, int axis, int slice, double window,
+                                                       double level, const ClaheParameters &parameters,
+                                                       int &width, int &height)
+{
+    if (!image) {
+        return nullptr;
+    }
+    const vtkMTimeType mtime = image->GetMTime();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->image == image && it->mtime == mtime && it->axis == axis && it->slice == slice &&
+            it->window == window && it->level == level && it->parameters == parameters) {
+            m_entries.splice(m_entries.begin(), m_entries, it);
+            width = m_entries.front().width;
+            height = m_entries.front().height;
+            return &m_entries.front().pixels;
+        }
+    }
+
+    std::vector<unsigned char> gray;
+    if (!WindowSlicePlane(image, axis, slice, window, level, gray, width, height)) {
+        return nullptr;
+    }
+    std::vector<unsigned char> enhanced(gray.size());
+    ApplyClahe(gray.data(), width, height, parameters, enhanced.data());
+
+    m_entries.push_front(Entry{ image, mtime, axis, slice, window, level, parameters, width, height,
+                                std::move(enhanced) });
+    while (m_entries.size() > std::max<size_t>(m_capacity, 1)) {
+        m_entries.pop_back();
+    }
+    return &m_entries.front().pixels;
+}
@@ -0,0 +1,67 @@
+﻿#ifndef CONTRASTENHANCEMENT_H
+#define CONTRASTENHANCEMENT_H
+
+#include "threadpool.h"
+
+#include <vtkImageData.h>
+#include <vtkType.h>
+
+#include <cstddef>
+#include <list>
+#include <vector>
+
+// 限制对比度的自适应直方图均衡（CLAHE）参数：切片划分为 tiles x tiles 块，
+// 每块直方图超过平均高度 clipLimit 倍的部分均匀摊回各灰度级
+struct ClaheParameters
+{
+    int tiles = 8;
+    double clipLimit = 2.0;
+
+    bool operator==(const ClaheParameters &other) const
+    {
+        return tiles == other.tiles && clipLimit == other.clipLimit;
+    }
+};
+
+// 对 width x height 的 8 位灰度做 CLAHE：各块的映射表并行计算，再逐行在相邻四块之间双线性插值
+void ApplyClahe(const unsigned char *src, int width, int height, const ClaheParameters &parameters,
+                unsigned char *dst, ThreadPool &pool = ThreadPool::Global());
+
+// 取出 image 中法线为 axis 的第 slice 层并按窗宽窗位映射为 8 位灰度，按 [v][u] 排列
+// （u、v 为法线轴以外的两轴按升序，与 vtkImageData 单层内存顺序一致）
+bool WindowSlicePlane(vtkImageData *image, int axis, int slice, double window, double level,
+                      std::vector<unsigned char> &gray, int &width, int &height);
+
+// 显示用的 CLAHE 结果缓存：按图像对象及其修改时间、方向、层号、窗宽窗位与参数区分，
+// 只在某层首次显示时计算，最近使用的若干层留在缓存中
+class ClaheSliceCache
+{
+public:
+    explicit ClaheSliceCache(size_t capacity = 12) : m_capacity(capacity) {}
+
+    // 返回的缓冲区在下次 Get 或 Clear 之前有效
+    const std::vector<unsigned char> *Get(vtkImageData *image, int axis, int slice, double window, double level,
+                                          const ClaheParameters &parameters, int &width, int &height);
+    void Clear() { m_entries.clear(); }
+
+private:
+    struct Entry
+    {
+        vtkImageData *image;
+        vtkMTimeType mtime;
+        int axis;
+        int slice;
+        double window;
+        double level;
+        ClaheParameters parameters;
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;
+    };
+
+    size_t m_capacity;
+    // 最近使用的在前
+    std::list<Entry> m_entries;
+};
+
+#endif // CONTRASTENHANCEMENT_H
@@ -0,0 +1,81 @@
+﻿#include "dicomdataset.h"
+
+#include <gdcmReader.h>
+#include <gdcmSequenceOfItems.h>
+
+#include <cstdlib>
+#include <set>
+
+std::string ReadDicomString(const gdcm::DataSet &ds, uint16_t group, uint16_t element)
+{
+    const gdcm::Tag tag(group, element);
+    if (!ds.FindDataElement(tag)) {
+        return std::string();
+    }
+    const gdcm::ByteValue *bv = ds.GetDataElement(tag).GetByteValue();
+    if (!bv || !bv->GetPointer()) {
+        return std::string();
+    }
+    std::string value(bv->GetPointer(), bv->GetLength());
+    const size_t first = value.find_first_not_of(std::string(" \t\r\n\0", 5));
+    if (first == std::string::npos) {
+        return std::string();
+    }
+    const size_t last = value.find_last_not_of(std::string(" \t\r\n\0", 5));
+    return value.substr(first, last - first + 1);
+}
+
+std::vector<double> ReadDicomDecimals(const gdcm::DataSet &ds, uint16_t group, uint16_t element)
+{
+    std::vector<double> values;
+    const std::string text = ReadDicomString(ds, group, element);
+    const char *cursor = text.c_str();
+    const char *const end = cursor + text.size();
+    while (cursor < end) {
+        char *next = nullptr;
+        const double value = std::strtod(cursor, &next);
+        if (next == cursor) {
+            ++cursor;
+            continue;
+        }
+        values.push_back(value);
+        cursor = next;
+    }
+    return values;
+}
+
+bool FirstSequenceItem(const gdcm::DataSet &ds, uint16_t group, uint16_t element, gdcm::DataSet &out)
+{
+    const gdcm::Tag tag(group, element);
+    if (!ds.FindDataElement(tag)) {
+        return false;
+    }
+    gdcm::SmartPointer<gdcm::SequenceOfItems> sq = ds.GetDataElement(tag).GetValueAsSQ();
+    if (!sq || sq->GetNumberOfItems() == 0) {
+        return false;
+    }
+    out = sq->GetItem(1).GetNestedDataSet();
+    return true;
+}
+
+std::vector<double> ReadFromMacro(const gdcm::DataSet &group,
+                                  uint16_t macroGroup, uint16_t macroElement,
+                                  uint16_t attrGroup, uint16_t attrElement)
+{
+    gdcm::DataSet macro;
+    if (FirstSequenceItem(group, macroGroup, macroElement, macro)) {
+        return ReadDicomDecimals(macro, attrGroup, attrElement);
+    }
+    return std::vector<double>();
+}
+
+bool IsDicomObjectOfClass(const std::string &fileName, const char *sopClassUID, const char *modality)
+{
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.c_str());
+    if (!reader.ReadUpToTag(gdcm::Tag(0x0008, 0x0070), std::set<gdcm::Tag>())) {
+        return false;
+    }
+    const gdcm::DataSet &ds = reader.GetFile().GetDataSet();
+    return ReadDicomString(ds, 0x0008, 0x0016) == sopClassUID || ReadDicomString(ds, 0x0008, 0x0060) == modality;
+}
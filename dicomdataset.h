@@ -0,0 +1,29 @@
+﻿#ifndef DICOMDATASET_H
+#define DICOMDATASET_H
+
+#include <gdcmDataSet.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 多帧、SEG 与 RTSTRUCT 读取器共用的 GDCM 数据集访问
+
+// 元素的原始字节去除首尾空白与填充的 \0；元素缺失或为空时返回空串
+std::string ReadDicomString(const gdcm::DataSet &ds, uint16_t group, uint16_t element);
+
+// 按反斜杠分隔的 DS 多值。Contour Data 动辄上万个值，直接在原字符串上逐个 strtod，不切分子串
+std::vector<double> ReadDicomDecimals(const gdcm::DataSet &ds, uint16_t group, uint16_t element);
+
+// 取序列第一个条目的嵌套数据集（拷贝一份，避免 GetValueAsSQ 临时对象释放后悬空）
+bool FirstSequenceItem(const gdcm::DataSet &ds, uint16_t group, uint16_t element, gdcm::DataSet &out);
+
+// 在功能组 (如 5200|9229 的条目) 中查找 宏序列 -> 属性
+std::vector<double> ReadFromMacro(const gdcm::DataSet &group,
+                                  uint16_t macroGroup, uint16_t macroElement,
+                                  uint16_t attrGroup, uint16_t attrElement);
+
+// 只读到 (0008,0070) 为止，按 SOP Class UID 或 Modality 判断文件的对象类型
+bool IsDicomObjectOfClass(const std::string &fileName, const char *sopClassUID, const char *modality);
+
+#endif // DICOMDATASET_H
@@ -0,0 +1,726 @@
+﻿#include "dicomscanner.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <system_error>
+
+namespace
+{
+
+constexpr uint32_t UndefinedLength = 0xFFFFFFFFu;
+constexpr size_t StreamBufferSize = 64 * 1024;
+// 只有这些值较短的标签才会被真正读入内存
+constexpr uint32_t MaxWantedValueLength = 1024;
+
+// 带缓冲的只读文件流，跳过大块数据时直接 seek，不读入内存；
+// 也可直接包装内存中的完整数据集（网络接收的实例），此时不做任何复制
+class HeaderStream
+{
+public:
+    explicit HeaderStream(const std::string &fileName)
+        : m_file(nullptr)
+        , m_buffer(StreamBufferSize)
+        , m_data(m_buffer.data())
+        , m_pos(0)
+        , m_size(0)
+        , m_bufferStart(0)
+    {
+#ifdef _WIN32
+        m_file = _wfopen(std::filesystem::u8path(fileName).c_str(), L"rb");
+#else
+        m_file = std::fopen(fileName.c_str(), "rb");
+#endif
+        if (m_file) {
+            std::setvbuf(m_file, nullptr, _IONBF, 0);
+        }
+    }
+
+    HeaderStream(const void *data, size_t size)
+        : m_file(nullptr)
+        , m_data(static_cast<const unsigned char *>(data))
+        , m_pos(0)
+        , m_size(size)
+        , m_bufferStart(0)
+    {
+    }
+
+    ~HeaderStream()
+    {
+        if (m_file) {
+            std::fclose(m_file);
+        }
+    }
+
+    HeaderStream(const HeaderStream &) = delete;
+    HeaderStream &operator=(const HeaderStream &) = delete;
+
+    bool IsOpen() const { return m_file != nullptr || m_data != nullptr; }
+    uint64_t Position() const { return m_bufferStart + m_pos; }
+
+    bool Peek(void *dst, size_t n)
+    {
+        if (!Ensure(n)) {
+            return false;
+        }
+        std::memcpy(dst, m_data + m_pos, n);
+        return true;
+    }
+
+    bool Read(void *dst, size_t n)
+    {
+        if (!Peek(dst, n)) {
+            return false;
+        }
+        m_pos += n;
+        return true;
+    }
+
+    bool Skip(uint64_t n)
+    {
+        if (n <= m_size - m_pos) {
+            m_pos += static_cast<size_t>(n);
+            return true;
+        }
+        if (!m_file) {
+            return false;
+        }
+        const uint64_t target = m_bufferStart + m_pos + n;
+#ifdef _WIN32
+        if (_fseeki64(m_file, static_cast<__int64>(target), SEEK_SET) != 0) {
+#else
+        if (fseeko(m_file, static_cast<off_t>(target), SEEK_SET) != 0) {
+#endif
+            return false;
+        }
+        m_bufferStart = target;
+        m_pos = 0;
+        m_size = 0;
+        return true;
+    }
+
+    bool Rewind()
+    {
+        if (m_bufferStart == 0) {
+            m_pos = 0;
+            return true;
+        }
+        std::rewind(m_file);
+        m_bufferStart = 0;
+        m_pos = 0;
+        m_size = 0;
+        return true;
+    }
+
+private:
+    bool Ensure(size_t n)
+    {
+        if (m_size - m_pos >= n) {
+            return true;
+        }
+        if (!m_file || n > m_buffer.size()) {
+            return false;
+        }
+        // 剩余字节移到缓冲区开头后继续读取
+        const size_t remain = m_size - m_pos;
+        std::memmove(m_buffer.data(), m_buffer.data() + m_pos, remain);
+        m_bufferStart += m_pos;
+        m_pos = 0;
+        m_size = remain;
+        while (m_size < n) {
+            const size_t got = std::fread(m_buffer.data() + m_size, 1, m_buffer.size() - m_size, m_file);
+            if (got == 0) {
+                return false;
+            }
+            m_size += got;
+        }
+        return true;
+    }
+
+    std::FILE *m_file;
+    std::vector<unsigned char> m_buffer;
+    const unsigned char *m_data;
+    size_t m_pos;
+    size_t m_size;
+    uint64_t m_bufferStart;
+};
+
+struct Syntax
+{
+    bool explicitVR = true;
+    bool bigEndian = false;
+};
+
+uint16_t ToU16(const unsigned char *p, bool bigEndian)
+{
+    return bigEndian ? static_cast<uint16_t>((p[0] << 8) | p[1])
+                     : static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t ToU32(const unsigned char *p, bool bigEndian)
+{
+    return bigEndian ? (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                       (static_cast<uint32_t>(p[2]) << 8) | p[3]
+                     : static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                       (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+bool IsLongLengthVR(const char vr[2])
+{
+    static const char *const longVRs[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ",
+                                           "SV", "UC", "UN", "UR", "UT", "UV" };
+    for (const char *candidate : longVRs) {
+        if (vr[0] == candidate[0] && vr[1] == candidate[1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LooksLikeVR(const unsigned char *p)
+{
+    return p[0] >= 'A' && p[0] <= 'Z' && p[1] >= 'A' && p[1] <= 'Z';
+}
+
+struct ElementHeader
+{
+    uint16_t group = 0;
+    uint16_t element = 0;
+    char vr[2] = { 0, 0 };
+    uint32_t length = 0;
+
+    uint32_t Tag() const { return (static_cast<uint32_t>(group) << 16) | element; }
+};
+
+bool ReadElementHeader(HeaderStream &in, const Syntax &syntax, ElementHeader &header)
+{
+    unsigned char buf[8];
+    if (!in.Read(buf, 4)) {
+        return false;
+    }
+    header.group = ToU16(buf, syntax.bigEndian);
+    header.element = ToU16(buf + 2, syntax.bigEndian);
+    header.vr[0] = header.vr[1] = 0;
+
+    // 条目/分隔符标签没有 VR
+    if (header.group == 0xFFFE || !syntax.explicitVR) {
+        if (!in.Read(buf, 4)) {
+            return false;
+        }
+        header.length = ToU32(buf, syntax.bigEndian);
+        return true;
+    }
+
+    if (!in.Read(buf, 4)) {
+        return false;
+    }
+    header.vr[0] = static_cast<char>(buf[0]);
+    header.vr[1] = static_cast<char>(buf[1]);
+    if (IsLongLengthVR(header.vr)) {
+        if (!in.Read(buf, 4)) {
+            return false;
+        }
+        header.length = ToU32(buf, syntax.bigEndian);
+    } else {
+        header.length = ToU16(buf + 2, syntax.bigEndian);
+    }
+    return true;
+}
+
+// 跳过未定义长度的序列（可嵌套），直到序列分隔符 (FFFE,E0DD)
+bool SkipUndefinedSequence(HeaderStream &in, const Syntax &syntax, int depth)
+{
+    if (depth > 32) {
+        return false;
+    }
+    ElementHeader item;
+    for (;;) {
+        if (!ReadElementHeader(in, syntax, item)) {
+            return false;
+        }
+        if (item.group == 0xFFFE && item.element == 0xE0DD) {
+            return true;
+        }
+        if (item.group != 0xFFFE || item.element != 0xE000) {
+            return false;
+        }
+        if (item.length != UndefinedLength) {
+            if (!in.Skip(item.length)) {
+                return false;
+            }
+            continue;
+        }
+        ElementHeader nested;
+        for (;;) {
+            if (!ReadElementHeader(in, syntax, nested)) {
+                return false;
+            }
+            if (nested.group == 0xFFFE && nested.element == 0xE00D) {
+                break;
+            }
+            if (nested.length == UndefinedLength) {
+                // 显式 VR 下未定义长度的 UN 内部按隐式 VR 编码
+                Syntax inner = syntax;
+                if (nested.vr[0] == 'U' && nested.vr[1] == 'N') {
+                    inner.explicitVR = false;
+                }
+                if (!SkipUndefinedSequence(in, inner, depth + 1)) {
+                    return false;
+                }
+            } else if (!in.Skip(nested.length)) {
+                return false;
+            }
+        }
+    }
+}
+
+std::string TrimValue(const char *data, size_t length)
+{
+    size_t begin = 0;
+    size_t end = length;
+    while (begin < end && (data[begin] == ' ' || data[begin] == '\0')) {
+        ++begin;
+    }
+    while (end > begin && (data[end - 1] == ' ' || data[end - 1] == '\0')) {
+        --end;
+    }
+    return std::string(data + begin, end - begin);
+}
+
+size_t ParseDecimals(const std::string &text, double *out, size_t maxCount)
+{
+    size_t count = 0;
+    const char *p = text.c_str();
+    while (*p && count < maxCount) {
+        char *endPtr = nullptr;
+        const double v = std::strtod(p, &endPtr);
+        if (endPtr == p) {
+            break;
+        }
+        out[count++] = v;
+        p = endPtr;
+        while (*p == '\\' || *p == ' ') {
+            ++p;
+        }
+    }
+    return count;
+}
+
+bool IsWantedTag(uint32_t tag)
+{
+    switch (tag) {
+    case 0x00080018: case 0x00080021: case 0x00080060:
+    case 0x00100010: case 0x00100020:
+    case 0x00180024: case 0x00180050:
+    case 0x0020000D: case 0x0020000E: case 0x00200011: case 0x00200013:
+    case 0x00200032: case 0x00200037:
+    case 0x00280008: case 0x00280010: case 0x00280011:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void StoreValue(DicomFileHeader &header, const ElementHeader &element,
+                const std::vector<char> &value, const Syntax &syntax)
+{
+    const std::string text = TrimValue(value.data(), value.size());
+    const auto *bytes = reinterpret_cast<const unsigned char *>(value.data());
+    switch (element.Tag()) {
+    case 0x00080018: header.sopInstanceUID = text; break;
+    case 0x00080021: header.seriesDate = text; break;
+    case 0x00080060: header.modality = text; break;
+    case 0x00100010: header.patientName = text; break;
+    case 0x00100020: header.patientID = text; break;
+    case 0x00180024: header.sequenceName = text; break;
+    case 0x00180050: header.sliceThickness = text; break;
+    case 0x0020000D: header.studyUID = text; break;
+    case 0x0020000E: header.seriesUID = text; break;
+    case 0x00200011: header.seriesNumber = text; break;
+    case 0x00200013: header.instanceNumber = std::atoi(text.c_str()); break;
+    case 0x00200032:
+        header.hasPosition = ParseDecimals(text, header.position, 3) == 3;
+        break;
+    case 0x00200037:
+        header.hasOrientation = ParseDecimals(text, header.orientation, 6) == 6;
+        break;
+    case 0x00280008: header.numberOfFrames = std::max(1, std::atoi(text.c_str())); break;
+    case 0x00280010:
+        if (value.size() >= 2) {
+            header.rows = ToU16(bytes, syntax.bigEndian);
+        }
+        break;
+    case 0x00280011:
+        if (value.size() >= 2) {
+            header.columns = ToU16(bytes, syntax.bigEndian);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+bool IsPixelModuleTag(uint32_t tag)
+{
+    switch (tag) {
+    case 0x00280002: case 0x00280030:
+    case 0x00280100: case 0x00280101: case 0x00280103:
+    case 0x00281052: case 0x00281053:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void StorePixelValue(DicomPixelModule &pixels, const ElementHeader &element,
+                     const std::vector<char> &value, const Syntax &syntax)
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(value.data());
+    const std::string text = TrimValue(value.data(), value.size());
+    if (element.Tag() == 0x00280030) {
+        double spacing[2];
+        if (ParseDecimals(text, spacing, 2) == 2 && spacing[0] > 0.0 && spacing[1] > 0.0) {
+            pixels.pixelSpacing[0] = spacing[0];
+            pixels.pixelSpacing[1] = spacing[1];
+        }
+        return;
+    }
+    if (element.Tag() == 0x00281052 || element.Tag() == 0x00281053) {
+        double number = 0.0;
+        if (ParseDecimals(text, &number, 1) == 1) {
+            (element.Tag() == 0x00281052 ? pixels.rescaleIntercept : pixels.rescaleSlope) = number;
+        }
+        return;
+    }
+    if (value.size() < 2) {
+        return;
+    }
+    const unsigned int number = ToU16(bytes, syntax.bigEndian);
+    switch (element.Tag()) {
+    case 0x00280002: pixels.samplesPerPixel = number; break;
+    case 0x00280100: pixels.bitsAllocated = number; break;
+    case 0x00280101: pixels.bitsStored = number; break;
+    case 0x00280103: pixels.pixelRepresentation = number; break;
+    default: break;
+    }
+}
+
+bool ReadFileMetaInformation(HeaderStream &in, DicomFileHeader &header)
+{
+    const Syntax metaSyntax;  // 文件元信息固定为显式 VR 小端
+    unsigned char peek[2];
+    ElementHeader element;
+    std::vector<char> value;
+    while (in.Peek(peek, 2) && ToU16(peek, false) == 0x0002) {
+        if (!ReadElementHeader(in, metaSyntax, element) || element.length == UndefinedLength) {
+            return false;
+        }
+        if (element.element == 0x0010 && element.length <= MaxWantedValueLength) {
+            value.resize(element.length);
+            if (element.length > 0 && !in.Read(value.data(), element.length)) {
+                return false;
+            }
+            header.transferSyntaxUID = TrimValue(value.data(), value.size());
+        } else if (!in.Skip(element.length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::vector<std::string> DicomSeriesInfo::FileNames() const
+{
+    std::vector<std::string> names;
+    names.reserve(files.size());
+    for (const auto &file : files) {
+        names.push_back(file.fileName);
+    }
+    return names;
+}
+
+DicomDirectoryScanner::DicomDirectoryScanner()
+    : m_recursive(false)
+    , m_useSeriesDate(true)
+    , m_ioThreads(0)
+    , m_scannedFiles(0)
+    , m_unsupportedFiles(0)
+{
+}
+
+static const char *const DeflatedTransferSyntaxUID = "1.2.840.10008.1.2.1.99";
+
+// 解析（可带前导码与文件元信息的）数据集。header.transferSyntaxUID 可由调用方预先给出；
+// pixels 非空时越过 0028 组继续读到像素数据，记录其偏移与长度
+static bool ReadDataset(HeaderStream &in, DicomFileHeader &header, DicomPixelModule *pixels)
+{
+    Syntax syntax;
+    unsigned char preamble[132];
+    if (in.Peek(preamble, sizeof(preamble)) && std::memcmp(preamble + 128, "DICM", 4) == 0) {
+        in.Skip(sizeof(preamble));
+        if (!ReadFileMetaInformation(in, header)) {
+            return false;
+        }
+    } else {
+        // 没有前导码的裸数据集：根据第一个元素判断显式/隐式 VR
+        unsigned char first[6];
+        in.Rewind();
+        if (!in.Peek(first, sizeof(first))) {
+            return false;
+        }
+        const uint16_t group = ToU16(first, false);
+        if (group != 0x0008 && group != 0x0002) {
+            return false;
+        }
+        syntax.explicitVR = LooksLikeVR(first + 4);
+        if (group == 0x0002 && !ReadFileMetaInformation(in, header)) {
+            return false;
+        }
+    }
+
+    const std::string &ts = header.transferSyntaxUID;
+    if (ts == "1.2.840.10008.1.2") {
+        syntax.explicitVR = false;
+    } else if (ts == "1.2.840.10008.1.2.2") {
+        syntax.explicitVR = true;
+        syntax.bigEndian = true;
+    } else if (ts == DeflatedTransferSyntaxUID) {
+        // Deflate 压缩的数据集无法只读文件头，由调用方回退到 GDCM
+        return false;
+    } else if (!ts.empty()) {
+        syntax.explicitVR = true;
+    }
+
+    ElementHeader element;
+    std::vector<char> value;
+    while (ReadElementHeader(in, syntax, element)) {
+        // 分组和排序需要的标签都在 0028 组之前，只读文件头时越过之后立即停止
+        if (element.group > 0x0028 && element.group != 0xFFFE) {
+            if (!pixels) {
+                break;
+            }
+            if (element.Tag() == 0x7FE00010) {
+                // 未定义长度即封装（压缩）像素，不记录位置
+                const uint64_t offset = in.Position();
+                if (element.length != UndefinedLength && in.Skip(element.length)) {
+                    pixels->pixelDataOffset = static_cast<size_t>(offset);
+                    pixels->pixelDataLength = element.length;
+                }
+                break;
+            }
+        }
+        if (element.length == UndefinedLength) {
+            Syntax inner = syntax;
+            if (element.vr[0] == 'U' && element.vr[1] == 'N') {
+                inner.explicitVR = false;
+            }
+            if (!SkipUndefinedSequence(in, inner, 0)) {
+                break;
+            }
+            continue;
+        }
+        const bool wantedPixelTag = pixels && IsPixelModuleTag(element.Tag());
+        if ((wantedPixelTag || IsWantedTag(element.Tag())) && element.length <= MaxWantedValueLength) {
+            value.resize(element.length);
+            if (element.length > 0 && !in.Read(value.data(), element.length)) {
+                break;
+            }
+            if (wantedPixelTag) {
+                StorePixelValue(*pixels, element, value, syntax);
+            } else {
+                StoreValue(header, element, value, syntax);
+            }
+        } else if (!in.Skip(element.length)) {
+            break;
+        }
+    }
+
+    return !header.seriesUID.empty() && header.rows > 0 && header.columns > 0;
+}
+
+bool DicomDirectoryScanner::ReadHeader(const std::string &fileName, DicomFileHeader &header)
+{
+    header = DicomFileHeader();
+    header.fileName = fileName;
+
+    HeaderStream in(fileName);
+    if (!in.IsOpen()) {
+        return false;
+    }
+    return ReadDataset(in, header, nullptr);
+}
+
+bool DicomDirectoryScanner::ReadHeader(const void *data, size_t size, const std::string &transferSyntaxUID,
+                                       DicomFileHeader &header, DicomPixelModule *pixels)
+{
+    header = DicomFileHeader();
+    header.transferSyntaxUID = transferSyntaxUID;
+    if (pixels) {
+        *pixels = DicomPixelModule();
+    }
+
+    HeaderStream in(data, size);
+    return ReadDataset(in, header, pixels);
+}
+
+std::vector<std::string> DicomDirectoryScanner::ListFiles(const std::string &directory, bool recursive)
+{
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+    std::error_code ec;
+    const fs::path root = fs::u8path(directory);
+    if (!fs::is_directory(root, ec)) {
+        return files;
+    }
+
+    auto collect = [&files](const fs::directory_entry &entry) {
+        std::error_code statError;
+        if (entry.is_regular_file(statError)) {
+            files.push_back(entry.path().u8string());
+        }
+    };
+    if (recursive) {
+        for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+             !ec && it != end; it.increment(ec)) {
+            collect(*it);
+        }
+    } else {
+        for (fs::directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+             !ec && it != end; it.increment(ec)) {
+            collect(*it);
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::vector<DicomFileHeader> DicomDirectoryScanner::ReadHeaders(const std::vector<std::string> &fileNames,
+                                                                ThreadPool &pool, size_t *unsupportedCount)
+{
+    std::vector<DicomFileHeader> headers(fileNames.size());
+    std::vector<unsigned char> valid(fileNames.size(), 0);
+    pool.ParallelFor(0, fileNames.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            valid[i] = ReadHeader(fileNames[i], headers[i]) ? 1 : 0;
+        }
+    }, 8);
+
+    std::vector<DicomFileHeader> result;
+    result.reserve(fileNames.size());
+    size_t unsupported = 0;
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (valid[i]) {
+            result.push_back(std::move(headers[i]));
+        } else if (headers[i].transferSyntaxUID == DeflatedTransferSyntaxUID) {
+            // 文件元信息已读出，只是数据集被 Deflate 压缩
+            ++unsupported;
+        }
+    }
+    if (unsupportedCount) {
+        *unsupportedCount = unsupported;
+    }
+    return result;
+}
+
+std::string DicomDirectoryScanner::SeriesKey(const DicomFileHeader &header, bool useSeriesDate)
+{
+    // 与 GDCM SerieHelper 的默认唯一标识一致：序列号、序列名、层厚、行、列
+    std::string key = header.seriesUID;
+    key += '.' + header.seriesNumber;
+    key += '.' + header.sequenceName;
+    key += '.' + header.sliceThickness;
+    key += '.' + std::to_string(header.rows);
+    key += '.' + std::to_string(header.columns);
+    if (useSeriesDate) {
+        key += '.' + header.seriesDate;
+    }
+    return key;
+}
+
+void DicomDirectoryScanner::SortSeries(std::vector<DicomFileHeader> &files)
+{
+    const bool allPositioned = !files.empty() &&
+        std::all_of(files.begin(), files.end(), [](const DicomFileHeader &h) {
+            return h.hasPosition && h.hasOrientation;
+        });
+
+    if (allPositioned) {
+        // 按 IPP 在切片法线上的投影排序
+        const double *o = files.front().orientation;
+        const double normal[3] = { o[1] * o[5] - o[2] * o[4],
+                                   o[2] * o[3] - o[0] * o[5],
+                                   o[0] * o[4] - o[1] * o[3] };
+        auto distance = [&normal](const DicomFileHeader &h) {
+            return h.position[0] * normal[0] + h.position[1] * normal[1] + h.position[2] * normal[2];
+        };
+        std::stable_sort(files.begin(), files.end(), [&distance](const DicomFileHeader &a, const DicomFileHeader &b) {
+            const double da = distance(a);
+            const double db = distance(b);
+            if (std::fabs(da - db) > 1e-6) {
+                return da < db;
+            }
+            return a.instanceNumber < b.instanceNumber;
+        });
+        return;
+    }
+
+    std::stable_sort(files.begin(), files.end(), [](const DicomFileHeader &a, const DicomFileHeader &b) {
+        if (a.instanceNumber != b.instanceNumber) {
+            return a.instanceNumber < b.instanceNumber;
+        }
+        return a.fileName < b.fileName;
+    });
+}
+
+std::vector<DicomSeriesInfo> DicomDirectoryScanner::GroupSeries(std::vector<DicomFileHeader> headers,
+                                                                bool useSeriesDate)
+{
+    std::map<std::string, DicomSeriesInfo> grouped;
+    for (auto &header : headers) {
+        const std::string key = SeriesKey(header, useSeriesDate);
+        DicomSeriesInfo &series = grouped[key];
+        if (series.key.empty()) {
+            series.key = key;
+            series.seriesUID = header.seriesUID;
+        }
+        series.files.push_back(std::move(header));
+    }
+
+    std::vector<DicomSeriesInfo> result;
+    result.reserve(grouped.size());
+    for (auto &entry : grouped) {
+        SortSeries(entry.second.files);
+        result.push_back(std::move(entry.second));
+    }
+    return result;
+}
+
+bool DicomDirectoryScanner::Scan(const std::string &directory)
+{
+    m_series.clear();
+    m_scannedFiles = 0;
+    m_unsupportedFiles = 0;
+
+    const std::vector<std::string> files = ListFiles(directory, m_recursive);
+    if (files.empty()) {
+        return false;
+    }
+    m_scannedFiles = files.size();
+
+    // 读文件头以 I/O 等待为主，线程数超过 CPU 核数可以让存储队列保持饱和
+    unsigned int threads = m_ioThreads;
+    if (threads == 0) {
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min(64u, std::max(8u, cores * 2));
+    }
+    ThreadPool ioPool(threads);
+    m_series = GroupSeries(ReadHeaders(files, ioPool, &m_unsupportedFiles), m_useSeriesDate);
+    return !m_series.empty();
+}
@@ -0,0 +1,98 @@
+﻿#ifndef DICOMSCANNER_H
+#define DICOMSCANNER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// 序列分组/排序所需的少量标签，解析到 (0028,xxxx) 之后即停止读取
+struct DicomFileHeader
+{
+    std::string fileName;
+    std::string transferSyntaxUID;  // 0002|0010
+    std::string sopInstanceUID;     // 0008|0018
+    std::string seriesDate;         // 0008|0021
+    std::string modality;           // 0008|0060
+    std::string patientName;        // 0010|0010
+    std::string patientID;          // 0010|0020
+    std::string sequenceName;       // 0018|0024
+    std::string sliceThickness;     // 0018|0050
+    std::string studyUID;           // 0020|000d
+    std::string seriesUID;          // 0020|000e
+    std::string seriesNumber;       // 0020|0011
+    int instanceNumber = 0;         // 0020|0013
+    bool hasPosition = false;
+    double position[3] = { 0.0, 0.0, 0.0 };     // 0020|0032
+    bool hasOrientation = false;
+    double orientation[6] = { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0 };  // 0020|0037
+    int numberOfFrames = 1;         // 0028|0008
+    unsigned int rows = 0;          // 0028|0010
+    unsigned int columns = 0;       // 0028|0011
+};
+
+// 像素模块与像素数据的位置，只在解析内存中的数据集时填写（网络接收的实例直接从内存解码像素）
+struct DicomPixelModule
+{
+    unsigned int samplesPerPixel = 1;       // 0028|0002
+    double pixelSpacing[2] = { 1.0, 1.0 };  // 0028|0030（行间距、列间距）
+    unsigned int bitsAllocated = 0;         // 0028|0100
+    unsigned int bitsStored = 0;            // 0028|0101
+    unsigned int pixelRepresentation = 0;   // 0028|0103
+    double rescaleIntercept = 0.0;          // 0028|1052
+    double rescaleSlope = 1.0;              // 0028|1053
+    size_t pixelDataOffset = 0;             // 7fe0|0010 值在数据集中的字节偏移，长度为 0 表示没有原生像素
+    size_t pixelDataLength = 0;
+};
+
+struct DicomSeriesInfo
+{
+    std::string key;         // 与 GDCMSeriesFileNames(UseSeriesDetails) 相同的分组键
+    std::string seriesUID;
+    std::vector<DicomFileHeader> files;   // 已按切片位置排序
+
+    std::vector<std::string> FileNames() const;
+};
+
+// 仅读取文件头的并行目录扫描器，用于替代 GDCMSeriesFileNames
+class DicomDirectoryScanner
+{
+public:
+    DicomDirectoryScanner();
+
+    void SetRecursive(bool recursive) { m_recursive = recursive; }
+    // 对应 AddSeriesRestriction("0008|0021")
+    void SetUseSeriesDateRestriction(bool use) { m_useSeriesDate = use; }
+    // 并行读取文件头的线程数，0 表示按 CPU 数量自动选择（I/O 密集，默认超配）
+    void SetIoThreadCount(unsigned int count) { m_ioThreads = count; }
+
+    bool Scan(const std::string &directory);
+    const std::vector<DicomSeriesInfo> &GetSeries() const { return m_series; }
+    size_t GetScannedFileCount() const { return m_scannedFiles; }
+    // 是 DICOM 但文件头无法快速解析（如 Deflate 传输语法）而未计入任何序列的文件数
+    size_t GetUnsupportedFileCount() const { return m_unsupportedFiles; }
+
+    static std::vector<std::string> ListFiles(const std::string &directory, bool recursive);
+    static bool ReadHeader(const std::string &fileName, DicomFileHeader &header);
+    // 解析内存中的数据集（无文件元信息时使用给定的传输语法），fileName 留空
+    static bool ReadHeader(const void *data, size_t size, const std::string &transferSyntaxUID,
+                           DicomFileHeader &header, DicomPixelModule *pixels = nullptr);
+    // unsupportedCount 非空时输出需要完整解析器才能读取的文件数
+    static std::vector<DicomFileHeader> ReadHeaders(const std::vector<std::string> &fileNames,
+                                                    ThreadPool &pool, size_t *unsupportedCount = nullptr);
+    static std::string SeriesKey(const DicomFileHeader &header, bool useSeriesDate);
+    static std::vector<DicomSeriesInfo> GroupSeries(std::vector<DicomFileHeader> headers,
+                                                    bool useSeriesDate);
+    static void SortSeries(std::vector<DicomFileHeader> &files);
+
+private:
+    bool m_recursive;
+    bool m_useSeriesDate;
+    unsigned int m_ioThreads;
+    size_t m_scannedFiles;
+    size_t m_unsupportedFiles;
+    std::vector<DicomSeriesInfo> m_series;
+};
+
+#endif // DICOMSCANNER_H
@@ -0,0 +1,484 @@
+﻿#include "dicomseg.h"
+#include "dicomdataset.h"
+#include "imageregistration.h"
+
+#include <gdcmReader.h>
+#include <gdcmDataSet.h>
+#include <gdcmSequenceOfItems.h>
+#include <gdcmAttribute.h>
+
+#include <vtkType.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+const char *const SegmentationStorageUID = "1.2.840.10008.5.1.4.1.1.66.4";
+
+// Segment Identification (0062,000A) -> Referenced Segment Number (0062,000B)，缺失时为 0
+unsigned int ReferencedSegment(const gdcm::DataSet &frameGroup)
+{
+    gdcm::DataSet identification;
+    if (!FirstSequenceItem(frameGroup, 0x0062, 0x000A, identification) ||
+        !identification.FindDataElement(gdcm::Tag(0x0062, 0x000B))) {
+        return 0;
+    }
+    gdcm::Attribute<0x0062, 0x000B> number;
+    number.SetFromDataSet(identification);
+    return number.GetValue();
+}
+
+// 每个字节值对应的 8 个像素（低位在前），0 或 0xFF
+using BitPatternTable = std::array<std::array<unsigned char, 8>, 256>;
+
+const BitPatternTable &BitPatterns()
+{
+    static const BitPatternTable table = []() {
+        BitPatternTable t{};
+        for (int v = 0; v < 256; ++v) {
+            for (int b = 0; b < 8; ++b) {
+                t[v][b] = (v >> b) & 1 ? 0xFF : 0x00;
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+// 一帧在参考网格上的仿射映射：像素 (r, c) 的连续索引 = base + c * du + r * dv
+struct FrameMapping
+{
+    unsigned int frame;
+    int label;
+    double base[3];
+    double du[3];
+    double dv[3];
+    // 帧平面与网格切片平行时 (i, j) -> (c, r) 的 2x2 逆矩阵，按输出体素反向取样
+    bool inPlane;
+    double inverse[4];
+};
+
+// 与网格切片平行的帧：遍历帧在该层覆盖的输出体素，反向取最近的帧像素，
+// 帧分辨率低于参考图像时也不会留下空隙
+template <typename T>
+size_t SampleFrame(const FrameMapping &map, const unsigned char *mask, unsigned int rows, unsigned int columns,
+                   const int dims[3], int slice, T *labels)
+{
+    double iLow = map.base[0];
+    double iHigh = map.base[0];
+    double jLow = map.base[1];
+    double jHigh = map.base[1];
+    for (int corner = 0; corner < 4; ++corner) {
+        const double c = (corner & 1) ? columns - 0.5 : -0.5;
+        const double r = (corner & 2) ? rows - 0.5 : -0.5;
+        const double i = map.base[0] + c * map.du[0] + r * map.dv[0];
+        const double j = map.base[1] + c * map.du[1] + r * map.dv[1];
+        iLow = std::min(iLow, i);
+        iHigh = std::max(iHigh, i);
+        jLow = std::min(jLow, j);
+        jHigh = std::max(jHigh, j);
+    }
+    const int iBegin = std::max(0, static_cast<int>(std::ceil(iLow)));
+    const int iEnd = std::min(dims[0] - 1, static_cast<int>(std::floor(iHigh)));
+    const int jBegin = std::max(0, static_cast<int>(std::ceil(jLow)));
+    const int jEnd = std::min(dims[1] - 1, static_cast<int>(std::floor(jHigh)));
+
+    const size_t sliceSize = static_cast<size_t>(dims[0]) * dims[1];
+    T *dst = labels + sliceSize * slice;
+    const T value = static_cast<T>(map.label);
+    size_t inside = 0;
+    for (int j = jBegin; j <= jEnd; ++j) {
+        const double dy = j - map.base[1];
+        for (int i = iBegin; i <= iEnd; ++i) {
+            const double dx = i - map.base[0];
+            const int c = static_cast<int>(std::floor(map.inverse[0] * dx + map.inverse[1] * dy + 0.5));
+            const int r = static_cast<int>(std::floor(map.inverse[2] * dx + map.inverse[3] * dy + 0.5));
+            if (c < 0 || r < 0 || c >= static_cast<int>(columns) || r >= static_cast<int>(rows) ||
+                !mask[static_cast<size_t>(r) * columns + c]) {
+                continue;
+            }
+            dst[static_cast<size_t>(j) * dims[0] + i] = value;
+            ++inside;
+        }
+    }
+    return inside;
+}
+
+// 斜切的帧：正向把每个前景像素放到最近的体素上
+template <typename T>
+size_t ScatterFrame(const FrameMapping &map, const unsigned char *mask, unsigned int rows, unsigned int columns,
+                    const int dims[3], int slice, T *labels)
+{
+    const size_t sliceSize = static_cast<size_t>(dims[0]) * dims[1];
+    T *dst = labels + sliceSize * slice;
+    const T value = static_cast<T>(map.label);
+    size_t inside = 0;
+    for (unsigned int r = 0; r < rows; ++r) {
+        const unsigned char *row = mask + static_cast<size_t>(r) * columns;
+        const double x0 = map.base[0] + r * map.dv[0];
+        const double y0 = map.base[1] + r * map.dv[1];
+        const double z0 = map.base[2] + r * map.dv[2];
+        for (unsigned int c = 0; c < columns; ++c) {
+            if (!row[c]) {
+                continue;
+            }
+            const int k = static_cast<int>(std::floor(z0 + c * map.du[2] + 0.5));
+            if (k != slice) {
+                continue;
+            }
+            const int i = static_cast<int>(std::floor(x0 + c * map.du[0] + 0.5));
+            const int j = static_cast<int>(std::floor(y0 + c * map.du[1] + 0.5));
+            if (i < 0 || j < 0 || i >= dims[0] || j >= dims[1]) {
+                continue;
+            }
+            dst[static_cast<size_t>(j) * dims[0] + i] = value;
+            ++inside;
+        }
+    }
+    return inside;
+}
+
+} // namespace
+
+bool PatientToGridIndex(const SegmentationGrid &grid, double matrix[9], double offset[3])
+{
+    double inverse[9];
+    if (grid.dims[0] <= 0 || grid.dims[1] <= 0 || grid.dims[2] <= 0 || !InvertMatrix3(grid.direction, inverse)) {
+        return false;
+    }
+    // P = O + D·(s ⊙ ijk)，于是 ijk = S⁻¹·D⁻¹·(P − O)
+    for (int a = 0; a < 3; ++a) {
+        double shift = 0.0;
+        for (int n = 0; n < 3; ++n) {
+            matrix[a * 3 + n] = inverse[a * 3 + n] / grid.spacing[a];
+            shift += matrix[a * 3 + n] * grid.origin[n];
+        }
+        offset[a] = -shift;
+    }
+    return true;
+}
+
+void UnpackBinaryPixels(const unsigned char *packed, size_t bitOffset, size_t count,
+                        unsigned char value, unsigned char *dst)
+{
+    const unsigned char *src = packed + bitOffset / 8;
+    unsigned int bit = static_cast<unsigned int>(bitOffset % 8);
+    size_t i = 0;
+    // 帧的位数不是 8 的倍数时后续帧不从字节边界开始，先逐位处理到对齐
+    for (; bit != 0 && i < count; ++i) {
+        dst[i] = (*src >> bit) & 1u ? value : 0;
+        if (++bit == 8) {
+            bit = 0;
+            ++src;
+        }
+    }
+
+    // 每个字节查表得到 8 个 0/0xFF 掩码，按 64 位整字与标签值相与后写出
+    const BitPatternTable &patterns = BitPatterns();
+    const uint64_t fill = 0x0101010101010101ull * value;
+    for (; i + 8 <= count; i += 8, ++src) {
+        uint64_t word;
+        std::memcpy(&word, patterns[*src].data(), sizeof(word));
+        word &= fill;
+        std::memcpy(dst + i, &word, sizeof(word));
+    }
+    for (unsigned int b = 0; i < count; ++i, ++b) {
+        dst[i] = (*src >> b) & 1u ? value : 0;
+    }
+}
+
+bool DicomSegReader::IsSegmentationFile(const std::string &fileName)
+{
+    return IsDicomObjectOfClass(fileName, SegmentationStorageUID, "SEG");
+}
+
+bool DicomSegReader::Open(const std::string &fileName, std::string *error)
+{
+    *this = DicomSegReader();
+    m_fileName = fileName;
+
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.c_str());
+    if (!reader.Read()) {
+        return fail("Cannot parse DICOM file: " + fileName);
+    }
+    const gdcm::DataSet &ds = reader.GetFile().GetDataSet();
+    if (ReadDicomString(ds, 0x0008, 0x0016) != SegmentationStorageUID && ReadDicomString(ds, 0x0008, 0x0060) != "SEG") {
+        return fail("Not a DICOM Segmentation object: " + fileName);
+    }
+
+    gdcm::Attribute<0x0028, 0x0010> rows;
+    gdcm::Attribute<0x0028, 0x0011> columns;
+    gdcm::Attribute<0x0028, 0x0100> bitsAllocated;
+    rows.SetFromDataSet(ds);
+    columns.SetFromDataSet(ds);
+    bitsAllocated.SetFromDataSet(ds);
+    m_rows = rows.GetValue();
+    m_columns = columns.GetValue();
+    m_bitsAllocated = bitsAllocated.GetValue();
+    m_frameCount = static_cast<unsigned int>(std::max(1, std::atoi(ReadDicomString(ds, 0x0028, 0x0008).c_str())));
+    if (m_rows == 0 || m_columns == 0) {
+        return fail("Missing Rows/Columns in " + fileName);
+    }
+    if (m_bitsAllocated != 1 && m_bitsAllocated != 8) {
+        return fail("Unsupported Bits Allocated in segmentation: " + std::to_string(m_bitsAllocated));
+    }
+    if (ReadDicomString(ds, 0x0062, 0x0001) == "FRACTIONAL") {
+        const std::vector<double> maximum = ReadDicomDecimals(ds, 0x0062, 0x000E);
+        const double maxValue = !maximum.empty() && maximum[0] > 0.0 ? maximum[0] : 255.0;
+        m_fractionalThreshold = static_cast<unsigned int>(std::max(1.0, std::ceil(maxValue / 2.0)));
+    }
+
+    m_seriesDescription = ReadDicomString(ds, 0x0008, 0x103E);
+    if (m_seriesDescription.empty()) {
+        m_seriesDescription = ReadDicomString(ds, 0x0070, 0x0080);
+    }
+
+    // 段表 (0062,0002)
+    const gdcm::Tag segmentTag(0x0062, 0x0002);
+    if (ds.FindDataElement(segmentTag)) {
+        gdcm::SmartPointer<gdcm::SequenceOfItems> sq = ds.GetDataElement(segmentTag).GetValueAsSQ();
+        const size_t items = sq ? sq->GetNumberOfItems() : 0;
+        for (size_t i = 0; i < items; ++i) {
+            const gdcm::DataSet &item = sq->GetItem(i + 1).GetNestedDataSet();
+            DicomSegment segment;
+            gdcm::Attribute<0x0062, 0x0004> number;
+            number.SetFromDataSet(item);
+            segment.number = number.GetValue();
+            segment.label = ReadDicomString(item, 0x0062, 0x0005);
+            if (segment.number == 0) {
+                continue;
+            }
+            if (segment.label.empty()) {
+                segment.label = "Segment " + std::to_string(segment.number);
+            }
+            m_segments.push_back(std::move(segment));
+        }
+    }
+    if (m_segments.empty()) {
+        return fail("Segmentation has no segments: " + fileName);
+    }
+
+    // 共享功能组 (5200|9229)：方向与像素间距，缺失时退回到逐帧功能组或顶层属性
+    gdcm::DataSet shared;
+    const bool hasShared = FirstSequenceItem(ds, 0x5200, 0x9229, shared);
+    std::vector<double> orientation = hasShared ? ReadFromMacro(shared, 0x0020, 0x9116, 0x0020, 0x0037)
+                                                : std::vector<double>();
+    std::vector<double> pixelSpacing = hasShared ? ReadFromMacro(shared, 0x0028, 0x9110, 0x0028, 0x0030)
+                                                 : std::vector<double>();
+
+    m_framePositions.assign(static_cast<size_t>(m_frameCount) * 3, 0.0);
+    m_hasPosition.assign(m_frameCount, false);
+
+    // 逐帧功能组 (5200|9230)：帧所属的段与帧位置
+    const gdcm::Tag perFrameTag(0x5200, 0x9230);
+    if (ds.FindDataElement(perFrameTag)) {
+        gdcm::SmartPointer<gdcm::SequenceOfItems> perFrame = ds.GetDataElement(perFrameTag).GetValueAsSQ();
+        const size_t items = perFrame ? perFrame->GetNumberOfItems() : 0;
+        for (size_t i = 0; i < items && i < m_frameCount; ++i) {
+            const gdcm::DataSet &frameGroup = perFrame->GetItem(i + 1).GetNestedDataSet();
+
+            const std::vector<double> ipp = ReadFromMacro(frameGroup, 0x0020, 0x9113, 0x0020, 0x0032);
+            if (ipp.size() >= 3) {
+                std::copy(ipp.begin(), ipp.begin() + 3, m_framePositions.begin() + i * 3);
+                m_hasPosition[i] = true;
+            }
+            if (orientation.size() < 6) {
+                orientation = ReadFromMacro(frameGroup, 0x0020, 0x9116, 0x0020, 0x0037);
+            }
+            if (pixelSpacing.size() < 2) {
+                pixelSpacing = ReadFromMacro(frameGroup, 0x0028, 0x9110, 0x0028, 0x0030);
+            }
+
+            const unsigned int number = ReferencedSegment(frameGroup);
+            for (DicomSegment &segment : m_segments) {
+                if (segment.number == number) {
+                    segment.frames.push_back(static_cast<unsigned int>(i));
+                    break;
+                }
+            }
+        }
+    }
+    if (orientation.size() < 6) {
+        orientation = ReadDicomDecimals(ds, 0x0020, 0x0037);
+    }
+    if (pixelSpacing.size() < 2) {
+        pixelSpacing = ReadDicomDecimals(ds, 0x0028, 0x0030);
+    }
+    if (orientation.size() < 6 || pixelSpacing.size() < 2 || pixelSpacing[0] <= 0.0 || pixelSpacing[1] <= 0.0) {
+        return fail("Segmentation lacks plane orientation or pixel spacing: " + fileName);
+    }
+    std::copy(orientation.begin(), orientation.begin() + 3, m_rowDirection);
+    std::copy(orientation.begin() + 3, orientation.begin() + 6, m_columnDirection);
+    m_pixelSpacing[0] = pixelSpacing[0];
+    m_pixelSpacing[1] = pixelSpacing[1];
+
+    // 像素数据原样保留；1 位帧之间首尾相接，不按字节对齐
+    const gdcm::Tag pixelTag(0x7fe0, 0x0010);
+    const gdcm::ByteValue *bv = ds.FindDataElement(pixelTag) ? ds.GetDataElement(pixelTag).GetByteValue() : nullptr;
+    if (!bv || !bv->GetPointer()) {
+        return fail("Encapsulated (compressed) segmentation pixel data is not supported: " + fileName);
+    }
+    const size_t pixels = static_cast<size_t>(m_rows) * m_columns * m_frameCount;
+    const size_t required = m_bitsAllocated == 1 ? (pixels + 7) / 8 : pixels;
+    if (bv->GetLength() < required) {
+        return fail("Segmentation pixel data is truncated: " + fileName);
+    }
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(bv->GetPointer());
+    m_pixelData.assign(data, data + required);
+    return true;
+}
+
+void DicomSegReader::UnpackFrame(unsigned int frame, unsigned char value, unsigned char *dst) const
+{
+    const size_t pixels = static_cast<size_t>(m_rows) * m_columns;
+    if (m_bitsAllocated == 1) {
+        UnpackBinaryPixels(m_pixelData.data(), pixels * frame, pixels, value, dst);
+        return;
+    }
+    const unsigned char *src = m_pixelData.data() + pixels * frame;
+    for (size_t i = 0; i < pixels; ++i) {
+        dst[i] = src[i] >= m_fractionalThreshold ? value : 0;
+    }
+}
+
+vtkSmartPointer<vtkImageData> DicomSegReader::DecodeSegments(const std::vector<size_t> &segmentIndices,
+                                                             const SegmentationGrid &grid,
+                                                             size_t *insideCount, std::string *error,
+                                                             ThreadPool &pool) const
+{
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return vtkSmartPointer<vtkImageData>();
+    };
+
+    double matrix[9];
+    double offset[3];
+    if (!PatientToGridIndex(grid, matrix, offset)) {
+        return fail("Invalid reference image geometry");
+    }
+
+    // 像素中心 P = IPP + c·Δc·行方向 + r·Δr·列方向，各帧映射为网格索引上的仿射关系
+    auto toIndex = [&](const double vector[3], bool isPoint, double out[3]) {
+        for (int a = 0; a < 3; ++a) {
+            double sum = isPoint ? offset[a] : 0.0;
+            for (int n = 0; n < 3; ++n) {
+                sum += matrix[a * 3 + n] * vector[n];
+            }
+            out[a] = sum;
+        }
+    };
+    double rowStep[3];
+    double columnStep[3];
+    for (int n = 0; n < 3; ++n) {
+        rowStep[n] = m_rowDirection[n] * m_pixelSpacing[1];
+        columnStep[n] = m_columnDirection[n] * m_pixelSpacing[0];
+    }
+
+    bool wideLabels = false;
+    std::vector<FrameMapping> mappings;
+    // 每个输出切片上按段的顺序排列的帧映射，同一切片内后写的段覆盖先写的
+    std::vector<std::vector<size_t>> framesForSlice(static_cast<size_t>(grid.dims[2]));
+    for (size_t index : segmentIndices) {
+        if (index >= m_segments.size()) {
+            return fail("Segment index out of range");
+        }
+        const DicomSegment &segment = m_segments[index];
+        wideLabels = wideLabels || segment.number > 255;
+        for (unsigned int frame : segment.frames) {
+            if (!m_hasPosition[frame]) {
+                continue;
+            }
+            FrameMapping map;
+            map.frame = frame;
+            map.label = static_cast<int>(std::min<unsigned int>(segment.number, 32767));
+            toIndex(&m_framePositions[static_cast<size_t>(frame) * 3], true, map.base);
+            toIndex(rowStep, false, map.du);
+            toIndex(columnStep, false, map.dv);
+            const double det = map.du[0] * map.dv[1] - map.dv[0] * map.du[1];
+            map.inPlane = std::abs(map.du[2]) < 1e-6 && std::abs(map.dv[2]) < 1e-6 && std::abs(det) > 1e-12;
+            if (map.inPlane) {
+                map.inverse[0] = map.dv[1] / det;
+                map.inverse[1] = -map.dv[0] / det;
+                map.inverse[2] = -map.du[1] / det;
+                map.inverse[3] = map.du[0] / det;
+            }
+
+            // 四个角点的切片索引范围；与参考图像同向的帧只落在一层上
+            double kLow = map.base[2];
+            double kHigh = map.base[2];
+            for (int corner = 1; corner < 4; ++corner) {
+                const double c = (corner & 1) ? m_columns - 1.0 : 0.0;
+                const double r = (corner & 2) ? m_rows - 1.0 : 0.0;
+                const double k = map.base[2] + c * map.du[2] + r * map.dv[2];
+                kLow = std::min(kLow, k);
+                kHigh = std::max(kHigh, k);
+            }
+            const int kBegin = std::max(0, static_cast<int>(std::floor(kLow + 0.5)));
+            const int kEnd = std::min(grid.dims[2] - 1, static_cast<int>(std::floor(kHigh + 0.5)));
+            if (kBegin > kEnd) {
+                continue;
+            }
+            mappings.push_back(map);
+            for (int k = kBegin; k <= kEnd; ++k) {
+                framesForSlice[k].push_back(mappings.size() - 1);
+            }
+        }
+    }
+
+    vtkSmartPointer<vtkImageData> labels = vtkSmartPointer<vtkImageData>::New();
+    labels->SetDimensions(grid.dims[0], grid.dims[1], grid.dims[2]);
+    labels->SetSpacing(grid.spacing[0], grid.spacing[1], grid.spacing[2]);
+    labels->SetOrigin(grid.origin[0], grid.origin[1], grid.origin[2]);
+    labels->AllocateScalars(wideLabels ? VTK_SHORT : VTK_UNSIGNED_CHAR, 1);
+    std::memset(labels->GetScalarPointer(), 0,
+                static_cast<size_t>(labels->GetNumberOfPoints()) * (wideLabels ? sizeof(short) : 1));
+
+    // 各输出切片互不相交，按切片并行；只有用到的帧才展开
+    std::atomic<size_t> inside{ 0 };
+    void *scalars = labels->GetScalarPointer();
+    const size_t framePixels = static_cast<size_t>(m_rows) * m_columns;
+    pool.ParallelFor(0, framesForSlice.size(), [&](size_t begin, size_t end) {
+        std::vector<unsigned char> mask(framePixels);
+        size_t localInside = 0;
+        for (size_t k = begin; k < end; ++k) {
+            for (size_t mapIndex : framesForSlice[k]) {
+                const FrameMapping &map = mappings[mapIndex];
+                UnpackFrame(map.frame, 1, mask.data());
+                const int slice = static_cast<int>(k);
+                if (wideLabels) {
+                    short *dst = static_cast<short *>(scalars);
+                    localInside += map.inPlane
+                        ? SampleFrame(map, mask.data(), m_rows, m_columns, grid.dims, slice, dst)
+                        : ScatterFrame(map, mask.data(), m_rows, m_columns, grid.dims, slice, dst);
+                } else {
+                    unsigned char *dst = static_cast<unsigned char *>(scalars);
+                    localInside += map.inPlane
+                        ? SampleFrame(map, mask.data(), m_rows, m_columns, grid.dims, slice, dst)
+                        : ScatterFrame(map, mask.data(), m_rows, m_columns, grid.dims, slice, dst);
+                }
+            }
+        }
+        inside += localInside;
+    });
+    if (insideCount) {
+        *insideCount = inside;
+    }
+    return labels;
+}
@@ -0,0 +1,85 @@
+﻿#ifndef DICOMSEG_H
+#define DICOMSEG_H
+
+#include "threadpool.h"
+
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// DICOM SEG 中的一个分割段 (Segment Sequence 0062,0002 的条目)
+struct DicomSegment
+{
+    unsigned int number = 0;            // Segment Number，输出标签体中的标签值
+    std::string label;                  // Segment Label
+    std::vector<unsigned int> frames;   // 引用该段的帧号（0 起）
+};
+
+// 映射目标：参考图像的尺寸、原点、间距与方向矩阵（行主序，LPS）
+struct SegmentationGrid
+{
+    int dims[3] = { 0, 0, 0 };
+    double origin[3] = { 0.0, 0.0, 0.0 };
+    double spacing[3] = { 1.0, 1.0, 1.0 };
+    double direction[9] = { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+};
+
+// 病人坐标到网格连续索引的仿射变换 ijk = matrix · P + offset；尺寸无效或方向矩阵奇异时返回 false
+bool PatientToGridIndex(const SegmentationGrid &grid, double matrix[9], double offset[3]);
+
+// 把从第 bitOffset 位开始的 count 个 1 位像素（字节内低位在前）展开为 0 / value 字节。
+// 对齐到字节后每次查表写出 8 个像素
+void UnpackBinaryPixels(const unsigned char *packed, size_t bitOffset, size_t count,
+                        unsigned char value, unsigned char *dst);
+
+// DICOM SEG 读取器：Open 只解析段表与逐帧功能组并保留原始像素数据，
+// 各段的帧在 DecodeSegments 请求时才展开并按帧位置映射到参考网格上
+class DicomSegReader
+{
+public:
+    bool Open(const std::string &fileName, std::string *error = nullptr);
+
+    const std::vector<DicomSegment> &GetSegments() const { return m_segments; }
+    const std::string &GetSeriesDescription() const { return m_seriesDescription; }
+    unsigned int GetRows() const { return m_rows; }
+    unsigned int GetColumns() const { return m_columns; }
+
+    // 按 SOP Class UID / Modality 判断文件是否为 DICOM SEG
+    static bool IsSegmentationFile(const std::string &fileName);
+
+    // 把 segmentIndices（GetSegments 的下标）中各段的帧最近邻映射到 grid 上，输出段号为标签值的标签体
+    // （段号均不超过 255 时为 uint8，否则为 int16）；重叠处列表中靠后的段覆盖靠前的。
+    // 按输出切片在线程池上并行。insideCount 输出被标记的体素数
+    vtkSmartPointer<vtkImageData> DecodeSegments(const std::vector<size_t> &segmentIndices,
+                                                 const SegmentationGrid &grid,
+                                                 size_t *insideCount = nullptr,
+                                                 std::string *error = nullptr,
+                                                 ThreadPool &pool = ThreadPool::Global()) const;
+
+private:
+    // 把第 frame 帧展开为 rows * columns 个 0 / value 字节
+    void UnpackFrame(unsigned int frame, unsigned char value, unsigned char *dst) const;
+
+    std::string m_fileName;
+    std::string m_seriesDescription;
+    unsigned int m_rows = 0;
+    unsigned int m_columns = 0;
+    unsigned int m_frameCount = 0;
+    unsigned short m_bitsAllocated = 1;
+    // FRACTIONAL 类型按最大值的一半二值化
+    unsigned int m_fractionalThreshold = 1;
+
+    double m_rowDirection[3] = { 1.0, 0.0, 0.0 };
+    double m_columnDirection[3] = { 0.0, 1.0, 0.0 };
+    double m_pixelSpacing[2] = { 1.0, 1.0 };   // 行间距、列间距
+    std::vector<double> m_framePositions;      // 每帧 3 个值 (Image Position Patient)
+    std::vector<bool> m_hasPosition;
+
+    std::vector<DicomSegment> m_segments;
+    std::vector<unsigned char> m_pixelData;
+};
+
+#endif // DICOMSEG_H
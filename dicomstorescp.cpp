@@ -0,0 +1,913 @@
+﻿#include "dicomstorescp.h"
+
+#include <vtkSetGet.h>
+#include <vtkType.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace
+{
+
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+const SocketHandle InvalidSocket = INVALID_SOCKET;
+#else
+using SocketHandle = int;
+const SocketHandle InvalidSocket = -1;
+#endif
+
+constexpr char ApplicationContextUID[] = "1.2.840.10008.3.1.1.1";
+constexpr char VerificationSOPClassUID[] = "1.2.840.10008.1.1";
+constexpr char StorageSOPClassPrefix[] = "1.2.840.10008.5.1.4.1.1.";
+constexpr char ImplicitVRLittleEndian[] = "1.2.840.10008.1.2";
+constexpr char ExplicitVRLittleEndian[] = "1.2.840.10008.1.2.1";
+// 2.25 根下由 UUID 派生的 UID，无需注册机构前缀
+constexpr char ImplementationClassUID[] = "2.25.163502894207316871582946305412843567123";
+constexpr char ImplementationVersionName[] = "MYDICOMVIEWER";
+
+// 向发送方声明的最大 PDU：分片越大系统调用越少，千兆网下一个 512x512 切片约一个 PDU
+constexpr uint32_t MaxReceivePduLength = 1u << 20;
+constexpr uint32_t MaxAssociatePduLength = 1u << 20;
+constexpr size_t MaxDatasetLength = static_cast<size_t>(1) << 30;
+constexpr int SocketReceiveBufferBytes = 4 << 20;
+// 对端长时间无数据时结束关联（相当于 ARTIM 定时器）
+constexpr int IdleTimeoutSeconds = 60;
+constexpr int AcceptPollMilliseconds = 200;
+
+constexpr uint16_t CStoreRQ = 0x0001;
+constexpr uint16_t CStoreRSP = 0x8001;
+constexpr uint16_t CEchoRQ = 0x0030;
+constexpr uint16_t CEchoRSP = 0x8030;
+constexpr uint16_t NoDataSet = 0x0101;
+constexpr uint16_t StatusSuccess = 0x0000;
+constexpr uint16_t StatusOutOfResources = 0xA700;
+constexpr uint16_t StatusCannotUnderstand = 0xC000;
+
+// 协商结果（A-ASSOCIATE-AC 表示上下文项中的 Result/Reason）
+constexpr uint8_t ContextAccepted = 0;
+constexpr uint8_t AbstractSyntaxNotSupported = 3;
+constexpr uint8_t TransferSyntaxesNotSupported = 4;
+
+bool InitializeSockets()
+{
+#ifdef _WIN32
+    static const bool initialized = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return initialized;
+#else
+    return true;
+#endif
+}
+
+std::string SocketErrorText()
+{
+#ifdef _WIN32
+    return "socket error " + std::to_string(WSAGetLastError());
+#else
+    return std::strerror(errno);
+#endif
+}
+
+void CloseSocket(SocketHandle socket)
+{
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    ::close(socket);
+#endif
+}
+
+void ShutdownSocket(SocketHandle socket)
+{
+#ifdef _WIN32
+    shutdown(socket, SD_BOTH);
+#else
+    shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+void ConfigureConnection(SocketHandle socket)
+{
+    const int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&noDelay), sizeof(noDelay));
+#ifdef _WIN32
+    const DWORD timeout = IdleTimeoutSeconds * 1000;
+#else
+    timeval timeout = {};
+    timeout.tv_sec = IdleTimeoutSeconds;
+#endif
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&timeout), sizeof(timeout));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&timeout), sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    const int noSigPipe = 1;
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+}
+
+uint16_t BigEndian16(const unsigned char *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t BigEndian32(const unsigned char *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+uint16_t LittleEndian16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t LittleEndian32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void AppendBigEndian16(std::vector<unsigned char> &out, uint16_t value)
+{
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+void AppendBigEndian32(std::vector<unsigned char> &out, uint32_t value)
+{
+    AppendBigEndian16(out, static_cast<uint16_t>(value >> 16));
+    AppendBigEndian16(out, static_cast<uint16_t>(value));
+}
+
+void AppendLittleEndian16(std::vector<unsigned char> &out, uint16_t value)
+{
+    out.push_back(static_cast<unsigned char>(value));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+}
+
+void AppendLittleEndian32(std::vector<unsigned char> &out, uint32_t value)
+{
+    AppendLittleEndian16(out, static_cast<uint16_t>(value));
+    AppendLittleEndian16(out, static_cast<uint16_t>(value >> 16));
+}
+
+// 协议项中的 UID/AE 可能以空格或 0 结尾
+std::string TrimText(const unsigned char *data, size_t length)
+{
+    size_t begin = 0;
+    size_t end = length;
+    while (begin < end && data[begin] == ' ') {
+        ++begin;
+    }
+    while (end > begin && (data[end - 1] == ' ' || data[end - 1] == '\0')) {
+        --end;
+    }
+    return std::string(reinterpret_cast<const char *>(data) + begin, end - begin);
+}
+
+// 类型(1) 保留(1) 长度(2, 大端) 值
+void AppendItem(std::vector<unsigned char> &out, uint8_t type, const std::string &value)
+{
+    out.push_back(type);
+    out.push_back(0);
+    AppendBigEndian16(out, static_cast<uint16_t>(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// 命令集固定为隐式 VR 小端，组号 0000
+void AppendCommandElement(std::vector<unsigned char> &out, uint16_t element, const std::string &uid)
+{
+    const size_t length = uid.size() + (uid.size() & 1);
+    AppendLittleEndian16(out, 0x0000);
+    AppendLittleEndian16(out, element);
+    AppendLittleEndian32(out, static_cast<uint32_t>(length));
+    out.insert(out.end(), uid.begin(), uid.end());
+    if (uid.size() & 1) {
+        out.push_back('\0');
+    }
+}
+
+void AppendCommandElement(std::vector<unsigned char> &out, uint16_t element, uint16_t value)
+{
+    AppendLittleEndian16(out, 0x0000);
+    AppendLittleEndian16(out, element);
+    AppendLittleEndian32(out, 2);
+    AppendLittleEndian16(out, value);
+}
+
+std::vector<unsigned char> BuildResponse(uint16_t commandField, const std::string &sopClassUID,
+                                         const std::string &sopInstanceUID, uint16_t messageID,
+                                         uint16_t status)
+{
+    std::vector<unsigned char> elements;
+    AppendCommandElement(elements, 0x0002, sopClassUID);
+    AppendCommandElement(elements, 0x0100, commandField);
+    AppendCommandElement(elements, 0x0120, messageID);
+    AppendCommandElement(elements, 0x0800, NoDataSet);
+    AppendCommandElement(elements, 0x0900, status);
+    if (!sopInstanceUID.empty()) {
+        AppendCommandElement(elements, 0x1000, sopInstanceUID);
+    }
+
+    std::vector<unsigned char> command;
+    AppendLittleEndian16(command, 0x0000);
+    AppendLittleEndian16(command, 0x0000);
+    AppendLittleEndian32(command, 4);
+    AppendLittleEndian32(command, static_cast<uint32_t>(elements.size()));
+    command.insert(command.end(), elements.begin(), elements.end());
+    return command;
+}
+
+struct PresentationContext
+{
+    uint8_t id = 0;
+    uint8_t result = AbstractSyntaxNotSupported;
+    std::string abstractSyntax;
+    std::string transferSyntax = ImplicitVRLittleEndian;
+};
+
+// 只接受原生小端传输语法：收到的像素可以直接按位深解释，无需解压
+uint8_t NegotiateContext(PresentationContext &context, const std::vector<std::string> &proposed)
+{
+    const bool storage = context.abstractSyntax.compare(0, sizeof(StorageSOPClassPrefix) - 1,
+                                                        StorageSOPClassPrefix) == 0;
+    if (!storage && context.abstractSyntax != VerificationSOPClassUID) {
+        return AbstractSyntaxNotSupported;
+    }
+    for (const char *candidate : { ExplicitVRLittleEndian, ImplicitVRLittleEndian }) {
+        if (std::find(proposed.begin(), proposed.end(), candidate) != proposed.end()) {
+            context.transferSyntax = candidate;
+            return ContextAccepted;
+        }
+    }
+    return TransferSyntaxesNotSupported;
+}
+
+// 一个关联的 DICOM 上层协议状态机：A-ASSOCIATE 协商、P-DATA 分片重组、C-ECHO/C-STORE 应答、A-RELEASE
+class StoreAssociation
+{
+public:
+    StoreAssociation(SocketHandle socket, const DicomStoreScp::InstanceHandler &handler,
+                     std::atomic<size_t> &receivedCount)
+        : m_socket(socket)
+        , m_handler(handler)
+        , m_receivedCount(receivedCount)
+    {
+    }
+
+    void Run()
+    {
+        unsigned char header[6];
+        while (ReadExact(header, sizeof(header))) {
+            const uint8_t type = header[0];
+            const uint32_t length = BigEndian32(header + 2);
+            bool ok = false;
+            switch (type) {
+            case 0x01:  // A-ASSOCIATE-RQ
+                ok = !m_associated && Associate(length);
+                if (ok && !m_associated) {
+                    return;  // 已回复 A-ASSOCIATE-RJ
+                }
+                break;
+            case 0x04:  // P-DATA-TF
+                ok = m_associated && ReceivePData(length);
+                break;
+            case 0x05: {  // A-RELEASE-RQ
+                unsigned char reserved[4];
+                if (m_associated && length == sizeof(reserved) && ReadExact(reserved, sizeof(reserved))) {
+                    SendAll({ 0x06, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00 });
+                    return;
+                }
+                break;
+            }
+            case 0x07:  // A-ABORT
+                return;
+            default:
+                break;
+            }
+            if (!ok) {
+                // 协议错误：A-ABORT，来源为服务提供方
+                SendAll({ 0x07, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x02, 0x00 });
+                return;
+            }
+        }
+    }
+
+private:
+    bool ReadExact(void *dst, size_t n)
+    {
+        auto *out = static_cast<char *>(dst);
+        while (n > 0) {
+            const int chunk = static_cast<int>(std::min<size_t>(n, INT_MAX));
+            const auto got = recv(m_socket, out, chunk, 0);
+            if (got <= 0) {
+                return false;
+            }
+            out += got;
+            n -= static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    bool SendAll(const std::vector<unsigned char> &data)
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const int chunk = static_cast<int>(std::min<size_t>(data.size() - sent, INT_MAX));
+            const auto n = send(m_socket, reinterpret_cast<const char *>(data.data()) + sent, chunk, flags);
+            if (n <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    const PresentationContext *AcceptedContext(uint8_t id) const
+    {
+        for (const PresentationContext &context : m_contexts) {
+            if (context.id == id) {
+                return context.result == ContextAccepted ? &context : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Associate(uint32_t length)
+    {
+        // 协议版本(2) 保留(2) 被叫 AE(16) 主叫 AE(16) 保留(32) 之后是可变项
+        constexpr size_t FixedLength = 68;
+        if (length < FixedLength || length > MaxAssociatePduLength) {
+            return false;
+        }
+        std::vector<unsigned char> request(length);
+        if (!ReadExact(request.data(), length)) {
+            return false;
+        }
+        if ((BigEndian16(request.data()) & 0x0001) == 0) {
+            // 永久拒绝，来源 ACSE 服务提供方，原因：协议版本不支持
+            SendAll({ 0x03, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x01, 0x02, 0x02 });
+            return true;
+        }
+        m_callingAETitle = TrimText(request.data() + 20, 16);
+
+        for (size_t pos = FixedLength; pos + 4 <= length;) {
+            const uint8_t itemType = request[pos];
+            const size_t itemLength = BigEndian16(request.data() + pos + 2);
+            const unsigned char *item = request.data() + pos + 4;
+            if (pos + 4 + itemLength > length) {
+                return false;
+            }
+            pos += 4 + itemLength;
+            if (itemType != 0x20 || itemLength < 4) {
+                continue;
+            }
+
+            PresentationContext context;
+            context.id = item[0];
+            std::vector<std::string> proposed;
+            for (size_t sub = 4; sub + 4 <= itemLength;) {
+                const uint8_t subType = item[sub];
+                const size_t subLength = BigEndian16(item + sub + 2);
+                if (sub + 4 + subLength > itemLength) {
+                    return false;
+                }
+                const std::string uid = TrimText(item + sub + 4, subLength);
+                if (subType == 0x30) {
+                    context.abstractSyntax = uid;
+                } else if (subType == 0x40) {
+                    proposed.push_back(uid);
+                }
+                sub += 4 + subLength;
+            }
+            context.result = NegotiateContext(context, proposed);
+            m_contexts.push_back(std::move(context));
+        }
+
+        std::vector<unsigned char> body;
+        AppendBigEndian16(body, 0x0001);
+        AppendBigEndian16(body, 0x0000);
+        // 两个 AE 与保留字段原样回送
+        body.insert(body.end(), request.begin() + 4, request.begin() + FixedLength);
+        AppendItem(body, 0x10, ApplicationContextUID);
+        for (const PresentationContext &context : m_contexts) {
+            body.push_back(0x21);
+            body.push_back(0);
+            AppendBigEndian16(body, static_cast<uint16_t>(8 + context.transferSyntax.size()));
+            body.push_back(context.id);
+            body.push_back(0);
+            body.push_back(context.result);
+            body.push_back(0);
+            AppendItem(body, 0x40, context.transferSyntax);
+        }
+
+        std::vector<unsigned char> userInfo;
+        userInfo.push_back(0x51);
+        userInfo.push_back(0);
+        AppendBigEndian16(userInfo, 4);
+        AppendBigEndian32(userInfo, MaxReceivePduLength);
+        AppendItem(userInfo, 0x52, ImplementationClassUID);
+        AppendItem(userInfo, 0x55, ImplementationVersionName);
+        body.push_back(0x50);
+        body.push_back(0);
+        AppendBigEndian16(body, static_cast<uint16_t>(userInfo.size()));
+        body.insert(body.end(), userInfo.begin(), userInfo.end());
+
+        std::vector<unsigned char> pdu = { 0x02, 0x00 };
+        AppendBigEndian32(pdu, static_cast<uint32_t>(body.size()));
+        pdu.insert(pdu.end(), body.begin(), body.end());
+        m_associated = true;
+        return SendAll(pdu);
+    }
+
+    // PDV 项：长度(4) 上下文 ID(1) 消息控制头(1，bit0 命令/数据集，bit1 最后分片) 分片。
+    // 数据集分片直接读入实例缓冲区，不经中间拷贝
+    bool ReceivePData(uint32_t length)
+    {
+        uint32_t remaining = length;
+        unsigned char itemHeader[6];
+        while (remaining > 0) {
+            if (remaining < sizeof(itemHeader) || !ReadExact(itemHeader, sizeof(itemHeader))) {
+                return false;
+            }
+            const uint32_t itemLength = BigEndian32(itemHeader);
+            if (itemLength < 2 || itemLength > remaining - 4) {
+                return false;
+            }
+            remaining -= 4 + itemLength;
+            const uint8_t contextId = itemHeader[4];
+            const bool isCommand = (itemHeader[5] & 0x01) != 0;
+            const bool isLast = (itemHeader[5] & 0x02) != 0;
+            const size_t fragment = itemLength - 2;
+            if (!AcceptedContext(contextId)) {
+                return false;
+            }
+
+            if (isCommand) {
+                if (m_command.size() + fragment > MaxAssociatePduLength) {
+                    return false;
+                }
+                const size_t offset = m_command.size();
+                m_command.resize(offset + fragment);
+                if (!ReadExact(m_command.data() + offset, fragment) || (isLast && !HandleCommand(contextId))) {
+                    return false;
+                }
+            } else {
+                if (!m_storePending || contextId != m_storeContext ||
+                    m_dataset.size() + fragment > MaxDatasetLength) {
+                    return false;
+                }
+                const size_t offset = m_dataset.size();
+                m_dataset.resize(offset + fragment);
+                if (!ReadExact(m_dataset.data() + offset, fragment) || (isLast && !HandleStore())) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool HandleCommand(uint8_t contextId)
+    {
+        uint16_t commandField = 0;
+        uint16_t messageID = 0;
+        uint16_t dataSetType = NoDataSet;
+        std::string sopClassUID;
+        std::string sopInstanceUID;
+        for (size_t pos = 0; pos + 8 <= m_command.size();) {
+            const uint16_t element = LittleEndian16(m_command.data() + pos + 2);
+            const size_t length = LittleEndian32(m_command.data() + pos + 4);
+            const unsigned char *value = m_command.data() + pos + 8;
+            if (length > m_command.size() - pos - 8) {
+                return false;
+            }
+            pos += 8 + length;
+            switch (element) {
+            case 0x0002: sopClassUID = TrimText(value, length); break;
+            case 0x0100: commandField = length >= 2 ? LittleEndian16(value) : 0; break;
+            case 0x0110: messageID = length >= 2 ? LittleEndian16(value) : 0; break;
+            case 0x0800: dataSetType = length >= 2 ? LittleEndian16(value) : NoDataSet; break;
+            case 0x1000: sopInstanceUID = TrimText(value, length); break;
+            default: break;
+            }
+        }
+        m_command.clear();
+
+        if (commandField == CEchoRQ) {
+            return SendCommand(contextId, BuildResponse(CEchoRSP, sopClassUID, std::string(), messageID, StatusSuccess));
+        }
+        if (commandField != CStoreRQ || dataSetType == NoDataSet || m_storePending) {
+            return false;
+        }
+        m_storePending = true;
+        m_storeContext = contextId;
+        m_storeMessageID = messageID;
+        m_storeSOPClassUID = sopClassUID;
+        m_storeSOPInstanceUID = sopInstanceUID;
+        m_dataset.clear();
+        return true;
+    }
+
+    bool HandleStore()
+    {
+        ReceivedDicomInstance instance;
+        instance.callingAETitle = m_callingAETitle;
+        instance.transferSyntaxUID = AcceptedContext(m_storeContext)->transferSyntax;
+        instance.dataset.swap(m_dataset);
+        m_storePending = false;
+
+        uint16_t status = StatusCannotUnderstand;
+        if (DicomDirectoryScanner::ReadHeader(instance.dataset.data(), instance.dataset.size(),
+                                              instance.transferSyntaxUID, instance.header, &instance.pixels)) {
+            if (instance.header.sopInstanceUID.empty()) {
+                instance.header.sopInstanceUID = m_storeSOPInstanceUID;
+            }
+            instance.header.fileName = instance.header.sopInstanceUID;
+            status = m_handler(std::move(instance)) ? StatusSuccess : StatusOutOfResources;
+            if (status == StatusSuccess) {
+                ++m_receivedCount;
+            }
+        }
+        return SendCommand(m_storeContext, BuildResponse(CStoreRSP, m_storeSOPClassUID, m_storeSOPInstanceUID,
+                                                         m_storeMessageID, status));
+    }
+
+    bool SendCommand(uint8_t contextId, const std::vector<unsigned char> &command)
+    {
+        std::vector<unsigned char> pdu = { 0x04, 0x00 };
+        AppendBigEndian32(pdu, static_cast<uint32_t>(6 + command.size()));
+        AppendBigEndian32(pdu, static_cast<uint32_t>(2 + command.size()));
+        pdu.push_back(contextId);
+        pdu.push_back(0x03);
+        pdu.insert(pdu.end(), command.begin(), command.end());
+        return SendAll(pdu);
+    }
+
+    SocketHandle m_socket;
+    const DicomStoreScp::InstanceHandler &m_handler;
+    std::atomic<size_t> &m_receivedCount;
+    bool m_associated = false;
+    std::string m_callingAETitle;
+    std::vector<PresentationContext> m_contexts;
+    std::vector<unsigned char> m_command;
+    std::vector<char> m_dataset;
+    // 命令已到、等待数据集的 C-STORE 请求
+    bool m_storePending = false;
+    uint8_t m_storeContext = 0;
+    uint16_t m_storeMessageID = 0;
+    std::string m_storeSOPClassUID;
+    std::string m_storeSOPInstanceUID;
+};
+
+// 对应 GDCM 按位深与 Rescale 推出的分量类型
+enum class ReceivedPixelClass
+{
+    Byte,
+    Signed,
+    Unsigned16,
+    Wide,
+    Float
+};
+
+ReceivedPixelClass ClassifyPixels(const ReceivedDicomInstance &instance)
+{
+    const DicomPixelModule &pixels = instance.pixels;
+    if (instance.header.modality == "PT" || pixels.rescaleSlope != std::floor(pixels.rescaleSlope) ||
+        pixels.rescaleIntercept != std::floor(pixels.rescaleIntercept)) {
+        return ReceivedPixelClass::Float;
+    }
+
+    const unsigned int bits = (pixels.bitsStored > 0 && pixels.bitsStored < pixels.bitsAllocated)
+                            ? pixels.bitsStored : pixels.bitsAllocated;
+    const double storedMin = pixels.pixelRepresentation ? -std::ldexp(1.0, static_cast<int>(bits) - 1) : 0.0;
+    const double storedMax = pixels.pixelRepresentation ? std::ldexp(1.0, static_cast<int>(bits) - 1) - 1.0
+                                                        : std::ldexp(1.0, static_cast<int>(bits)) - 1.0;
+    const double a = storedMin * pixels.rescaleSlope + pixels.rescaleIntercept;
+    const double b = storedMax * pixels.rescaleSlope + pixels.rescaleIntercept;
+    const double low = std::min(a, b);
+    const double high = std::max(a, b);
+    if (low >= 0.0 && high <= 255.0) {
+        return ReceivedPixelClass::Byte;
+    }
+    if (low >= -128.0 && high <= 127.0) {
+        return ReceivedPixelClass::Signed;
+    }
+    if (low >= 0.0 && high <= 65535.0) {
+        return ReceivedPixelClass::Unsigned16;
+    }
+    if (low >= -32768.0 && high <= 32767.0) {
+        return ReceivedPixelClass::Signed;
+    }
+    return ReceivedPixelClass::Wide;
+}
+
+template <typename TOut, typename TStored>
+void DecodeStoredPixels(const unsigned char *src, size_t count, const DicomPixelModule &pixels, TOut *dst)
+{
+    using Unsigned = std::make_unsigned_t<TStored>;
+    constexpr unsigned int Bits = sizeof(TStored) * 8;
+    const unsigned int stored = (pixels.bitsStored > 0 && pixels.bitsStored < Bits) ? pixels.bitsStored : Bits;
+    const unsigned int shift = Bits - stored;
+    const bool identity = pixels.rescaleSlope == 1.0 && pixels.rescaleIntercept == 0.0;
+    const double low = static_cast<double>(std::numeric_limits<TOut>::lowest());
+    const double high = static_cast<double>(std::numeric_limits<TOut>::max());
+
+    for (size_t i = 0; i < count; ++i) {
+        Unsigned raw;
+        std::memcpy(&raw, src + i * sizeof(TStored), sizeof(TStored));
+        // Bits Stored 之上的高位可能夹带无关位：先左移到最高位，有符号再算术右移完成符号扩展
+        const Unsigned aligned = static_cast<Unsigned>(raw << shift);
+        double value;
+        if (std::is_signed<TStored>::value) {
+            value = static_cast<double>(static_cast<TStored>(aligned) >> shift);
+        } else {
+            value = static_cast<double>(aligned >> shift);
+        }
+        if (!identity) {
+            value = value * pixels.rescaleSlope + pixels.rescaleIntercept;
+        }
+        if (std::is_integral<TOut>::value) {
+            value = std::min(std::max(std::round(value), low), high);
+        }
+        dst[i] = static_cast<TOut>(value);
+    }
+}
+
+template <typename TOut>
+void DecodeSliceAs(const unsigned char *src, size_t count, const DicomPixelModule &pixels, TOut *dst)
+{
+    const bool isSigned = pixels.pixelRepresentation != 0;
+    switch (pixels.bitsAllocated) {
+    case 8:
+        isSigned ? DecodeStoredPixels<TOut, int8_t>(src, count, pixels, dst)
+                 : DecodeStoredPixels<TOut, uint8_t>(src, count, pixels, dst);
+        break;
+    case 16:
+        isSigned ? DecodeStoredPixels<TOut, int16_t>(src, count, pixels, dst)
+                 : DecodeStoredPixels<TOut, uint16_t>(src, count, pixels, dst);
+        break;
+    default:
+        isSigned ? DecodeStoredPixels<TOut, int32_t>(src, count, pixels, dst)
+                 : DecodeStoredPixels<TOut, uint32_t>(src, count, pixels, dst);
+        break;
+    }
+}
+
+} // namespace
+
+bool ReceivedDicomInstance::IsDisplayableSlice() const
+{
+    const unsigned int bytesPerPixel = pixels.bitsAllocated / 8;
+    if (header.numberOfFrames > 1 || pixels.samplesPerPixel != 1 ||
+        (bytesPerPixel != 1 && bytesPerPixel != 2 && bytesPerPixel != 4) || pixels.bitsAllocated % 8 != 0) {
+        return false;
+    }
+    const size_t required = static_cast<size_t>(header.rows) * header.columns * bytesPerPixel;
+    return pixels.pixelDataLength >= required && pixels.pixelDataOffset <= dataset.size() &&
+           dataset.size() - pixels.pixelDataOffset >= required;
+}
+
+int SelectReceivedScalarType(const std::vector<const ReceivedDicomInstance *> &instances)
+{
+    bool anyFloat = false;
+    bool anySigned = false;
+    bool anyUnsigned16 = false;
+    bool anyWide = false;
+    bool allByte = true;
+    for (const ReceivedDicomInstance *instance : instances) {
+        switch (ClassifyPixels(*instance)) {
+        case ReceivedPixelClass::Byte:
+            break;
+        case ReceivedPixelClass::Signed:
+            anySigned = true;
+            allByte = false;
+            break;
+        case ReceivedPixelClass::Unsigned16:
+            anyUnsigned16 = true;
+            allByte = false;
+            break;
+        case ReceivedPixelClass::Float:
+            anyFloat = true;
+            allByte = false;
+            break;
+        case ReceivedPixelClass::Wide:
+            anyWide = true;
+            allByte = false;
+            break;
+        }
+    }
+
+    if (anyFloat) {
+        return VTK_FLOAT;
+    }
+    if (anyWide || (anySigned && anyUnsigned16)) {
+        return VTK_INT;
+    }
+    if (anyUnsigned16) {
+        return VTK_UNSIGNED_SHORT;
+    }
+    if (allByte) {
+        return VTK_UNSIGNED_CHAR;
+    }
+    return VTK_SHORT;
+}
+
+bool DecodeReceivedSlice(const ReceivedDicomInstance &instance, int scalarType, void *dst)
+{
+    if (!instance.IsDisplayableSlice()) {
+        return false;
+    }
+    // 只协商了小端传输语法，像素按小端主机字节序直接解释
+    const auto *src = reinterpret_cast<const unsigned char *>(instance.dataset.data()) + instance.pixels.pixelDataOffset;
+    const size_t count = static_cast<size_t>(instance.header.rows) * instance.header.columns;
+    switch (scalarType) {
+        vtkTemplateMacro(DecodeSliceAs(src, count, instance.pixels, static_cast<VTK_TT *>(dst)));
+    default:
+        return false;
+    }
+    return true;
+}
+
+struct DicomStoreScp::Connection
+{
+    SocketHandle socket = InvalidSocket;
+    std::thread thread;
+    bool finished = false;
+};
+
+DicomStoreScp::DicomStoreScp()
+    : m_listenSocket(static_cast<std::intptr_t>(InvalidSocket))
+    , m_port(0)
+    , m_stopping(false)
+    , m_receivedCount(0)
+{
+}
+
+DicomStoreScp::~DicomStoreScp()
+{
+    Stop();
+}
+
+bool DicomStoreScp::Start(unsigned short port, InstanceHandler handler, std::string *error)
+{
+    Stop();
+    if (!InitializeSockets()) {
+        if (error) {
+            *error = "Cannot initialize sockets.";
+        }
+        return false;
+    }
+
+    const SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == InvalidSocket) {
+        if (error) {
+            *error = "Cannot create socket: " + SocketErrorText();
+        }
+        return false;
+    }
+#ifndef _WIN32
+    const int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+    // 在 listen 之前设置，接受的连接继承较大的接收窗口
+    const int receiveBuffer = SocketReceiveBufferBytes;
+    setsockopt(listener, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char *>(&receiveBuffer), sizeof(receiveBuffer));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    socklen_t addressLength = sizeof(address);
+    if (bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr *>(&address), &addressLength) != 0) {
+        if (error) {
+            *error = "Cannot listen on port " + std::to_string(port) + ": " + SocketErrorText();
+        }
+        CloseSocket(listener);
+        return false;
+    }
+
+    m_listenSocket = static_cast<std::intptr_t>(listener);
+    m_port = ntohs(address.sin_port);
+    m_handler = std::move(handler);
+    m_stopping = false;
+    m_receivedCount = 0;
+    m_acceptThread = std::thread(&DicomStoreScp::AcceptLoop, this);
+    return true;
+}
+
+void DicomStoreScp::Stop()
+{
+    if (!m_acceptThread.joinable()) {
+        return;
+    }
+    m_stopping = true;
+    m_acceptThread.join();
+    CloseSocket(static_cast<SocketHandle>(m_listenSocket));
+    m_listenSocket = static_cast<std::intptr_t>(InvalidSocket);
+
+    // 关闭读写使阻塞在 recv/send 上的关联线程立即返回；线程退出时要加锁，因此在锁外等待
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &connection : m_connections) {
+            if (connection->socket != InvalidSocket) {
+                ShutdownSocket(connection->socket);
+            }
+        }
+    }
+    for (const auto &connection : m_connections) {
+        connection->thread.join();
+    }
+    m_connections.clear();
+    m_handler = nullptr;
+}
+
+void DicomStoreScp::AcceptLoop()
+{
+    const SocketHandle listener = static_cast<SocketHandle>(m_listenSocket);
+    while (!m_stopping) {
+        // 带超时等待新连接，以便及时响应 Stop
+#ifdef _WIN32
+        WSAPOLLFD descriptor = {};
+        descriptor.fd = listener;
+        descriptor.events = POLLRDNORM;
+        const int ready = WSAPoll(&descriptor, 1, AcceptPollMilliseconds);
+#else
+        pollfd descriptor = {};
+        descriptor.fd = listener;
+        descriptor.events = POLLIN;
+        const int ready = poll(&descriptor, 1, AcceptPollMilliseconds);
+#endif
+        ReapFinishedConnections();
+        if (ready <= 0) {
+            continue;
+        }
+        const SocketHandle client = accept(listener, nullptr, nullptr);
+        if (client == InvalidSocket) {
+            continue;
+        }
+        ConfigureConnection(client);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connections.push_back(std::make_unique<Connection>());
+        Connection *connection = m_connections.back().get();
+        connection->socket = client;
+        connection->thread = std::thread([this, connection]() {
+            StoreAssociation(connection->socket, m_handler, m_receivedCount).Run();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            CloseSocket(connection->socket);
+            connection->socket = InvalidSocket;
+            connection->finished = true;
+        });
+    }
+}
+
+void DicomStoreScp::ReapFinishedConnections()
+{
+    std::list<std::unique_ptr<Connection>> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_connections.begin(); it != m_connections.end();) {
+            if ((*it)->finished) {
+                finished.splice(finished.end(), m_connections, it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (const auto &connection : finished) {
+        connection->thread.join();
+    }
+}
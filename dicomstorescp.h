@@ -0,0 +1,73 @@
+﻿#ifndef DICOMSTORESCP_H
+#define DICOMSTORESCP_H
+
+#include "dicomscanner.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 通过 C-STORE 收到的一个实例：数据集原样留在内存中，文件头与像素模块已在关联线程上解析
+struct ReceivedDicomInstance
+{
+    std::string callingAETitle;
+    std::string transferSyntaxUID;
+    DicomFileHeader header;       // fileName 为 SOP Instance UID，作为增量序列的去重键
+    DicomPixelModule pixels;      // pixelDataOffset 相对于 dataset
+    std::vector<char> dataset;
+
+    // 单帧、单通道且像素数据完整的原生编码实例才能作为一张切片显示
+    bool IsDisplayableSlice() const;
+};
+
+// 与 SelectDicomScalarType 规则相同，按实例的位深与 Rescale 选择 VTK 标量类型
+int SelectReceivedScalarType(const std::vector<const ReceivedDicomInstance *> &instances);
+
+// 把实例像素按 Rescale 换算后写入 dst（rows * columns 个 scalarType 体素）
+bool DecodeReceivedSlice(const ReceivedDicomInstance &instance, int scalarType, void *dst);
+
+// 最小的存储服务（Storage SCP）：接受 Verification 与所有存储类 SOP，只协商隐式/显式 VR 小端，
+// 像素无需编解码器即可直接从接收缓冲区取出。每个关联一个线程，实例不落盘，交给回调处理
+class DicomStoreScp
+{
+public:
+    // 在关联线程上调用；返回 false 时以“资源不足”(A700) 回复发送方
+    using InstanceHandler = std::function<bool(ReceivedDicomInstance &&instance)>;
+
+    DicomStoreScp();
+    ~DicomStoreScp();
+
+    DicomStoreScp(const DicomStoreScp &) = delete;
+    DicomStoreScp &operator=(const DicomStoreScp &) = delete;
+
+    bool Start(unsigned short port, InstanceHandler handler, std::string *error = nullptr);
+    // 关闭监听并中断所有关联，返回时不再有回调
+    void Stop();
+
+    bool IsListening() const { return m_acceptThread.joinable(); }
+    unsigned short GetPort() const { return m_port; }
+    size_t GetReceivedCount() const { return m_receivedCount; }
+
+private:
+    struct Connection;
+
+    void AcceptLoop();
+    void ReapFinishedConnections();
+
+    std::intptr_t m_listenSocket;
+    unsigned short m_port;
+    InstanceHandler m_handler;
+    std::atomic<bool> m_stopping;
+    std::atomic<size_t> m_receivedCount;
+    std::thread m_acceptThread;
+    std::mutex m_mutex;
+    std::list<std::unique_ptr<Connection>> m_connections;
+};
+
+#endif // DICOMSTORESCP_H
@@ -0,0 +1,557 @@
+﻿#include "dicomvolumeloader.h"
+#include "dicomscanner.h"
+
+#include <itkImageSeriesReader.h>
+#include <itkGDCMSeriesFileNames.h>
+#include <itkImageFileReader.h>
+#include <itkGDCMImageIO.h>
+#include <itkMetaDataObject.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <set>
+#include <stdexcept>
+
+namespace
+{
+
+std::string TrimmedValue(const itk::MetaDataDictionary &dict, const std::string &tagKey)
+{
+    std::string value;
+    if (!itk::ExposeMetaData<std::string>(dict, tagKey, value)) {
+        return std::string();
+    }
+    const size_t first = value.find_first_not_of(" \t\n\r");
+    if (first == std::string::npos) {
+        return std::string();
+    }
+    const size_t last = value.find_last_not_of(" \t\n\r");
+    return value.substr(first, last - first + 1);
+}
+
+// 读取单个切片文件写入 dst（dims[0] x dims[1] 个体素），尺寸不符或读取失败时抛出异常
+template <typename TPixel>
+void ReadSliceInto(const std::string &fileName, const VolumeGeometry &geometry, TPixel *dst)
+{
+    using SliceType = itk::Image<TPixel, 2>;
+    using ReaderType = itk::ImageFileReader<SliceType>;
+
+    auto reader = ReaderType::New();
+    reader->SetImageIO(itk::GDCMImageIO::New());
+    reader->SetFileName(fileName);
+    reader->Update();
+    SliceType *slice = reader->GetOutput();
+    const auto size = slice->GetLargestPossibleRegion().GetSize();
+    if (size[0] != static_cast<size_t>(geometry.dims[0]) ||
+        size[1] != static_cast<size_t>(geometry.dims[1])) {
+        throw std::runtime_error("Slice size mismatch: " + fileName);
+    }
+    std::copy(slice->GetBufferPointer(), slice->GetBufferPointer() + size[0] * size[1], dst);
+}
+
+template <typename TPixel>
+bool StreamDicomSeriesAs(const std::vector<std::string> &fileNames, BrickedVolumeStore &store,
+                         std::string *error)
+{
+    const VolumeGeometry &geometry = store.GetGeometry();
+    const size_t sliceVoxels = static_cast<size_t>(geometry.dims[0]) * geometry.dims[1];
+    const size_t batchSize = static_cast<size_t>(store.GetBrickSize());
+    std::vector<TPixel> batch(sliceVoxels * batchSize);
+    std::mutex errorMutex;
+
+    for (size_t first = 0; first < fileNames.size(); first += batchSize) {
+        const size_t count = std::min(batchSize, fileNames.size() - first);
+        std::atomic<bool> ok(true);
+        // 一层砖块的切片并行解码，解码完成后整层写出
+        ThreadPool::Global().ParallelFor(0, count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                TPixel *dst = batch.data() + i * sliceVoxels;
+                try {
+                    ReadSliceInto(fileNames[first + i], geometry, dst);
+                } catch (const std::exception &ex) {
+                    std::fill(dst, dst + sliceVoxels, TPixel());
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (error && ok.load()) {
+                        *error = ex.what();
+                    }
+                    ok.store(false);
+                }
+            }
+        });
+        if (!ok.load() || !store.AppendSlices(batch.data(), static_cast<int>(count))) {
+            if (error && error->empty()) {
+                *error = "Cannot write volume store.";
+            }
+            return false;
+        }
+    }
+    if (!store.FinishWrite()) {
+        if (error) {
+            *error = "Cannot write volume store.";
+        }
+        return false;
+    }
+    return true;
+}
+
+template <typename TPixel>
+bool DecodeDicomSeriesAs(const std::vector<std::string> &fileNames, const VolumeGeometry &geometry,
+                         TPixel *volume, ThreadPool &pool, std::string *error,
+                         const std::function<void(size_t, size_t)> &progress)
+{
+    const size_t sliceVoxels = static_cast<size_t>(geometry.dims[0]) * geometry.dims[1];
+    // 每批只提交约两轮的切片：ParallelFor 的辅助任务会一直取块直到本批做完，
+    // 批次小时两个同时加载的序列在池的任务队列里交替排队，而不是一个做完另一个才开始
+    const size_t batchSize = (static_cast<size_t>(pool.GetThreadCount()) + 1) * 2;
+    std::atomic<bool> ok(true);
+    std::mutex errorMutex;
+
+    for (size_t first = 0; first < fileNames.size() && ok.load(); first += batchSize) {
+        const size_t count = std::min(batchSize, fileNames.size() - first);
+        pool.ParallelFor(first, first + count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                try {
+                    ReadSliceInto(fileNames[i], geometry, volume + i * sliceVoxels);
+                } catch (const std::exception &ex) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (error && ok.load()) {
+                        *error = ex.what();
+                    }
+                    ok.store(false);
+                }
+            }
+        });
+        if (progress) {
+            progress(first + count, fileNames.size());
+        }
+    }
+    return ok.load();
+}
+
+} // namespace
+
+bool FindDicomSeries(const std::string &directory,
+                     std::vector<std::string> &fileNames,
+                     bool *isMultiFrame)
+{
+    fileNames.clear();
+    bool multiFrame = false;
+    DicomDirectoryScanner scanner;
+    scanner.SetUseSeriesDateRestriction(true);
+    // 只要有文件的文件头无法快速解析（如 Deflate 传输语法）就整体回退，否则这些切片会从序列中静默丢失
+    if (scanner.Scan(directory) && scanner.GetUnsupportedFileCount() == 0) {
+        const DicomSeriesInfo &series = scanner.GetSeries().front();
+        fileNames = series.FileNames();
+        multiFrame = fileNames.size() == 1 && series.files.front().numberOfFrames > 1;
+    } else {
+        // 回退到 GDCM 的完整扫描
+        auto seriesFileNames = itk::GDCMSeriesFileNames::New();
+        seriesFileNames->SetUseSeriesDetails(true);
+        seriesFileNames->AddSeriesRestriction("0008|0021");
+        seriesFileNames->SetDirectory(directory);
+        const auto &seriesUIDs = seriesFileNames->GetSeriesUIDs();
+        if (!seriesUIDs.empty()) {
+            fileNames = seriesFileNames->GetFileNames(seriesUIDs.front());
+            multiFrame = fileNames.size() == 1 && MultiFrameDicomReader::IsMultiFrameFile(fileNames.front());
+        }
+    }
+    if (isMultiFrame) {
+        *isMultiFrame = multiFrame;
+    }
+    return !fileNames.empty();
+}
+
+bool FindAllDicomSeries(const std::string &directory, bool recursive,
+                        std::vector<DicomSeriesInfo> &series,
+                        size_t *scannedFiles)
+{
+    series.clear();
+    size_t fileCount = 0;
+    DicomDirectoryScanner scanner;
+    scanner.SetRecursive(recursive);
+    scanner.SetUseSeriesDateRestriction(true);
+    if (scanner.Scan(directory) && scanner.GetUnsupportedFileCount() == 0) {
+        series = scanner.GetSeries();
+        fileCount = scanner.GetScannedFileCount();
+    } else {
+        auto seriesFileNames = itk::GDCMSeriesFileNames::New();
+        seriesFileNames->SetRecursive(recursive);
+        seriesFileNames->SetUseSeriesDetails(true);
+        seriesFileNames->AddSeriesRestriction("0008|0021");
+        seriesFileNames->SetDirectory(directory);
+        for (const std::string &uid : seriesFileNames->GetSeriesUIDs()) {
+            const std::vector<std::string> fileNames = seriesFileNames->GetFileNames(uid);
+            if (fileNames.empty()) {
+                continue;
+            }
+            DicomSeriesInfo info;
+            info.key = uid;
+            info.files.resize(fileNames.size());
+            for (size_t i = 0; i < fileNames.size(); ++i) {
+                info.files[i].fileName = fileNames[i];
+            }
+
+            // 输出命名与内存估计只用到首个文件头
+            auto io = itk::GDCMImageIO::New();
+            io->SetFileName(fileNames.front());
+            try {
+                io->ReadImageInformation();
+            } catch (const itk::ExceptionObject &) {
+                continue;
+            }
+            const itk::MetaDataDictionary &dict = io->GetMetaDataDictionary();
+            DicomFileHeader &first = info.files.front();
+            first.modality = TrimmedValue(dict, "0008|0060");
+            first.patientID = TrimmedValue(dict, "0010|0020");
+            first.seriesUID = TrimmedValue(dict, "0020|000e");
+            first.seriesNumber = TrimmedValue(dict, "0020|0011");
+            first.columns = static_cast<unsigned int>(io->GetDimensions(0));
+            first.rows = static_cast<unsigned int>(io->GetDimensions(1));
+            const std::string frames = TrimmedValue(dict, "0028|0008");
+            first.numberOfFrames = frames.empty() ? 1 : std::max(1, std::atoi(frames.c_str()));
+            info.seriesUID = first.seriesUID;
+            fileCount += fileNames.size();
+            series.push_back(std::move(info));
+        }
+    }
+    if (scannedFiles) {
+        *scannedFiles = fileCount;
+    }
+    return !series.empty();
+}
+
+int MultiFrameScalarType(MultiFramePixelType type)
+{
+    switch (type) {
+    case MultiFramePixelType::UInt8:
+        return VTK_UNSIGNED_CHAR;
+    case MultiFramePixelType::UInt16:
+        return VTK_UNSIGNED_SHORT;
+    case MultiFramePixelType::Int32:
+        return VTK_INT;
+    case MultiFramePixelType::Float32:
+        return VTK_FLOAT;
+    case MultiFramePixelType::Int16:
+    default:
+        return VTK_SHORT;
+    }
+}
+
+vtkSmartPointer<vtkImageData> LoadMultiFrameVolume(const std::string &fileName,
+                                                   DicomVolumeMetadata *metadata,
+                                                   std::string *error,
+                                                   ThreadPool &pool)
+{
+    MultiFrameDicomReader reader;
+    if (!reader.Open(fileName, error)) {
+        return nullptr;
+    }
+    const MultiFrameInfo &info = reader.GetInfo();
+    if (metadata) {
+        metadata->patientName = info.patientName;
+        metadata->patientID   = info.patientID;
+        metadata->modality    = info.modality;
+    }
+
+    auto image = vtkSmartPointer<vtkImageData>::New();
+    image->SetDimensions(static_cast<int>(info.columns),
+                         static_cast<int>(info.rows),
+                         static_cast<int>(info.frameCount));
+    image->SetSpacing(info.spacing);
+    image->SetOrigin(info.origin);
+    image->AllocateScalars(MultiFrameScalarType(info.outputType), 1);
+    std::memset(image->GetScalarPointer(), 0, info.SliceVoxelCount() * info.frameCount * info.OutputPixelSize());
+
+    // 与界面相同的逐帧解码任务，只是在这里等待全部完成
+    MultiFrameDecodeJob job(info, image->GetScalarPointer(), nullptr);
+    job.Start(pool, std::max(1u, pool.GetThreadCount()), nullptr);
+    job.Wait();
+    if (!job.IsFinished()) {
+        if (error) {
+            *error = "Failed to decode all frames.";
+        }
+        return nullptr;
+    }
+    return image;
+}
+
+int SelectDicomScalarType(const std::vector<std::string> &fileNames)
+{
+    if (fileNames.empty()) {
+        return VTK_SHORT;
+    }
+
+    // 逐层 Rescale 可能不同（如 PET），因此抽查首、中、尾三个文件
+    std::set<size_t> samples = { 0, fileNames.size() / 2, fileNames.size() - 1 };
+    bool anyFloat = false;
+    bool anySigned = false;
+    bool anyUnsigned16 = false;
+    bool anyWide = false;
+    bool allByte = true;
+
+    for (size_t index : samples) {
+        auto io = itk::GDCMImageIO::New();
+        io->SetFileName(fileNames[index]);
+        try {
+            io->ReadImageInformation();
+        } catch (const itk::ExceptionObject &) {
+            continue;
+        }
+
+        if (TrimmedValue(io->GetMetaDataDictionary(), "0008|0060") == "PT") {
+            anyFloat = true;
+        }
+
+        // GDCMImageIO 已根据 Rescale Slope/Intercept 给出容纳换算后数值的分量类型
+        switch (io->GetComponentType()) {
+        case itk::IOComponentEnum::UCHAR:
+            break;
+        case itk::IOComponentEnum::CHAR:
+            anySigned = true;
+            allByte = false;
+            break;
+        case itk::IOComponentEnum::SHORT:
+            anySigned = true;
+            allByte = false;
+            break;
+        case itk::IOComponentEnum::USHORT:
+            anyUnsigned16 = true;
+            allByte = false;
+            break;
+        case itk::IOComponentEnum::FLOAT:
+        case itk::IOComponentEnum::DOUBLE:
+            anyFloat = true;
+            allByte = false;
+            break;
+        default:
+            anyWide = true;
+            allByte = false;
+            break;
+        }
+    }
+
+    if (anyFloat) {
+        return VTK_FLOAT;
+    }
+    if (anyWide || (anySigned && anyUnsigned16)) {
+        return VTK_INT;
+    }
+    if (anyUnsigned16) {
+        return VTK_UNSIGNED_SHORT;
+    }
+    if (allByte) {
+        return VTK_UNSIGNED_CHAR;
+    }
+    return VTK_SHORT;
+}
+
+bool ReadDicomSeriesGeometry(const std::vector<std::string> &fileNames,
+                             VolumeGeometry &geometry,
+                             DicomVolumeMetadata *metadata)
+{
+    if (fileNames.empty()) {
+        return false;
+    }
+
+    auto io = itk::GDCMImageIO::New();
+    io->SetFileName(fileNames.front());
+    try {
+        io->ReadImageInformation();
+    } catch (const itk::ExceptionObject &) {
+        return false;
+    }
+
+    geometry = VolumeGeometry();
+    geometry.dims[0] = static_cast<int>(io->GetDimensions(0));
+    geometry.dims[1] = static_cast<int>(io->GetDimensions(1));
+    geometry.dims[2] = static_cast<int>(fileNames.size());
+    geometry.spacing[0] = io->GetSpacing(0);
+    geometry.spacing[1] = io->GetSpacing(1);
+    geometry.spacing[2] = io->GetNumberOfDimensions() > 2 ? io->GetSpacing(2) : 1.0;
+    for (unsigned int i = 0; i < 3; ++i) {
+        geometry.origin[i] = io->GetNumberOfDimensions() > i ? io->GetOrigin(i) : 0.0;
+    }
+
+    // 与 ImageSeriesReader 相同：层间距取前两个文件原点之间的距离
+    if (fileNames.size() > 1) {
+        auto nextIO = itk::GDCMImageIO::New();
+        nextIO->SetFileName(fileNames[1]);
+        try {
+            nextIO->ReadImageInformation();
+            double distance = 0.0;
+            for (unsigned int i = 0; i < 3; ++i) {
+                const double d = nextIO->GetOrigin(i) - geometry.origin[i];
+                distance += d * d;
+            }
+            if (distance > 0.0) {
+                geometry.spacing[2] = std::sqrt(distance);
+            }
+        } catch (const itk::ExceptionObject &) {
+        }
+    }
+
+    geometry.scalarType = SelectDicomScalarType(fileNames);
+    geometry.bytesPerVoxel = static_cast<size_t>(vtkDataArray::GetDataTypeSize(geometry.scalarType));
+
+    if (metadata) {
+        const itk::MetaDataDictionary &dict = io->GetMetaDataDictionary();
+        metadata->patientName = TrimmedValue(dict, "0010|0010");
+        metadata->patientID   = TrimmedValue(dict, "0010|0020");
+        metadata->modality    = TrimmedValue(dict, "0008|0060");
+        for (unsigned int c = 0; c < 3; ++c) {
+            const std::vector<double> axis = io->GetDirection(c);
+            for (unsigned int r = 0; r < 3 && r < axis.size(); ++r) {
+                metadata->direction[r * 3 + c] = axis[r];
+            }
+        }
+    }
+    return geometry.dims[0] > 0 && geometry.dims[1] > 0 && geometry.bytesPerVoxel > 0;
+}
+
+vtkSmartPointer<vtkImageData> DecodeDicomSeries(const std::vector<std::string> &fileNames,
+                                                const VolumeGeometry &geometry,
+                                                ThreadPool &pool,
+                                                std::string *error,
+                                                const std::function<void(size_t, size_t)> &progress)
+{
+    if (static_cast<int>(fileNames.size()) != geometry.dims[2]) {
+        if (error) {
+            *error = "Slice count does not match the series geometry.";
+        }
+        return nullptr;
+    }
+
+    auto image = vtkSmartPointer<vtkImageData>::New();
+    image->SetDimensions(geometry.dims[0], geometry.dims[1], geometry.dims[2]);
+    image->SetSpacing(geometry.spacing[0], geometry.spacing[1], geometry.spacing[2]);
+    image->SetOrigin(geometry.origin[0], geometry.origin[1], geometry.origin[2]);
+    void *volume = nullptr;
+    try {
+        image->AllocateScalars(geometry.scalarType, 1);
+        volume = image->GetScalarPointer();
+    } catch (const std::bad_alloc &) {
+    }
+    if (!volume) {
+        if (error) {
+            *error = "Out of memory.";
+        }
+        return nullptr;
+    }
+
+    bool ok = false;
+    switch (geometry.scalarType) {
+    case VTK_UNSIGNED_CHAR:
+        ok = DecodeDicomSeriesAs(fileNames, geometry, static_cast<unsigned char *>(volume), pool, error, progress);
+        break;
+    case VTK_UNSIGNED_SHORT:
+        ok = DecodeDicomSeriesAs(fileNames, geometry, static_cast<unsigned short *>(volume), pool, error, progress);
+        break;
+    case VTK_INT:
+        ok = DecodeDicomSeriesAs(fileNames, geometry, static_cast<int *>(volume), pool, error, progress);
+        break;
+    case VTK_FLOAT:
+        ok = DecodeDicomSeriesAs(fileNames, geometry, static_cast<float *>(volume), pool, error, progress);
+        break;
+    case VTK_SHORT:
+        ok = DecodeDicomSeriesAs(fileNames, geometry, static_cast<short *>(volume), pool, error, progress);
+        break;
+    default:
+        if (error) {
+            *error = "Unsupported pixel type.";
+        }
+        break;
+    }
+    return ok ? image : nullptr;
+}
+
+bool StreamDicomSeries(const std::vector<std::string> &fileNames,
+                       BrickedVolumeStore &store,
+                       std::string *error)
+{
+    if (static_cast<int>(fileNames.size()) != store.GetGeometry().dims[2]) {
+        if (error) {
+            *error = "Slice count does not match the volume store.";
+        }
+        return false;
+    }
+
+    switch (store.GetGeometry().scalarType) {
+    case VTK_UNSIGNED_CHAR:
+        return StreamDicomSeriesAs<unsigned char>(fileNames, store, error);
+    case VTK_UNSIGNED_SHORT:
+        return StreamDicomSeriesAs<unsigned short>(fileNames, store, error);
+    case VTK_INT:
+        return StreamDicomSeriesAs<int>(fileNames, store, error);
+    case VTK_FLOAT:
+        return StreamDicomSeriesAs<float>(fileNames, store, error);
+    case VTK_SHORT:
+    default:
+        return StreamDicomSeriesAs<short>(fileNames, store, error);
+    }
+}
+
+template <typename TPixel>
+vtkSmartPointer<vtkImageData> LoadDicomSeriesAs(const std::vector<std::string> &fileNames,
+                                                DicomVolumeMetadata *metadata)
+{
+    using ImageType = itk::Image<TPixel, 3>;
+    using ReaderType = itk::ImageSeriesReader<ImageType>;
+
+    auto reader = ReaderType::New();
+    auto gdcmIO = itk::GDCMImageIO::New();
+    reader->SetImageIO(gdcmIO);
+    reader->SetFileNames(fileNames);
+    reader->Update();
+
+    if (metadata) {
+        const auto &dictArray = *(reader->GetMetaDataDictionaryArray());
+        const itk::MetaDataDictionary &dict = (!dictArray.empty() && dictArray[0])
+            ? *dictArray[0] : gdcmIO->GetMetaDataDictionary();
+        metadata->patientName = TrimmedValue(dict, "0010|0010");
+        metadata->patientID   = TrimmedValue(dict, "0010|0020");
+        metadata->modality    = TrimmedValue(dict, "0008|0060");
+
+        const auto &direction = reader->GetOutput()->GetDirection();
+        for (unsigned int r = 0; r < 3; ++r) {
+            for (unsigned int c = 0; c < 3; ++c) {
+                metadata->direction[r * 3 + c] = direction[r][c];
+            }
+        }
+    }
+
+    return ItkToVtkImage<TPixel>(reader->GetOutput());
+}
+
+template vtkSmartPointer<vtkImageData> LoadDicomSeriesAs<unsigned char>(const std::vector<std::string> &, DicomVolumeMetadata *);
+template vtkSmartPointer<vtkImageData> LoadDicomSeriesAs<short>(const std::vector<std::string> &, DicomVolumeMetadata *);
+template vtkSmartPointer<vtkImageData> LoadDicomSeriesAs<unsigned short>(const std::vector<std::string> &, DicomVolumeMetadata *);
+template vtkSmartPointer<vtkImageData> LoadDicomSeriesAs<int>(const std::vector<std::string> &, DicomVolumeMetadata *);
+template vtkSmartPointer<vtkImageData> LoadDicomSeriesAs<float>(const std::vector<std::string> &, DicomVolumeMetadata *);
+
+vtkSmartPointer<vtkImageData> LoadDicomSeries(const std::vector<std::string> &fileNames,
+                                              DicomVolumeMetadata *metadata,
+                                              int scalarType)
+{
+    if (scalarType < 0) {
+        scalarType = SelectDicomScalarType(fileNames);
+    }
+
+    switch (scalarType) {
+    case VTK_UNSIGNED_CHAR:
+        return LoadDicomSeriesAs<unsigned char>(fileNames, metadata);
+    case VTK_UNSIGNED_SHORT:
+        return LoadDicomSeriesAs<unsigned short>(fileNames, metadata);
+    case VTK_INT:
+        return LoadDicomSeriesAs<int>(fileNames, metadata);
+    case VTK_FLOAT:
+        return LoadDicomSeriesAs<float>(fileNames, metadata);
+    case VTK_SHORT:
+    default:
+        return LoadDicomSeriesAs<short>(fileNames, metadata);
+    }
+}
@@ -0,0 +1,125 @@
+﻿#ifndef DICOMVOLUMELOADER_H
+#define DICOMVOLUMELOADER_H
+
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkDataArray.h>
+#include <vtkAOSDataArrayTemplate.h>
+#include <vtkTypeTraits.h>
+
+#include <itkImage.h>
+
+#include "volumestore.h"
+#include "multiframereader.h"
+#include "dicomscanner.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// 序列加载时顺带取出的元数据（字符串为去除首尾空白后的原始字节）
+struct DicomVolumeMetadata
+{
+    std::string patientName;
+    std::string patientID;
+    std::string modality;
+    double direction[9] = { 1.0, 0.0, 0.0,
+                            0.0, 1.0, 0.0,
+                            0.0, 0.0, 1.0 };
+};
+
+// 与界面“打开目录”相同的序列查找：仅文件头并行扫描（UseSeriesDetails + 0008|0021 分组），
+// 无法快速解析时回退到 GDCMSeriesFileNames。返回第一个序列按切片位置排序的文件列表
+bool FindDicomSeries(const std::string &directory,
+                     std::vector<std::string> &fileNames,
+                     bool *isMultiFrame = nullptr);
+
+// FindDicomSeries 的全部序列版本（批量转换使用），回退规则相同；回退时每个序列只填写首个文件头的
+// 命名与尺寸字段，其余文件只有文件名。scannedFiles 输出参与分组的文件数
+bool FindAllDicomSeries(const std::string &directory, bool recursive,
+                        std::vector<DicomSeriesInfo> &series,
+                        size_t *scannedFiles = nullptr);
+
+// 多帧输出像素类型对应的 VTK 标量类型
+int MultiFrameScalarType(MultiFramePixelType type);
+
+// 同步解码整个单文件多帧对象（无界面场景使用；界面走后台逐帧解码）
+vtkSmartPointer<vtkImageData> LoadMultiFrameVolume(const std::string &fileName,
+                                                   DicomVolumeMetadata *metadata = nullptr,
+                                                   std::string *error = nullptr,
+                                                   ThreadPool &pool = ThreadPool::Global());
+
+// 根据序列头（首/中/尾文件的 IOComponentType 与 Rescale）在运行时选择 VTK 标量类型：
+// VTK_UNSIGNED_CHAR / VTK_SHORT / VTK_UNSIGNED_SHORT / VTK_INT / VTK_FLOAT
+int SelectDicomScalarType(const std::vector<std::string> &fileNames);
+
+// 按原生像素类型读取序列并转换为 vtkImageData，失败时抛出 itk::ExceptionObject
+vtkSmartPointer<vtkImageData> LoadDicomSeries(const std::vector<std::string> &fileNames,
+                                              DicomVolumeMetadata *metadata = nullptr,
+                                              int scalarType = -1);
+
+// 只读文件头得到整个序列的几何与像素类型，不分配体数据（用于决定是否走外存模式）
+bool ReadDicomSeriesGeometry(const std::vector<std::string> &fileNames,
+                             VolumeGeometry &geometry,
+                             DicomVolumeMetadata *metadata = nullptr);
+
+// 按 ReadDicomSeriesGeometry 得到的几何分配体数据，切片分批在 pool 上并行解码；
+// 多个序列共用同一个池时交替推进。progress(已解码层数, 总层数) 在调用线程上回调。文件须已按切片位置排序
+vtkSmartPointer<vtkImageData> DecodeDicomSeries(const std::vector<std::string> &fileNames,
+                                                const VolumeGeometry &geometry,
+                                                ThreadPool &pool,
+                                                std::string *error = nullptr,
+                                                const std::function<void(size_t, size_t)> &progress = nullptr);
+
+// 逐层读取序列写入分块存储，常驻内存只有一层砖块的切片；文件须已按切片位置排序
+bool StreamDicomSeries(const std::vector<std::string> &fileNames,
+                       BrickedVolumeStore &store,
+                       std::string *error = nullptr);
+
+template <typename TPixel>
+vtkSmartPointer<vtkImageData> LoadDicomSeriesAs(const std::vector<std::string> &fileNames,
+                                                DicomVolumeMetadata *metadata);
+
+// ITK -> VTK 零拷贝：接管 ITK 像素缓冲区的所有权，不做类型转换也不复制
+template <typename TPixel>
+vtkSmartPointer<vtkImageData> ItkToVtkImage(itk::Image<TPixel, 3> *image)
+{
+    if (!image) {
+        return nullptr;
+    }
+
+    const auto region = image->GetLargestPossibleRegion();
+    const auto size = region.GetSize();
+    const auto spacing = image->GetSpacing();
+    const auto origin = image->GetOrigin();
+
+    auto vtkImage = vtkSmartPointer<vtkImageData>::New();
+    vtkImage->SetDimensions(static_cast<int>(size[0]),
+                            static_cast<int>(size[1]),
+                            static_cast<int>(size[2]));
+    vtkImage->SetSpacing(spacing[0], spacing[1], spacing[2]);
+    vtkImage->SetOrigin(origin[0], origin[1], origin[2]);
+
+    auto *container = image->GetPixelContainer();
+    const vtkIdType pixelCount = static_cast<vtkIdType>(region.GetNumberOfPixels());
+    vtkSmartPointer<vtkDataArray> scalars;
+    scalars.TakeReference(vtkDataArray::CreateDataArray(vtkTypeTraits<TPixel>::VTKTypeID()));
+    auto *typedScalars = vtkAOSDataArrayTemplate<TPixel>::SafeDownCast(scalars);
+
+    if (typedScalars && container->GetContainerManageMemory()) {
+        // ITK 以 new[] 分配缓冲区，交给 VTK 以 delete[] 释放
+        container->SetContainerManageMemory(false);
+        typedScalars->SetNumberOfComponents(1);
+        typedScalars->SetArray(container->GetBufferPointer(), pixelCount, 0,
+                               vtkAbstractArray::VTK_DATA_ARRAY_DELETE);
+        vtkImage->GetPointData()->SetScalars(typedScalars);
+    } else {
+        vtkImage->AllocateScalars(vtkTypeTraits<TPixel>::VTKTypeID(), 1);
+        std::copy(image->GetBufferPointer(), image->GetBufferPointer() + pixelCount,
+                  static_cast<TPixel*>(vtkImage->GetScalarPointer()));
+    }
+    return vtkImage;
+}
+
+#endif // DICOMVOLUMELOADER_H
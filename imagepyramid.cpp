@@ -0,0 +1,139 @@
+﻿#include "imagepyramid.h"
+#include "windowlevel.h"
+
+#include <vtkPointData.h>
+#include <vtkSetGet.h>
+
+#include <algorithm>
+#include <cstddef>
+
+namespace
+{
+
+// 2x2 平均：奇数边长时最后一列/行与自身平均
+template <typename T>
+void Downsample(const T *src, int srcWidth, int srcHeight, float *dst, int dstWidth, int dstHeight,
+                ThreadPool &pool)
+{
+    pool.ParallelFor(0, static_cast<size_t>(dstHeight), [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const size_t y0 = 2 * y;
+            const size_t y1 = std::min(y0 + 1, static_cast<size_t>(srcHeight) - 1);
+            const T *row0 = src + y0 * static_cast<size_t>(srcWidth);
+            const T *row1 = src + y1 * static_cast<size_t>(srcWidth);
+            float *out = dst + y * static_cast<size_t>(dstWidth);
+            for (int x = 0; x < dstWidth; ++x) {
+                const int x0 = 2 * x;
+                const int x1 = std::min(x0 + 1, srcWidth - 1);
+                out[x] = 0.25f * (static_cast<float>(row0[x0]) + static_cast<float>(row0[x1]) +
+                                  static_cast<float>(row1[x0]) + static_cast<float>(row1[x1]));
+            }
+        }
+    }, 16);
+}
+
+// 输出自上而下，即 v 递减
+template <typename T>
+void WindowTile(const T *src, int srcWidth, int u0, int v0, int width, int height,
+                double lower, double scale, unsigned char *dst, int dstStride)
+{
+    for (int r = 0; r < height; ++r) {
+        WindowLevelRow(src + static_cast<size_t>(v0 + height - 1 - r) * srcWidth + u0, 1, width, lower, scale,
+                       dst + static_cast<size_t>(r) * dstStride);
+    }
+}
+
+} // namespace
+
+bool ImagePyramid::SetImage(vtkImageData *image, std::string *error)
+{
+    auto fail = [error](const char *message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+    int dims[3];
+    if (!image || !image->GetPointData()->GetScalars()) {
+        return fail("No image data");
+    }
+    image->GetDimensions(dims);
+    if (dims[2] != 1 || image->GetNumberOfScalarComponents() != 1) {
+        return fail("Tiled view requires a single-frame, single-component image");
+    }
+
+    m_source = image;
+    m_levels.clear();
+    Level level;
+    level.width = dims[0];
+    level.height = dims[1];
+    m_levels.push_back(level);
+    while (std::max(level.width, level.height) > TileSize) {
+        level.width = (level.width + 1) / 2;
+        level.height = (level.height + 1) / 2;
+        m_levels.push_back(level);
+    }
+    // 各层的缓冲区一次分配好，生成期间读取已完成的层不会遇到重新分配
+    for (size_t i = 1; i < m_levels.size(); ++i) {
+        m_levels[i].pixels.resize(static_cast<size_t>(m_levels[i].width) * m_levels[i].height);
+    }
+    m_readyLevels.store(1, std::memory_order_release);
+    return true;
+}
+
+void ImagePyramid::Build(ThreadPool &pool, const std::atomic<bool> *cancel,
+                         const std::function<void(int)> &levelReady)
+{
+    for (size_t i = static_cast<size_t>(GetReadyLevelCount()); i < m_levels.size(); ++i) {
+        if (cancel && cancel->load()) {
+            return;
+        }
+        const Level &src = m_levels[i - 1];
+        Level &dst = m_levels[i];
+        if (i == 1) {
+            const void *base = m_source->GetScalarPointer();
+            switch (m_source->GetScalarType()) {
+                vtkTemplateMacro(Downsample(static_cast<const VTK_TT *>(base), src.width, src.height,
+                                            dst.pixels.data(), dst.width, dst.height, pool));
+            default:
+                return;
+            }
+        } else {
+            Downsample(src.pixels.data(), src.width, src.height, dst.pixels.data(), dst.width, dst.height, pool);
+        }
+        m_readyLevels.store(static_cast<int>(i) + 1, std::memory_order_release);
+        if (levelReady) {
+            levelReady(static_cast<int>(i) + 1);
+        }
+    }
+}
+
+bool ImagePyramid::RenderTile(int level, int column, int row, double window, double center,
+                              unsigned char *dst, int dstStride, int &width, int &height) const
+{
+    if (level < 0 || level >= GetReadyLevelCount() || column < 0 || row < 0 ||
+        column >= GetTileColumns(level) || row >= GetTileRows(level)) {
+        return false;
+    }
+    const Level &source = m_levels[level];
+    const int u0 = column * TileSize;
+    const int v0 = row * TileSize;
+    width = std::min(TileSize, source.width - u0);
+    height = std::min(TileSize, source.height - v0);
+
+    window = std::max(window, 1e-6);
+    const double lower = center - window / 2.0;
+    const double scale = 255.0 / window;
+    if (level == 0) {
+        const void *base = m_source->GetScalarPointer();
+        switch (m_source->GetScalarType()) {
+            vtkTemplateMacro(WindowTile(static_cast<const VTK_TT *>(base), source.width, u0, v0, width, height,
+                                        lower, scale, dst, dstStride));
+        default:
+            return false;
+        }
+    } else {
+        WindowTile(source.pixels.data(), source.width, u0, v0, width, height, lower, scale, dst, dstStride);
+    }
+    return true;
+}
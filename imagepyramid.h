@@ -0,0 +1,58 @@
+﻿#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include "threadpool.h"
+
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+// 大尺寸单帧图像（乳腺 X 线、DR 等）的多分辨率瓦片金字塔。第 0 层直接引用原图不复制，
+// 之后每层 2x2 平均缩小一半，直到长边不超过一个瓦片。平面坐标 u 向右、v 向上（与二维视图一致），
+// 瓦片按 TileSize 划分，第 0 列第 0 行位于左下角
+class ImagePyramid
+{
+public:
+    static constexpr int TileSize = 256;
+
+    // image 须为 Z 方向只有一层的单通道图像
+    bool SetImage(vtkImageData *image, std::string *error = nullptr);
+    vtkImageData *GetImage() const { return m_source; }
+
+    // 逐层生成较粗的层，每完成一层回调一次 levelReady(已可用层数)；在后台线程调用一次，
+    // cancel 置位时提前返回。生成期间其他线程可以读取已完成的层
+    void Build(ThreadPool &pool = ThreadPool::Global(),
+               const std::atomic<bool> *cancel = nullptr,
+               const std::function<void(int)> &levelReady = nullptr);
+
+    int GetLevelCount() const { return static_cast<int>(m_levels.size()); }
+    int GetReadyLevelCount() const { return m_readyLevels.load(std::memory_order_acquire); }
+    int GetLevelWidth(int level) const { return m_levels[level].width; }
+    int GetLevelHeight(int level) const { return m_levels[level].height; }
+    int GetTileColumns(int level) const { return (m_levels[level].width + TileSize - 1) / TileSize; }
+    int GetTileRows(int level) const { return (m_levels[level].height + TileSize - 1) / TileSize; }
+
+    // 把 level 层 (column, row) 瓦片按窗宽窗位映射为 8 位灰度，自上而下写入 dst（行距 dstStride）；
+    // width/height 为瓦片实际大小（右、上边缘的瓦片较小）。该层尚未生成时返回 false
+    bool RenderTile(int level, int column, int row, double window, double center,
+                    unsigned char *dst, int dstStride, int &width, int &height) const;
+
+private:
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        // 第 0 层为空，直接读 m_source
+        std::vector<float> pixels;
+    };
+
+    vtkSmartPointer<vtkImageData> m_source;
+    std::vector<Level> m_levels;
+    std::atomic<int> m_readyLevels{ 0 };
+};
+
+#endif // IMAGEPYRAMID_H
@@ -0,0 +1,306 @@
+﻿#include "imageregistration.h"
+
+#include <itkImage.h>
+#include <itkImageRegistrationMethodv4.h>
+#include <itkMattesMutualInformationImageToImageMetricv4.h>
+#include <itkRegularStepGradientDescentOptimizerv4.h>
+#include <itkRegistrationParameterScalesFromPhysicalShift.h>
+#include <itkCenteredTransformInitializer.h>
+#include <itkEuler3DTransform.h>
+#include <itkAffineTransform.h>
+
+#include <vtkPointData.h>
+#include <vtkSetGet.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+
+using RegistrationImage = itk::Image<float, 3>;
+
+// 每个 stride 块取平均写成一个 float 体素，按输出切片在线程池上并行
+template <typename T>
+void AverageBlocks(const T *src, const int srcDims[3], const int stride[3],
+                   float *dst, const int dstDims[3], ThreadPool &pool)
+{
+    const size_t srcRow = static_cast<size_t>(srcDims[0]);
+    const size_t srcSlice = srcRow * static_cast<size_t>(srcDims[1]);
+    pool.ParallelFor(0, static_cast<size_t>(dstDims[2]), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const int z0 = static_cast<int>(k) * stride[2];
+            const int z1 = std::min(z0 + stride[2], srcDims[2]);
+            float *dstSlice = dst + k * static_cast<size_t>(dstDims[0]) * dstDims[1];
+            for (int j = 0; j < dstDims[1]; ++j) {
+                const int y0 = j * stride[1];
+                const int y1 = std::min(y0 + stride[1], srcDims[1]);
+                for (int i = 0; i < dstDims[0]; ++i) {
+                    const int x0 = i * stride[0];
+                    const int x1 = std::min(x0 + stride[0], srcDims[0]);
+                    double sum = 0.0;
+                    for (int z = z0; z < z1; ++z) {
+                        for (int y = y0; y < y1; ++y) {
+                            const T *row = src + srcSlice * z + srcRow * y;
+                            for (int x = x0; x < x1; ++x) {
+                                sum += static_cast<double>(row[x]);
+                            }
+                        }
+                    }
+                    const int count = (z1 - z0) * (y1 - y0) * (x1 - x0);
+                    dstSlice[static_cast<size_t>(j) * dstDims[0] + i] = static_cast<float>(sum / count);
+                }
+            }
+        }
+    });
+}
+
+// 把体数据缩小到每轴不超过 maxDimension 并转成带方向矩阵的 ITK float 图像；
+// 新体素中心取块中心，因此物理位置与原数据一致
+RegistrationImage::Pointer ToRegistrationImage(vtkImageData *image, const double direction[9],
+                                               int maxDimension, ThreadPool &pool)
+{
+    int dims[3];
+    double spacing[3];
+    double origin[3];
+    image->GetDimensions(dims);
+    image->GetSpacing(spacing);
+    image->GetOrigin(origin);
+
+    maxDimension = std::max(maxDimension, 1);
+    int stride[3];
+    int outDims[3];
+    RegistrationImage::SizeType size;
+    RegistrationImage::SpacingType outSpacing;
+    for (int axis = 0; axis < 3; ++axis) {
+        stride[axis] = std::max(1, (dims[axis] + maxDimension - 1) / maxDimension);
+        outDims[axis] = (dims[axis] + stride[axis] - 1) / stride[axis];
+        size[axis] = static_cast<itk::SizeValueType>(outDims[axis]);
+        outSpacing[axis] = spacing[axis] * stride[axis];
+    }
+
+    RegistrationImage::PointType outOrigin;
+    RegistrationImage::DirectionType outDirection;
+    for (int r = 0; r < 3; ++r) {
+        outOrigin[r] = origin[r];
+        for (int c = 0; c < 3; ++c) {
+            outDirection(r, c) = direction[r * 3 + c];
+            outOrigin[r] += direction[r * 3 + c] * spacing[c] * (stride[c] - 1) * 0.5;
+        }
+    }
+
+    RegistrationImage::Pointer result = RegistrationImage::New();
+    RegistrationImage::RegionType region;
+    region.SetSize(size);
+    result->SetRegions(region);
+    result->SetSpacing(outSpacing);
+    result->SetOrigin(outOrigin);
+    result->SetDirection(outDirection);
+    result->Allocate();
+
+    const void *scalars = image->GetScalarPointer();
+    switch (image->GetScalarType()) {
+        vtkTemplateMacro(AverageBlocks(static_cast<const VTK_TT *>(scalars), dims, stride,
+                                       result->GetBufferPointer(), outDims, pool));
+    default:
+        return nullptr;
+    }
+    return result;
+}
+
+// 一轮多分辨率配准：transform 既是初值也是结果（InPlace）。
+// 每层按各轴尺寸限制缩小倍数，薄层体数据不会在粗层上缩成空图像
+template <typename TTransform>
+bool RunStage(RegistrationImage *fixed, RegistrationImage *moving, TTransform *transform,
+              const RegistrationOptions &options, unsigned int threads,
+              int stage, int stageCount, double *metricValue,
+              const std::function<void(double)> &progress, const std::atomic<bool> *cancel)
+{
+    using MetricType = itk::MattesMutualInformationImageToImageMetricv4<RegistrationImage, RegistrationImage>;
+    using OptimizerType = itk::RegularStepGradientDescentOptimizerv4<double>;
+    using RegistrationType = itk::ImageRegistrationMethodv4<RegistrationImage, RegistrationImage, TTransform>;
+    using ScalesEstimatorType = itk::RegistrationParameterScalesFromPhysicalShift<MetricType>;
+
+    auto metric = MetricType::New();
+    metric->SetNumberOfHistogramBins(50);
+    metric->SetUseFixedImageGradientFilter(false);
+    metric->SetUseMovingImageGradientFilter(false);
+    metric->SetMaximumNumberOfWorkUnits(threads);
+
+    // 旋转与平移参数按物理位移统一尺度，步长以毫米计
+    auto scales = ScalesEstimatorType::New();
+    scales->SetMetric(metric);
+    scales->SetTransformForward(true);
+
+    auto optimizer = OptimizerType::New();
+    optimizer->SetScalesEstimator(scales);
+    optimizer->SetDoEstimateLearningRateOnce(true);
+    optimizer->SetLearningRate(1.0);
+    optimizer->SetMinimumStepLength(1e-4);
+    optimizer->SetRelaxationFactor(0.5);
+    optimizer->SetGradientMagnitudeTolerance(1e-6);
+    optimizer->SetNumberOfIterations(std::max(1u, options.iterations));
+    optimizer->SetReturnBestParametersAndValue(true);
+
+    auto registration = RegistrationType::New();
+    registration->SetFixedImage(fixed);
+    registration->SetMovingImage(moving);
+    registration->SetMetric(metric);
+    registration->SetOptimizer(optimizer);
+    registration->SetInitialTransform(transform);
+    registration->InPlaceOn();
+
+    const unsigned int levels = std::max(1u, options.levels);
+    const auto fixedSize = fixed->GetLargestPossibleRegion().GetSize();
+    registration->SetNumberOfLevels(levels);
+    typename RegistrationType::SmoothingSigmasArrayType smoothingSigmas(levels);
+    for (unsigned int level = 0; level < levels; ++level) {
+        const unsigned int shrink = 1u << (levels - 1 - level);
+        typename RegistrationType::ShrinkFactorsPerDimensionContainerType factors;
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            const unsigned int limit = std::max<unsigned int>(1, static_cast<unsigned int>(fixedSize[axis] / 8));
+            factors[axis] = std::min(shrink, limit);
+        }
+        registration->SetShrinkFactorsPerDimension(level, factors);
+        smoothingSigmas[level] = static_cast<double>(levels - 1 - level);
+    }
+    registration->SetSmoothingSigmasPerLevel(smoothingSigmas);
+    registration->SetSmoothingSigmasAreSpecifiedInPhysicalUnits(false);
+    registration->SetMetricSamplingStrategy(RegistrationType::MetricSamplingStrategyEnum::RANDOM);
+    registration->SetMetricSamplingPercentage(std::clamp(options.samplingFraction, 0.01, 1.0));
+    registration->MetricSamplingReinitializeSeed(121212);
+
+    OptimizerType *rawOptimizer = optimizer.GetPointer();
+    RegistrationType *rawRegistration = registration.GetPointer();
+    const double iterations = static_cast<double>(std::max(1u, options.iterations));
+    optimizer->AddObserver(itk::IterationEvent(), [=](const itk::EventObject &) {
+        if (cancel && cancel->load()) {
+            rawOptimizer->StopOptimization();
+            return;
+        }
+        if (progress) {
+            const double level = static_cast<double>(rawRegistration->GetCurrentLevel());
+            const double iteration = std::min(1.0, rawOptimizer->GetCurrentIteration() / iterations);
+            progress((stage + (level + iteration) / levels) / stageCount);
+        }
+    });
+
+    registration->Update();
+    if (metricValue) {
+        *metricValue = optimizer->GetValue();
+    }
+    return !(cancel && cancel->load());
+}
+
+} // namespace
+
+bool InvertMatrix3(const double m[9], double inverse[9])
+{
+
+    const double c00 = m[4] * m[8] - m[5] * m[7];
+    const double c01 = m[5] * m[6] - m[3] * m[8];
+    const double c02 = m[3] * m[7] - m[4] * m[6];
+    const double det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    if (std::abs(det) < 1e-12) {
+        return false;
+    }
+    const double s = 1.0 / det;
+    inverse[0] = c00 * s;
+    inverse[1] = (m[2] * m[7] - m[1] * m[8]) * s;
+    inverse[2] = (m[1] * m[5] - m[2] * m[4]) * s;
+    inverse[3] = c01 * s;
+    inverse[4] = (m[0] * m[8] - m[2] * m[6]) * s;
+    inverse[5] = (m[2] * m[3] - m[0] * m[5]) * s;
+    inverse[6] = c02 * s;
+    inverse[7] = (m[1] * m[6] - m[0] * m[7]) * s;
+    inverse[8] = (m[0] * m[4] - m[1] * m[3]) * s;
+    return true;
+}
+
+bool RegisterVolumes(vtkImageData *fixed, const double fixedDirection[9],
+                     vtkImageData *moving, const double movingDirection[9],
+                     const RegistrationOptions &options,
+                     PatientTransform &transform,
+                     std::string *error,
+                     double *finalMetric,
+                     const std::function<void(double)> &progress,
+                     const std::atomic<bool> *cancel,
+                     ThreadPool &pool)
+{
+    if (!fixed || !moving || !fixed->GetPointData()->GetScalars() || !moving->GetPointData()->GetScalars()) {
+        if (error) {
+            *error = "Both volumes must be loaded in memory.";
+        }
+        return false;
+    }
+
+    RegistrationImage::Pointer fixedImage = ToRegistrationImage(fixed, fixedDirection, options.maxDimension, pool);
+    RegistrationImage::Pointer movingImage = ToRegistrationImage(moving, movingDirection, options.maxDimension, pool);
+    if (!fixedImage || !movingImage) {
+        if (error) {
+            *error = "Unsupported pixel type.";
+        }
+        return false;
+    }
+
+    using RigidType = itk::Euler3DTransform<double>;
+    using AffineType = itk::AffineTransform<double, 3>;
+    using InitializerType = itk::CenteredTransformInitializer<RigidType, RegistrationImage, RegistrationImage>;
+    const unsigned int threads = options.threads ? options.threads
+                                                 : std::max(1u, std::thread::hardware_concurrency());
+    const int stageCount = options.affine ? 2 : 1;
+    double metric = 0.0;
+    try {
+        // 两次检查的摆位可能相差很远，先按灰度质心对齐作为刚体初值
+        auto rigid = RigidType::New();
+        auto initializer = InitializerType::New();
+        initializer->SetTransform(rigid);
+        initializer->SetFixedImage(fixedImage);
+        initializer->SetMovingImage(movingImage);
+        initializer->MomentsOn();
+        initializer->InitializeTransform();
+
+        const itk::MatrixOffsetTransformBase<double, 3, 3> *result = rigid.GetPointer();
+        bool finished = RunStage(fixedImage.GetPointer(), movingImage.GetPointer(), rigid.GetPointer(), options,
+                                 threads, 0, stageCount, &metric, progress, cancel);
+        AffineType::Pointer affine;
+        if (finished && options.affine) {
+            affine = AffineType::New();
+            affine->SetCenter(rigid->GetCenter());
+            affine->SetMatrix(rigid->GetMatrix());
+            affine->SetTranslation(rigid->GetTranslation());
+            finished = RunStage(fixedImage.GetPointer(), movingImage.GetPointer(), affine.GetPointer(), options,
+                                threads, 1, stageCount, &metric, progress, cancel);
+            result = affine.GetPointer();
+        }
+        if (!finished) {
+            if (error) {
+                *error = "Registration cancelled.";
+            }
+            return false;
+        }
+
+        const auto &matrix = result->GetMatrix();
+        const auto &offset = result->GetOffset();
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                transform.matrix[r * 3 + c] = matrix(r, c);
+            }
+            transform.translation[r] = offset[r];
+        }
+    } catch (const itk::ExceptionObject &ex) {
+        if (error) {
+            *error = ex.what();
+        }
+        return false;
+    }
+
+    if (finalMetric) {
+        *finalMetric = metric;
+    }
+    if (progress) {
+        progress(1.0);
+    }
+    return true;
+}
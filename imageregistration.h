@@ -0,0 +1,56 @@
+﻿#ifndef IMAGEREGISTRATION_H
+#define IMAGEREGISTRATION_H
+
+#include <vtkImageData.h>
+
+#include "threadpool.h"
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+// 病人坐标 (LPS) 之间的仿射变换 y = M·x + t（M 行主序）。
+// 配准结果把当前研究中的点映射到对比研究（或其掩膜）中的对应点
+struct PatientTransform
+{
+    double matrix[9] = { 1.0, 0.0, 0.0,
+                         0.0, 1.0, 0.0,
+                         0.0, 0.0, 1.0 };
+    double translation[3] = { 0.0, 0.0, 0.0 };
+
+    void Apply(const double in[3], double out[3]) const
+    {
+        for (int r = 0; r < 3; ++r) {
+            out[r] = matrix[r * 3 + 0] * in[0] + matrix[r * 3 + 1] * in[1] +
+                     matrix[r * 3 + 2] * in[2] + translation[r];
+        }
+    }
+};
+
+// 3x3 行主序矩阵求逆（方向矩阵、配准矩阵），行列式接近 0 时返回 false
+bool InvertMatrix3(const double m[9], double inverse[9]);
+
+struct RegistrationOptions
+{
+    bool affine = false;              // false 只做刚体（旋转 + 平移）；true 在刚体结果上再做一轮仿射
+    unsigned int levels = 3;          // 多分辨率层数，逐层缩小一半
+    unsigned int iterations = 200;    // 每层最大迭代次数
+    double samplingFraction = 0.1;    // 互信息度量随机采样的体素比例
+    int maxDimension = 256;           // 体数据先按块平均缩小到每轴不超过此尺寸再配准
+    unsigned int threads = 0;         // 度量计算的线程数，0 为硬件并发数
+};
+
+// 以 fixed（当前研究）为参考、moving（对比研究）为浮动图像做 Mattes 互信息配准，
+// 两者都按各自的原点、间距与方向矩阵放在病人坐标中，原始体数据不做重采样。
+// progress(0..1) 在调用线程上回调；cancel 置位后在下一次迭代停止并返回 false
+bool RegisterVolumes(vtkImageData *fixed, const double fixedDirection[9],
+                     vtkImageData *moving, const double movingDirection[9],
+                     const RegistrationOptions &options,
+                     PatientTransform &transform,
+                     std::string *error = nullptr,
+                     double *finalMetric = nullptr,
+                     const std::function<void(double)> &progress = nullptr,
+                     const std::atomic<bool> *cancel = nullptr,
+                     ThreadPool &pool = ThreadPool::Global());
+
+#endif // IMAGEREGISTRATION_H
@@ -0,0 +1,136 @@
+﻿#include "incrementalseries.h"
+
+#include "threadpool.h"
+
+#include <cmath>
+#include <unordered_map>
+
+IncrementalDicomSeries::IncrementalDicomSeries()
+    : m_useSeriesDate(true)
+{
+}
+
+bool IncrementalDicomSeries::Reset(const std::vector<std::string> &fileNames, bool useSeriesDate, ThreadPool &pool)
+{
+    std::vector<DicomFileHeader> headers = DicomDirectoryScanner::ReadHeaders(fileNames, pool);
+    // 每张已加载切片都必须有文件头，否则切片索引无法对应
+    if (headers.size() != fileNames.size()) {
+        Clear();
+        return false;
+    }
+    return Reset(std::move(headers), useSeriesDate);
+}
+
+bool IncrementalDicomSeries::Reset(std::vector<DicomFileHeader> headers, bool useSeriesDate)
+{
+    Clear();
+    m_useSeriesDate = useSeriesDate;
+    if (headers.empty()) {
+        return false;
+    }
+    // 保持给定顺序，与体数据的切片顺序一一对应
+    m_files = std::move(headers);
+    m_key = DicomDirectoryScanner::SeriesKey(m_files.front(), m_useSeriesDate);
+    for (const DicomFileHeader &header : m_files) {
+        m_known.insert(header.fileName);
+    }
+    return true;
+}
+
+void IncrementalDicomSeries::Clear()
+{
+    m_key.clear();
+    m_files.clear();
+    m_known.clear();
+}
+
+std::vector<std::string> IncrementalDicomSeries::GetFileNames() const
+{
+    std::vector<std::string> fileNames;
+    fileNames.reserve(m_files.size());
+    for (const DicomFileHeader &header : m_files) {
+        fileNames.push_back(header.fileName);
+    }
+    return fileNames;
+}
+
+bool IncrementalDicomSeries::AddFiles(const std::vector<std::string> &fileNames, ThreadPool &pool, Update &update)
+{
+    update = Update();
+    std::vector<std::string> fresh;
+    for (const std::string &fileName : fileNames) {
+        if (m_known.insert(fileName).second) {
+            fresh.push_back(fileName);
+        }
+    }
+    if (fresh.empty() || m_files.empty()) {
+        return false;
+    }
+    return Merge(DicomDirectoryScanner::ReadHeaders(fresh, pool), update);
+}
+
+bool IncrementalDicomSeries::AddHeaders(std::vector<DicomFileHeader> headers, Update &update)
+{
+    update = Update();
+    std::vector<DicomFileHeader> fresh;
+    for (DicomFileHeader &header : headers) {
+        if (m_known.insert(header.fileName).second) {
+            fresh.push_back(std::move(header));
+        }
+    }
+    if (fresh.empty() || m_files.empty()) {
+        return false;
+    }
+    return Merge(std::move(fresh), update);
+}
+
+bool IncrementalDicomSeries::Merge(std::vector<DicomFileHeader> headers, Update &update)
+{
+    std::vector<DicomFileHeader> merged = m_files;
+    const size_t oldCount = merged.size();
+    for (DicomFileHeader &header : headers) {
+        // 多帧对象无法作为单张切片插入
+        if (header.numberOfFrames <= 1 && DicomDirectoryScanner::SeriesKey(header, m_useSeriesDate) == m_key) {
+            merged.push_back(std::move(header));
+        }
+    }
+    if (merged.size() == oldCount) {
+        return false;
+    }
+
+    std::unordered_map<std::string, int> oldIndex;
+    for (size_t i = 0; i < oldCount; ++i) {
+        oldIndex.emplace(m_files[i].fileName, static_cast<int>(i));
+    }
+    DicomDirectoryScanner::SortSeries(merged);
+
+    update.depth = static_cast<int>(merged.size());
+    update.oldToNew.assign(oldCount, -1);
+    for (size_t i = 0; i < merged.size(); ++i) {
+        const auto it = oldIndex.find(merged[i].fileName);
+        if (it != oldIndex.end()) {
+            update.oldToNew[it->second] = static_cast<int>(i);
+        } else {
+            update.insertedSlices.emplace_back(static_cast<int>(i), merged[i].fileName);
+        }
+    }
+
+    const DicomFileHeader &first = merged.front();
+    if (first.hasPosition) {
+        update.hasOrigin = true;
+        for (int axis = 0; axis < 3; ++axis) {
+            update.origin[axis] = first.position[axis];
+        }
+        if (merged.size() > 1 && merged[1].hasPosition) {
+            double distance = 0.0;
+            for (int axis = 0; axis < 3; ++axis) {
+                const double d = merged[1].position[axis] - first.position[axis];
+                distance += d * d;
+            }
+            update.sliceSpacing = std::sqrt(distance);
+        }
+    }
+
+    m_files = std::move(merged);
+    return true;
+}
@@ -0,0 +1,59 @@
+﻿#ifndef INCREMENTALSERIES_H
+#define INCREMENTALSERIES_H
+
+#include "dicomscanner.h"
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// 逐批到达的序列（监视目录的新文件或网络接收的实例）：只解析新切片的文件头，按切片位置插入已有序列，
+// 给出已加载切片的新位置与新切片的插入位置，调用方据此原地扩展体数据而无需重新读取。
+// 切片以 DicomFileHeader::fileName 区分，网络实例用 SOP Instance UID 代替文件名
+class IncrementalDicomSeries
+{
+public:
+    struct Update
+    {
+        int depth = 0;
+        // 已有第 i 张切片在新序列中的索引
+        std::vector<int> oldToNew;
+        // (新索引, 文件名)，按索引升序
+        std::vector<std::pair<int, std::string>> insertedSlices;
+        // 与 ImageSeriesReader 一致：原点取首张切片的 IPP，层间距取前两张切片 IPP 的距离（0 表示未知）
+        bool hasOrigin = false;
+        double origin[3] = { 0.0, 0.0, 0.0 };
+        double sliceSpacing = 0.0;
+    };
+
+    IncrementalDicomSeries();
+
+    // 以已加载的序列初始化（文件须已按切片位置排序），只读文件头
+    bool Reset(const std::vector<std::string> &fileNames, bool useSeriesDate, ThreadPool &pool);
+    // 以已解析的文件头初始化，顺序即体数据的切片顺序
+    bool Reset(std::vector<DicomFileHeader> headers, bool useSeriesDate);
+    void Clear();
+
+    bool IsEmpty() const { return m_files.empty(); }
+    bool IsKnown(const std::string &fileName) const { return m_known.count(fileName) > 0; }
+    std::vector<std::string> GetFileNames() const;
+
+    // 解析一批新文件的文件头；不属于本序列或无法解析的文件同样记为已知，不再重复解析。
+    // 有新切片加入时返回 true
+    bool AddFiles(const std::vector<std::string> &fileNames, ThreadPool &pool, Update &update);
+    // 同 AddFiles，文件头已由调用方解析
+    bool AddHeaders(std::vector<DicomFileHeader> headers, Update &update);
+
+private:
+    bool Merge(std::vector<DicomFileHeader> headers, Update &update);
+
+    std::string m_key;
+    bool m_useSeriesDate;
+    std::vector<DicomFileHeader> m_files;
+    std::unordered_set<std::string> m_known;
+};
+
+#endif // INCREMENTALSERIES_H
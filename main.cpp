@@ -1,10 +1,13 @@
 ﻿#include "widget.h"
+#include "commandline.h"
 #if defined(_MSC_VER) && (_MSC_VER >= 1600)
 # pragma execution_character_set("utf-8")
 #endif
 #include <QApplication>
+#include <QElapsedTimer>
 #include <QFont>
 #include <QLocale>
+#include <QTimer>
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -12,6 +15,9 @@
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+
 #ifdef Q_OS_WIN
     // 设置控制台代码页为 UTF-8（Windows 10 1803+）
     // 这对于 GUI 程序可能不是必需的，但有助于调试输出
@@ -19,6 +25,11 @@ int main(int argc, char *argv[])
     SetConsoleCP(65001);
 #endif
 
+    // 批处理参数（如 --export-png）走无界面模式，不创建任何窗口
+    if (IsCommandLineMode(argc, argv)) {
+        return RunCommandLine(argc, argv);
+    }
+
     QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     QApplication a(argc, argv);
     
@@ -30,5 +41,13 @@ int main(int argc, char *argv[])
     
     Widget w;
     w.show();
+
+    // 设置 MYDICOMVIEWER_TIMING 时，在首次进入事件循环（窗口可交互）时输出启动耗时
+    if (qEnvironmentVariableIsSet("MYDICOMVIEWER_TIMING")) {
+        QTimer::singleShot(0, [&startupTimer]() {
+            qInfo("[timing] startup to first interactive window: %lld ms",
+                  static_cast<long long>(startupTimer.elapsed()));
+        });
+    }
     return a.exec();
 }
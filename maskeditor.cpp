@@ -0,0 +1,428 @@
+﻿#include "maskeditor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+void WriteVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t ReadVarint(const uint8_t *&p)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= static_cast<uint64_t>(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= static_cast<uint64_t>(*p++) << shift;
+    return value;
+}
+
+// 将一段连续体素的取值序列以 (个数, 值) 游程写出
+template <typename Getter>
+void WriteValueRuns(std::vector<uint8_t> &out, size_t count, Getter value)
+{
+    size_t i = 0;
+    while (i < count) {
+        const uint16_t v = value(i);
+        size_t j = i + 1;
+        while (j < count && value(j) == v) {
+            ++j;
+        }
+        WriteVarint(out, j - i);
+        WriteVarint(out, v);
+        i = j;
+    }
+}
+
+} // namespace
+
+void MaskRegion::Include(int i, int j, int k)
+{
+    if (IsEmpty()) {
+        extent[0] = extent[1] = i;
+        extent[2] = extent[3] = j;
+        extent[4] = extent[5] = k;
+        return;
+    }
+    extent[0] = std::min(extent[0], i);
+    extent[1] = std::max(extent[1], i);
+    extent[2] = std::min(extent[2], j);
+    extent[3] = std::max(extent[3], j);
+    extent[4] = std::min(extent[4], k);
+    extent[5] = std::max(extent[5], k);
+}
+
+void MaskRegion::Merge(const MaskRegion &other)
+{
+    if (other.IsEmpty()) {
+        return;
+    }
+    Include(other.extent[0], other.extent[2], other.extent[4]);
+    Include(other.extent[1], other.extent[3], other.extent[5]);
+}
+
+MaskEditor::MaskEditor()
+    : m_labels(nullptr)
+    , m_wide(false)
+    , m_dims{ 0, 0, 0 }
+    , m_spacing{ 1.0, 1.0, 1.0 }
+    , m_stroking(false)
+    , m_tool(Tool::Paint)
+    , m_strokeValue(0)
+    , m_radius(1.0)
+    , m_axis(2)
+    , m_lastCenter{ 0.0, 0.0, 0.0 }
+    , m_historyBytes(0)
+    , m_maxHistoryBytes(static_cast<size_t>(256) << 20)
+{
+}
+
+void MaskEditor::Attach(void *labels, bool wideLabels, const int dims[3], const double spacing[3])
+{
+    Detach();
+    m_labels = labels;
+    m_wide = wideLabels;
+    for (int axis = 0; axis < 3; ++axis) {
+        m_dims[axis] = dims[axis];
+        m_spacing[axis] = spacing[axis] > 0.0 ? spacing[axis] : 1.0;
+    }
+}
+
+void MaskEditor::Detach()
+{
+    m_labels = nullptr;
+    m_stroking = false;
+    m_strokeBefore.clear();
+    ClearHistory();
+}
+
+void MaskEditor::SetMaxHistoryBytes(size_t bytes)
+{
+    m_maxHistoryBytes = bytes;
+    TrimHistory();
+}
+
+void MaskEditor::ClearHistory()
+{
+    m_undo.clear();
+    m_redo.clear();
+    m_historyBytes = 0;
+}
+
+uint16_t MaskEditor::Get(size_t index) const
+{
+    if (m_wide) {
+        return static_cast<uint16_t>(static_cast<const int16_t *>(m_labels)[index]);
+    }
+    return static_cast<const uint8_t *>(m_labels)[index];
+}
+
+void MaskEditor::Set(size_t index, uint16_t value)
+{
+    if (m_wide) {
+        static_cast<int16_t *>(m_labels)[index] = static_cast<int16_t>(value);
+    } else {
+        static_cast<uint8_t *>(m_labels)[index] = static_cast<uint8_t>(value);
+    }
+}
+
+size_t MaskEditor::IndexOf(int i, int j, int k) const
+{
+    return (static_cast<size_t>(k) * m_dims[1] + static_cast<size_t>(j)) * m_dims[0] + static_cast<size_t>(i);
+}
+
+bool MaskEditor::Inside(int i, int j, int k) const
+{
+    return i >= 0 && j >= 0 && k >= 0 && i < m_dims[0] && j < m_dims[1] && k < m_dims[2];
+}
+
+bool MaskEditor::BeginStroke(Tool tool, int label, double radius, int axis, const int ijk[3], MaskRegion &dirty)
+{
+    if (!m_labels || tool == Tool::Fill || axis < 0 || axis > 2) {
+        return false;
+    }
+    m_stroking = true;
+    m_tool = tool;
+    m_strokeValue = tool == Tool::Erase ? 0 : static_cast<uint16_t>(label);
+    m_radius = std::max(0.5, radius);
+    m_axis = axis;
+    m_strokeRegion = MaskRegion();
+    m_strokeBefore.clear();
+
+    for (int a = 0; a < 3; ++a) {
+        m_lastCenter[a] = ijk[a];
+    }
+    Stamp(m_lastCenter, dirty);
+    return true;
+}
+
+bool MaskEditor::StrokeTo(const int ijk[3], MaskRegion &dirty)
+{
+    if (!m_stroking) {
+        return false;
+    }
+    // 相邻两次鼠标事件之间按半个笔刷半径插值，快速拖动也不会断线
+    double delta[3];
+    double longest = 0.0;
+    for (int a = 0; a < 3; ++a) {
+        delta[a] = (a == m_axis) ? 0.0 : ijk[a] - m_lastCenter[a];
+        longest = std::max(longest, std::abs(delta[a]));
+    }
+    const double stepLength = std::max(1.0, m_radius * 0.5);
+    const int steps = std::max(1, static_cast<int>(std::ceil(longest / stepLength)));
+    for (int s = 1; s <= steps; ++s) {
+        const double t = static_cast<double>(s) / steps;
+        double center[3];
+        for (int a = 0; a < 3; ++a) {
+            center[a] = m_lastCenter[a] + delta[a] * t;
+        }
+        Stamp(center, dirty);
+    }
+    for (int a = 0; a < 3; ++a) {
+        if (a != m_axis) {
+            m_lastCenter[a] = ijk[a];
+        }
+    }
+    return true;
+}
+
+void MaskEditor::Stamp(const double center[3], MaskRegion &dirty)
+{
+    const int u = (m_axis + 1) % 3;
+    const int v = (m_axis + 2) % 3;
+    const double radiusMM = m_radius * std::min(m_spacing[u], m_spacing[v]);
+    const int reachU = static_cast<int>(std::ceil(radiusMM / m_spacing[u]));
+    const int reachV = static_cast<int>(std::ceil(radiusMM / m_spacing[v]));
+    const int cu = static_cast<int>(std::lround(center[u]));
+    const int cv = static_cast<int>(std::lround(center[v]));
+
+    int ijk[3];
+    ijk[m_axis] = static_cast<int>(std::lround(center[m_axis]));
+    for (int dv = -reachV; dv <= reachV; ++dv) {
+        for (int du = -reachU; du <= reachU; ++du) {
+            const double mmU = du * m_spacing[u];
+            const double mmV = dv * m_spacing[v];
+            if (mmU * mmU + mmV * mmV > radiusMM * radiusMM) {
+                continue;
+            }
+            ijk[u] = cu + du;
+            ijk[v] = cv + dv;
+            if (!Inside(ijk[0], ijk[1], ijk[2])) {
+                continue;
+            }
+            const size_t index = IndexOf(ijk[0], ijk[1], ijk[2]);
+            const uint16_t current = Get(index);
+            if (current == m_strokeValue) {
+                continue;
+            }
+            m_strokeBefore.emplace(index, current);
+            Set(index, m_strokeValue);
+            m_strokeRegion.Include(ijk[0], ijk[1], ijk[2]);
+            dirty.Include(ijk[0], ijk[1], ijk[2]);
+        }
+    }
+}
+
+void MaskEditor::EndStroke()
+{
+    if (!m_stroking) {
+        return;
+    }
+    m_stroking = false;
+
+    std::vector<Change> changes;
+    changes.reserve(m_strokeBefore.size());
+    for (const auto &entry : m_strokeBefore) {
+        const uint16_t after = Get(entry.first);
+        if (after != entry.second) {
+            changes.push_back({ entry.first, entry.second, after });
+        }
+    }
+    m_strokeBefore.clear();
+    Commit(changes, m_strokeRegion);
+}
+
+bool MaskEditor::Fill(int label, int axis, const int ijk[3], MaskRegion &dirty)
+{
+    if (!m_labels || axis < 0 || axis > 2 || !Inside(ijk[0], ijk[1], ijk[2])) {
+        return false;
+    }
+    const uint16_t value = static_cast<uint16_t>(label);
+    const uint16_t target = Get(IndexOf(ijk[0], ijk[1], ijk[2]));
+    if (target == value) {
+        return false;
+    }
+
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+    std::vector<Change> changes;
+    MaskRegion region;
+
+    // 扫描线填充：每次整段填满一行，再把上下两行的起点压栈
+    std::vector<std::pair<int, int>> stack;
+    stack.emplace_back(ijk[u], ijk[v]);
+    int p[3];
+    p[axis] = ijk[axis];
+    auto matches = [&](int pu, int pv) {
+        p[u] = pu;
+        p[v] = pv;
+        return pu >= 0 && pv >= 0 && pu < m_dims[u] && pv < m_dims[v] &&
+               Get(IndexOf(p[0], p[1], p[2])) == target;
+    };
+
+    while (!stack.empty()) {
+        const auto [su, sv] = stack.back();
+        stack.pop_back();
+        if (!matches(su, sv)) {
+            continue;
+        }
+        int left = su;
+        while (matches(left - 1, sv)) {
+            --left;
+        }
+        int right = su;
+        while (matches(right + 1, sv)) {
+            ++right;
+        }
+        bool aboveOpen = false;
+        bool belowOpen = false;
+        for (int x = left; x <= right; ++x) {
+            p[u] = x;
+            p[v] = sv;
+            const size_t index = IndexOf(p[0], p[1], p[2]);
+            changes.push_back({ index, target, value });
+            Set(index, value);
+            region.Include(p[0], p[1], p[2]);
+
+            const bool above = matches(x, sv - 1);
+            if (above && !aboveOpen) {
+                stack.emplace_back(x, sv - 1);
+            }
+            aboveOpen = above;
+            const bool below = matches(x, sv + 1);
+            if (below && !belowOpen) {
+                stack.emplace_back(x, sv + 1);
+            }
+            belowOpen = below;
+        }
+    }
+
+    dirty.Merge(region);
+    Commit(changes, region);
+    return true;
+}
+
+void MaskEditor::Commit(std::vector<Change> &changes, const MaskRegion &region)
+{
+    if (changes.empty()) {
+        return;
+    }
+    std::sort(changes.begin(), changes.end(),
+              [](const Change &a, const Change &b) { return a.index < b.index; });
+    Delta delta = Encode(changes, region);
+    m_historyBytes += delta.data.size();
+    m_undo.push_back(std::move(delta));
+    for (const Delta &stale : m_redo) {
+        m_historyBytes -= stale.data.size();
+    }
+    m_redo.clear();
+    TrimHistory();
+}
+
+MaskEditor::Delta MaskEditor::Encode(const std::vector<Change> &changes, const MaskRegion &region)
+{
+    // 格式：若干连续索引段，每段为 [与上一段末尾的间隔][长度][原值游程][新值游程]
+    Delta delta;
+    delta.region = region;
+    size_t previousEnd = 0;
+    size_t i = 0;
+    while (i < changes.size()) {
+        size_t j = i + 1;
+        while (j < changes.size() && changes[j].index == changes[j - 1].index + 1) {
+            ++j;
+        }
+        const size_t count = j - i;
+        WriteVarint(delta.data, changes[i].index - previousEnd);
+        WriteVarint(delta.data, count);
+        WriteValueRuns(delta.data, count, [&](size_t n) { return changes[i + n].before; });
+        WriteValueRuns(delta.data, count, [&](size_t n) { return changes[i + n].after; });
+        previousEnd = changes[i].index + count;
+        i = j;
+    }
+    delta.data.shrink_to_fit();
+    return delta;
+}
+
+void MaskEditor::Apply(const Delta &delta, bool redo)
+{
+    const uint8_t *p = delta.data.data();
+    const uint8_t *end = p + delta.data.size();
+    size_t position = 0;
+    while (p < end) {
+        position += static_cast<size_t>(ReadVarint(p));
+        const size_t count = static_cast<size_t>(ReadVarint(p));
+        for (int pass = 0; pass < 2; ++pass) {
+            const bool write = (pass == 1) == redo;
+            size_t written = 0;
+            while (written < count) {
+                const size_t run = static_cast<size_t>(ReadVarint(p));
+                const uint16_t value = static_cast<uint16_t>(ReadVarint(p));
+                if (write) {
+                    for (size_t n = 0; n < run; ++n) {
+                        Set(position + written + n, value);
+                    }
+                }
+                written += run;
+            }
+        }
+        position += count;
+    }
+}
+
+bool MaskEditor::Undo(MaskRegion &dirty)
+{
+    if (!m_labels || m_stroking || m_undo.empty()) {
+        return false;
+    }
+    Delta delta = std::move(m_undo.back());
+    m_undo.pop_back();
+    Apply(delta, false);
+    dirty.Merge(delta.region);
+    m_redo.push_back(std::move(delta));
+    return true;
+}
+
+bool MaskEditor::Redo(MaskRegion &dirty)
+{
+    if (!m_labels || m_stroking || m_redo.empty()) {
+        return false;
+    }
+    Delta delta = std::move(m_redo.back());
+    m_redo.pop_back();
+    Apply(delta, true);
+    dirty.Merge(delta.region);
+    m_undo.push_back(std::move(delta));
+    return true;
+}
+
+void MaskEditor::TrimHistory()
+{
+    size_t drop = 0;
+    while (m_historyBytes > m_maxHistoryBytes && drop < m_undo.size()) {
+        m_historyBytes -= m_undo[drop].data.size();
+        ++drop;
+    }
+    if (drop > 0) {
+        m_undo.erase(m_undo.begin(), m_undo.begin() + static_cast<std::ptrdiff_t>(drop));
+    }
+}
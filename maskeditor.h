@@ -0,0 +1,105 @@
+﻿#ifndef MASKEDITOR_H
+#define MASKEDITOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// 体素索引包围盒，extent[0] > extent[1] 表示空区域
+struct MaskRegion
+{
+    int extent[6] = { 0, -1, 0, -1, 0, -1 };
+
+    bool IsEmpty() const { return extent[0] > extent[1]; }
+    void Include(int i, int j, int k);
+    void Merge(const MaskRegion &other);
+};
+
+// 掩膜编辑：笔刷 / 橡皮 / 漫水填充直接写入标签体数据。
+// 每一笔只记录被改动体素的差分（游程 + 变长整数编码），撤销/重做不保存整卷快照。
+class MaskEditor
+{
+public:
+    enum class Tool
+    {
+        Paint,
+        Erase,
+        Fill
+    };
+
+    MaskEditor();
+
+    // labels 按 [z][y][x] 排列，元素为 uint8（wideLabels=false）或 int16；编辑器不持有所有权
+    void Attach(void *labels, bool wideLabels, const int dims[3], const double spacing[3]);
+    void Detach();
+    bool IsAttached() const { return m_labels != nullptr; }
+
+    // 撤销历史的压缩字节上限，超出时丢弃最早的记录
+    void SetMaxHistoryBytes(size_t bytes);
+    size_t GetHistoryBytes() const { return m_historyBytes; }
+
+    // 按下时 BeginStroke，拖动时 StrokeTo，抬起时 EndStroke；整笔为一个撤销单元。
+    // radius 以面内较小间距的体素为单位，按实际间距画圆；axis 为当前视图的法线轴
+    bool BeginStroke(Tool tool, int label, double radius, int axis, const int ijk[3], MaskRegion &dirty);
+    bool StrokeTo(const int ijk[3], MaskRegion &dirty);
+    void EndStroke();
+    bool IsStroking() const { return m_stroking; }
+
+    // 在垂直于 axis 的切片内做 4 连通漫水填充，本身构成一个撤销单元
+    bool Fill(int label, int axis, const int ijk[3], MaskRegion &dirty);
+
+    bool CanUndo() const { return !m_undo.empty(); }
+    bool CanRedo() const { return !m_redo.empty(); }
+    bool Undo(MaskRegion &dirty);
+    bool Redo(MaskRegion &dirty);
+    void ClearHistory();
+
+private:
+    struct Change
+    {
+        size_t index;
+        uint16_t before;
+        uint16_t after;
+    };
+
+    struct Delta
+    {
+        std::vector<uint8_t> data;
+        MaskRegion region;
+    };
+
+    uint16_t Get(size_t index) const;
+    void Set(size_t index, uint16_t value);
+    size_t IndexOf(int i, int j, int k) const;
+    bool Inside(int i, int j, int k) const;
+
+    void Stamp(const double center[3], MaskRegion &dirty);
+    void Commit(std::vector<Change> &changes, const MaskRegion &region);
+    void Apply(const Delta &delta, bool redo);
+    void TrimHistory();
+
+    static Delta Encode(const std::vector<Change> &changes, const MaskRegion &region);
+
+    void *m_labels;
+    bool m_wide;
+    int m_dims[3];
+    double m_spacing[3];
+
+    bool m_stroking;
+    Tool m_tool;
+    uint16_t m_strokeValue;
+    double m_radius;
+    int m_axis;
+    double m_lastCenter[3];
+    MaskRegion m_strokeRegion;
+    // 本笔首次触及的体素 -> 原值
+    std::unordered_map<size_t, uint16_t> m_strokeBefore;
+
+    std::vector<Delta> m_undo;
+    std::vector<Delta> m_redo;
+    size_t m_historyBytes;
+    size_t m_maxHistoryBytes;
+};
+
+#endif // MASKEDITOR_H
@@ -0,0 +1,350 @@
+﻿#include "maskoverlay.h"
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+template <typename TLabel>
+static vtkSmartPointer<vtkImageData> ReadMaskVolumeAs(const std::string &fileName, int scalarType,
+                                                      double *direction)
+{
+    typedef itk::Image<TLabel, 3> MaskType;
+    typedef itk::ImageFileReader<MaskType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(fileName);
+    reader->Update();
+
+    typename MaskType::Pointer itkImage = reader->GetOutput();
+    typename MaskType::RegionType region = itkImage->GetLargestPossibleRegion();
+    typename MaskType::SizeType size = region.GetSize();
+    typename MaskType::SpacingType spacing = itkImage->GetSpacing();
+    typename MaskType::PointType origin = itkImage->GetOrigin();
+
+    vtkSmartPointer<vtkImageData> maskVtk = vtkSmartPointer<vtkImageData>::New();
+    maskVtk->SetDimensions(static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2]));
+    maskVtk->SetSpacing(spacing[0], spacing[1], spacing[2]);
+    maskVtk->SetOrigin(origin[0], origin[1], origin[2]);
+    maskVtk->AllocateScalars(scalarType, 1);
+
+    std::memcpy(maskVtk->GetScalarPointer(), itkImage->GetBufferPointer(), region.GetNumberOfPixels() * sizeof(TLabel));
+    if (direction) {
+        const typename MaskType::DirectionType &matrix = itkImage->GetDirection();
+        for (unsigned int r = 0; r < 3; ++r) {
+            for (unsigned int c = 0; c < 3; ++c) {
+                direction[r * 3 + c] = matrix(r, c);
+            }
+        }
+    }
+    return maskVtk;
+}
+
+vtkSmartPointer<vtkImageData> ReadMaskVolume(const std::string &fileName, double *direction)
+{
+    try {
+        return ReadMaskVolumeAs<unsigned char>(fileName, VTK_UNSIGNED_CHAR, direction);
+    } catch (...) {
+        try {
+            return ReadMaskVolumeAs<short>(fileName, VTK_SHORT, direction);
+        } catch (...) {
+        }
+    }
+    return nullptr;
+}
+
+// 参考网格索引 -> 标签体连续索引的仿射 a·ijk + b。每行先解析地求出落在标签体内的 i 区间，
+// 区间外整段清零，区间内无需逐点判断越界；各层互不依赖
+template <typename TLabel>
+static size_t ResampleLabels(const TLabel *src, const int srcDims[3], TLabel *dst, const int dstDims[3],
+                             const double a[9], const double b[3], ThreadPool &pool)
+{
+    std::atomic<size_t> inside(0);
+    const size_t sliceVoxels = static_cast<size_t>(dstDims[0]) * dstDims[1];
+    const size_t srcRow = static_cast<size_t>(srcDims[0]);
+    const size_t srcSlice = srcRow * srcDims[1];
+    pool.ParallelFor(0, static_cast<size_t>(dstDims[2]), [&](size_t begin, size_t end) {
+        size_t localInside = 0;
+        for (size_t k = begin; k < end; ++k) {
+            TLabel *out = dst + sliceVoxels * k;
+            for (int j = 0; j < dstDims[1]; ++j, out += dstDims[0]) {
+                double p[3];
+                // 最近邻取整后落在 [0, n) 内等价于连续索引落在 [-0.5, n - 0.5) 内
+                double first = 0.0;
+                double last = dstDims[0] - 1.0;
+                for (int r = 0; r < 3; ++r) {
+                    p[r] = a[r * 3 + 1] * j + a[r * 3 + 2] * static_cast<double>(k) + b[r] + 0.5;
+                    const double step = a[r * 3];
+                    if (std::abs(step) < 1e-12) {
+                        if (p[r] < 0.0 || p[r] >= srcDims[r]) {
+                            last = -1.0;
+                        }
+                    } else {
+                        const double t0 = -p[r] / step;
+                        const double t1 = (srcDims[r] - p[r]) / step;
+                        first = std::max(first, std::min(t0, t1));
+                        last = std::min(last, std::max(t0, t1));
+                    }
+                }
+                // 区间端点受舍入误差影响可能多出一格，逐点复核端点；区间内各坐标单调，无需再判断
+                auto insideAt = [&](int i) {
+                    for (int r = 0; r < 3; ++r) {
+                        const double v = p[r] + a[r * 3] * i;
+                        if (v < 0.0 || v >= srcDims[r]) {
+                            return false;
+                        }
+                    }
+                    return true;
+                };
+                const double rowEnd = dstDims[0];
+                int iBegin = static_cast<int>(std::clamp(std::ceil(first - 1.0), 0.0, rowEnd));
+                int iEnd = std::max(iBegin, static_cast<int>(std::clamp(std::floor(last) + 2.0, 0.0, rowEnd)));
+                while (iBegin < iEnd && !insideAt(iBegin)) {
+                    ++iBegin;
+                }
+                while (iEnd > iBegin && !insideAt(iEnd - 1)) {
+                    --iEnd;
+                }
+                std::fill(out, out + iBegin, TLabel(0));
+                std::fill(out + iEnd, out + dstDims[0], TLabel(0));
+                for (int i = iBegin; i < iEnd; ++i) {
+                    const size_t x = static_cast<size_t>(p[0] + a[0] * i);
+                    const size_t y = static_cast<size_t>(p[1] + a[3] * i);
+                    const size_t z = static_cast<size_t>(p[2] + a[6] * i);
+                    out[i] = src[z * srcSlice + y * srcRow + x];
+                }
+                localInside += static_cast<size_t>(iEnd - iBegin);
+            }
+        }
+        inside += localInside;
+    });
+    return inside;
+}
+
+bool MaskMatchesGrid(vtkImageData *mask, const double maskDirection[9],
+                     const int dims[3], const double spacing[3],
+                     const double origin[3], const double direction[9])
+{
+    if (!mask) {
+        return false;
+    }
+    int maskDims[3];
+    double maskSpacing[3];
+    double maskOrigin[3];
+    mask->GetDimensions(maskDims);
+    mask->GetSpacing(maskSpacing);
+    mask->GetOrigin(maskOrigin);
+    for (int axis = 0; axis < 3; ++axis) {
+        // 原点偏差不超过千分之一个体素，间距相对偏差不超过 1e-4
+        if (maskDims[axis] != dims[axis] ||
+            std::abs(maskSpacing[axis] - spacing[axis]) > 1e-4 * std::abs(spacing[axis]) ||
+            std::abs(maskOrigin[axis] - origin[axis]) > 1e-3 * std::abs(spacing[axis])) {
+            return false;
+        }
+    }
+    for (int i = 0; i < 9; ++i) {
+        if (std::abs(maskDirection[i] - direction[i]) > 1e-4) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vtkSmartPointer<vtkImageData> ResampleMaskToGrid(vtkImageData *mask, const double maskDirection[9],
+                                                 const int dims[3], const double spacing[3],
+                                                 const double origin[3], const double direction[9],
+                                                 const PatientTransform *transform,
+                                                 size_t *insideCount, ThreadPool &pool)
+{
+    double inverse[9];
+    if (!mask || !InvertMatrix3(maskDirection, inverse)) {
+        return nullptr;
+    }
+
+    // 有配准变换时把 y = M·x + t 并入参考网格：等效方向 M·D_r、等效原点 M·O_r + t
+    double gridDirection[9];
+    double gridOrigin[3];
+    std::copy(direction, direction + 9, gridDirection);
+    std::copy(origin, origin + 3, gridOrigin);
+    if (transform) {
+        transform->Apply(origin, gridOrigin);
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                double sum = 0.0;
+                for (int n = 0; n < 3; ++n) {
+                    sum += transform->matrix[r * 3 + n] * direction[n * 3 + c];
+                }
+                gridDirection[r * 3 + c] = sum;
+            }
+        }
+    }
+
+    int srcDims[3];
+    double srcSpacing[3];
+    double srcOrigin[3];
+    mask->GetDimensions(srcDims);
+    mask->GetSpacing(srcSpacing);
+    mask->GetOrigin(srcOrigin);
+
+    // 物理坐标 P = O + D·(s ⊙ ijk)，于是标签体索引 = S_m⁻¹·D_m⁻¹·(D_r·S_r·ijk + O_r − O_m)
+    double a[9];
+    double b[3];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            double sum = 0.0;
+            for (int n = 0; n < 3; ++n) {
+                sum += inverse[r * 3 + n] * gridDirection[n * 3 + c];
+            }
+            a[r * 3 + c] = sum * spacing[c] / srcSpacing[r];
+        }
+        double offset = 0.0;
+        for (int n = 0; n < 3; ++n) {
+            offset += inverse[r * 3 + n] * (gridOrigin[n] - srcOrigin[n]);
+        }
+        b[r] = offset / srcSpacing[r];
+    }
+
+    vtkSmartPointer<vtkImageData> resampled = vtkSmartPointer<vtkImageData>::New();
+    resampled->SetDimensions(dims[0], dims[1], dims[2]);
+    resampled->SetSpacing(spacing[0], spacing[1], spacing[2]);
+    resampled->SetOrigin(origin[0], origin[1], origin[2]);
+    resampled->AllocateScalars(mask->GetScalarType(), 1);
+
+    size_t inside = 0;
+    if (mask->GetScalarType() == VTK_SHORT) {
+        inside = ResampleLabels(static_cast<const short *>(mask->GetScalarPointer()), srcDims,
+                                static_cast<short *>(resampled->GetScalarPointer()), dims, a, b, pool);
+    } else {
+        inside = ResampleLabels(static_cast<const unsigned char *>(mask->GetScalarPointer()), srcDims,
+                                static_cast<unsigned char *>(resampled->GetScalarPointer()), dims, a, b, pool);
+    }
+    if (insideCount) {
+        *insideCount = inside;
+    }
+    return resampled;
+}
+
+vtkSmartPointer<vtkLookupTable> CreateMaskLookupTable()
+{
+    vtkSmartPointer<vtkLookupTable> lut = vtkSmartPointer<vtkLookupTable>::New();
+
+    // Discrete label LUT:
+    //   0 -> transparent
+    //   1 -> red
+    //   2 -> green
+    //   3 -> blue
+    //   others -> clamped to the range ends
+    lut->SetNumberOfTableValues(4);
+    lut->SetRange(0, 3);
+
+    // 0: background - fully transparent
+    lut->SetTableValue(0, 0.0, 0.0, 0.0, 0.0);
+    // 1: label 1 - red
+    lut->SetTableValue(1, 1.0, 0.0, 0.0, 0.7);
+    // 2: label 2 - green
+    lut->SetTableValue(2, 0.0, 1.0, 0.0, 0.7);
+    // 3: label 3 - blue
+    lut->SetTableValue(3, 0.0, 0.0, 1.0, 0.7);
+
+    lut->Build();
+
+    return lut;
+}
+
+void CompositeMaskLayers(const std::vector<MaskOverlayLayer> &layers,
+                         vtkLookupTable *lut,
+                         const int ext[6],
+                         const int dstExtent[6],
+                         unsigned char *rgba)
+{
+    if (!lut || !rgba) {
+        return;
+    }
+
+    // 每个图层的标签 -> 预乘 alpha 颜色（已乘图层不透明度），逐像素按图层顺序由下往上做 over 合成
+    struct CompositeLayer {
+        const void *labels;
+        bool wide;
+        int dims[3];
+        float opacity;
+        float palette[256][4];
+    };
+    std::vector<CompositeLayer> entries;
+    entries.reserve(layers.size());
+    for (const MaskOverlayLayer &layer : layers) {
+        if (!layer.labels || layer.opacity <= 0.0) {
+            continue;
+        }
+        CompositeLayer entry;
+        entry.labels = layer.labels;
+        entry.wide = layer.wideLabels;
+        for (int axis = 0; axis < 3; ++axis) {
+            entry.dims[axis] = layer.dims[axis];
+        }
+        entry.opacity = static_cast<float>(layer.opacity);
+        for (int value = 0; value < 256; ++value) {
+            const unsigned char *color = lut->MapValue(value);
+            const float alpha = color[3] / 255.0f * entry.opacity;
+            for (int c = 0; c < 3; ++c) {
+                entry.palette[value][c] = color[c] / 255.0f * alpha;
+            }
+            entry.palette[value][3] = alpha;
+        }
+        entries.push_back(entry);
+    }
+
+    const size_t rowLength = static_cast<size_t>(dstExtent[1] - dstExtent[0] + 1);
+    const size_t rowCount = static_cast<size_t>(dstExtent[3] - dstExtent[2] + 1);
+
+    for (int k = ext[4]; k <= ext[5]; ++k) {
+        for (int j = ext[2]; j <= ext[3]; ++j) {
+            unsigned char *dst = rgba + 4 * ((static_cast<size_t>(k - dstExtent[4]) * rowCount +
+                                              static_cast<size_t>(j - dstExtent[2])) * rowLength +
+                                             static_cast<size_t>(ext[0] - dstExtent[0]));
+            for (int i = ext[0]; i <= ext[1]; ++i, dst += 4) {
+                float r = 0.0f;
+                float g = 0.0f;
+                float b = 0.0f;
+                float a = 0.0f;
+                for (const CompositeLayer &layer : entries) {
+                    if (i >= layer.dims[0] || j >= layer.dims[1] || k >= layer.dims[2]) {
+                        continue;
+                    }
+                    const size_t index = (static_cast<size_t>(k) * layer.dims[1] + j) * layer.dims[0] + i;
+                    const int label = layer.wide ? static_cast<const short *>(layer.labels)[index]
+                                                 : static_cast<const unsigned char *>(layer.labels)[index];
+                    if (label == 0) {
+                        continue;
+                    }
+                    float mapped[4];
+                    const float *color = mapped;
+                    if (label > 0 && label < 256) {
+                        color = layer.palette[label];
+                    } else {
+                        const unsigned char *raw = lut->MapValue(label);
+                        mapped[3] = raw[3] / 255.0f * layer.opacity;
+                        for (int c = 0; c < 3; ++c) {
+                            mapped[c] = raw[c] / 255.0f * mapped[3];
+                        }
+                    }
+                    const float keep = 1.0f - color[3];
+                    r = color[0] + r * keep;
+                    g = color[1] + g * keep;
+                    b = color[2] + b * keep;
+                    a = color[3] + a * keep;
+                }
+                if (a > 0.0f) {
+                    dst[0] = static_cast<unsigned char>(std::lround(r / a * 255.0f));
+                    dst[1] = static_cast<unsigned char>(std::lround(g / a * 255.0f));
+                    dst[2] = static_cast<unsigned char>(std::lround(b / a * 255.0f));
+                    dst[3] = static_cast<unsigned char>(std::lround(a * 255.0f));
+                } else {
+                    dst[0] = dst[1] = dst[2] = dst[3] = 0;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,55 @@
+﻿#ifndef MASKOVERLAY_H
+#define MASKOVERLAY_H
+
+#include <vtkSmartPointer.h>
+#include <vtkLookupTable.h>
+#include <vtkImageData.h>
+
+#include "threadpool.h"
+#include "imageregistration.h"
+
+#include <string>
+#include <vector>
+
+// 参与合成的一个标签图层（标签体按 [z][y][x] 排列，不持有所有权）
+struct MaskOverlayLayer
+{
+    const void *labels = nullptr;
+    bool wideLabels = false;   // false: uint8, true: int16
+    int dims[3] = { 0, 0, 0 };
+    double opacity = 1.0;
+};
+
+// 读取 NIfTI / MetaImage 标签体：先按 uint8 读取，失败时按 int16 读取；失败返回空。
+// direction 非空时输出文件中的方向矩阵（行主序，LPS）
+vtkSmartPointer<vtkImageData> ReadMaskVolume(const std::string &fileName, double *direction = nullptr);
+
+// 标签体与参考网格的尺寸相同，且原点、间距与方向矩阵在容差内一致（文件读写的浮点舍入）时返回 true，
+// 此时可直接沿用参考网格的几何而无需重采样
+bool MaskMatchesGrid(vtkImageData *mask, const double maskDirection[9],
+                     const int dims[3], const double spacing[3],
+                     const double origin[3], const double direction[9]);
+
+// 按两者真实的原点、间距与方向矩阵（行主序）把标签体最近邻重采样到参考网格上，
+// 按切片在线程池上并行；落在标签体范围外的体素为 0。insideCount 输出落在标签体范围内的体素数。
+// transform 非空时参考网格上的点先经它映射到标签体所在的病人坐标（如配准到对比研究的掩膜）。
+// 方向矩阵奇异时返回空
+vtkSmartPointer<vtkImageData> ResampleMaskToGrid(vtkImageData *mask, const double maskDirection[9],
+                                                 const int dims[3], const double spacing[3],
+                                                 const double origin[3], const double direction[9],
+                                                 const PatientTransform *transform = nullptr,
+                                                 size_t *insideCount = nullptr,
+                                                 ThreadPool &pool = ThreadPool::Global());
+
+// 离散标签查找表：0 透明，1 红，2 绿，3 蓝，其余按边界钳制
+vtkSmartPointer<vtkLookupTable> CreateMaskLookupTable();
+
+// 将各图层在体素范围 ext 内按顺序由下往上做预乘 alpha 的 over 合成，
+// 结果写入按 dstExtent 排列的 RGBA 图像（ext 须落在 dstExtent 内）
+void CompositeMaskLayers(const std::vector<MaskOverlayLayer> &layers,
+                         vtkLookupTable *lut,
+                         const int ext[6],
+                         const int dstExtent[6],
+                         unsigned char *rgba);
+
+#endif // MASKOVERLAY_H
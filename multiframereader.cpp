@@ -0,0 +1,538 @@
+﻿#include "multiframereader.h"
+#include "dicomdataset.h"
+
+#include <gdcmReader.h>
+#include <gdcmImageRegionReader.h>
+#include <gdcmBoxRegion.h>
+#include <gdcmDataSet.h>
+#include <gdcmSequenceOfItems.h>
+#include <gdcmAttribute.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <set>
+#include <type_traits>
+
+namespace
+{
+
+template <typename TRaw, typename TDest>
+constexpr bool RawFitsIn()
+{
+    return std::is_floating_point<TDest>::value ||
+           (static_cast<long long>(std::numeric_limits<TRaw>::min()) >=
+                static_cast<long long>(std::numeric_limits<TDest>::min()) &&
+            static_cast<long long>(std::numeric_limits<TRaw>::max()) <=
+                static_cast<long long>(std::numeric_limits<TDest>::max()));
+}
+
+template <typename TRaw, typename TDest>
+void ConvertFrame(const char *raw, TDest *dest, size_t count, double slope, double intercept)
+{
+    const TRaw *src = reinterpret_cast<const TRaw *>(raw);
+    if (slope == 1.0 && intercept == 0.0 && RawFitsIn<TRaw, TDest>()) {
+        for (size_t i = 0; i < count; ++i) {
+            dest[i] = static_cast<TDest>(src[i]);
+        }
+        return;
+    }
+    if constexpr (std::is_floating_point<TDest>::value) {
+        for (size_t i = 0; i < count; ++i) {
+            dest[i] = static_cast<TDest>(static_cast<double>(src[i]) * slope + intercept);
+        }
+    } else {
+        constexpr double lo = std::numeric_limits<TDest>::min();
+        constexpr double hi = std::numeric_limits<TDest>::max();
+        for (size_t i = 0; i < count; ++i) {
+            const double v = static_cast<double>(src[i]) * slope + intercept;
+            dest[i] = static_cast<TDest>(std::llround(std::clamp(v, lo, hi)));
+        }
+    }
+}
+
+template <typename TDest>
+bool ConvertRawFrame(const MultiFrameInfo &info, const char *raw, TDest *dest,
+                     size_t voxels, double slope, double intercept)
+{
+    switch (info.bitsAllocated) {
+    case 8:
+        if (info.isSigned) {
+            ConvertFrame<signed char>(raw, dest, voxels, slope, intercept);
+        } else {
+            ConvertFrame<unsigned char>(raw, dest, voxels, slope, intercept);
+        }
+        return true;
+    case 16:
+        if (info.isSigned) {
+            ConvertFrame<short>(raw, dest, voxels, slope, intercept);
+        } else {
+            ConvertFrame<unsigned short>(raw, dest, voxels, slope, intercept);
+        }
+        return true;
+    case 32:
+        if (info.isSigned) {
+            ConvertFrame<int>(raw, dest, voxels, slope, intercept);
+        } else {
+            ConvertFrame<unsigned int>(raw, dest, voxels, slope, intercept);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 按存储位数与各帧 Rescale 推算换算后数值范围，选出能无损容纳的最窄类型
+MultiFramePixelType SelectOutputType(const MultiFrameInfo &info)
+{
+    if (info.modality == "PT") {
+        return MultiFramePixelType::Float32;
+    }
+    const unsigned int bits = std::clamp<unsigned int>(info.bitsStored ? info.bitsStored : info.bitsAllocated, 1, 32);
+    const double rawMin = info.isSigned ? -std::ldexp(1.0, static_cast<int>(bits) - 1) : 0.0;
+    const double rawMax = info.isSigned ? std::ldexp(1.0, static_cast<int>(bits) - 1) - 1.0
+                                        : std::ldexp(1.0, static_cast<int>(bits)) - 1.0;
+    double lo = std::numeric_limits<double>::max();
+    double hi = std::numeric_limits<double>::lowest();
+    for (size_t f = 0; f < info.rescaleSlope.size(); ++f) {
+        const double slope = info.rescaleSlope[f];
+        const double intercept = info.rescaleIntercept[f];
+        if (slope != std::floor(slope) || intercept != std::floor(intercept)) {
+            return MultiFramePixelType::Float32;
+        }
+        const double a = rawMin * slope + intercept;
+        const double b = rawMax * slope + intercept;
+        lo = std::min({ lo, a, b });
+        hi = std::max({ hi, a, b });
+    }
+    if (lo > hi) {
+        lo = rawMin;
+        hi = rawMax;
+    }
+    if (lo >= 0.0 && hi <= 255.0) {
+        return MultiFramePixelType::UInt8;
+    }
+    if (lo >= -32768.0 && hi <= 32767.0) {
+        return MultiFramePixelType::Int16;
+    }
+    if (lo >= 0.0 && hi <= 65535.0) {
+        return MultiFramePixelType::UInt16;
+    }
+    if (lo >= -2147483648.0 && hi <= 2147483647.0) {
+        return MultiFramePixelType::Int32;
+    }
+    return MultiFramePixelType::Float32;
+}
+
+bool DecodeSliceWith(gdcm::ImageRegionReader &regionReader, const MultiFrameInfo &info,
+                     unsigned int slice, void *volume, std::vector<char> &raw)
+{
+    const unsigned int frame = info.frameForSlice[slice];
+    gdcm::BoxRegion box;
+    box.SetDomain(0, info.columns - 1, 0, info.rows - 1, frame, frame);
+    regionReader.SetRegion(box);
+
+    const size_t length = regionReader.ComputeBufferLength();
+    const size_t voxels = info.SliceVoxelCount();
+    if (length == 0 || length < voxels * (info.bitsAllocated / 8)) {
+        return false;
+    }
+    raw.resize(length);
+    if (!regionReader.ReadIntoBuffer(raw.data(), raw.size())) {
+        return false;
+    }
+
+    const size_t offset = static_cast<size_t>(slice) * voxels;
+    const double slope = info.rescaleSlope[frame];
+    const double intercept = info.rescaleIntercept[frame];
+    switch (info.outputType) {
+    case MultiFramePixelType::UInt8:
+        return ConvertRawFrame(info, raw.data(), static_cast<unsigned char*>(volume) + offset,
+                               voxels, slope, intercept);
+    case MultiFramePixelType::UInt16:
+        return ConvertRawFrame(info, raw.data(), static_cast<unsigned short*>(volume) + offset,
+                               voxels, slope, intercept);
+    case MultiFramePixelType::Int32:
+        return ConvertRawFrame(info, raw.data(), static_cast<int*>(volume) + offset,
+                               voxels, slope, intercept);
+    case MultiFramePixelType::Float32:
+        return ConvertRawFrame(info, raw.data(), static_cast<float*>(volume) + offset,
+                               voxels, slope, intercept);
+    case MultiFramePixelType::Int16:
+    default:
+        return ConvertRawFrame(info, raw.data(), static_cast<short*>(volume) + offset,
+                               voxels, slope, intercept);
+    }
+}
+
+} // namespace
+
+size_t MultiFrameInfo::OutputPixelSize() const
+{
+    switch (outputType) {
+    case MultiFramePixelType::UInt8:
+        return sizeof(unsigned char);
+    case MultiFramePixelType::UInt16:
+        return sizeof(unsigned short);
+    case MultiFramePixelType::Int32:
+        return sizeof(int);
+    case MultiFramePixelType::Float32:
+        return sizeof(float);
+    case MultiFramePixelType::Int16:
+    default:
+        return sizeof(short);
+    }
+}
+
+bool MultiFrameDicomReader::IsMultiFrameFile(const std::string &fileName)
+{
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.c_str());
+    if (!reader.ReadUpToTag(gdcm::Tag(0x0028, 0x0009), std::set<gdcm::Tag>())) {
+        return false;
+    }
+    const std::string frames = ReadDicomString(reader.GetFile().GetDataSet(), 0x0028, 0x0008);
+    return !frames.empty() && std::atoi(frames.c_str()) > 1;
+}
+
+bool MultiFrameDicomReader::Open(const std::string &fileName, std::string *error)
+{
+    m_info = MultiFrameInfo();
+    m_info.fileName = fileName;
+
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.c_str());
+    // 只解析到像素数据之前，像素在后续按帧惰性解码
+    if (!reader.ReadUpToTag(gdcm::Tag(0x7fe0, 0x0010), std::set<gdcm::Tag>())) {
+        if (error) {
+            *error = "Cannot parse DICOM header: " + fileName;
+        }
+        return false;
+    }
+    const gdcm::DataSet &ds = reader.GetFile().GetDataSet();
+
+    gdcm::Attribute<0x0028, 0x0010> rows;
+    gdcm::Attribute<0x0028, 0x0011> columns;
+    gdcm::Attribute<0x0028, 0x0100> bitsAllocated;
+    gdcm::Attribute<0x0028, 0x0101> bitsStored;
+    gdcm::Attribute<0x0028, 0x0103> pixelRepresentation;
+    rows.SetFromDataSet(ds);
+    columns.SetFromDataSet(ds);
+    bitsAllocated.SetFromDataSet(ds);
+    bitsStored.SetFromDataSet(ds);
+    pixelRepresentation.SetFromDataSet(ds);
+
+    m_info.rows = rows.GetValue();
+    m_info.columns = columns.GetValue();
+    m_info.bitsAllocated = bitsAllocated.GetValue();
+    m_info.bitsStored = std::min(bitsStored.GetValue(), m_info.bitsAllocated);
+    m_info.isSigned = pixelRepresentation.GetValue() == 1;
+    m_info.frameCount = static_cast<unsigned int>(std::max(1, std::atoi(ReadDicomString(ds, 0x0028, 0x0008).c_str())));
+
+    if (m_info.rows == 0 || m_info.columns == 0) {
+        if (error) {
+            *error = "Missing Rows/Columns in " + fileName;
+        }
+        return false;
+    }
+
+    m_info.patientName = ReadDicomString(ds, 0x0010, 0x0010);
+    m_info.patientID = ReadDicomString(ds, 0x0010, 0x0020);
+    m_info.modality = ReadDicomString(ds, 0x0008, 0x0060);
+
+    // 共享功能组 (5200|9229)，缺失时退回到顶层属性
+    gdcm::DataSet shared;
+    const bool hasShared = FirstSequenceItem(ds, 0x5200, 0x9229, shared);
+
+    std::vector<double> orientation = hasShared ? ReadFromMacro(shared, 0x0020, 0x9116, 0x0020, 0x0037)
+                                                : std::vector<double>();
+    if (orientation.size() < 6) {
+        orientation = ReadDicomDecimals(ds, 0x0020, 0x0037);
+    }
+    std::vector<double> pixelSpacing = hasShared ? ReadFromMacro(shared, 0x0028, 0x9110, 0x0028, 0x0030)
+                                                 : std::vector<double>();
+    if (pixelSpacing.size() < 2) {
+        pixelSpacing = ReadDicomDecimals(ds, 0x0028, 0x0030);
+    }
+    std::vector<double> thickness = hasShared ? ReadFromMacro(shared, 0x0028, 0x9110, 0x0018, 0x0050)
+                                              : std::vector<double>();
+    if (thickness.empty()) {
+        thickness = ReadDicomDecimals(ds, 0x0018, 0x0050);
+    }
+    std::vector<double> betweenSlices = hasShared ? ReadFromMacro(shared, 0x0028, 0x9110, 0x0018, 0x0088)
+                                                  : std::vector<double>();
+    if (betweenSlices.empty()) {
+        betweenSlices = ReadDicomDecimals(ds, 0x0018, 0x0088);
+    }
+
+    double defaultSlope = 1.0;
+    double defaultIntercept = 0.0;
+    {
+        std::vector<double> slope = hasShared ? ReadFromMacro(shared, 0x0028, 0x9145, 0x0028, 0x1053)
+                                              : std::vector<double>();
+        std::vector<double> intercept = hasShared ? ReadFromMacro(shared, 0x0028, 0x9145, 0x0028, 0x1052)
+                                                  : std::vector<double>();
+        if (slope.empty()) {
+            slope = ReadDicomDecimals(ds, 0x0028, 0x1053);
+        }
+        if (intercept.empty()) {
+            intercept = ReadDicomDecimals(ds, 0x0028, 0x1052);
+        }
+        if (!slope.empty() && slope[0] != 0.0) {
+            defaultSlope = slope[0];
+        }
+        if (!intercept.empty()) {
+            defaultIntercept = intercept[0];
+        }
+    }
+
+    const unsigned int frames = m_info.frameCount;
+    m_info.rescaleSlope.assign(frames, defaultSlope);
+    m_info.rescaleIntercept.assign(frames, defaultIntercept);
+    std::vector<double> positions(frames * 3, 0.0);
+    std::vector<bool> hasPosition(frames, false);
+
+    // 逐帧功能组 (5200|9230)：位置与像素值变换
+    const gdcm::Tag perFrameTag(0x5200, 0x9230);
+    if (ds.FindDataElement(perFrameTag)) {
+        gdcm::SmartPointer<gdcm::SequenceOfItems> perFrame = ds.GetDataElement(perFrameTag).GetValueAsSQ();
+        const size_t items = perFrame ? perFrame->GetNumberOfItems() : 0;
+        for (size_t i = 0; i < items && i < frames; ++i) {
+            const gdcm::DataSet &frameGroup = perFrame->GetItem(i + 1).GetNestedDataSet();
+
+            const std::vector<double> ipp = ReadFromMacro(frameGroup, 0x0020, 0x9113, 0x0020, 0x0032);
+            if (ipp.size() >= 3) {
+                std::copy(ipp.begin(), ipp.begin() + 3, positions.begin() + i * 3);
+                hasPosition[i] = true;
+            }
+            if (orientation.size() < 6) {
+                orientation = ReadFromMacro(frameGroup, 0x0020, 0x9116, 0x0020, 0x0037);
+            }
+            const std::vector<double> slope = ReadFromMacro(frameGroup, 0x0028, 0x9145, 0x0028, 0x1053);
+            const std::vector<double> intercept = ReadFromMacro(frameGroup, 0x0028, 0x9145, 0x0028, 0x1052);
+            if (!slope.empty() && slope[0] != 0.0) {
+                m_info.rescaleSlope[i] = slope[0];
+            }
+            if (!intercept.empty()) {
+                m_info.rescaleIntercept[i] = intercept[0];
+            }
+        }
+    }
+    m_info.outputType = SelectOutputType(m_info);
+
+    if (pixelSpacing.size() >= 2) {
+        // DICOM PixelSpacing 依次为行间距、列间距
+        m_info.spacing[0] = pixelSpacing[1] > 0.0 ? pixelSpacing[1] : 1.0;
+        m_info.spacing[1] = pixelSpacing[0] > 0.0 ? pixelSpacing[0] : 1.0;
+    }
+
+    double normal[3] = { 0.0, 0.0, 1.0 };
+    if (orientation.size() >= 6) {
+        normal[0] = orientation[1] * orientation[5] - orientation[2] * orientation[4];
+        normal[1] = orientation[2] * orientation[3] - orientation[0] * orientation[5];
+        normal[2] = orientation[0] * orientation[4] - orientation[1] * orientation[3];
+    }
+
+    m_info.frameForSlice.resize(frames);
+    std::iota(m_info.frameForSlice.begin(), m_info.frameForSlice.end(), 0u);
+
+    const bool allPositioned = std::all_of(hasPosition.begin(), hasPosition.end(), [](bool b) { return b; });
+    double sliceSpacing = 0.0;
+    if (allPositioned && frames > 1) {
+        std::vector<double> distance(frames);
+        for (unsigned int f = 0; f < frames; ++f) {
+            distance[f] = positions[f * 3] * normal[0] + positions[f * 3 + 1] * normal[1] +
+                          positions[f * 3 + 2] * normal[2];
+        }
+        std::stable_sort(m_info.frameForSlice.begin(), m_info.frameForSlice.end(),
+                         [&distance](unsigned int a, unsigned int b) { return distance[a] < distance[b]; });
+
+        std::vector<double> gaps;
+        gaps.reserve(frames - 1);
+        for (unsigned int s = 1; s < frames; ++s) {
+            const double gap = distance[m_info.frameForSlice[s]] - distance[m_info.frameForSlice[s - 1]];
+            if (gap > 1e-4) {
+                gaps.push_back(gap);
+            }
+        }
+        if (!gaps.empty()) {
+            std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+            sliceSpacing = gaps[gaps.size() / 2];
+        }
+    }
+    if (sliceSpacing <= 0.0) {
+        if (!betweenSlices.empty() && betweenSlices[0] > 0.0) {
+            sliceSpacing = betweenSlices[0];
+        } else if (!thickness.empty() && thickness[0] > 0.0) {
+            sliceSpacing = thickness[0];
+        } else {
+            sliceSpacing = 1.0;
+        }
+    }
+    m_info.spacing[2] = sliceSpacing;
+
+    if (hasPosition[m_info.frameForSlice.front()]) {
+        const unsigned int first = m_info.frameForSlice.front();
+        m_info.origin[0] = positions[first * 3];
+        m_info.origin[1] = positions[first * 3 + 1];
+        m_info.origin[2] = positions[first * 3 + 2];
+    } else {
+        const std::vector<double> ipp = ReadDicomDecimals(ds, 0x0020, 0x0032);
+        for (size_t i = 0; i < 3 && i < ipp.size(); ++i) {
+            m_info.origin[i] = ipp[i];
+        }
+    }
+    return true;
+}
+
+MultiFrameDecodeJob::MultiFrameDecodeJob(const MultiFrameInfo &info, void *volume,
+                                         std::shared_ptr<void> volumeOwner)
+    : m_info(info)
+    , m_volume(volume)
+    , m_volumeOwner(std::move(volumeOwner))
+    , m_state(new std::atomic<unsigned char>[info.frameCount])
+    , m_focus(info.frameCount / 2)
+    , m_decoded(0)
+    , m_failed(0)
+    , m_cancelled(false)
+{
+    for (unsigned int i = 0; i < m_info.frameCount; ++i) {
+        m_state[i].store(0);
+    }
+}
+
+MultiFrameDecodeJob::~MultiFrameDecodeJob()
+{
+    Cancel();
+    Wait();
+}
+
+bool MultiFrameDecodeJob::IsSliceDecoded(unsigned int slice) const
+{
+    return slice < m_info.frameCount && m_state[slice].load() == 2;
+}
+
+void MultiFrameDecodeJob::MarkDecoded(unsigned int slice)
+{
+    m_state[slice].store(2);
+    m_decoded.fetch_add(1);
+}
+
+bool MultiFrameDecodeJob::DecodeSlice(unsigned int slice)
+{
+    if (slice >= m_info.frameCount) {
+        return false;
+    }
+    unsigned char expected = 0;
+    if (!m_state[slice].compare_exchange_strong(expected, 1)) {
+        return expected == 2;
+    }
+
+    gdcm::ImageRegionReader regionReader;
+    regionReader.SetFileName(m_info.fileName.c_str());
+    std::vector<char> raw;
+    const bool ok = regionReader.ReadInformation() &&
+                    DecodeSliceWith(regionReader, m_info, slice, m_volume, raw);
+    // 失败的帧保持为 0，同样视为已处理，避免反复重试
+    if (!ok) {
+        m_failed.fetch_add(1);
+    }
+    MarkDecoded(slice);
+    return ok;
+}
+
+bool MultiFrameDecodeJob::ClaimNextSlice(unsigned int &slice)
+{
+    const unsigned int total = m_info.frameCount;
+    const unsigned int focus = std::min(m_focus.load(), total ? total - 1 : 0);
+    // 从焦点切片向两侧扩展，先解码当前显示附近的帧
+    auto tryClaim = [this, &slice](unsigned int s) {
+        unsigned char expected = 0;
+        if (m_state[s].load() == 0 && m_state[s].compare_exchange_strong(expected, 1)) {
+            slice = s;
+            return true;
+        }
+        return false;
+    };
+    for (unsigned int d = 0; d < total; ++d) {
+        const bool above = focus + d < total;
+        const bool below = d > 0 && d <= focus;
+        if (!above && !below) {
+            break;
+        }
+        if ((above && tryClaim(focus + d)) || (below && tryClaim(focus - d))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MultiFrameDecodeJob::WorkerLoop()
+{
+    gdcm::ImageRegionReader regionReader;
+    regionReader.SetFileName(m_info.fileName.c_str());
+    unsigned int slice = 0;
+    if (!regionReader.ReadInformation()) {
+        // 与 DecodeSlice 一致：文件无法读取时剩余帧保持为 0 并视为已处理，任务仍能结束并通知界面
+        while (ClaimNextSlice(slice)) {
+            m_failed.fetch_add(1);
+            MarkDecoded(slice);
+        }
+        ReportProgress(true);
+        return;
+    }
+
+    std::vector<char> raw;
+    while (!m_cancelled.load() && ClaimNextSlice(slice)) {
+        if (!DecodeSliceWith(regionReader, m_info, slice, m_volume, raw)) {
+            m_failed.fetch_add(1);
+        }
+        MarkDecoded(slice);
+        ReportProgress(false);
+    }
+}
+
+void MultiFrameDecodeJob::ReportProgress(bool force)
+{
+    if (!m_onProgress) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_progressMutex);
+    const auto now = std::chrono::steady_clock::now();
+    const unsigned int decoded = m_decoded.load();
+    const bool finished = decoded >= m_info.frameCount;
+    // 限制刷新频率，避免界面线程被大量重绘请求淹没
+    if (!force && !finished && now - m_lastReport < std::chrono::milliseconds(100)) {
+        return;
+    }
+    m_lastReport = now;
+    m_onProgress(decoded, m_info.frameCount);
+}
+
+void MultiFrameDecodeJob::Start(ThreadPool &pool, unsigned int workerCount, ProgressCallback onProgress)
+{
+    m_onProgress = std::move(onProgress);
+    m_lastReport = std::chrono::steady_clock::now();
+    workerCount = std::max(1u, workerCount);
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        m_workers.push_back(pool.Submit([this]() { WorkerLoop(); }));
+    }
+}
+
+void MultiFrameDecodeJob::Cancel()
+{
+    m_cancelled.store(true);
+}
+
+void MultiFrameDecodeJob::Wait()
+{
+    for (auto &worker : m_workers) {
+        if (worker.valid()) {
+            worker.wait();
+        }
+    }
+    m_workers.clear();
+}
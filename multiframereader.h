@@ -0,0 +1,117 @@
+﻿#ifndef MULTIFRAMEREADER_H
+#define MULTIFRAMEREADER_H
+
+#include "threadpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 解码输出的像素类型：由位深、符号与 Rescale 决定，保持原生精度
+enum class MultiFramePixelType
+{
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    Float32
+};
+
+// Enhanced (多帧) DICOM 的帧索引：几何信息与逐帧功能组只解析一次
+struct MultiFrameInfo
+{
+    std::string fileName;
+    unsigned int columns = 0;
+    unsigned int rows = 0;
+    unsigned int frameCount = 0;
+    unsigned short bitsAllocated = 16;
+    unsigned short bitsStored = 16;
+    bool isSigned = true;
+    MultiFramePixelType outputType = MultiFramePixelType::Int16;
+
+    double spacing[3] = { 1.0, 1.0, 1.0 };
+    double origin[3] = { 0.0, 0.0, 0.0 };
+
+    // 按切片位置排序后：切片 z 对应的帧号
+    std::vector<unsigned int> frameForSlice;
+    // 每帧的 Rescale Slope / Intercept（Pixel Value Transformation 功能组）
+    std::vector<double> rescaleSlope;
+    std::vector<double> rescaleIntercept;
+
+    std::string patientName;
+    std::string patientID;
+    std::string modality;
+
+    size_t SliceVoxelCount() const { return static_cast<size_t>(columns) * rows; }
+    size_t OutputPixelSize() const;
+};
+
+class MultiFrameDicomReader
+{
+public:
+    // 只读到像素数据 (7FE0,0010) 之前，建立帧索引
+    bool Open(const std::string &fileName, std::string *error = nullptr);
+
+    const MultiFrameInfo &GetInfo() const { return m_info; }
+
+    // 快速判断文件是否为多帧对象
+    static bool IsMultiFrameFile(const std::string &fileName);
+
+private:
+    MultiFrameInfo m_info;
+};
+
+// 后台逐帧解码任务：按与当前显示切片的距离由近及远解码，
+// 每个工作线程持有独立的 gdcm::ImageRegionReader，帧之间互不依赖
+class MultiFrameDecodeJob
+{
+public:
+    using ProgressCallback = std::function<void(unsigned int decoded, unsigned int total)>;
+
+    // volume 的元素类型须与 info.outputType 一致
+    MultiFrameDecodeJob(const MultiFrameInfo &info, void *volume,
+                        std::shared_ptr<void> volumeOwner);
+    ~MultiFrameDecodeJob();
+
+    // 在调用线程上同步解码指定切片（用于首帧显示）
+    bool DecodeSlice(unsigned int slice);
+
+    void Start(ThreadPool &pool, unsigned int workerCount, ProgressCallback onProgress);
+    void SetFocusSlice(unsigned int slice) { m_focus.store(slice); }
+    bool IsSliceDecoded(unsigned int slice) const;
+    bool IsFinished() const { return m_decoded.load() >= m_info.frameCount; }
+    // 解码失败（保持为 0）的帧数
+    unsigned int GetFailedCount() const { return m_failed.load(); }
+    void Cancel();
+    void Wait();
+
+private:
+    bool ClaimNextSlice(unsigned int &slice);
+    void WorkerLoop();
+    void ReportProgress(bool force);
+    void MarkDecoded(unsigned int slice);
+
+    MultiFrameInfo m_info;
+    void *m_volume;
+    std::shared_ptr<void> m_volumeOwner;
+
+    // 0 = 待解码, 1 = 已认领, 2 = 已完成
+    std::unique_ptr<std::atomic<unsigned char>[]> m_state;
+    std::atomic<unsigned int> m_focus;
+    std::atomic<unsigned int> m_decoded;
+    std::atomic<unsigned int> m_failed;
+    std::atomic<bool> m_cancelled;
+
+    ProgressCallback m_onProgress;
+    std::mutex m_progressMutex;
+    std::chrono::steady_clock::time_point m_lastReport;
+    std::vector<std::future<void>> m_workers;
+};
+
+#endif // MULTIFRAMEREADER_H
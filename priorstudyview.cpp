@@ -0,0 +1,166 @@
+﻿#include "priorstudyview.h"
+
+#include <QCloseEvent>
+#include <QHBoxLayout>
+#include <QVTKOpenGLNativeWidget.h>
+
+#include <vtkRenderer.h>
+#include <vtkRenderWindowInteractor.h>
+#include <vtkTextProperty.h>
+
+#include <algorithm>
+#include <cmath>
+
+PriorStudyView::PriorStudyView(QWidget *parent)
+    : QWidget(parent, Qt::Window)
+    , m_hasTransform(false)
+{
+    setWindowTitle(QStringLiteral("Prior"));
+    resize(960, 360);
+
+    auto *layout = new QHBoxLayout(this);
+    layout->setContentsMargins(2, 2, 2, 2);
+    layout->setSpacing(2);
+    for (int axis = 0; axis < 3; ++axis) {
+        m_views[axis] = new QVTKOpenGLNativeWidget(this);
+        m_windows[axis] = vtkSmartPointer<vtkGenericOpenGLRenderWindow>::New();
+        m_views[axis]->setRenderWindow(m_windows[axis]);
+        layout->addWidget(m_views[axis]);
+
+        m_viewers[axis] = vtkSmartPointer<vtkResliceImageViewer>::New();
+        m_viewers[axis]->SetRenderWindow(m_windows[axis]);
+        m_viewers[axis]->SetupInteractor(m_windows[axis]->GetInteractor());
+        m_viewers[axis]->SetSliceOrientation(axis);
+
+        m_annotations[axis] = vtkSmartPointer<vtkCornerAnnotation>::New();
+        m_annotations[axis]->GetTextProperty()->SetColor(1.0, 1.0, 0.0);
+        m_annotations[axis]->SetMaximumFontSize(14);
+        m_viewers[axis]->GetRenderer()->AddViewProp(m_annotations[axis]);
+    }
+}
+
+PriorStudyView::~PriorStudyView()
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        m_viewers[axis]->SetInputData(nullptr);
+    }
+}
+
+void PriorStudyView::SetStudy(LoadedStudy study, const QString &title)
+{
+    m_study = std::move(study);
+    m_title = title;
+    ClearPatientTransform();
+    setWindowTitle(QStringLiteral("Prior - %1").arg(m_title));
+    if (!m_study.image) {
+        ClearStudy();
+        return;
+    }
+
+    int dims[3];
+    m_study.image->GetDimensions(dims);
+    for (int axis = 0; axis < 3; ++axis) {
+        m_viewers[axis]->SetInputData(m_study.image);
+        m_viewers[axis]->SetSlice(dims[axis] / 2);
+        m_viewers[axis]->GetRenderer()->ResetCamera();
+    }
+    UpdateAnnotations();
+    for (int axis = 0; axis < 3; ++axis) {
+        m_viewers[axis]->Render();
+    }
+}
+
+void PriorStudyView::ClearStudy()
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        m_viewers[axis]->SetInputData(nullptr);
+        m_annotations[axis]->ClearAllTexts();
+        m_windows[axis]->Render();
+    }
+    // 归还内存预算
+    m_study = LoadedStudy();
+    ClearPatientTransform();
+}
+
+void PriorStudyView::SetPatientTransform(const PatientTransform &transform)
+{
+    m_transform = transform;
+    m_hasTransform = true;
+}
+
+void PriorStudyView::ClearPatientTransform()
+{
+    m_transform = PatientTransform();
+    m_hasTransform = false;
+}
+
+void PriorStudyView::closeEvent(QCloseEvent *event)
+{
+    ClearStudy();
+    setWindowTitle(QStringLiteral("Prior"));
+    QWidget::closeEvent(event);
+}
+
+void PriorStudyView::SyncToPatientPoint(const double lps[3])
+{
+    if (!m_study.image) {
+        return;
+    }
+    double point[3] = { lps[0], lps[1], lps[2] };
+    if (m_hasTransform) {
+        m_transform.Apply(lps, point);
+    }
+
+    // 方向矩阵为正交阵：ijk = S^-1 * D^T * (P - O)
+    const double *direction = m_study.metadata.direction;
+    double origin[3];
+    double spacing[3];
+    int extent[6];
+    m_study.image->GetOrigin(origin);
+    m_study.image->GetSpacing(spacing);
+    m_study.image->GetExtent(extent);
+    for (int axis = 0; axis < 3; ++axis) {
+        double distance = 0.0;
+        for (int r = 0; r < 3; ++r) {
+            distance += direction[r * 3 + axis] * (point[r] - origin[r]);
+        }
+        const double index = spacing[axis] != 0.0 ? distance / spacing[axis] : 0.0;
+        const int slice = std::clamp(static_cast<int>(std::lround(index)), extent[2 * axis], extent[2 * axis + 1]);
+        if (m_viewers[axis]->GetSlice() != slice) {
+            m_viewers[axis]->SetSlice(slice);
+        }
+    }
+    UpdateAnnotations();
+    for (int axis = 0; axis < 3; ++axis) {
+        m_viewers[axis]->Render();
+    }
+}
+
+void PriorStudyView::SetWindowLevel(double window, double level)
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        m_viewers[axis]->SetColorWindow(window);
+        m_viewers[axis]->SetColorLevel(level);
+        if (m_study.image) {
+            m_viewers[axis]->Render();
+        }
+    }
+}
+
+void PriorStudyView::ShowLoadProgress(size_t decoded, size_t total)
+{
+    setWindowTitle(QStringLiteral("Prior - loading %1/%2").arg(decoded).arg(total));
+}
+
+void PriorStudyView::UpdateAnnotations()
+{
+    int dims[3];
+    m_study.image->GetDimensions(dims);
+    for (int axis = 0; axis < 3; ++axis) {
+        const QString text = QStringLiteral("%1\nSlice: %2/%3")
+                                 .arg(m_hasTransform ? m_title + QStringLiteral(" (registered)") : m_title)
+                                 .arg(m_viewers[axis]->GetSlice() + 1)
+                                 .arg(dims[axis]);
+        m_annotations[axis]->SetText(vtkCornerAnnotation::UpperLeft, text.toUtf8().constData());
+    }
+}
@@ -0,0 +1,64 @@
+﻿#ifndef PRIORSTUDYVIEW_H
+#define PRIORSTUDYVIEW_H
+
+#include <QWidget>
+
+#include <vtkSmartPointer.h>
+#include <vtkResliceImageViewer.h>
+#include <vtkGenericOpenGLRenderWindow.h>
+#include <vtkCornerAnnotation.h>
+
+#include "studyloader.h"
+#include "imageregistration.h"
+
+class QVTKOpenGLNativeWidget;
+
+// 对比（既往）研究窗口：独立的一组矢状 / 冠状 / 轴位视图。切片位置经病人坐标 (LPS)
+// 与当前研究联动，两次检查的体素网格、层厚与方向可以不同；窗宽窗位跟随当前研究
+class PriorStudyView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit PriorStudyView(QWidget *parent = nullptr);
+    ~PriorStudyView() override;
+
+    // 接管加载结果（连同其内存预算），替换之前的对比研究
+    void SetStudy(LoadedStudy study, const QString &title);
+    void ClearStudy();
+    bool HasStudy() const { return static_cast<bool>(m_study.image); }
+    const LoadedStudy &GetStudy() const { return m_study; }
+
+    // 把当前研究中的病人坐标点定位到本研究最近的切片上（超出范围时停在边界层）；
+    // 有配准结果时先经配准变换映射到本研究的病人坐标
+    void SyncToPatientPoint(const double lps[3]);
+
+    // 当前研究 -> 本研究的配准变换，换研究时清除
+    void SetPatientTransform(const PatientTransform &transform);
+    void ClearPatientTransform();
+    bool HasPatientTransform() const { return m_hasTransform; }
+    const PatientTransform &GetPatientTransform() const { return m_transform; }
+    void SetWindowLevel(double window, double level);
+    // 加载期间在标题栏显示进度
+    void ShowLoadProgress(size_t decoded, size_t total);
+
+protected:
+    // 关闭窗口即释放对比研究及其内存预算
+    void closeEvent(QCloseEvent *event) override;
+
+private:
+    void UpdateAnnotations();
+
+    // 按轴：0=X 矢状, 1=Y 冠状, 2=Z 轴位
+    QVTKOpenGLNativeWidget *m_views[3];
+    vtkSmartPointer<vtkGenericOpenGLRenderWindow> m_windows[3];
+    vtkSmartPointer<vtkResliceImageViewer> m_viewers[3];
+    vtkSmartPointer<vtkCornerAnnotation> m_annotations[3];
+
+    LoadedStudy m_study;
+    QString m_title;
+    PatientTransform m_transform;
+    bool m_hasTransform;
+};
+
+#endif // PRIORSTUDYVIEW_H
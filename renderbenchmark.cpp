@@ -0,0 +1,268 @@
+﻿#include "renderbenchmark.h"
+
+#include "maskoverlay.h"
+#include "threadpool.h"
+
+#include <vtkAutoInit.h>
+VTK_MODULE_INIT(vtkRenderingOpenGL2);
+VTK_MODULE_INIT(vtkInteractionStyle);
+
+#include <vtkRenderWindow.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindowInteractor.h>
+#include <vtkResliceImageViewer.h>
+#include <vtkImagePlaneWidget.h>
+#include <vtkImageActor.h>
+#include <vtkImageProperty.h>
+#include <vtkPointData.h>
+#include <vtkProperty.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+namespace
+{
+
+vtkSmartPointer<vtkRenderWindow> CreateOffscreenWindow(const RenderBenchmarkOptions &options)
+{
+    auto window = vtkSmartPointer<vtkRenderWindow>::New();
+    window->SetOffScreenRendering(1);
+    window->SetSize(options.width, options.height);
+    return window;
+}
+
+// 在 [0, count) 内来回扫动，避免在末端跳回首层
+int PingPong(int frame, int count)
+{
+    if (count <= 1) {
+        return 0;
+    }
+    const int period = 2 * (count - 1);
+    const int t = frame % period;
+    return t < count ? t : period - t;
+}
+
+// step(frame) 改变状态并调用 Render()；每帧计时包含 WaitForCompletion，使软件与 GPU 渲染都计入完整耗时
+RenderLatencyStats Measure(const std::string &operation, vtkRenderWindow *window,
+                           const RenderBenchmarkOptions &options, const std::function<void(int)> &step)
+{
+    using Clock = std::chrono::steady_clock;
+    int frame = 0;
+    auto timeFrame = [&]() {
+        const Clock::time_point start = Clock::now();
+        step(frame++);
+        window->WaitForCompletion();
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    const double firstFrame = timeFrame();
+    for (int i = 0; i < options.warmupFrames; ++i) {
+        timeFrame();
+    }
+    std::vector<double> samples;
+    samples.reserve(static_cast<size_t>(std::max(options.frames, 0)));
+    for (int i = 0; i < options.frames; ++i) {
+        samples.push_back(timeFrame());
+    }
+    return SummarizeLatencies(operation, std::move(samples), firstFrame);
+}
+
+// 与体数据同网格的合成标签：两个同心球（标签 1 与 2），每层都有边界像素参与合成
+vtkSmartPointer<vtkImageData> CreateSphereMask(vtkImageData *volume)
+{
+    int dims[3];
+    volume->GetDimensions(dims);
+    auto mask = vtkSmartPointer<vtkImageData>::New();
+    mask->SetDimensions(dims);
+    mask->SetOrigin(volume->GetOrigin());
+    mask->SetSpacing(volume->GetSpacing());
+    mask->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+
+    const double center[3] = { 0.5 * (dims[0] - 1), 0.5 * (dims[1] - 1), 0.5 * (dims[2] - 1) };
+    const double outer = 0.4;
+    const double inner = 0.2;
+    auto *labels = static_cast<unsigned char *>(mask->GetScalarPointer());
+    const size_t sliceSize = static_cast<size_t>(dims[0]) * dims[1];
+    ThreadPool::Global().ParallelFor(0, static_cast<size_t>(dims[2]), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const double dz = (k - center[2]) / std::max(1, dims[2]);
+            for (int j = 0; j < dims[1]; ++j) {
+                const double dy = (j - center[1]) / std::max(1, dims[1]);
+                unsigned char *row = labels + sliceSize * k + static_cast<size_t>(j) * dims[0];
+                for (int i = 0; i < dims[0]; ++i) {
+                    const double dx = (i - center[0]) / std::max(1, dims[0]);
+                    const double r = std::sqrt(dx * dx + dy * dy + dz * dz);
+                    row[i] = r < inner ? 2 : (r < outer ? 1 : 0);
+                }
+            }
+        }
+    });
+    return mask;
+}
+
+vtkSmartPointer<vtkResliceImageViewer> CreateViewer(vtkRenderWindow *window, vtkImageData *volume,
+                                                    int axis, const RenderBenchmarkOptions &options)
+{
+    auto viewer = vtkSmartPointer<vtkResliceImageViewer>::New();
+    viewer->SetRenderWindow(window);
+    viewer->SetInputData(volume);
+    viewer->SetSliceOrientation(axis);
+    viewer->SetColorWindow(options.window);
+    viewer->SetColorLevel(options.level);
+    viewer->SetSlice((viewer->GetSliceMin() + viewer->GetSliceMax()) / 2);
+    viewer->GetRenderer()->ResetCamera();
+    return viewer;
+}
+
+} // namespace
+
+RenderLatencyStats SummarizeLatencies(const std::string &operation, std::vector<double> samples,
+                                      double firstFrame)
+{
+    RenderLatencyStats stats;
+    stats.operation = operation;
+    stats.frames = samples.size();
+    stats.firstFrame = firstFrame;
+    if (samples.empty()) {
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+        return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+    };
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    stats.mean = sum / samples.size();
+    stats.p50 = percentile(50.0);
+    stats.p95 = percentile(95.0);
+    stats.p99 = percentile(99.0);
+    stats.max = samples.back();
+    return stats;
+}
+
+bool RunRenderBenchmark(vtkImageData *volume, const RenderBenchmarkOptions &input,
+                        RenderBenchmarkReport &report, std::string *error)
+{
+    if (!volume || !volume->GetPointData()->GetScalars()) {
+        if (error) {
+            *error = "No volume to render.";
+        }
+        return false;
+    }
+
+    RenderBenchmarkOptions options = input;
+    if (options.window <= 0.0) {
+        double range[2];
+        volume->GetScalarRange(range);
+        options.window = std::max(range[1] - range[0], 1.0);
+        options.level = 0.5 * (range[0] + range[1]);
+    }
+
+    int dims[3];
+    volume->GetDimensions(dims);
+    report.operations.clear();
+
+    // 翻层：三个方向各用一个离屏窗口，与界面滑块驱动 SetSlice + Render 相同
+    const char *sliceNames[3] = { "slice_sagittal", "slice_coronal", "slice_axial" };
+    for (int axis = 0; axis < 3; ++axis) {
+        vtkSmartPointer<vtkRenderWindow> window = CreateOffscreenWindow(options);
+        if (axis == 0) {
+            report.renderWindowClass = window->GetClassName();
+        }
+        vtkSmartPointer<vtkResliceImageViewer> viewer = CreateViewer(window, volume, axis, options);
+        report.operations.push_back(Measure(sliceNames[axis], window, options, [&](int frame) {
+            viewer->SetSlice(PingPong(frame, dims[axis]));
+            viewer->Render();
+        }));
+    }
+
+    // 窗宽窗位：在初始窗宽的 0.5~1.5 倍、窗位 ±0.25 窗宽内连续扫动
+    {
+        vtkSmartPointer<vtkRenderWindow> window = CreateOffscreenWindow(options);
+        vtkSmartPointer<vtkResliceImageViewer> viewer = CreateViewer(window, volume, 2, options);
+        report.operations.push_back(Measure("window_level", window, options, [&](int frame) {
+            const double phase = 0.05 * frame;
+            viewer->SetColorWindow(options.window * (1.0 + 0.5 * std::sin(phase)));
+            viewer->SetColorLevel(options.level + 0.25 * options.window * std::cos(phase));
+            viewer->Render();
+        }));
+    }
+
+    // 掩膜叠加：与界面相同，叠加层只含当前切片，每次翻层重新合成 RGBA 后与图像一起渲染
+    {
+        vtkSmartPointer<vtkRenderWindow> window = CreateOffscreenWindow(options);
+        vtkSmartPointer<vtkResliceImageViewer> viewer = CreateViewer(window, volume, 2, options);
+        vtkSmartPointer<vtkImageData> mask = CreateSphereMask(volume);
+        vtkSmartPointer<vtkLookupTable> lut = CreateMaskLookupTable();
+        MaskOverlayLayer layer;
+        layer.labels = mask->GetScalarPointer();
+        layer.dims[0] = dims[0];
+        layer.dims[1] = dims[1];
+        layer.dims[2] = dims[2];
+        layer.opacity = 0.5;
+        const std::vector<MaskOverlayLayer> layers{ layer };
+
+        auto overlay = vtkSmartPointer<vtkImageData>::New();
+        overlay->SetOrigin(volume->GetOrigin());
+        overlay->SetSpacing(volume->GetSpacing());
+        auto actor = vtkSmartPointer<vtkImageActor>::New();
+        actor->SetInputData(overlay);
+        actor->PickableOff();
+        viewer->GetRenderer()->AddActor(actor);
+
+        report.operations.push_back(Measure("mask_overlay_axial", window, options, [&](int frame) {
+            const int slice = PingPong(frame, dims[2]);
+            viewer->SetSlice(slice);
+            const int extent[6] = { 0, dims[0] - 1, 0, dims[1] - 1, slice, slice };
+            overlay->SetExtent(extent);
+            overlay->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+            CompositeMaskLayers(layers, lut, extent, extent,
+                                static_cast<unsigned char *>(overlay->GetScalarPointer()));
+            overlay->Modified();
+            viewer->Render();
+        }));
+    }
+
+    // 3D 切片平面：与界面相同的三个 vtkImagePlaneWidget，依次移动其中一个后渲染
+    {
+        vtkSmartPointer<vtkRenderWindow> window = CreateOffscreenWindow(options);
+        auto renderer = vtkSmartPointer<vtkRenderer>::New();
+        window->AddRenderer(renderer);
+        auto interactor = vtkSmartPointer<vtkRenderWindowInteractor>::New();
+        interactor->SetRenderWindow(window);
+
+        vtkSmartPointer<vtkImagePlaneWidget> planes[3];
+        const double colors[3][3] = { { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 }, { 1.0, 0.0, 0.0 } };
+        for (int axis = 0; axis < 3; ++axis) {
+            planes[axis] = vtkSmartPointer<vtkImagePlaneWidget>::New();
+            planes[axis]->SetInteractor(interactor);
+            planes[axis]->SetDefaultRenderer(renderer);
+            planes[axis]->SetInputData(volume);
+            planes[axis]->SetPlaneOrientation(axis);
+            planes[axis]->SetSliceIndex(dims[axis] / 2);
+            planes[axis]->SetWindowLevel(options.window, options.level);
+            planes[axis]->DisplayTextOff();
+            planes[axis]->SetMarginSizeX(0);
+            planes[axis]->SetMarginSizeY(0);
+            planes[axis]->GetPlaneProperty()->SetColor(colors[axis][0], colors[axis][1], colors[axis][2]);
+            planes[axis]->On();
+            planes[axis]->InteractionOff();
+        }
+        renderer->ResetCamera();
+
+        report.operations.push_back(Measure("plane_3d", window, options, [&](int frame) {
+            const int axis = frame % 3;
+            planes[axis]->SetSliceIndex(PingPong(frame / 3, dims[axis]));
+            window->Render();
+        }));
+        for (int axis = 0; axis < 3; ++axis) {
+            planes[axis]->Off();
+        }
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+﻿#ifndef RENDERBENCHMARK_H
+#define RENDERBENCHMARK_H
+
+#include <vtkImageData.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct RenderBenchmarkOptions
+{
+    int width = 512;
+    int height = 512;
+    int frames = 200;          // 每项操作计时的帧数
+    int warmupFrames = 5;      // 不计时的预热帧（着色器编译、纹理上传）
+    double window = 0.0;       // 初始窗宽窗位；window <= 0 时取标量范围
+    double level = 0.0;
+};
+
+// 一项操作的逐帧延迟（毫秒）：从改变状态到 Render() 完成并等待 GPU 结束
+struct RenderLatencyStats
+{
+    std::string operation;
+    size_t frames = 0;
+    double firstFrame = 0.0;   // 预热前的第一帧，含首次上传与编译
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+struct RenderBenchmarkReport
+{
+    std::string renderWindowClass;
+    std::vector<RenderLatencyStats> operations;
+};
+
+// 离屏驱动与界面相同的交互路径：三个 vtkResliceImageViewer 的翻层、窗宽窗位扫动、
+// 带掩膜叠加层的翻层（与界面相同按切片合成 RGBA），以及 3D 视图中三个切片平面的移动。
+// 离屏窗口类型由 VTK 构建决定（OSMesa / EGL 构建即为无 GPU 的软件渲染）
+bool RunRenderBenchmark(vtkImageData *volume, const RenderBenchmarkOptions &options,
+                        RenderBenchmarkReport &report, std::string *error = nullptr);
+
+// 按最近秩法计算百分位
+RenderLatencyStats SummarizeLatencies(const std::string &operation, std::vector<double> samples,
+                                      double firstFrame);
+
+#endif // RENDERBENCHMARK_H
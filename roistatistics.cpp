@@ -0,0 +1,209 @@
+﻿#include "roistatistics.h"
+
+#include <vtkPointData.h>
+#include <vtkSetGet.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// 逐行累加前缀和：S(u + 1, v + 1) = 行内前缀 + S(u + 1, v)
+template <typename T>
+void BuildTables(const T *base, vtkIdType uStride, vtkIdType vStride, int width, int height,
+                 double offset, double *sum, double *sumSquares)
+{
+    const size_t stride = static_cast<size_t>(width) + 1;
+    for (int v = 0; v < height; ++v) {
+        const T *row = base + v * vStride;
+        const double *sumAbove = sum + stride * v;
+        const double *squaresAbove = sumSquares + stride * v;
+        double *sumRow = sum + stride * (v + 1);
+        double *squaresRow = sumSquares + stride * (v + 1);
+        double rowSum = 0.0;
+        double rowSquares = 0.0;
+        for (int u = 0; u < width; ++u) {
+            const double value = static_cast<double>(row[u * uStride]) - offset;
+            rowSum += value;
+            rowSquares += value * value;
+            sumRow[u + 1] = sumAbove[u + 1] + rowSum;
+            squaresRow[u + 1] = squaresAbove[u + 1] + rowSquares;
+        }
+    }
+}
+
+} // namespace
+
+bool SliceIntegralImage::Build(vtkImageData *image, int axis, int slice)
+{
+    if (!image || axis < 0 || axis > 2 || !image->GetPointData()->GetScalars()) {
+        return false;
+    }
+    int extent[6];
+    image->GetExtent(extent);
+    if (slice < extent[2 * axis] || slice > extent[2 * axis + 1]) {
+        return false;
+    }
+
+    const int uAxis = axis == 0 ? 1 : 0;
+    const int vAxis = axis == 2 ? 1 : 2;
+    m_uMin = extent[2 * uAxis];
+    m_vMin = extent[2 * vAxis];
+    m_width = extent[2 * uAxis + 1] - m_uMin + 1;
+    m_height = extent[2 * vAxis + 1] - m_vMin + 1;
+
+    vtkIdType increments[3];
+    image->GetIncrements(increments);
+    int ijk[3];
+    ijk[axis] = slice;
+    ijk[uAxis] = m_uMin;
+    ijk[vAxis] = m_vMin;
+    const void *base = image->GetScalarPointer(ijk);
+    m_offset = image->GetScalarComponentAsDouble(ijk[0], ijk[1], ijk[2], 0);
+
+    const size_t tableSize = (static_cast<size_t>(m_width) + 1) * (static_cast<size_t>(m_height) + 1);
+    m_sum.assign(tableSize, 0.0);
+    m_sumSquares.assign(tableSize, 0.0);
+    switch (image->GetScalarType()) {
+        vtkTemplateMacro(BuildTables(static_cast<const VTK_TT *>(base), increments[uAxis], increments[vAxis],
+                                     m_width, m_height, m_offset, m_sum.data(), m_sumSquares.data()));
+    default:
+        return false;
+    }
+    return true;
+}
+
+void SliceIntegralImage::AddSpan(int v, int u0, int u1, Accumulator &acc) const
+{
+    u0 = std::max(u0, 0);
+    u1 = std::min(u1, m_width - 1);
+    if (v < 0 || v >= m_height || u0 > u1) {
+        return;
+    }
+    const size_t stride = static_cast<size_t>(m_width) + 1;
+    const size_t below = stride * (v + 1);
+    const size_t above = stride * v;
+    acc.count += static_cast<size_t>(u1 - u0 + 1);
+    acc.sum += m_sum[below + u1 + 1] - m_sum[below + u0] - m_sum[above + u1 + 1] + m_sum[above + u0];
+    acc.sumSquares += m_sumSquares[below + u1 + 1] - m_sumSquares[below + u0] -
+                      m_sumSquares[above + u1 + 1] + m_sumSquares[above + u0];
+}
+
+RoiStatistics SliceIntegralImage::Finish(const Accumulator &acc) const
+{
+    RoiStatistics stats;
+    if (acc.count == 0) {
+        return stats;
+    }
+    const double n = static_cast<double>(acc.count);
+    const double mean = acc.sum / n;
+    stats.count = acc.count;
+    stats.mean = mean + m_offset;
+    stats.stdDev = std::sqrt(std::max(0.0, acc.sumSquares / n - mean * mean));
+    return stats;
+}
+
+RoiStatistics SliceIntegralImage::Rectangle(int u0, int v0, int u1, int v1) const
+{
+    const int uLow = std::max(std::min(u0, u1) - m_uMin, 0);
+    const int uHigh = std::min(std::max(u0, u1) - m_uMin, m_width - 1);
+    const int vLow = std::max(std::min(v0, v1) - m_vMin, 0);
+    const int vHigh = std::min(std::max(v0, v1) - m_vMin, m_height - 1);
+    Accumulator acc;
+    if (uLow > uHigh || vLow > vHigh) {
+        return Finish(acc);
+    }
+
+    // 整个矩形直接四角查表，与区域大小无关
+    const size_t stride = static_cast<size_t>(m_width) + 1;
+    const size_t bottom = stride * (vHigh + 1);
+    const size_t top = stride * vLow;
+    acc.count = static_cast<size_t>(uHigh - uLow + 1) * static_cast<size_t>(vHigh - vLow + 1);
+    acc.sum = m_sum[bottom + uHigh + 1] - m_sum[bottom + uLow] - m_sum[top + uHigh + 1] + m_sum[top + uLow];
+    acc.sumSquares = m_sumSquares[bottom + uHigh + 1] - m_sumSquares[bottom + uLow] -
+                     m_sumSquares[top + uHigh + 1] + m_sumSquares[top + uLow];
+    return Finish(acc);
+}
+
+RoiStatistics SliceIntegralImage::Ellipse(double cu, double cv, double ru, double rv) const
+{
+    Accumulator acc;
+    if (!(ru > 0.0) || !(rv > 0.0)) {
+        return Finish(acc);
+    }
+    cu -= m_uMin;
+    cv -= m_vMin;
+    const int vBegin = std::max(0, static_cast<int>(std::ceil(cv - rv)));
+    const int vEnd = std::min(m_height - 1, static_cast<int>(std::floor(cv + rv)));
+    for (int v = vBegin; v <= vEnd; ++v) {
+        const double d = (v - cv) / rv;
+        if (d * d > 1.0) {
+            continue;
+        }
+        const double half = ru * std::sqrt(1.0 - d * d);
+        AddSpan(v, static_cast<int>(std::ceil(cu - half)), static_cast<int>(std::floor(cu + half)), acc);
+    }
+    return Finish(acc);
+}
+
+RoiStatistics SliceIntegralImage::Polygon(const std::vector<std::array<double, 2>> &vertices) const
+{
+    Accumulator acc;
+    if (vertices.size() < 3) {
+        return Finish(acc);
+    }
+
+    double vLow = vertices.front()[1];
+    double vHigh = vLow;
+    for (const std::array<double, 2> &p : vertices) {
+        vLow = std::min(vLow, p[1]);
+        vHigh = std::max(vHigh, p[1]);
+    }
+    const int vBegin = std::max(0, static_cast<int>(std::ceil(vLow - m_vMin)));
+    const int vEnd = std::min(m_height - 1, static_cast<int>(std::floor(vHigh - m_vMin)));
+
+    // 每行与各边求交（下端闭、上端开，顶点不重复计数），交点两两配对成跨度
+    std::vector<double> crossings;
+    for (int v = vBegin; v <= vEnd; ++v) {
+        const double y = v + m_vMin;
+        crossings.clear();
+        for (size_t i = 0, j = vertices.size() - 1; i < vertices.size(); j = i++) {
+            const std::array<double, 2> &a = vertices[j];
+            const std::array<double, 2> &b = vertices[i];
+            if ((a[1] <= y) != (b[1] <= y)) {
+                crossings.push_back(a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]) - m_uMin);
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            AddSpan(v, static_cast<int>(std::ceil(crossings[i])), static_cast<int>(std::ceil(crossings[i + 1])) - 1,
+                    acc);
+        }
+    }
+    return Finish(acc);
+}
+
+const SliceIntegralImage *RoiStatisticsCache::Get(vtkImageData *image, int axis, int slice)
+{
+    if (!image) {
+        return nullptr;
+    }
+    const vtkMTimeType mtime = image->GetMTime();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->image == image && it->mtime == mtime && it->axis == axis && it->slice == slice) {
+            m_entries.splice(m_entries.begin(), m_entries, it);
+            return m_entries.front().table.get();
+        }
+    }
+
+    auto table = std::make_unique<SliceIntegralImage>();
+    if (!table->Build(image, axis, slice)) {
+        return nullptr;
+    }
+    m_entries.push_front(Entry{ image, mtime, axis, slice, std::move(table) });
+    while (m_entries.size() > std::max<size_t>(m_capacity, 1)) {
+        m_entries.pop_back();
+    }
+    return m_entries.front().table.get();
+}
@@ -0,0 +1,85 @@
+﻿#ifndef ROISTATISTICS_H
+#define ROISTATISTICS_H
+
+#include <vtkImageData.h>
+#include <vtkType.h>
+
+#include <array>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <vector>
+
+// 区域内体素数、均值与总体标准差
+struct RoiStatistics
+{
+    size_t count = 0;
+    double mean = 0.0;
+    double stdDev = 0.0;
+};
+
+// 一层切片的积分图（summed-area table）：同时累加灰度与灰度平方，
+// 任意轴对齐矩形的和与平方和都只需四次查表。平面坐标 (u, v) 为法线轴以外的两轴按升序，
+// 下列接口的坐标均为体素索引；像素中心落在区域内即计入
+class SliceIntegralImage
+{
+public:
+    // 取出 image 中法线为 axis 的第 slice 层（须在 image 的 extent 内）
+    bool Build(vtkImageData *image, int axis, int slice);
+
+    // [u0, u1] x [v0, v1] 闭区间，自动裁剪到切片内，O(1)
+    RoiStatistics Rectangle(int u0, int v0, int u1, int v1) const;
+    // 中心 (cu, cv)、半轴 (ru, rv) 的轴对齐椭圆，逐行求跨度后查表，O(行数)
+    RoiStatistics Ellipse(double cu, double cv, double ru, double rv) const;
+    // 任意多边形按奇偶规则扫描线求各行跨度，O(行数 x 边数)
+    RoiStatistics Polygon(const std::vector<std::array<double, 2>> &vertices) const;
+
+private:
+    struct Accumulator
+    {
+        size_t count = 0;
+        double sum = 0.0;
+        double sumSquares = 0.0;
+    };
+
+    // 把第 v 行 [u0, u1] 的跨度累加到 acc（坐标已相对于 extent 起点）
+    void AddSpan(int v, int u0, int u1, Accumulator &acc) const;
+    RoiStatistics Finish(const Accumulator &acc) const;
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_uMin = 0;
+    int m_vMin = 0;
+    // 累加前减去的偏移，避免平方和在 HU 这类带大常数的数据上损失精度
+    double m_offset = 0.0;
+    // (width + 1) x (height + 1)，第 0 行与第 0 列为 0
+    std::vector<double> m_sum;
+    std::vector<double> m_sumSquares;
+};
+
+// 每个视图缓存最近几层的积分图，首次在某层上统计时才构建；
+// 图像对象或其修改时间变化（换序列、外存模式重新取层、插入切片）后自动失效
+class RoiStatisticsCache
+{
+public:
+    explicit RoiStatisticsCache(size_t capacity = 4) : m_capacity(capacity) {}
+
+    const SliceIntegralImage *Get(vtkImageData *image, int axis, int slice);
+    void Clear() { m_entries.clear(); }
+
+private:
+    struct Entry
+    {
+        vtkImageData *image;
+        vtkMTimeType mtime;
+        int axis;
+        int slice;
+        std::unique_ptr<SliceIntegralImage> table;
+    };
+
+    size_t m_capacity;
+    // 最近使用的在前
+    std::list<Entry> m_entries;
+};
+
+#endif // ROISTATISTICS_H
@@ -0,0 +1,332 @@
+﻿#include "rtstruct.h"
+#include "dicomdataset.h"
+
+#include <gdcmReader.h>
+#include <gdcmDataSet.h>
+#include <gdcmSequenceOfItems.h>
+
+#include <vtkType.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace
+{
+
+const char *const RtStructureSetStorageUID = "1.2.840.10008.5.1.4.1.1.481.3";
+
+bool SameGrid(const SegmentationGrid &a, const SegmentationGrid &b)
+{
+    return std::equal(std::begin(a.dims), std::end(a.dims), std::begin(b.dims)) &&
+           std::equal(std::begin(a.origin), std::end(a.origin), std::begin(b.origin)) &&
+           std::equal(std::begin(a.spacing), std::end(a.spacing), std::begin(b.spacing)) &&
+           std::equal(std::begin(a.direction), std::end(a.direction), std::begin(b.direction));
+}
+
+// 同一 ROI 落在同一层上的所有轮廓（顶点已变换为网格索引 (i, j)）
+struct SliceContours
+{
+    size_t roi;
+    int slice;
+    std::vector<std::vector<std::array<double, 2>>> polygons;
+};
+
+// 逐行与所有轮廓的边求交（下端闭、上端开，顶点不重复计数），交点两两配对成跨度；
+// 像素中心落在区域内即计入，与 SliceIntegralImage::Polygon 的规则一致
+void ScanConvert(const SliceContours &contours, const int dims[3], std::vector<RasterSpan> &spans)
+{
+    double vLow = std::numeric_limits<double>::max();
+    double vHigh = std::numeric_limits<double>::lowest();
+    for (const auto &polygon : contours.polygons) {
+        for (const std::array<double, 2> &p : polygon) {
+            vLow = std::min(vLow, p[1]);
+            vHigh = std::max(vHigh, p[1]);
+        }
+    }
+    const int vBegin = std::max(0, static_cast<int>(std::ceil(vLow)));
+    const int vEnd = std::min(dims[1] - 1, static_cast<int>(std::floor(vHigh)));
+
+    std::vector<double> crossings;
+    for (int v = vBegin; v <= vEnd; ++v) {
+        const double y = v;
+        crossings.clear();
+        for (const auto &polygon : contours.polygons) {
+            for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+                const std::array<double, 2> &a = polygon[j];
+                const std::array<double, 2> &b = polygon[i];
+                if ((a[1] <= y) != (b[1] <= y)) {
+                    crossings.push_back(a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]));
+                }
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            const int begin = std::max(0, static_cast<int>(std::ceil(crossings[i])));
+            const int end = std::min(dims[0] - 1, static_cast<int>(std::ceil(crossings[i + 1])) - 1);
+            if (begin <= end) {
+                spans.push_back(RasterSpan{ contours.slice, v, begin, end });
+            }
+        }
+    }
+}
+
+template <typename T>
+size_t FillSlice(const std::vector<std::pair<T, const RasterSpan *>> &spans, const int dims[3], int slice,
+                 T *labels)
+{
+    const size_t sliceSize = static_cast<size_t>(dims[0]) * dims[1];
+    T *dst = labels + sliceSize * slice;
+    for (const auto &entry : spans) {
+        const RasterSpan &span = *entry.second;
+        std::fill(dst + static_cast<size_t>(span.row) * dims[0] + span.begin,
+                  dst + static_cast<size_t>(span.row) * dims[0] + span.end + 1, entry.first);
+    }
+    return spans.empty() ? 0 : sliceSize - static_cast<size_t>(std::count(dst, dst + sliceSize, T(0)));
+}
+
+} // namespace
+
+bool RtStructReader::IsRtStructFile(const std::string &fileName)
+{
+    return IsDicomObjectOfClass(fileName, RtStructureSetStorageUID, "RTSTRUCT");
+}
+
+bool RtStructReader::Open(const std::string &fileName, std::string *error)
+{
+    *this = RtStructReader();
+
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.c_str());
+    if (!reader.Read()) {
+        return fail("Cannot parse DICOM file: " + fileName);
+    }
+    const gdcm::DataSet &ds = reader.GetFile().GetDataSet();
+    if (ReadDicomString(ds, 0x0008, 0x0016) != RtStructureSetStorageUID && ReadDicomString(ds, 0x0008, 0x0060) != "RTSTRUCT") {
+        return fail("Not an RT Structure Set: " + fileName);
+    }
+    m_structureSetUID = ReadDicomString(ds, 0x0008, 0x0018);
+    m_structureSetLabel = ReadDicomString(ds, 0x3006, 0x0002);
+
+    // Structure Set ROI Sequence (3006,0020)：ROI 编号与名称
+    const gdcm::Tag roiTag(0x3006, 0x0020);
+    if (ds.FindDataElement(roiTag)) {
+        gdcm::SmartPointer<gdcm::SequenceOfItems> sq = ds.GetDataElement(roiTag).GetValueAsSQ();
+        const size_t items = sq ? sq->GetNumberOfItems() : 0;
+        for (size_t i = 0; i < items; ++i) {
+            const gdcm::DataSet &item = sq->GetItem(i + 1).GetNestedDataSet();
+            RtStructRoi roi;
+            roi.number = std::atoi(ReadDicomString(item, 0x3006, 0x0022).c_str());
+            roi.name = ReadDicomString(item, 0x3006, 0x0026);
+            if (roi.number <= 0) {
+                continue;
+            }
+            if (roi.name.empty()) {
+                roi.name = "ROI " + std::to_string(roi.number);
+            }
+            m_rois.push_back(std::move(roi));
+        }
+    }
+
+    // ROI Contour Sequence (3006,0039)：按 Referenced ROI Number 归到各 ROI，只取闭合平面轮廓
+    const gdcm::Tag contourSetTag(0x3006, 0x0039);
+    if (ds.FindDataElement(contourSetTag)) {
+        gdcm::SmartPointer<gdcm::SequenceOfItems> sq = ds.GetDataElement(contourSetTag).GetValueAsSQ();
+        const size_t items = sq ? sq->GetNumberOfItems() : 0;
+        for (size_t i = 0; i < items; ++i) {
+            const gdcm::DataSet &item = sq->GetItem(i + 1).GetNestedDataSet();
+            const int number = std::atoi(ReadDicomString(item, 0x3006, 0x0084).c_str());
+            auto roi = std::find_if(m_rois.begin(), m_rois.end(),
+                                    [number](const RtStructRoi &r) { return r.number == number; });
+            const gdcm::Tag contourTag(0x3006, 0x0040);
+            if (roi == m_rois.end() || !item.FindDataElement(contourTag)) {
+                continue;
+            }
+            gdcm::SmartPointer<gdcm::SequenceOfItems> contours = item.GetDataElement(contourTag).GetValueAsSQ();
+            const size_t contourCount = contours ? contours->GetNumberOfItems() : 0;
+            for (size_t c = 0; c < contourCount; ++c) {
+                const gdcm::DataSet &contour = contours->GetItem(c + 1).GetNestedDataSet();
+                if (ReadDicomString(contour, 0x3006, 0x0042) != "CLOSED_PLANAR") {
+                    continue;
+                }
+                std::vector<double> points = ReadDicomDecimals(contour, 0x3006, 0x0050);
+                points.resize(points.size() / 3 * 3);
+                if (points.size() >= 9) {
+                    roi->contours.push_back(std::move(points));
+                }
+            }
+        }
+    }
+
+    m_rois.erase(std::remove_if(m_rois.begin(), m_rois.end(),
+                                [](const RtStructRoi &roi) { return roi.contours.empty(); }),
+                 m_rois.end());
+    if (m_rois.empty()) {
+        return fail("Structure set has no closed planar contours: " + fileName);
+    }
+    return true;
+}
+
+bool RasterizeRois(const std::vector<const RtStructRoi *> &rois, const SegmentationGrid &grid,
+                   std::vector<std::vector<RasterSpan>> &spans, ThreadPool &pool)
+{
+    double matrix[9];
+    double offset[3];
+    if (!PatientToGridIndex(grid, matrix, offset)) {
+        return false;
+    }
+
+    // 顶点变换到网格索引后按 (ROI, 层) 分组
+    std::vector<SliceContours> tasks;
+    for (size_t r = 0; r < rois.size(); ++r) {
+        std::map<int, size_t> taskForSlice;
+        for (const std::vector<double> &points : rois[r]->contours) {
+            const size_t count = points.size() / 3;
+            std::vector<std::array<double, 2>> polygon(count);
+            double kSum = 0.0;
+            for (size_t p = 0; p < count; ++p) {
+                double ijk[3];
+                for (int a = 0; a < 3; ++a) {
+                    ijk[a] = offset[a] + matrix[a * 3] * points[p * 3] + matrix[a * 3 + 1] * points[p * 3 + 1] +
+                             matrix[a * 3 + 2] * points[p * 3 + 2];
+                }
+                polygon[p] = { ijk[0], ijk[1] };
+                kSum += ijk[2];
+            }
+            const int slice = static_cast<int>(std::floor(kSum / count + 0.5));
+            if (slice < 0 || slice >= grid.dims[2]) {
+                continue;
+            }
+            auto found = taskForSlice.find(slice);
+            if (found == taskForSlice.end()) {
+                found = taskForSlice.emplace(slice, tasks.size()).first;
+                tasks.push_back(SliceContours{ r, slice, {} });
+            }
+            tasks[found->second].polygons.push_back(std::move(polygon));
+        }
+    }
+
+    std::vector<std::vector<RasterSpan>> taskSpans(tasks.size());
+    pool.ParallelFor(0, tasks.size(), [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            ScanConvert(tasks[t], grid.dims, taskSpans[t]);
+        }
+    });
+
+    spans.assign(rois.size(), std::vector<RasterSpan>());
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        std::vector<RasterSpan> &dst = spans[tasks[t].roi];
+        dst.insert(dst.end(), taskSpans[t].begin(), taskSpans[t].end());
+    }
+    return true;
+}
+
+RtStructRasterCache::Entry &RtStructRasterCache::Lookup(const std::string &structureSetUID,
+                                                        const SegmentationGrid &grid)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->structureSetUID == structureSetUID) {
+            m_entries.splice(m_entries.begin(), m_entries, it);
+            Entry &entry = m_entries.front();
+            if (!SameGrid(entry.grid, grid)) {
+                entry.grid = grid;
+                entry.spans.clear();
+            }
+            return entry;
+        }
+    }
+
+    m_entries.push_front(Entry{ structureSetUID, grid, {} });
+    while (m_entries.size() > std::max<size_t>(m_capacity, 1)) {
+        m_entries.pop_back();
+    }
+    return m_entries.front();
+}
+
+vtkSmartPointer<vtkImageData> RtStructRasterCache::BuildLabels(const RtStructReader &reader,
+                                                               const std::vector<size_t> &roiIndices,
+                                                               const SegmentationGrid &grid, size_t *voxelCount,
+                                                               std::string *error, ThreadPool &pool)
+{
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return vtkSmartPointer<vtkImageData>();
+    };
+
+    const std::vector<RtStructRoi> &rois = reader.GetRois();
+    bool wideLabels = false;
+    for (size_t index : roiIndices) {
+        if (index >= rois.size()) {
+            return fail("ROI index out of range");
+        }
+        wideLabels = wideLabels || rois[index].number > 255;
+    }
+
+    // 只栅格化缓存中还没有的 ROI
+    Entry &entry = Lookup(reader.GetStructureSetUID(), grid);
+    std::vector<const RtStructRoi *> missing;
+    for (size_t index : roiIndices) {
+        const RtStructRoi *roi = &rois[index];
+        if (!entry.spans.count(roi->number) && std::find(missing.begin(), missing.end(), roi) == missing.end()) {
+            missing.push_back(roi);
+        }
+    }
+    if (!missing.empty()) {
+        std::vector<std::vector<RasterSpan>> rasterized;
+        if (!RasterizeRois(missing, grid, rasterized, pool)) {
+            return fail("Invalid reference image geometry");
+        }
+        for (size_t i = 0; i < missing.size(); ++i) {
+            entry.spans[missing[i]->number] = std::move(rasterized[i]);
+        }
+    }
+
+    vtkSmartPointer<vtkImageData> labels = vtkSmartPointer<vtkImageData>::New();
+    labels->SetDimensions(grid.dims[0], grid.dims[1], grid.dims[2]);
+    labels->SetSpacing(grid.spacing[0], grid.spacing[1], grid.spacing[2]);
+    labels->SetOrigin(grid.origin[0], grid.origin[1], grid.origin[2]);
+    labels->AllocateScalars(wideLabels ? VTK_SHORT : VTK_UNSIGNED_CHAR, 1);
+    std::memset(labels->GetScalarPointer(), 0,
+                static_cast<size_t>(labels->GetNumberOfPoints()) * (wideLabels ? sizeof(short) : 1));
+
+    // 跨度按层归组后各层并行填充，同层内按 ROI 顺序写入
+    auto fill = [&](auto *scalars) {
+        using T = std::remove_pointer_t<decltype(scalars)>;
+        std::vector<std::vector<std::pair<T, const RasterSpan *>>> bySlice(static_cast<size_t>(grid.dims[2]));
+        for (size_t index : roiIndices) {
+            const T label = static_cast<T>(std::min(rois[index].number, 32767));
+            for (const RasterSpan &span : entry.spans[rois[index].number]) {
+                bySlice[span.slice].emplace_back(label, &span);
+            }
+        }
+        std::atomic<size_t> filled{ 0 };
+        pool.ParallelFor(0, bySlice.size(), [&](size_t begin, size_t end) {
+            size_t localFilled = 0;
+            for (size_t k = begin; k < end; ++k) {
+                localFilled += FillSlice(bySlice[k], grid.dims, static_cast<int>(k), scalars);
+            }
+            filled += localFilled;
+        });
+        return filled.load();
+    };
+    const size_t filled = wideLabels ? fill(static_cast<short *>(labels->GetScalarPointer()))
+                                     : fill(static_cast<unsigned char *>(labels->GetScalarPointer()));
+    if (voxelCount) {
+        *voxelCount = filled;
+    }
+    return labels;
+}
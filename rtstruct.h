@@ -0,0 +1,87 @@
+﻿#ifndef RTSTRUCT_H
+#define RTSTRUCT_H
+
+#include "dicomseg.h"
+#include "threadpool.h"
+
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// RTSTRUCT 中的一个 ROI：只保留闭合平面轮廓，顶点为病人坐标 (x, y, z) 三元组（mm）
+struct RtStructRoi
+{
+    int number = 0;                            // ROI Number，输出标签体中的标签值
+    std::string name;                          // ROI Name
+    std::vector<std::vector<double>> contours;
+};
+
+// 一个 ROI 栅格化后在网格上的行跨度：第 slice 层第 row 行的 [begin, end] 闭区间
+struct RasterSpan
+{
+    int slice;
+    int row;
+    int begin;
+    int end;
+};
+
+class RtStructReader
+{
+public:
+    bool Open(const std::string &fileName, std::string *error = nullptr);
+
+    // SOP Instance UID，作为栅格化结果的缓存键
+    const std::string &GetStructureSetUID() const { return m_structureSetUID; }
+    const std::string &GetStructureSetLabel() const { return m_structureSetLabel; }
+    const std::vector<RtStructRoi> &GetRois() const { return m_rois; }
+
+    // 按 SOP Class UID / Modality 判断文件是否为 RT Structure Set
+    static bool IsRtStructFile(const std::string &fileName);
+
+private:
+    std::string m_structureSetUID;
+    std::string m_structureSetLabel;
+    std::vector<RtStructRoi> m_rois;
+};
+
+// 把各 ROI 的轮廓扫描转换为网格上的行跨度：同一 ROI 同一层的轮廓合在一起按奇偶规则填充（内轮廓成为空洞），
+// 每个 (ROI, 层) 互不依赖，在线程池上并行。轮廓按顶点的平均层号归到最近的一层
+bool RasterizeRois(const std::vector<const RtStructRoi *> &rois, const SegmentationGrid &grid,
+                   std::vector<std::vector<RasterSpan>> &spans, ThreadPool &pool = ThreadPool::Global());
+
+// 按结构集 UID 缓存各 ROI 的栅格化结果，重复加载同一结构集（或其中其他 ROI 组合）时只栅格化未缓存的 ROI；
+// 网格几何变化（换序列）后该结构集的缓存失效
+class RtStructRasterCache
+{
+public:
+    explicit RtStructRasterCache(size_t capacity = 4) : m_capacity(capacity) {}
+
+    // 组合 roiIndices（GetRois 的下标）中各 ROI 为标签体，重叠处列表中靠后的 ROI 覆盖靠前的；
+    // ROI 编号均不超过 255 时为 uint8，否则为 int16。voxelCount 输出被标记的体素数
+    vtkSmartPointer<vtkImageData> BuildLabels(const RtStructReader &reader, const std::vector<size_t> &roiIndices,
+                                              const SegmentationGrid &grid, size_t *voxelCount = nullptr,
+                                              std::string *error = nullptr,
+                                              ThreadPool &pool = ThreadPool::Global());
+    void Clear() { m_entries.clear(); }
+
+private:
+    struct Entry
+    {
+        std::string structureSetUID;
+        SegmentationGrid grid;
+        std::map<int, std::vector<RasterSpan>> spans;   // ROI Number -> 行跨度
+    };
+
+    Entry &Lookup(const std::string &structureSetUID, const SegmentationGrid &grid);
+
+    size_t m_capacity;
+    // 最近使用的在前
+    std::list<Entry> m_entries;
+};
+
+#endif // RTSTRUCT_H
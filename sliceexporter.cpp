@@ -0,0 +1,282 @@
+﻿#include "sliceexporter.h"
+#include "windowlevel.h"
+
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+#include <vtkSetGet.h>
+
+#include <QDir>
+#include <QImage>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <mutex>
+
+namespace {
+
+const char *const AxisFileNames[3] = { "sagittal", "coronal", "axial" };
+
+// 平面按 [v][u] 排列：X 平面 u=Y, v=Z；Y 平面 u=X, v=Z；Z 平面 u=X, v=Y（与分块存储一致）
+void PlaneAxes(int axis, int &uAxis, int &vAxis)
+{
+    uAxis = axis == 0 ? 1 : 0;
+    vAxis = axis == 2 ? 1 : 2;
+}
+
+template <typename T>
+void WindowPlane(const T *src, size_t base, size_t strideU, size_t strideV,
+                 int nu, int nv, double lower, double scale, unsigned char *dst)
+{
+    for (int v = 0; v < nv; ++v) {
+        WindowLevelRow(src + base + static_cast<size_t>(v) * strideV, static_cast<std::ptrdiff_t>(strideU), nu,
+                       lower, scale, dst + static_cast<size_t>(v) * nu);
+    }
+}
+
+// 读取 axis 方向第 index 个平面并做窗宽窗位映射，输出按 [v][u] 排列的灰度
+using PlaneReader = std::function<bool(int axis, int index, double lower, double scale,
+                                       std::vector<unsigned char> &gray)>;
+
+bool ExportPlanes(const int dims[3], const double spacing[3],
+                  const PlaneReader &readPlane,
+                  const SliceExportOptions &options,
+                  std::string *error,
+                  ThreadPool &pool,
+                  const std::function<void(double)> &progress)
+{
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    if (dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0) {
+        return fail("Empty volume");
+    }
+    const QDir outputDir(options.outputDirectory);
+    if (options.outputDirectory.isEmpty() || !QDir().mkpath(outputDir.absolutePath())) {
+        return fail("Cannot create output directory: " + options.outputDirectory.toStdString());
+    }
+
+    const int step = std::max(1, options.step);
+    std::vector<std::pair<int, int>> jobs;
+    for (int axis : { 2, 0, 1 }) {
+        if (!options.axes[axis]) {
+            continue;
+        }
+        for (int index = 0; index < dims[axis]; index += step) {
+            jobs.emplace_back(axis, index);
+        }
+    }
+    if (jobs.empty()) {
+        return fail("No slices selected for export");
+    }
+
+    const double window = options.window > 0.0 ? options.window : 1.0;
+    const double lower = options.level - window / 2.0;
+    const double scale = 255.0 / window;
+
+    // vtkLookupTable::MapValue 不保证线程安全：每个工作槽使用独立副本
+    vtkSmartPointer<vtkLookupTable> sharedLut = options.lut;
+    if (!sharedLut && !options.masks.empty()) {
+        sharedLut = CreateMaskLookupTable();
+    }
+    const size_t slots = std::min(jobs.size(), static_cast<size_t>(pool.GetThreadCount()) + 1);
+    std::vector<vtkSmartPointer<vtkLookupTable>> luts(slots);
+    if (sharedLut) {
+        for (auto &lut : luts) {
+            lut = vtkSmartPointer<vtkLookupTable>::New();
+            lut->DeepCopy(sharedLut);
+        }
+    }
+
+    std::atomic<bool> failed(false);
+    std::atomic<size_t> finished(0);
+    std::mutex reportMutex;
+    std::string firstError;
+
+    auto exportOne = [&](int axis, int index, vtkLookupTable *lut,
+                         std::vector<unsigned char> &gray, std::vector<unsigned char> &overlay) -> bool {
+        int uAxis;
+        int vAxis;
+        PlaneAxes(axis, uAxis, vAxis);
+        const int nu = dims[uAxis];
+        const int nv = dims[vAxis];
+
+        gray.resize(static_cast<size_t>(nu) * nv);
+        if (!readPlane(axis, index, lower, scale, gray)) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (firstError.empty()) {
+                firstError = std::string("Cannot read ") + AxisFileNames[axis] + " slice " + std::to_string(index);
+            }
+            return false;
+        }
+
+        const bool hasMask = lut && !options.masks.empty();
+        if (hasMask) {
+            int ext[6] = { 0, dims[0] - 1, 0, dims[1] - 1, 0, dims[2] - 1 };
+            ext[2 * axis] = ext[2 * axis + 1] = index;
+            overlay.resize(gray.size() * 4);
+            CompositeMaskLayers(options.masks, lut, ext, ext, overlay.data());
+        }
+
+        // 输出像素取面内较小间距，最近邻采样
+        int width = nu;
+        int height = nv;
+        if (options.squarePixels) {
+            const double pixel = std::min(spacing[uAxis], spacing[vAxis]);
+            if (pixel > 0.0) {
+                width = std::max(1, static_cast<int>(std::lround(nu * spacing[uAxis] / pixel)));
+                height = std::max(1, static_cast<int>(std::lround(nv * spacing[vAxis] / pixel)));
+            }
+        }
+        std::vector<int> columnMap(width);
+        for (int c = 0; c < width; ++c) {
+            columnMap[c] = std::min(nu - 1, static_cast<int>((c + 0.5) * nu / width));
+        }
+
+        // 与视图朝向一致：u 向右、v 向上，因此图像行自上而下对应 v 递减
+        QImage image(width, height, QImage::Format_RGB888);
+        if (image.isNull()) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (firstError.empty()) {
+                firstError = "Out of memory while exporting slices";
+            }
+            return false;
+        }
+        for (int r = 0; r < height; ++r) {
+            const int v = nv - 1 - std::min(nv - 1, static_cast<int>((r + 0.5) * nv / height));
+            const unsigned char *grayRow = gray.data() + static_cast<size_t>(v) * nu;
+            const unsigned char *maskRow = hasMask ? overlay.data() + static_cast<size_t>(v) * nu * 4 : nullptr;
+            uchar *dst = image.scanLine(r);
+            for (int c = 0; c < width; ++c, dst += 3) {
+                const int u = columnMap[c];
+                const unsigned char g = grayRow[u];
+                if (maskRow && maskRow[4 * u + 3]) {
+                    const unsigned char *m = maskRow + 4 * u;
+                    const int a = m[3];
+                    for (int ch = 0; ch < 3; ++ch) {
+                        dst[ch] = static_cast<uchar>((m[ch] * a + g * (255 - a) + 127) / 255);
+                    }
+                } else {
+                    dst[0] = dst[1] = dst[2] = g;
+                }
+            }
+        }
+
+        const QString fileName = outputDir.filePath(QStringLiteral("%1_%2.png")
+                                                        .arg(QLatin1String(AxisFileNames[axis]))
+                                                        .arg(index, 4, 10, QLatin1Char('0')));
+        if (!image.save(fileName, "PNG")) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (firstError.empty()) {
+                firstError = "Cannot write " + fileName.toStdString();
+            }
+            return false;
+        }
+        return true;
+    };
+
+    // 每个工作槽按间隔取任务，各轴的切片交错分布，负载更均衡
+    pool.ParallelFor(0, slots, [&](size_t sb, size_t se) {
+        std::vector<unsigned char> gray;
+        std::vector<unsigned char> overlay;
+        for (size_t slot = sb; slot < se; ++slot) {
+            for (size_t job = slot; job < jobs.size(); job += slots) {
+                if (failed.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                if (!exportOne(jobs[job].first, jobs[job].second, luts[slot], gray, overlay)) {
+                    failed = true;
+                    return;
+                }
+                const size_t done = ++finished;
+                if (progress) {
+                    std::lock_guard<std::mutex> lock(reportMutex);
+                    progress(static_cast<double>(done) / static_cast<double>(jobs.size()));
+                }
+            }
+        }
+    });
+
+    if (failed) {
+        return fail(firstError);
+    }
+    return true;
+}
+
+} // namespace
+
+bool ExportSlicesToPng(vtkImageData *volume,
+                       const SliceExportOptions &options,
+                       std::string *error,
+                       ThreadPool &pool,
+                       const std::function<void(double)> &progress)
+{
+    if (!volume || !volume->GetScalarPointer()) {
+        if (error) {
+            *error = "No volume data";
+        }
+        return false;
+    }
+
+    int dims[3];
+    double spacing[3];
+    volume->GetDimensions(dims);
+    volume->GetSpacing(spacing);
+    const void *scalars = volume->GetScalarPointer();
+    const int scalarType = volume->GetScalarType();
+    const size_t rowStride = static_cast<size_t>(dims[0]);
+    const size_t sliceStride = rowStride * static_cast<size_t>(dims[1]);
+
+    auto readPlane = [&](int axis, int index, double lower, double scale,
+                         std::vector<unsigned char> &gray) -> bool {
+        int uAxis;
+        int vAxis;
+        PlaneAxes(axis, uAxis, vAxis);
+        const size_t strides[3] = { 1, rowStride, sliceStride };
+        const size_t base = static_cast<size_t>(index) * strides[axis];
+        switch (scalarType) {
+            vtkTemplateMacro(WindowPlane(static_cast<const VTK_TT *>(scalars), base,
+                                         strides[uAxis], strides[vAxis], dims[uAxis], dims[vAxis],
+                                         lower, scale, gray.data()));
+        default:
+            return false;
+        }
+        return true;
+    };
+    return ExportPlanes(dims, spacing, readPlane, options, error, pool, progress);
+}
+
+bool ExportSlicesToPng(BrickedVolumeStore &store,
+                       const SliceExportOptions &options,
+                       std::string *error,
+                       ThreadPool &pool,
+                       const std::function<void(double)> &progress)
+{
+    const VolumeGeometry &geometry = store.GetGeometry();
+
+    auto readPlane = [&](int axis, int index, double lower, double scale,
+                         std::vector<unsigned char> &gray) -> bool {
+        int uAxis;
+        int vAxis;
+        PlaneAxes(axis, uAxis, vAxis);
+        std::vector<unsigned char> plane(store.PlaneVoxelCount(axis) * geometry.bytesPerVoxel);
+        if (plane.empty() || !store.ExtractPlane(axis, index, plane.data(), pool)) {
+            return false;
+        }
+        const int nu = geometry.dims[uAxis];
+        switch (geometry.scalarType) {
+            vtkTemplateMacro(WindowPlane(reinterpret_cast<const VTK_TT *>(plane.data()), 0,
+                                         1, static_cast<size_t>(nu), nu, geometry.dims[vAxis],
+                                         lower, scale, gray.data()));
+        default:
+            return false;
+        }
+        return true;
+    };
+    return ExportPlanes(geometry.dims, geometry.spacing, readPlane, options, error, pool, progress);
+}
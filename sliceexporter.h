@@ -0,0 +1,51 @@
+﻿#ifndef SLICEEXPORTER_H
+#define SLICEEXPORTER_H
+
+#include <vtkImageData.h>
+#include <vtkLookupTable.h>
+
+#include <QString>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "maskoverlay.h"
+#include "threadpool.h"
+#include "volumestore.h"
+
+// 批量导出参数：窗宽窗位与叠加层合成方式与界面视图一致
+struct SliceExportOptions
+{
+    QString outputDirectory;
+    // 每隔 step 层导出一张
+    int step = 1;
+    double window = 400.0;
+    double level = 40.0;
+    // 按轴启用：0=X 矢状, 1=Y 冠状, 2=Z 轴位
+    bool axes[3] = { true, true, true };
+    // 按体素间距做最近邻拉伸，使输出像素为正方形
+    bool squarePixels = true;
+    // 由下往上合成的掩膜图层，为空时不叠加；lut 为空时使用默认标签颜色
+    std::vector<MaskOverlayLayer> masks;
+    vtkLookupTable *lut = nullptr;
+};
+
+// 纯 CPU 实现（窗宽窗位映射 + 掩膜合成 + QImage 编码），不创建任何窗口或 OpenGL 上下文，
+// 可在无显示、无 GPU 的 Linux 上运行。切片在线程池上并行生成与编码，
+// 文件名为 axial_0000.png / sagittal_0000.png / coronal_0000.png（编号为切片索引）。
+// progress 以 [0, 1] 报告已完成的比例，可能在任意线程上调用（已串行化）。
+bool ExportSlicesToPng(vtkImageData *volume,
+                       const SliceExportOptions &options,
+                       std::string *error = nullptr,
+                       ThreadPool &pool = ThreadPool::Global(),
+                       const std::function<void(double)> &progress = {});
+
+// 外存模式：逐平面从分块存储提取
+bool ExportSlicesToPng(BrickedVolumeStore &store,
+                       const SliceExportOptions &options,
+                       std::string *error = nullptr,
+                       ThreadPool &pool = ThreadPool::Global(),
+                       const std::function<void(double)> &progress = {});
+
+#endif // SLICEEXPORTER_H
@@ -0,0 +1,174 @@
+﻿#include "studyloader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+
+namespace
+{
+
+unsigned int DecodeThreadCount()
+{
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    return std::clamp(cores / 2, 2u, 8u);
+}
+
+size_t InCoreVolumeLimit()
+{
+    if (const char *value = std::getenv("MYDICOMVIEWER_INCORE_LIMIT_MB")) {
+        const long long limitMB = std::atoll(value);
+        if (limitMB > 0) {
+            return static_cast<size_t>(limitMB) * 1024 * 1024;
+        }
+    }
+    const uint64_t physical = BrickedVolumeStore::PhysicalMemoryBytes();
+    if (physical == 0) {
+        return std::numeric_limits<size_t>::max();
+    }
+    return static_cast<size_t>(std::min<uint64_t>(physical / 2, std::numeric_limits<size_t>::max()));
+}
+
+} // namespace
+
+StudyLoadContext::StudyLoadContext()
+    : m_decodePool(DecodeThreadCount())
+    , m_limit(InCoreVolumeLimit())
+    , m_used(0)
+{
+}
+
+StudyLoadContext &StudyLoadContext::Shared()
+{
+    static StudyLoadContext context;
+    return context;
+}
+
+size_t StudyLoadContext::GetAvailable() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_used < m_limit ? m_limit - m_used : 0;
+}
+
+bool StudyLoadContext::TryReserve(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_used > m_limit || bytes > m_limit - m_used) {
+        return false;
+    }
+    m_used += bytes;
+    return true;
+}
+
+void StudyLoadContext::Charge(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_used += bytes;
+}
+
+void StudyLoadContext::Release(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_used -= std::min(bytes, m_used);
+}
+
+StudyMemoryReservation::StudyMemoryReservation(StudyMemoryReservation &&other) noexcept
+    : m_context(other.m_context)
+    , m_bytes(other.m_bytes)
+{
+    other.m_context = nullptr;
+    other.m_bytes = 0;
+}
+
+StudyMemoryReservation &StudyMemoryReservation::operator=(StudyMemoryReservation &&other) noexcept
+{
+    if (this != &other) {
+        Reset();
+        m_context = other.m_context;
+        m_bytes = other.m_bytes;
+        other.m_context = nullptr;
+        other.m_bytes = 0;
+    }
+    return *this;
+}
+
+bool StudyMemoryReservation::Acquire(size_t bytes, StudyLoadContext &context)
+{
+    Reset();
+    if (!context.TryReserve(bytes)) {
+        return false;
+    }
+    m_context = &context;
+    m_bytes = bytes;
+    return true;
+}
+
+void StudyMemoryReservation::Charge(size_t bytes, StudyLoadContext &context)
+{
+    Reset();
+    context.Charge(bytes);
+    m_context = &context;
+    m_bytes = bytes;
+}
+
+void StudyMemoryReservation::Shrink(size_t bytes)
+{
+    if (m_context && bytes < m_bytes) {
+        m_context->Release(m_bytes - bytes);
+        m_bytes = bytes;
+    }
+}
+
+void StudyMemoryReservation::Reset()
+{
+    if (m_context) {
+        m_context->Release(m_bytes);
+    }
+    m_context = nullptr;
+    m_bytes = 0;
+}
+
+LoadedStudy LoadStudyInMemory(const std::string &directory,
+                              const std::function<void(size_t, size_t)> &progress)
+{
+    LoadedStudy study;
+    bool isMultiFrame = false;
+    if (!FindDicomSeries(directory, study.fileNames, &isMultiFrame)) {
+        study.error = "No DICOM series found.";
+        return study;
+    }
+
+    StudyLoadContext &context = StudyLoadContext::Shared();
+    if (isMultiFrame) {
+        // 多帧对象的体积只有解码后才知道，先解码再计入预算
+        study.image = LoadMultiFrameVolume(study.fileNames.front(), &study.metadata, &study.error,
+                                           context.GetDecodePool());
+        if (study.image) {
+            const size_t bytes = static_cast<size_t>(study.image->GetNumberOfPoints()) *
+                                 static_cast<size_t>(study.image->GetScalarSize());
+            if (!study.reservation.Acquire(bytes, context)) {
+                study.image = nullptr;
+                study.error = "Not enough memory budget for another study.";
+            }
+        }
+        return study;
+    }
+
+    VolumeGeometry geometry;
+    if (!ReadDicomSeriesGeometry(study.fileNames, geometry, &study.metadata)) {
+        study.error = "Cannot read series geometry.";
+        return study;
+    }
+    if (!study.reservation.Acquire(geometry.ByteSize(), context)) {
+        study.error = "Not enough memory budget for another study (" +
+                      std::to_string(geometry.ByteSize() >> 20) + " MB needed, " +
+                      std::to_string(context.GetAvailable() >> 20) + " MB available).";
+        return study;
+    }
+
+    study.image = DecodeDicomSeries(study.fileNames, geometry, context.GetDecodePool(), &study.error, progress);
+    if (!study.image) {
+        study.reservation.Reset();
+    }
+    return study;
+}
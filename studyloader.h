@@ -0,0 +1,82 @@
+﻿#ifndef STUDYLOADER_H
+#define STUDYLOADER_H
+
+#include "dicomvolumeloader.h"
+#include "threadpool.h"
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 当前研究与对比研究共用的加载资源：有界的切片解码线程池与常驻体数据的内存预算。
+// 解码池与全局线程池分开，加载期间直方图、导出等任务仍有线程可用
+class StudyLoadContext
+{
+public:
+    static StudyLoadContext &Shared();
+
+    ThreadPool &GetDecodePool() { return m_decodePool; }
+    size_t GetLimit() const { return m_limit; }
+    size_t GetAvailable() const;
+
+    // 剩余预算足够时记入 bytes 并返回 true；不等待其他加载释放
+    bool TryReserve(size_t bytes);
+    // 无条件记入（可超出上限），用于已经分配、没有外存退路的体数据
+    void Charge(size_t bytes);
+    void Release(size_t bytes);
+
+private:
+    StudyLoadContext();
+
+    ThreadPool m_decodePool;
+    // 默认物理内存的一半，可用环境变量 MYDICOMVIEWER_INCORE_LIMIT_MB 调整
+    size_t m_limit;
+    mutable std::mutex m_mutex;
+    size_t m_used;
+};
+
+// 一份常驻体数据占用的预算，析构或 Reset 时归还
+class StudyMemoryReservation
+{
+public:
+    StudyMemoryReservation() = default;
+    ~StudyMemoryReservation() { Reset(); }
+
+    StudyMemoryReservation(StudyMemoryReservation &&other) noexcept;
+    StudyMemoryReservation &operator=(StudyMemoryReservation &&other) noexcept;
+    StudyMemoryReservation(const StudyMemoryReservation &) = delete;
+    StudyMemoryReservation &operator=(const StudyMemoryReservation &) = delete;
+
+    // 先归还已持有的预算再申请
+    bool Acquire(size_t bytes, StudyLoadContext &context = StudyLoadContext::Shared());
+    // 先归还已持有的预算再无条件记入 bytes，让之后的加载看到真实的常驻占用
+    void Charge(size_t bytes, StudyLoadContext &context = StudyLoadContext::Shared());
+    // 只归还超出 bytes 的部分（先按上限预留、得知实际大小后收缩），不会与其他加载竞争
+    void Shrink(size_t bytes);
+    void Reset();
+
+    size_t GetBytes() const { return m_bytes; }
+
+private:
+    StudyLoadContext *m_context = nullptr;
+    size_t m_bytes = 0;
+};
+
+// 一次完整加载到内存的研究；image 为空时 error 说明原因
+struct LoadedStudy
+{
+    vtkSmartPointer<vtkImageData> image;
+    DicomVolumeMetadata metadata;
+    std::vector<std::string> fileNames;
+    StudyMemoryReservation reservation;
+    std::string error;
+};
+
+// 查找目录中的第一个序列，预算足够时在共享解码池上加载到内存；可在任意线程调用。
+// progress(已解码层数, 总层数) 在调用线程上回调
+LoadedStudy LoadStudyInMemory(const std::string &directory,
+                              const std::function<void(size_t, size_t)> &progress = nullptr);
+
+#endif // STUDYLOADER_H
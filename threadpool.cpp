@@ -0,0 +1,126 @@
+﻿#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : m_stopping(false)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    m_workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cond.notify_all();
+    for (auto &worker : m_workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+ThreadPool &ThreadPool::Global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_cond.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_stopping && m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end,
+                             const std::function<void(size_t, size_t)> &body,
+                             size_t minChunk)
+{
+    if (end <= begin) {
+        return;
+    }
+
+    const size_t total = end - begin;
+    const size_t workers = static_cast<size_t>(GetThreadCount()) + 1;
+    // 每个线程约 4 块，兼顾负载均衡与调度开销
+    size_t chunk = std::max<size_t>(std::max<size_t>(minChunk, 1), total / (workers * 4));
+    const size_t chunkCount = (total + chunk - 1) / chunk;
+    if (chunkCount <= 1) {
+        body(begin, end);
+        return;
+    }
+
+    struct SharedState {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<SharedState>();
+
+    auto runChunks = [state, begin, end, chunk, chunkCount, &body]() {
+        for (;;) {
+            const size_t c = state->next.fetch_add(1);
+            if (c >= chunkCount) {
+                return;
+            }
+            const size_t b = begin + c * chunk;
+            const size_t e = std::min(end, b + chunk);
+            try {
+                body(b, e);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+            }
+            if (state->done.fetch_add(1) + 1 == chunkCount) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->cond.notify_all();
+            }
+        }
+    };
+
+    const size_t helpers = std::min(chunkCount - 1, static_cast<size_t>(GetThreadCount()));
+    for (size_t i = 0; i < helpers; ++i) {
+        Enqueue(runChunks);
+    }
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cond.wait(lock, [&]() { return state->done.load() == chunkCount; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
@@ -0,0 +1,54 @@
+﻿#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 简单的固定大小线程池，供直方图、解码等并行任务共用
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned int GetThreadCount() const { return static_cast<unsigned int>(m_workers.size()); }
+
+    template <typename F>
+    std::future<void> Submit(F &&task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task));
+        std::future<void> result = packaged->get_future();
+        Enqueue([packaged]() { (*packaged)(); });
+        return result;
+    }
+
+    // 将 [begin, end) 切成若干块并行执行 body(chunkBegin, chunkEnd)。
+    // 调用线程也参与计算，因此在池内线程中调用不会死锁。
+    void ParallelFor(size_t begin, size_t end,
+                     const std::function<void(size_t, size_t)> &body,
+                     size_t minChunk = 1);
+
+    static ThreadPool &Global();
+
+private:
+    void Enqueue(std::function<void()> task);
+    void WorkerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stopping;
+};
+
+#endif // THREADPOOL_H
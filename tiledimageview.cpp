@@ -0,0 +1,331 @@
+﻿#include "tiledimageview.h"
+
+#include <QCloseEvent>
+#include <QMetaObject>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPointer>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+// 约 32 MB 的 8 位瓦片
+constexpr size_t TileCacheCapacity = 512;
+
+quint64 TileKey(int level, int column, int row)
+{
+    return (static_cast<quint64>(level) << 48) | (static_cast<quint64>(row) << 24) | static_cast<quint64>(column);
+}
+
+} // namespace
+
+TiledImageView::TiledImageView(QWidget *parent)
+    : QWidget(parent, Qt::Window)
+    , m_window(400.0)
+    , m_level(40.0)
+    , m_centerU(0.0)
+    , m_centerV(0.0)
+    , m_zoom(1.0)
+    , m_aspect(1.0)
+    , m_panning(false)
+{
+    setWindowTitle(QStringLiteral("Large Image"));
+    resize(900, 900);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setMouseTracking(false);
+}
+
+TiledImageView::~TiledImageView()
+{
+    CancelBuild();
+}
+
+bool TiledImageView::IsLargePlanarImage(vtkImageData *image)
+{
+    if (!image) {
+        return false;
+    }
+    int dims[3];
+    image->GetDimensions(dims);
+    return dims[2] == 1 && image->GetNumberOfScalarComponents() == 1 &&
+           static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1]) >= (static_cast<size_t>(4) << 20);
+}
+
+void TiledImageView::CancelBuild()
+{
+    if (m_buildCancel) {
+        m_buildCancel->store(true);
+    }
+    if (m_buildTask.valid()) {
+        m_buildTask.wait();
+    }
+    m_buildCancel.reset();
+}
+
+bool TiledImageView::SetImage(vtkSmartPointer<vtkImageData> image, const QString &title, std::string *error)
+{
+    ClearImage();
+    auto pyramid = std::make_shared<ImagePyramid>();
+    if (!pyramid->SetImage(image, error)) {
+        return false;
+    }
+    m_pyramid = pyramid;
+    m_title = title;
+
+    double spacing[3];
+    image->GetSpacing(spacing);
+    m_aspect = spacing[0] > 0.0 ? spacing[1] / spacing[0] : 1.0;
+    setWindowTitle(QStringLiteral("Large Image - %1 (%2 x %3)")
+                       .arg(m_title)
+                       .arg(pyramid->GetLevelWidth(0))
+                       .arg(pyramid->GetLevelHeight(0)));
+    FitToWindow();
+
+    // 第 0 层立即可用；较粗的层在后台逐层生成，每完成一层重绘一次
+    m_buildCancel = std::make_shared<std::atomic<bool>>(false);
+    std::shared_ptr<std::atomic<bool>> cancel = m_buildCancel;
+    QPointer<TiledImageView> guard(this);
+    m_buildTask = ThreadPool::Global().Submit([pyramid, cancel, guard]() {
+        pyramid->Build(ThreadPool::Global(), cancel.get(), [guard](int) {
+            QMetaObject::invokeMethod(guard, [guard]() {
+                if (guard) {
+                    guard->update();
+                }
+            }, Qt::QueuedConnection);
+        });
+    });
+    update();
+    return true;
+}
+
+void TiledImageView::ClearImage()
+{
+    CancelBuild();
+    m_pyramid.reset();
+    ClearTileCache();
+    update();
+}
+
+void TiledImageView::SetWindowLevel(double window, double level)
+{
+    if (window == m_window && level == m_level) {
+        return;
+    }
+    m_window = window;
+    m_level = level;
+    ClearTileCache();
+    update();
+}
+
+void TiledImageView::ClearTileCache()
+{
+    m_tiles.clear();
+    m_tileIndex.clear();
+}
+
+double TiledImageView::FitZoom() const
+{
+    if (!m_pyramid) {
+        return 1.0;
+    }
+    const double zoomU = width() / static_cast<double>(m_pyramid->GetLevelWidth(0));
+    const double zoomV = height() / (m_pyramid->GetLevelHeight(0) * m_aspect);
+    return std::max(1e-4, std::min(zoomU, zoomV));
+}
+
+void TiledImageView::FitToWindow()
+{
+    if (!m_pyramid) {
+        return;
+    }
+    m_centerU = m_pyramid->GetLevelWidth(0) / 2.0;
+    m_centerV = m_pyramid->GetLevelHeight(0) / 2.0;
+    m_zoom = FitZoom();
+    update();
+}
+
+int TiledImageView::SelectLevel() const
+{
+    // 每层像素覆盖 2^level 个原图像素；取层像素在屏幕上占 0.5～1 个像素的那一层
+    const int desired = m_zoom >= 1.0 ? 0 : static_cast<int>(std::floor(std::log2(1.0 / m_zoom)));
+    return std::clamp(desired, 0, std::max(0, m_pyramid->GetReadyLevelCount() - 1));
+}
+
+QPointF TiledImageView::ImageToScreen(double u, double v) const
+{
+    // v 向上，与二维视图一致
+    return QPointF(width() / 2.0 + (u - m_centerU) * m_zoom,
+                   height() / 2.0 - (v - m_centerV) * m_zoom * m_aspect);
+}
+
+QPointF TiledImageView::ScreenToImage(const QPointF &point) const
+{
+    return QPointF(m_centerU + (point.x() - width() / 2.0) / m_zoom,
+                   m_centerV - (point.y() - height() / 2.0) / (m_zoom * m_aspect));
+}
+
+void TiledImageView::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+    if (!m_pyramid) {
+        return;
+    }
+
+    const int level = SelectLevel();
+    const double factor = std::ldexp(1.0, level);
+    const double tileSpan = ImagePyramid::TileSize * factor;
+    const QPointF topLeft = ScreenToImage(QPointF(0.0, 0.0));
+    const QPointF bottomRight = ScreenToImage(QPointF(width(), height()));
+    const int columnBegin = std::max(0, static_cast<int>(std::floor(topLeft.x() / tileSpan)));
+    const int columnEnd = std::min(m_pyramid->GetTileColumns(level) - 1,
+                                   static_cast<int>(std::floor(bottomRight.x() / tileSpan)));
+    const int rowBegin = std::max(0, static_cast<int>(std::floor(bottomRight.y() / tileSpan)));
+    const int rowEnd = std::min(m_pyramid->GetTileRows(level) - 1,
+                                static_cast<int>(std::floor(topLeft.y() / tileSpan)));
+
+    // 先找出缓存中没有的可见瓦片，并行映射后再统一放入缓存
+    struct TileJob
+    {
+        int column;
+        int row;
+        QImage image;
+    };
+    std::vector<TileJob> missing;
+    for (int row = rowBegin; row <= rowEnd; ++row) {
+        for (int column = columnBegin; column <= columnEnd; ++column) {
+            if (!m_tileIndex.count(TileKey(level, column, row))) {
+                missing.push_back(TileJob{ column, row, QImage() });
+            }
+        }
+    }
+    const ImagePyramid &pyramid = *m_pyramid;
+    const double window = m_window;
+    const double center = m_level;
+    ThreadPool::Global().ParallelFor(0, missing.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            QImage tile(ImagePyramid::TileSize, ImagePyramid::TileSize, QImage::Format_Grayscale8);
+            int tileWidth = 0;
+            int tileHeight = 0;
+            if (tile.isNull() || !pyramid.RenderTile(level, missing[i].column, missing[i].row, window, center,
+                                                     tile.bits(), tile.bytesPerLine(), tileWidth, tileHeight)) {
+                continue;
+            }
+            missing[i].image = tileWidth == ImagePyramid::TileSize && tileHeight == ImagePyramid::TileSize
+                                   ? tile
+                                   : tile.copy(0, 0, tileWidth, tileHeight);
+        }
+    });
+    for (TileJob &job : missing) {
+        if (job.image.isNull()) {
+            continue;
+        }
+        const quint64 key = TileKey(level, job.column, job.row);
+        m_tiles.push_front(CachedTile{ key, std::move(job.image) });
+        m_tileIndex[key] = m_tiles.begin();
+    }
+
+    // 缩小显示时平滑采样；放大到单个原图像素大于一个屏幕像素时保持像素边界清晰
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, m_zoom * factor < 1.0);
+    for (int row = rowBegin; row <= rowEnd; ++row) {
+        for (int column = columnBegin; column <= columnEnd; ++column) {
+            auto it = m_tileIndex.find(TileKey(level, column, row));
+            if (it == m_tileIndex.end()) {
+                continue;
+            }
+            m_tiles.splice(m_tiles.begin(), m_tiles, it->second);
+            const QImage &image = it->second->image;
+            // 瓦片边界取整到同一组屏幕坐标，相邻瓦片之间不留缝
+            const QPointF a = ImageToScreen(column * tileSpan, (row * ImagePyramid::TileSize + image.height()) * factor);
+            const QPointF b = ImageToScreen((column * ImagePyramid::TileSize + image.width()) * factor, row * tileSpan);
+            const QRect target(QPoint(static_cast<int>(std::lround(a.x())), static_cast<int>(std::lround(a.y()))),
+                               QPoint(static_cast<int>(std::lround(b.x())) - 1,
+                                      static_cast<int>(std::lround(b.y())) - 1));
+            painter.drawImage(target, image);
+        }
+    }
+    while (m_tiles.size() > TileCacheCapacity) {
+        m_tileIndex.erase(m_tiles.back().key);
+        m_tiles.pop_back();
+    }
+
+    QString text = QStringLiteral("Level %1/%2  Zoom %3%  W %4 L %5")
+                       .arg(level)
+                       .arg(m_pyramid->GetLevelCount() - 1)
+                       .arg(m_zoom * 100.0, 0, 'f', 1)
+                       .arg(m_window, 0, 'f', 0)
+                       .arg(m_level, 0, 'f', 0);
+    if (m_pyramid->GetReadyLevelCount() < m_pyramid->GetLevelCount()) {
+        text += QStringLiteral("  (building %1/%2)")
+                    .arg(m_pyramid->GetReadyLevelCount())
+                    .arg(m_pyramid->GetLevelCount());
+    }
+    painter.setPen(Qt::yellow);
+    painter.drawText(rect().adjusted(6, 4, -6, -4), Qt::AlignLeft | Qt::AlignTop, text);
+}
+
+void TiledImageView::wheelEvent(QWheelEvent *event)
+{
+    if (!m_pyramid) {
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    const QPointF position = event->position();
+#else
+    const QPointF position = event->posF();
+#endif
+    // 以光标处的图像点为不动点缩放
+    const QPointF anchor = ScreenToImage(position);
+    const double factor = std::pow(1.25, event->angleDelta().y() / 120.0);
+    m_zoom = std::clamp(m_zoom * factor, FitZoom() / 4.0, 32.0);
+    m_centerU = anchor.x() - (position.x() - width() / 2.0) / m_zoom;
+    m_centerV = anchor.y() + (position.y() - height() / 2.0) / (m_zoom * m_aspect);
+    event->accept();
+    update();
+}
+
+void TiledImageView::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        m_panning = true;
+        m_lastMouse = event->pos();
+        setCursor(Qt::ClosedHandCursor);
+    }
+}
+
+void TiledImageView::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!m_panning || !m_pyramid) {
+        return;
+    }
+    const QPoint delta = event->pos() - m_lastMouse;
+    m_lastMouse = event->pos();
+    m_centerU -= delta.x() / m_zoom;
+    m_centerV += delta.y() / (m_zoom * m_aspect);
+    update();
+}
+
+void TiledImageView::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        m_panning = false;
+        unsetCursor();
+    }
+}
+
+void TiledImageView::mouseDoubleClickEvent(QMouseEvent *)
+{
+    FitToWindow();
+}
+
+void TiledImageView::closeEvent(QCloseEvent *event)
+{
+    ClearImage();
+    QWidget::closeEvent(event);
+}
@@ -0,0 +1,85 @@
+﻿#ifndef TILEDIMAGEVIEW_H
+#define TILEDIMAGEVIEW_H
+
+#include <QWidget>
+#include <QImage>
+#include <QPoint>
+
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "imagepyramid.h"
+
+// 大图模式窗口：单帧大尺寸图像（乳腺 X 线、DR 等）不经过三维重切片，而是在后台建立瓦片金字塔，
+// 每次绘制只按当前缩放选一层并映射可见瓦片，映射结果按 LRU 缓存。平移、缩放的开销只与窗口大小有关。
+// 左键拖动平移，滚轮以光标为中心缩放，双击恢复适合窗口；窗宽窗位跟随主窗口
+class TiledImageView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit TiledImageView(QWidget *parent = nullptr);
+    ~TiledImageView() override;
+
+    // 像素数超过约 4M 的单层单通道图像使用大图模式
+    static bool IsLargePlanarImage(vtkImageData *image);
+
+    bool SetImage(vtkSmartPointer<vtkImageData> image, const QString &title, std::string *error = nullptr);
+    void ClearImage();
+    bool HasImage() const { return static_cast<bool>(m_pyramid); }
+    void SetWindowLevel(double window, double level);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+    // 关闭窗口即释放金字塔与瓦片缓存
+    void closeEvent(QCloseEvent *event) override;
+
+private:
+    void CancelBuild();
+    void FitToWindow();
+    double FitZoom() const;
+    // 缩放越小取越粗的层，尚未生成时退回已完成的最粗层
+    int SelectLevel() const;
+    QPointF ImageToScreen(double u, double v) const;
+    QPointF ScreenToImage(const QPointF &point) const;
+    void ClearTileCache();
+
+    std::shared_ptr<ImagePyramid> m_pyramid;
+    std::shared_ptr<std::atomic<bool>> m_buildCancel;
+    std::future<void> m_buildTask;
+    QString m_title;
+
+    double m_window;
+    double m_level;
+    // 视图中心对应的第 0 层像素坐标与缩放（屏幕像素 / 原图像素）；aspect 为 v 与 u 的像素间距之比
+    double m_centerU;
+    double m_centerV;
+    double m_zoom;
+    double m_aspect;
+
+    bool m_panning;
+    QPoint m_lastMouse;
+
+    // 已映射的瓦片，最近使用的在前；窗宽窗位变化时整体失效
+    struct CachedTile
+    {
+        quint64 key;
+        QImage image;
+    };
+    std::list<CachedTile> m_tiles;
+    std::unordered_map<quint64, std::list<CachedTile>::iterator> m_tileIndex;
+};
+
+#endif // TILEDIMAGEVIEW_H
@@ -0,0 +1,78 @@
+﻿#include "volumehistogram.h"
+
+#include <cmath>
+
+double VolumeHistogram::Percentile(double p) const
+{
+    if (IsEmpty()) {
+        return 0.0;
+    }
+    p = std::clamp(p, 0.0, 1.0);
+    const double target = p * static_cast<double>(m_total);
+
+    uint64_t accumulated = 0;
+    for (size_t i = 0; i < m_bins.size(); ++i) {
+        const uint64_t next = accumulated + m_bins[i];
+        if (static_cast<double>(next) >= target && m_bins[i] > 0) {
+            // bin 内线性插值
+            const double frac = (target - static_cast<double>(accumulated)) / static_cast<double>(m_bins[i]);
+            return std::min(m_maximum, BinLowerEdge(i) + std::clamp(frac, 0.0, 1.0) * m_binWidth);
+        }
+        accumulated = next;
+    }
+    return m_maximum;
+}
+
+WindowLevelPreset VolumeHistogram::AutoWindowLevel(double lowPercentile,
+                                                   double highPercentile) const
+{
+    const double lo = Percentile(lowPercentile);
+    const double hi = Percentile(highPercentile);
+    double window = hi - lo;
+    if (window <= 0.0) {
+        window = std::max(1.0, m_maximum - m_minimum);
+    }
+    return WindowLevelPreset{ "Auto", window, (lo + hi) * 0.5 };
+}
+
+std::vector<WindowLevelPreset> BuildWindowLevelPresets(const std::string &modality,
+                                                       const VolumeHistogram &histogram)
+{
+    std::vector<WindowLevelPreset> presets;
+    if (histogram.IsEmpty()) {
+        return presets;
+    }
+
+    WindowLevelPreset autoPreset = histogram.AutoWindowLevel(0.01, 0.99);
+    autoPreset.name = "Auto (1-99%)";
+    presets.push_back(autoPreset);
+
+    WindowLevelPreset narrowPreset = histogram.AutoWindowLevel(0.05, 0.95);
+    narrowPreset.name = "Auto (5-95%)";
+    presets.push_back(narrowPreset);
+
+    const double fullWindow = std::max(1.0, histogram.GetMaximum() - histogram.GetMinimum());
+    presets.push_back({ "Full Range", fullWindow,
+                        (histogram.GetMaximum() + histogram.GetMinimum()) * 0.5 });
+
+    if (modality == "CT") {
+        presets.push_back({ "Brain",       80,   40 });
+        presets.push_back({ "Subdural",    215,  75 });
+        presets.push_back({ "Stroke",      40,   40 });
+        presets.push_back({ "Lung",        1500, -600 });
+        presets.push_back({ "Mediastinum", 350,  50 });
+        presets.push_back({ "Abdomen",     400,  50 });
+        presets.push_back({ "Liver",       150,  30 });
+        presets.push_back({ "Bone",        2000, 500 });
+    } else if (modality == "PT" || modality == "NM") {
+        // 核医学数据以低值背景为主，按高百分位截断
+        WindowLevelPreset hot = histogram.AutoWindowLevel(0.0, 0.995);
+        hot.name = "Hot Spot (0-99.5%)";
+        presets.push_back(hot);
+    } else if (modality == "MR") {
+        WindowLevelPreset soft = histogram.AutoWindowLevel(0.10, 0.995);
+        soft.name = "Tissue (10-99.5%)";
+        presets.push_back(soft);
+    }
+    return presets;
+}
@@ -0,0 +1,140 @@
+﻿#ifndef VOLUMEHISTOGRAM_H
+#define VOLUMEHISTOGRAM_H
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+struct WindowLevelPreset
+{
+    std::string name;
+    double window;
+    double level;
+};
+
+// 体数据灰度直方图，每次加载计算一次并随体数据缓存
+class VolumeHistogram
+{
+public:
+    static constexpr size_t DefaultBinCount = 4096;
+
+    template <typename T>
+    static VolumeHistogram Compute(const T *data, size_t count,
+                                   ThreadPool &pool = ThreadPool::Global(),
+                                   size_t binCount = DefaultBinCount);
+
+    bool IsEmpty() const { return m_total == 0; }
+    double GetMinimum() const { return m_minimum; }
+    double GetMaximum() const { return m_maximum; }
+    uint64_t GetTotalCount() const { return m_total; }
+    const std::vector<uint64_t> &GetBins() const { return m_bins; }
+
+    // p 取值 [0, 1]，返回对应的灰度值
+    double Percentile(double p) const;
+    WindowLevelPreset AutoWindowLevel(double lowPercentile = 0.01,
+                                      double highPercentile = 0.99) const;
+
+private:
+    double BinLowerEdge(size_t bin) const { return m_minimum + bin * m_binWidth; }
+
+    double m_minimum = 0.0;
+    double m_maximum = 0.0;
+    double m_binWidth = 1.0;
+    uint64_t m_total = 0;
+    std::vector<uint64_t> m_bins;
+};
+
+// 根据模态 (0008|0060) 与直方图生成窗宽窗位预设，第一个为自动窗
+std::vector<WindowLevelPreset> BuildWindowLevelPresets(const std::string &modality,
+                                                       const VolumeHistogram &histogram);
+
+template <typename T>
+VolumeHistogram VolumeHistogram::Compute(const T *data, size_t count,
+                                         ThreadPool &pool, size_t binCount)
+{
+    VolumeHistogram hist;
+    if (!data || count == 0 || binCount == 0) {
+        return hist;
+    }
+
+    constexpr size_t grain = 1 << 16;
+    const size_t chunkCount = (count + grain - 1) / grain;
+
+    // 第一遍：并行求最小/最大值（浮点数据忽略 NaN）
+    std::vector<double> chunkMin(chunkCount, std::numeric_limits<double>::max());
+    std::vector<double> chunkMax(chunkCount, std::numeric_limits<double>::lowest());
+    pool.ParallelFor(0, chunkCount, [&](size_t cb, size_t ce) {
+        for (size_t c = cb; c < ce; ++c) {
+            const size_t b = c * grain;
+            const size_t e = std::min(count, b + grain);
+            double lo = std::numeric_limits<double>::max();
+            double hi = std::numeric_limits<double>::lowest();
+            for (size_t i = b; i < e; ++i) {
+                const double v = static_cast<double>(data[i]);
+                if (v == v) {
+                    lo = std::min(lo, v);
+                    hi = std::max(hi, v);
+                }
+            }
+            chunkMin[c] = lo;
+            chunkMax[c] = hi;
+        }
+    });
+    hist.m_minimum = *std::min_element(chunkMin.begin(), chunkMin.end());
+    hist.m_maximum = *std::max_element(chunkMax.begin(), chunkMax.end());
+    if (hist.m_minimum > hist.m_maximum) {
+        return VolumeHistogram();
+    }
+
+    // 整型数据范围较小时一个 bin 对应一个灰度值
+    const double range = hist.m_maximum - hist.m_minimum;
+    if (std::numeric_limits<T>::is_integer && range + 1 <= static_cast<double>(binCount)) {
+        binCount = static_cast<size_t>(range) + 1;
+        hist.m_binWidth = 1.0;
+    } else {
+        hist.m_binWidth = range > 0.0 ? range / static_cast<double>(binCount) : 1.0;
+    }
+
+    // 第二遍：每个块独立统计，最后合并，避免原子操作竞争
+    const size_t workers = pool.GetThreadCount() + 1;
+    const size_t slices = std::min(chunkCount, workers * 2);
+    std::vector<std::vector<uint64_t>> partial(slices, std::vector<uint64_t>(binCount, 0));
+    const double scale = 1.0 / hist.m_binWidth;
+    const double minimum = hist.m_minimum;
+    pool.ParallelFor(0, slices, [&](size_t sb, size_t se) {
+        for (size_t s = sb; s < se; ++s) {
+            const size_t b = count * s / slices;
+            const size_t e = count * (s + 1) / slices;
+            auto &bins = partial[s];
+            for (size_t i = b; i < e; ++i) {
+                const double v = static_cast<double>(data[i]);
+                if (v != v) {
+                    continue;
+                }
+                size_t bin = static_cast<size_t>((v - minimum) * scale);
+                if (bin >= binCount) {
+                    bin = binCount - 1;
+                }
+                ++bins[bin];
+            }
+        }
+    });
+
+    hist.m_bins.assign(binCount, 0);
+    for (const auto &bins : partial) {
+        for (size_t i = 0; i < binCount; ++i) {
+            hist.m_bins[i] += bins[i];
+        }
+    }
+    for (uint64_t c : hist.m_bins) {
+        hist.m_total += c;
+    }
+    return hist;
+}
+
+#endif // VOLUMEHISTOGRAM_H
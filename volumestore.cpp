@@ -0,0 +1,727 @@
+﻿#include "volumestore.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+size_t CeilDiv(size_t value, size_t divisor)
+{
+    return (value + divisor - 1) / divisor;
+}
+
+// 压缩砖块的格式：首字节为编码方式，之后每组 32 个残差先写一字节位宽，再按位宽紧密排列（低位在前）
+enum BrickEncoding : unsigned char
+{
+    BrickRaw = 0,
+    BrickDeltaPacked = 1,
+};
+
+constexpr size_t PackGroupSize = 32;
+
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<unsigned char> &out) : m_out(out) {}
+
+    void Put(uint64_t value, int width)
+    {
+        // 一次最多放 32 位，累加器不会溢出
+        if (width > 32) {
+            Put(value & 0xffffffffu, 32);
+            Put(value >> 32, width - 32);
+            return;
+        }
+        m_acc |= value << m_bits;
+        m_bits += width;
+        while (m_bits >= 8) {
+            m_out.push_back(static_cast<unsigned char>(m_acc));
+            m_acc >>= 8;
+            m_bits -= 8;
+        }
+    }
+
+    void Flush()
+    {
+        if (m_bits > 0) {
+            m_out.push_back(static_cast<unsigned char>(m_acc));
+        }
+        m_acc = 0;
+        m_bits = 0;
+    }
+
+private:
+    std::vector<unsigned char> &m_out;
+    uint64_t m_acc = 0;
+    int m_bits = 0;
+};
+
+class BitReader
+{
+public:
+    BitReader(const unsigned char *data, size_t size) : m_data(data), m_size(size) {}
+
+    bool Get(int width, uint64_t &value)
+    {
+        if (width > 32) {
+            uint64_t low = 0;
+            uint64_t high = 0;
+            if (!Get(32, low) || !Get(width - 32, high)) {
+                return false;
+            }
+            value = low | (high << 32);
+            return true;
+        }
+        while (m_bits < width) {
+            if (m_pos >= m_size) {
+                return false;
+            }
+            m_acc |= static_cast<uint64_t>(m_data[m_pos++]) << m_bits;
+            m_bits += 8;
+        }
+        value = width == 0 ? 0 : (m_acc & ((uint64_t(1) << width) - 1));
+        m_acc >>= width;
+        m_bits -= width;
+        return true;
+    }
+
+private:
+    const unsigned char *m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+    uint64_t m_acc = 0;
+    int m_bits = 0;
+};
+
+// 预测值：行内取左邻，行首取上一行同列，第一个体素取 0；运算按标量位宽回绕，整数与浮点都无损
+template <typename U>
+inline U PredictVoxel(const U *values, size_t i, size_t rowLength)
+{
+    if (i % rowLength != 0) {
+        return values[i - 1];
+    }
+    return i >= rowLength ? values[i - rowLength] : U(0);
+}
+
+template <typename U>
+void EncodeBrick(const unsigned char *src, size_t voxelCount, size_t rowLength, std::vector<unsigned char> &out)
+{
+    constexpr int bits = static_cast<int>(sizeof(U) * 8);
+    std::vector<U> values(voxelCount);
+    std::memcpy(values.data(), src, voxelCount * sizeof(U));
+
+    out.push_back(BrickDeltaPacked);
+    uint64_t group[PackGroupSize];
+    for (size_t begin = 0; begin < voxelCount; begin += PackGroupSize) {
+        const size_t count = std::min(PackGroupSize, voxelCount - begin);
+        uint64_t used = 0;
+        for (size_t k = 0; k < count; ++k) {
+            const size_t i = begin + k;
+            const U delta = static_cast<U>(values[i] - PredictVoxel(values.data(), i, rowLength));
+            // zigzag：小的正负残差都映射为小的无符号数
+            const U sign = static_cast<U>(delta >> (bits - 1));
+            const U zig = static_cast<U>(static_cast<U>(delta << 1) ^ static_cast<U>(U(0) - sign));
+            group[k] = zig;
+            used |= zig;
+        }
+        int width = 0;
+        while (width < 64 && (used >> width) != 0) {
+            ++width;
+        }
+        out.push_back(static_cast<unsigned char>(width));
+        BitWriter writer(out);
+        for (size_t k = 0; k < count && width > 0; ++k) {
+            writer.Put(group[k], width);
+        }
+        writer.Flush();
+    }
+}
+
+template <typename U>
+bool DecodeBrick(const unsigned char *data, size_t size, size_t voxelCount, size_t rowLength, unsigned char *dst)
+{
+    std::vector<U> values(voxelCount);
+    size_t pos = 1;
+    for (size_t begin = 0; begin < voxelCount; begin += PackGroupSize) {
+        if (pos >= size) {
+            return false;
+        }
+        const int width = data[pos++];
+        if (width > static_cast<int>(sizeof(U) * 8)) {
+            return false;
+        }
+        const size_t count = std::min(PackGroupSize, voxelCount - begin);
+        BitReader reader(data + pos, size - pos);
+        for (size_t k = 0; k < count; ++k) {
+            const size_t i = begin + k;
+            uint64_t zig = 0;
+            if (!reader.Get(width, zig)) {
+                return false;
+            }
+            const U z = static_cast<U>(zig);
+            const U delta = static_cast<U>(static_cast<U>(z >> 1) ^ static_cast<U>(U(0) - static_cast<U>(z & 1)));
+            values[i] = static_cast<U>(PredictVoxel(values.data(), i, rowLength) + delta);
+        }
+        pos += (static_cast<size_t>(width) * count + 7) / 8;
+    }
+    std::memcpy(dst, values.data(), voxelCount * sizeof(U));
+    return true;
+}
+
+} // namespace
+
+BrickedVolumeStore::BrickedVolumeStore(const VolumeGeometry &geometry, int brickSize, size_t residentBudget)
+    : m_geometry(geometry)
+    , m_brickSize(std::max(8, brickSize))
+    , m_brickBytes(0)
+    , m_budget(residentBudget)
+    , m_residentBytes(0)
+    , m_pendingPrefetch(0)
+    , m_slabSlices(0)
+    , m_writtenSlices(0)
+    , m_writeFinished(false)
+    , m_writeFailed(false)
+{
+    const size_t b = static_cast<size_t>(m_brickSize);
+    m_brickBytes = b * b * b * m_geometry.bytesPerVoxel;
+    for (int axis = 0; axis < 3; ++axis) {
+        m_brickCount[axis] = CeilDiv(static_cast<size_t>(std::max(1, m_geometry.dims[axis])), b);
+    }
+
+    // 预算至少要容纳三个正交平面所需的砖块，外加一个平面的预读余量，否则单帧内就会颠簸
+    const size_t axialBricks = m_brickCount[0] * m_brickCount[1];
+    const size_t coronalBricks = m_brickCount[0] * m_brickCount[2];
+    const size_t sagittalBricks = m_brickCount[1] * m_brickCount[2];
+    const size_t largest = std::max({ axialBricks, coronalBricks, sagittalBricks });
+    const size_t minimumBudget = (axialBricks + coronalBricks + sagittalBricks + largest) * m_brickBytes;
+    m_budget = std::max(m_budget, minimumBudget);
+}
+
+BrickedVolumeStore::~BrickedVolumeStore() = default;
+
+size_t BrickedVolumeStore::GetResidentBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    return m_residentBytes;
+}
+
+bool BrickedVolumeStore::AppendSlice(const void *slice)
+{
+    return AppendSlices(slice, 1);
+}
+
+bool BrickedVolumeStore::AppendSlices(const void *slices, int count)
+{
+    if (m_writeFinished || m_writeFailed || !slices || count <= 0) {
+        return false;
+    }
+    const size_t sliceBytes = static_cast<size_t>(m_geometry.dims[0]) * m_geometry.dims[1] *
+                              m_geometry.bytesPerVoxel;
+    if (m_slab.empty()) {
+        m_slab.assign(sliceBytes * m_brickSize, 0);
+    }
+
+    const auto *src = static_cast<const unsigned char *>(slices);
+    for (int i = 0; i < count; ++i) {
+        if (m_writtenSlices + m_slabSlices >= m_geometry.dims[2]) {
+            return false;
+        }
+        std::memcpy(m_slab.data() + sliceBytes * m_slabSlices, src + sliceBytes * i, sliceBytes);
+        if (++m_slabSlices == m_brickSize && !FlushSlab()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BrickedVolumeStore::FlushSlab()
+{
+    if (m_slabSlices == 0) {
+        return true;
+    }
+
+    const size_t b = static_cast<size_t>(m_brickSize);
+    const size_t bpv = m_geometry.bytesPerVoxel;
+    const size_t nx = static_cast<size_t>(m_geometry.dims[0]);
+    const size_t ny = static_cast<size_t>(m_geometry.dims[1]);
+    const size_t bz = static_cast<size_t>(m_writtenSlices) / b;
+    const size_t slabBricks = m_brickCount[0] * m_brickCount[1];
+    std::atomic<bool> ok(true);
+
+    ThreadPool::Global().ParallelFor(0, slabBricks, [&](size_t begin, size_t end) {
+        std::vector<unsigned char> brick(m_brickBytes);
+        for (size_t i = begin; i < end; ++i) {
+            const size_t bx = i % m_brickCount[0];
+            const size_t by = i / m_brickCount[0];
+            const size_t x0 = bx * b;
+            const size_t y0 = by * b;
+            const size_t width = std::min(b, nx - x0);
+            const size_t height = std::min(b, ny - y0);
+            // 边缘砖块补零，保证每块大小一致，文件偏移可直接由编号计算
+            std::fill(brick.begin(), brick.end(), 0);
+            for (size_t z = 0; z < static_cast<size_t>(m_slabSlices); ++z) {
+                for (size_t y = 0; y < height; ++y) {
+                    const unsigned char *row = m_slab.data() + ((z * ny + y0 + y) * nx + x0) * bpv;
+                    std::memcpy(brick.data() + ((z * b + y) * b) * bpv, row, width * bpv);
+                }
+            }
+            const size_t brickId = (bz * m_brickCount[1] + by) * m_brickCount[0] + bx;
+            if (!WriteBrick(brickId, brick.data())) {
+                ok.store(false);
+            }
+        }
+    });
+
+    m_writtenSlices += m_slabSlices;
+    m_slabSlices = 0;
+    std::fill(m_slab.begin(), m_slab.end(), 0);
+    if (!ok.load()) {
+        m_writeFailed = true;
+    }
+    return ok.load();
+}
+
+bool BrickedVolumeStore::FinishWrite()
+{
+    if (m_writeFinished) {
+        return !m_writeFailed;
+    }
+    const bool flushed = FlushSlab();
+    std::vector<unsigned char>().swap(m_slab);
+    m_writeFinished = true;
+    return flushed && !m_writeFailed && m_writtenSlices == m_geometry.dims[2];
+}
+
+size_t BrickedVolumeStore::PlaneVoxelCount(int axis) const
+{
+    switch (axis) {
+    case 0:
+        return static_cast<size_t>(m_geometry.dims[1]) * m_geometry.dims[2];
+    case 1:
+        return static_cast<size_t>(m_geometry.dims[0]) * m_geometry.dims[2];
+    default:
+        return static_cast<size_t>(m_geometry.dims[0]) * m_geometry.dims[1];
+    }
+}
+
+void BrickedVolumeStore::BricksForPlane(int axis, int index, std::vector<size_t> &brickIds) const
+{
+    brickIds.clear();
+    if (axis < 0 || axis > 2 || index < 0 || index >= m_geometry.dims[axis]) {
+        return;
+    }
+    size_t lo[3] = { 0, 0, 0 };
+    size_t hi[3] = { m_brickCount[0], m_brickCount[1], m_brickCount[2] };
+    lo[axis] = static_cast<size_t>(index) / static_cast<size_t>(m_brickSize);
+    hi[axis] = lo[axis] + 1;
+    brickIds.reserve((hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]));
+    for (size_t bz = lo[2]; bz < hi[2]; ++bz) {
+        for (size_t by = lo[1]; by < hi[1]; ++by) {
+            for (size_t bx = lo[0]; bx < hi[0]; ++bx) {
+                brickIds.push_back((bz * m_brickCount[1] + by) * m_brickCount[0] + bx);
+            }
+        }
+    }
+}
+
+std::shared_ptr<const BrickedVolumeStore::Brick> BrickedVolumeStore::AcquireBrick(size_t brickId)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        auto it = m_cache.find(brickId);
+        if (it != m_cache.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+            return it->second.data;
+        }
+    }
+
+    // 读盘在锁外进行；偶发的重复读取由下面的二次检查消化
+    auto brick = std::make_shared<Brick>(m_brickBytes);
+    if (!ReadBrick(brickId, brick->data())) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto it = m_cache.find(brickId);
+    if (it != m_cache.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+        return it->second.data;
+    }
+    m_lru.push_front(brickId);
+    m_cache.emplace(brickId, CacheEntry{ brick, m_lru.begin() });
+    m_residentBytes += m_brickBytes;
+
+    // 正在被使用的砖块由 shared_ptr 保活，淘汰只是让缓存放手
+    while (m_residentBytes > m_budget && m_lru.size() > 1) {
+        const size_t victim = m_lru.back();
+        m_lru.pop_back();
+        m_cache.erase(victim);
+        m_residentBytes -= m_brickBytes;
+    }
+    return brick;
+}
+
+bool BrickedVolumeStore::ExtractPlane(int axis, int index, void *dst, ThreadPool &pool)
+{
+    if (!dst || !m_writeFinished || axis < 0 || axis > 2 ||
+        index < 0 || index >= m_geometry.dims[axis]) {
+        return false;
+    }
+
+    std::vector<size_t> brickIds;
+    BricksForPlane(axis, index, brickIds);
+
+    const size_t b = static_cast<size_t>(m_brickSize);
+    const size_t bpv = m_geometry.bytesPerVoxel;
+    const size_t nx = static_cast<size_t>(m_geometry.dims[0]);
+    const size_t ny = static_cast<size_t>(m_geometry.dims[1]);
+    const size_t nz = static_cast<size_t>(m_geometry.dims[2]);
+    const size_t local = static_cast<size_t>(index) % b;
+    auto *out = static_cast<unsigned char *>(dst);
+    std::atomic<bool> ok(true);
+
+    pool.ParallelFor(0, brickIds.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const size_t brickId = brickIds[i];
+            const size_t bx = brickId % m_brickCount[0];
+            const size_t by = (brickId / m_brickCount[0]) % m_brickCount[1];
+            const size_t bz = brickId / (m_brickCount[0] * m_brickCount[1]);
+            const size_t x0 = bx * b;
+            const size_t y0 = by * b;
+            const size_t z0 = bz * b;
+            const size_t width = std::min(b, nx - x0);
+            const size_t height = std::min(b, ny - y0);
+            const size_t depth = std::min(b, nz - z0);
+
+            std::shared_ptr<const Brick> brick = AcquireBrick(brickId);
+            if (!brick) {
+                ok.store(false);
+                continue;
+            }
+            const unsigned char *data = brick->data();
+
+            if (axis == 2) {
+                for (size_t y = 0; y < height; ++y) {
+                    std::memcpy(out + ((y0 + y) * nx + x0) * bpv,
+                                data + ((local * b + y) * b) * bpv, width * bpv);
+                }
+            } else if (axis == 1) {
+                for (size_t z = 0; z < depth; ++z) {
+                    std::memcpy(out + ((z0 + z) * nx + x0) * bpv,
+                                data + ((z * b + local) * b) * bpv, width * bpv);
+                }
+            } else {
+                for (size_t z = 0; z < depth; ++z) {
+                    for (size_t y = 0; y < height; ++y) {
+                        std::memcpy(out + ((z0 + z) * ny + y0 + y) * bpv,
+                                    data + ((z * b + y) * b + local) * bpv, bpv);
+                    }
+                }
+            }
+        }
+    });
+    return ok.load();
+}
+
+void BrickedVolumeStore::Prefetch(int axis, int index, ThreadPool &pool)
+{
+    if (!m_writeFinished || axis < 0 || axis > 2 || index < 0 || index >= m_geometry.dims[axis]) {
+        return;
+    }
+    // 预读只是提示：排队过多时直接放弃，不与当前显示争抢 I/O
+    if (m_pendingPrefetch.fetch_add(1) >= 2) {
+        m_pendingPrefetch.fetch_sub(1);
+        return;
+    }
+    std::shared_ptr<BrickedVolumeStore> self = shared_from_this();
+    pool.Submit([self, axis, index]() {
+        std::vector<size_t> brickIds;
+        self->BricksForPlane(axis, index, brickIds);
+        for (size_t brickId : brickIds) {
+            self->AcquireBrick(brickId);
+        }
+        self->m_pendingPrefetch.fetch_sub(1);
+    });
+}
+
+uint64_t BrickedVolumeStore::PhysicalMemoryBytes()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return static_cast<uint64_t>(status.ullTotalPhys);
+    }
+    return 0;
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || pageSize <= 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize);
+#endif
+}
+
+// ===== FileVolumeStore =====
+
+std::shared_ptr<FileVolumeStore> FileVolumeStore::Create(const std::string &filePath,
+                                                         const VolumeGeometry &geometry,
+                                                         size_t residentBudget,
+                                                         int brickSize)
+{
+    if (geometry.bytesPerVoxel == 0 || geometry.VoxelCount() == 0) {
+        return nullptr;
+    }
+    std::shared_ptr<FileVolumeStore> store(new FileVolumeStore(filePath, geometry, residentBudget, brickSize));
+    if (!store->Open()) {
+        return nullptr;
+    }
+    return store;
+}
+
+FileVolumeStore::FileVolumeStore(const std::string &filePath, const VolumeGeometry &geometry,
+                                 size_t residentBudget, int brickSize)
+    : BrickedVolumeStore(geometry, brickSize, residentBudget)
+    , m_filePath(filePath)
+#ifdef _WIN32
+    , m_handle(INVALID_HANDLE_VALUE)
+#else
+    , m_fd(-1)
+#endif
+{
+}
+
+FileVolumeStore::~FileVolumeStore()
+{
+#ifdef _WIN32
+    if (m_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(static_cast<HANDLE>(m_handle));
+    }
+#else
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+#endif
+}
+
+bool FileVolumeStore::Open()
+{
+#ifdef _WIN32
+    const int length = MultiByteToWideChar(CP_UTF8, 0, m_filePath.c_str(), -1, nullptr, 0);
+    std::wstring widePath(static_cast<size_t>(std::max(length, 1)), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, m_filePath.c_str(), -1, &widePath[0], length);
+    // 临时文件：尽量留在系统缓存中，句柄关闭时由系统删除
+    HANDLE handle = CreateFileW(widePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    m_handle = handle;
+    return true;
+#else
+    m_fd = open(m_filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (m_fd < 0) {
+        return false;
+    }
+    // 打开后立即删除目录项，进程退出（包括崩溃）时空间自动回收
+    unlink(m_filePath.c_str());
+    return true;
+#endif
+}
+
+bool FileVolumeStore::ReadBrick(size_t brickId, void *dst)
+{
+    const uint64_t offset = static_cast<uint64_t>(brickId) * GetBrickBytes();
+    auto *out = static_cast<char *>(dst);
+    size_t remaining = GetBrickBytes();
+#ifdef _WIN32
+    uint64_t position = offset;
+    while (remaining > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(position & 0xffffffffu);
+        overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+        DWORD bytesRead = 0;
+        const DWORD request = static_cast<DWORD>(std::min<size_t>(remaining, 1u << 30));
+        if (!ReadFile(static_cast<HANDLE>(m_handle), out, request, &bytesRead, &overlapped) || bytesRead == 0) {
+            return false;
+        }
+        out += bytesRead;
+        position += bytesRead;
+        remaining -= bytesRead;
+    }
+    return true;
+#else
+    off_t position = static_cast<off_t>(offset);
+    while (remaining > 0) {
+        const ssize_t n = pread(m_fd, out, remaining, position);
+        if (n <= 0) {
+            return false;
+        }
+        out += n;
+        position += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    return true;
+#endif
+}
+
+bool FileVolumeStore::WriteBrick(size_t brickId, const void *src)
+{
+    const uint64_t offset = static_cast<uint64_t>(brickId) * GetBrickBytes();
+    const auto *in = static_cast<const char *>(src);
+    size_t remaining = GetBrickBytes();
+#ifdef _WIN32
+    uint64_t position = offset;
+    while (remaining > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(position & 0xffffffffu);
+        overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+        DWORD bytesWritten = 0;
+        const DWORD request = static_cast<DWORD>(std::min<size_t>(remaining, 1u << 30));
+        if (!WriteFile(static_cast<HANDLE>(m_handle), in, request, &bytesWritten, &overlapped) ||
+            bytesWritten == 0) {
+            return false;
+        }
+        in += bytesWritten;
+        position += bytesWritten;
+        remaining -= bytesWritten;
+    }
+    return true;
+#else
+    off_t position = static_cast<off_t>(offset);
+    while (remaining > 0) {
+        const ssize_t n = pwrite(m_fd, in, remaining, position);
+        if (n <= 0) {
+            return false;
+        }
+        in += n;
+        position += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    return true;
+#endif
+}
+
+// ===== CompressedVolumeStore =====
+
+std::shared_ptr<CompressedVolumeStore> CompressedVolumeStore::Create(const VolumeGeometry &geometry,
+                                                                     size_t residentBudget,
+                                                                     size_t maxCompressedBytes,
+                                                                     int brickSize)
+{
+    if (geometry.bytesPerVoxel == 0 || geometry.VoxelCount() == 0) {
+        return nullptr;
+    }
+    return std::shared_ptr<CompressedVolumeStore>(
+        new CompressedVolumeStore(geometry, residentBudget, maxCompressedBytes, brickSize));
+}
+
+CompressedVolumeStore::CompressedVolumeStore(const VolumeGeometry &geometry, size_t residentBudget,
+                                             size_t maxCompressedBytes, int brickSize)
+    : BrickedVolumeStore(geometry, brickSize, residentBudget)
+    , m_maxCompressedBytes(maxCompressedBytes)
+    , m_bricks(GetBrickCount())
+    , m_compressedBytes(0)
+    , m_overLimit(false)
+{
+}
+
+size_t CompressedVolumeStore::GetCompressedLimit() const
+{
+    // 原样存放的砖块比原始数据多一个编码字节
+    const size_t rawBytes = GetBrickCount() * (GetBrickBytes() + 1);
+    return m_maxCompressedBytes > 0 ? std::min(m_maxCompressedBytes, rawBytes) : rawBytes;
+}
+
+bool CompressedVolumeStore::WriteBrick(size_t brickId, const void *src)
+{
+    if (brickId >= m_bricks.size()) {
+        return false;
+    }
+    const auto *in = static_cast<const unsigned char *>(src);
+    const size_t bytesPerVoxel = GetGeometry().bytesPerVoxel;
+    const size_t voxelCount = GetBrickBytes() / bytesPerVoxel;
+    const size_t rowLength = static_cast<size_t>(GetBrickSize());
+
+    std::vector<unsigned char> encoded;
+    encoded.reserve(GetBrickBytes() / 2);
+    switch (bytesPerVoxel) {
+    case 1:
+        EncodeBrick<uint8_t>(in, voxelCount, rowLength, encoded);
+        break;
+    case 2:
+        EncodeBrick<uint16_t>(in, voxelCount, rowLength, encoded);
+        break;
+    case 4:
+        EncodeBrick<uint32_t>(in, voxelCount, rowLength, encoded);
+        break;
+    case 8:
+        EncodeBrick<uint64_t>(in, voxelCount, rowLength, encoded);
+        break;
+    default:
+        break;
+    }
+    // 噪声大到打包后反而变大（或标量宽度不支持）时按原样存放
+    if (encoded.empty() || encoded.size() > GetBrickBytes() + 1) {
+        encoded.assign(1, BrickRaw);
+        encoded.insert(encoded.end(), in, in + GetBrickBytes());
+    }
+
+    const size_t size = encoded.size();
+    if (m_compressedBytes.fetch_add(size) + size > m_maxCompressedBytes && m_maxCompressedBytes > 0) {
+        m_compressedBytes.fetch_sub(size);
+        m_overLimit.store(true);
+        return false;
+    }
+    // 按实际大小复制一份，不保留编码时的预留容量
+    m_bricks[brickId].assign(encoded.begin(), encoded.end());
+    return true;
+}
+
+bool CompressedVolumeStore::ReadBrick(size_t brickId, void *dst)
+{
+    if (brickId >= m_bricks.size() || m_bricks[brickId].empty()) {
+        return false;
+    }
+    const std::vector<unsigned char> &encoded = m_bricks[brickId];
+    auto *out = static_cast<unsigned char *>(dst);
+    if (encoded[0] == BrickRaw) {
+        if (encoded.size() != GetBrickBytes() + 1) {
+            return false;
+        }
+        std::memcpy(out, encoded.data() + 1, GetBrickBytes());
+        return true;
+    }
+
+    const size_t bytesPerVoxel = GetGeometry().bytesPerVoxel;
+    const size_t voxelCount = GetBrickBytes() / bytesPerVoxel;
+    const size_t rowLength = static_cast<size_t>(GetBrickSize());
+    switch (bytesPerVoxel) {
+    case 1:
+        return DecodeBrick<uint8_t>(encoded.data(), encoded.size(), voxelCount, rowLength, out);
+    case 2:
+        return DecodeBrick<uint16_t>(encoded.data(), encoded.size(), voxelCount, rowLength, out);
+    case 4:
+        return DecodeBrick<uint32_t>(encoded.data(), encoded.size(), voxelCount, rowLength, out);
+    case 8:
+        return DecodeBrick<uint64_t>(encoded.data(), encoded.size(), voxelCount, rowLength, out);
+    default:
+        return false;
+    }
+}
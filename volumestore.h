@@ -0,0 +1,172 @@
+﻿#ifndef VOLUMESTORE_H
+#define VOLUMESTORE_H
+
+#include "threadpool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 体数据几何与标量类型（scalarType 取 VTK 类型常量，如 VTK_SHORT）
+struct VolumeGeometry
+{
+    int dims[3] = { 0, 0, 0 };
+    double spacing[3] = { 1.0, 1.0, 1.0 };
+    double origin[3] = { 0.0, 0.0, 0.0 };
+    int scalarType = 0;
+    size_t bytesPerVoxel = 0;
+
+    size_t VoxelCount() const
+    {
+        return static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1]) * static_cast<size_t>(dims[2]);
+    }
+    size_t ByteSize() const { return VoxelCount() * bytesPerVoxel; }
+};
+
+// 按砖块 (brick) 存放的体数据：后端只负责整块读写，本类负责 LRU 缓存、
+// 平面提取与沿滚动方向的预读。常驻内存受 residentBudget 限制。
+// 写入阶段按轴位顺序追加切片，每凑满一层砖块即写出，写入完成后只读。
+class BrickedVolumeStore : public std::enable_shared_from_this<BrickedVolumeStore>
+{
+public:
+    static constexpr int DefaultBrickSize = 32;
+
+    BrickedVolumeStore(const VolumeGeometry &geometry, int brickSize, size_t residentBudget);
+    virtual ~BrickedVolumeStore();
+
+    BrickedVolumeStore(const BrickedVolumeStore &) = delete;
+    BrickedVolumeStore &operator=(const BrickedVolumeStore &) = delete;
+
+    const VolumeGeometry &GetGeometry() const { return m_geometry; }
+    int GetBrickSize() const { return m_brickSize; }
+    size_t GetBrickBytes() const { return m_brickBytes; }
+    size_t GetBrickCount() const { return m_brickCount[0] * m_brickCount[1] * m_brickCount[2]; }
+    size_t GetResidentBudget() const { return m_budget; }
+    size_t GetResidentBytes() const;
+
+    // 顺序追加一张完整的轴位切片（dims[0] * dims[1] 个体素）
+    bool AppendSlice(const void *slice);
+    // 追加若干连续轴位切片，砖块层凑满后按块并行写出
+    bool AppendSlices(const void *slices, int count);
+    bool FinishWrite();
+    bool IsWriteFinished() const { return m_writeFinished; }
+
+    // 提取垂直于 axis（0=X 矢状, 1=Y 冠状, 2=Z 轴位）的第 index 个平面。
+    // dst 按 VTK 内存顺序排列：Z 平面为 [y][x]，Y 平面为 [z][x]，X 平面为 [z][y]
+    bool ExtractPlane(int axis, int index, void *dst, ThreadPool &pool = ThreadPool::Global());
+    size_t PlaneVoxelCount(int axis) const;
+
+    // 异步把平面所需的砖块读入缓存（已驻留的砖块不重复读取）
+    void Prefetch(int axis, int index, ThreadPool &pool = ThreadPool::Global());
+
+    // 物理内存的估计值，失败时返回 0
+    static uint64_t PhysicalMemoryBytes();
+
+protected:
+    // 后端接口：整块读写 m_brickBytes 字节，须可被多个线程同时调用
+    virtual bool ReadBrick(size_t brickId, void *dst) = 0;
+    virtual bool WriteBrick(size_t brickId, const void *src) = 0;
+
+private:
+    using Brick = std::vector<unsigned char>;
+
+    std::shared_ptr<const Brick> AcquireBrick(size_t brickId);
+    void BricksForPlane(int axis, int index, std::vector<size_t> &brickIds) const;
+    bool FlushSlab();
+
+    VolumeGeometry m_geometry;
+    int m_brickSize;
+    size_t m_brickBytes;
+    size_t m_brickCount[3];
+    size_t m_budget;
+
+    // LRU：链表头为最近使用
+    struct CacheEntry
+    {
+        std::shared_ptr<const Brick> data;
+        std::list<size_t>::iterator lruPos;
+    };
+    mutable std::mutex m_cacheMutex;
+    std::unordered_map<size_t, CacheEntry> m_cache;
+    std::list<size_t> m_lru;
+    size_t m_residentBytes;
+
+    std::atomic<int> m_pendingPrefetch;
+
+    // 写入阶段的砖块层缓冲
+    std::vector<unsigned char> m_slab;
+    int m_slabSlices;
+    int m_writtenSlices;
+    bool m_writeFinished;
+    bool m_writeFailed;
+};
+
+// 落盘后端：砖块按编号顺序存放在一个临时文件中，关闭时删除
+class FileVolumeStore : public BrickedVolumeStore
+{
+public:
+    static std::shared_ptr<FileVolumeStore> Create(const std::string &filePath,
+                                                   const VolumeGeometry &geometry,
+                                                   size_t residentBudget,
+                                                   int brickSize = DefaultBrickSize);
+    ~FileVolumeStore() override;
+
+    const std::string &GetFilePath() const { return m_filePath; }
+
+protected:
+    bool ReadBrick(size_t brickId, void *dst) override;
+    bool WriteBrick(size_t brickId, const void *src) override;
+
+private:
+    FileVolumeStore(const std::string &filePath, const VolumeGeometry &geometry,
+                    size_t residentBudget, int brickSize);
+    bool Open();
+
+    std::string m_filePath;
+#ifdef _WIN32
+    void *m_handle;
+#else
+    int m_fd;
+#endif
+};
+
+// 内存压缩后端：砖块内逐行做差分预测（行首取上一行），残差 zigzag 后每 32 个一组按组内最大位宽打包，
+// 完全无损。CT 的 12 位有效数据与大片空气区域通常压到原始大小的 1/3～1/5；
+// 解压只在取砖块时进行，解压后的砖块由基类的 LRU 缓存保留，缓存大小即 residentBudget
+class CompressedVolumeStore : public BrickedVolumeStore
+{
+public:
+    // maxCompressedBytes 为压缩数据总量上限，写入超出时失败，便于调用方改用其他后端；0 表示不限
+    static std::shared_ptr<CompressedVolumeStore> Create(const VolumeGeometry &geometry,
+                                                         size_t residentBudget,
+                                                         size_t maxCompressedBytes = 0,
+                                                         int brickSize = DefaultBrickSize);
+
+    size_t GetCompressedBytes() const { return m_compressedBytes.load(); }
+    // 压缩数据可能达到的最大字节数：上限与全部砖块原样存放两者中较小的一个
+    size_t GetCompressedLimit() const;
+    // 是否因超出 maxCompressedBytes 而写入失败（区别于读取 DICOM 出错）
+    bool IsOverLimit() const { return m_overLimit.load(); }
+
+protected:
+    bool ReadBrick(size_t brickId, void *dst) override;
+    bool WriteBrick(size_t brickId, const void *src) override;
+
+private:
+    CompressedVolumeStore(const VolumeGeometry &geometry, size_t residentBudget,
+                          size_t maxCompressedBytes, int brickSize);
+
+    size_t m_maxCompressedBytes;
+    // 按砖块编号存放；每个编号只由一个线程写一次，写入完成后只读
+    std::vector<std::vector<unsigned char>> m_bricks;
+    std::atomic<size_t> m_compressedBytes;
+    std::atomic<bool> m_overLimit;
+};
+
+#endif // VOLUMESTORE_H
@@ -0,0 +1,432 @@
+﻿#include "volumewriter.h"
+
+#include <itk_zlib.h>
+#include <vtkType.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+
+// 每块独立压缩的原始字节数；块越大压缩率越接近单线程，块越小并行度越高
+constexpr size_t ChunkSize = static_cast<size_t>(1) << 20;
+constexpr size_t NiftiHeaderSize = 348;
+constexpr size_t NiftiVoxOffset = 352;
+
+enum class StreamWrapper
+{
+    Gzip,
+    Zlib
+};
+
+struct CompressedChunk
+{
+    std::vector<unsigned char> data;
+    uLong checksum = 0;
+    size_t rawSize = 0;
+    bool ok = false;
+};
+
+// 体素类型在 NIfTI-1 datatype 与 MetaImage ElementType 中的表示
+struct VoxelFormat
+{
+    int scalarType;
+    size_t bytes;
+    int16_t niftiType;
+    const char *metaType;
+};
+
+const VoxelFormat VoxelFormats[] = {
+    { VTK_UNSIGNED_CHAR,  1, 2,    "MET_UCHAR" },
+    { VTK_SIGNED_CHAR,    1, 256,  "MET_CHAR" },
+    { VTK_CHAR,           1, 256,  "MET_CHAR" },
+    { VTK_SHORT,          2, 4,    "MET_SHORT" },
+    { VTK_UNSIGNED_SHORT, 2, 512,  "MET_USHORT" },
+    { VTK_INT,            4, 8,    "MET_INT" },
+    { VTK_UNSIGNED_INT,   4, 768,  "MET_UINT" },
+    { VTK_FLOAT,          4, 16,   "MET_FLOAT" },
+    { VTK_DOUBLE,         8, 64,   "MET_DOUBLE" },
+};
+
+const VoxelFormat *FindVoxelFormat(int scalarType)
+{
+    for (const VoxelFormat &format : VoxelFormats) {
+        if (format.scalarType == scalarType) {
+            return &format;
+        }
+    }
+    return nullptr;
+}
+
+void SetError(std::string *error, const std::string &message)
+{
+    if (error && error->empty()) {
+        *error = message;
+    }
+}
+
+// 原始 deflate 压缩一块。非末块以 Z_SYNC_FLUSH 结束（字节对齐且无结束标记），
+// 因此各块可直接首尾相接组成一个合法的 deflate 流
+void DeflateChunk(const unsigned char *src, size_t size, bool last, StreamWrapper wrapper,
+                  CompressedChunk &chunk)
+{
+    chunk.rawSize = size;
+    chunk.checksum = wrapper == StreamWrapper::Gzip
+        ? crc32(crc32(0L, Z_NULL, 0), src, static_cast<uInt>(size))
+        : adler32(adler32(0L, Z_NULL, 0), src, static_cast<uInt>(size));
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+    // 同步刷新额外占用至多 5 字节的空存储块
+    chunk.data.resize(deflateBound(&stream, static_cast<uLong>(size)) + 16);
+    stream.next_in = const_cast<Bytef *>(src);
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = chunk.data.data();
+    stream.avail_out = static_cast<uInt>(chunk.data.size());
+
+    const int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    chunk.ok = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0);
+    chunk.data.resize(stream.total_out);
+    deflateEnd(&stream);
+}
+
+void WriteLE32(std::ostream &out, uint32_t value)
+{
+    const unsigned char bytes[4] = {
+        static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8),
+        static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)
+    };
+    out.write(reinterpret_cast<const char *>(bytes), 4);
+}
+
+// 并行压缩 prefix + data，写出带 gzip 或 zlib 头尾的单个压缩流；prefix（如 NIfTI 头）
+// 单独成块，避免为拼接复制整卷。一次只保留一批（线程数的若干倍）压缩结果
+bool WriteDeflateStream(std::ostream &out, const std::vector<unsigned char> &prefix,
+                        const unsigned char *data, size_t size,
+                        StreamWrapper wrapper, ThreadPool &pool,
+                        const std::function<void(double)> &progress,
+                        std::string *error)
+{
+    if (wrapper == StreamWrapper::Gzip) {
+        // ID1 ID2 CM=deflate FLG=0 MTIME=0 XFL=0 OS=unknown
+        const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    } else {
+        const unsigned char header[2] = { 0x78, 0x9c };
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    }
+
+    std::vector<std::pair<const unsigned char *, size_t>> pieces;
+    if (!prefix.empty()) {
+        pieces.emplace_back(prefix.data(), prefix.size());
+    }
+    for (size_t offset = 0; offset < size; offset += ChunkSize) {
+        pieces.emplace_back(data + offset, std::min(ChunkSize, size - offset));
+    }
+    if (pieces.empty()) {
+        pieces.emplace_back(data, 0);
+    }
+
+    const size_t chunkCount = pieces.size();
+    const size_t batchSize = std::max<size_t>(2, static_cast<size_t>(pool.GetThreadCount() + 1) * 2);
+    std::vector<CompressedChunk> batch(batchSize);
+    uLong checksum = wrapper == StreamWrapper::Gzip ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+
+    for (size_t first = 0; first < chunkCount; first += batchSize) {
+        const size_t count = std::min(batchSize, chunkCount - first);
+        pool.ParallelFor(0, count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const size_t chunkIndex = first + i;
+                batch[i] = CompressedChunk();
+                DeflateChunk(pieces[chunkIndex].first, pieces[chunkIndex].second,
+                             chunkIndex + 1 == chunkCount, wrapper, batch[i]);
+            }
+        });
+
+        for (size_t i = 0; i < count; ++i) {
+            const CompressedChunk &chunk = batch[i];
+            if (!chunk.ok) {
+                SetError(error, "Compression failed.");
+                return false;
+            }
+            out.write(reinterpret_cast<const char *>(chunk.data.data()),
+                      static_cast<std::streamsize>(chunk.data.size()));
+            checksum = wrapper == StreamWrapper::Gzip
+                ? crc32_combine(checksum, chunk.checksum, static_cast<z_off_t>(chunk.rawSize))
+                : adler32_combine(checksum, chunk.checksum, static_cast<z_off_t>(chunk.rawSize));
+        }
+        if (!out) {
+            SetError(error, "Cannot write file.");
+            return false;
+        }
+        if (progress) {
+            progress(static_cast<double>(first + count) / chunkCount);
+        }
+    }
+
+    if (wrapper == StreamWrapper::Gzip) {
+        WriteLE32(out, static_cast<uint32_t>(checksum));
+        WriteLE32(out, static_cast<uint32_t>(prefix.size() + size));
+    } else {
+        const unsigned char trailer[4] = {
+            static_cast<unsigned char>(checksum >> 24), static_cast<unsigned char>(checksum >> 16),
+            static_cast<unsigned char>(checksum >> 8), static_cast<unsigned char>(checksum)
+        };
+        out.write(reinterpret_cast<const char *>(trailer), 4);
+    }
+    return static_cast<bool>(out);
+}
+
+template <typename T>
+void Put(std::vector<unsigned char> &buffer, size_t offset, T value)
+{
+    std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+// NIfTI 使用 RAS 坐标：LPS 的前两行取反。方向矩阵同时写入 sform 与四元数 qform
+std::vector<unsigned char> BuildNiftiHeader(const VolumeFileDescription &desc, const VoxelFormat &format)
+{
+    std::vector<unsigned char> header(NiftiVoxOffset, 0);
+    Put<int32_t>(header, 0, static_cast<int32_t>(NiftiHeaderSize));
+    header[38] = 'r';
+
+    const int16_t dim[8] = { 3, static_cast<int16_t>(desc.dims[0]), static_cast<int16_t>(desc.dims[1]),
+                             static_cast<int16_t>(desc.dims[2]), 1, 1, 1, 1 };
+    for (int i = 0; i < 8; ++i) {
+        Put<int16_t>(header, 40 + 2 * i, dim[i]);
+    }
+    Put<int16_t>(header, 70, format.niftiType);
+    Put<int16_t>(header, 72, static_cast<int16_t>(format.bytes * 8));
+
+    double ras[3][3];
+    for (int r = 0; r < 3; ++r) {
+        const double sign = r < 2 ? -1.0 : 1.0;
+        for (int c = 0; c < 3; ++c) {
+            ras[r][c] = sign * desc.direction[r * 3 + c];
+        }
+    }
+    const double determinant =
+        ras[0][0] * (ras[1][1] * ras[2][2] - ras[1][2] * ras[2][1]) -
+        ras[0][1] * (ras[1][0] * ras[2][2] - ras[1][2] * ras[2][0]) +
+        ras[0][2] * (ras[1][0] * ras[2][1] - ras[1][1] * ras[2][0]);
+    const float qfac = determinant < 0.0 ? -1.0f : 1.0f;
+
+    const float pixdim[8] = { qfac, static_cast<float>(desc.spacing[0]), static_cast<float>(desc.spacing[1]),
+                              static_cast<float>(desc.spacing[2]), 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int i = 0; i < 8; ++i) {
+        Put<float>(header, 76 + 4 * i, pixdim[i]);
+    }
+    Put<float>(header, 108, static_cast<float>(NiftiVoxOffset));
+    header[123] = 2;   // NIFTI_UNITS_MM
+
+    const double offset[3] = { -desc.origin[0], -desc.origin[1], desc.origin[2] };
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            Put<float>(header, 280 + 16 * r + 4 * c, static_cast<float>(ras[r][c] * desc.spacing[c]));
+        }
+        Put<float>(header, 280 + 16 * r + 12, static_cast<float>(offset[r]));
+    }
+
+    // 旋转矩阵 -> 四元数（与 nifti_mat44_to_quatern 相同），左手系时第三列取反
+    double m[3][3];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            m[r][c] = (c == 2 && qfac < 0.0f) ? -ras[r][c] : ras[r][c];
+        }
+    }
+    double a = m[0][0] + m[1][1] + m[2][2] + 1.0;
+    double b = 0.0;
+    double c = 0.0;
+    double d = 0.0;
+    if (a > 0.5) {
+        a = 0.5 * std::sqrt(a);
+        b = 0.25 * (m[2][1] - m[1][2]) / a;
+        c = 0.25 * (m[0][2] - m[2][0]) / a;
+        d = 0.25 * (m[1][0] - m[0][1]) / a;
+    } else {
+        const double xd = 1.0 + m[0][0] - (m[1][1] + m[2][2]);
+        const double yd = 1.0 + m[1][1] - (m[0][0] + m[2][2]);
+        const double zd = 1.0 + m[2][2] - (m[0][0] + m[1][1]);
+        if (xd > 1.0) {
+            b = 0.5 * std::sqrt(xd);
+            c = 0.25 * (m[0][1] + m[1][0]) / b;
+            d = 0.25 * (m[0][2] + m[2][0]) / b;
+            a = 0.25 * (m[2][1] - m[1][2]) / b;
+        } else if (yd > 1.0) {
+            c = 0.5 * std::sqrt(yd);
+            b = 0.25 * (m[0][1] + m[1][0]) / c;
+            d = 0.25 * (m[1][2] + m[2][1]) / c;
+            a = 0.25 * (m[0][2] - m[2][0]) / c;
+        } else {
+            d = 0.5 * std::sqrt(zd);
+            b = 0.25 * (m[0][2] + m[2][0]) / d;
+            c = 0.25 * (m[1][2] + m[2][1]) / d;
+            a = 0.25 * (m[1][0] - m[0][1]) / d;
+        }
+        if (a < 0.0) {
+            b = -b;
+            c = -c;
+            d = -d;
+        }
+    }
+
+    Put<int16_t>(header, 252, 1);   // qform_code = NIFTI_XFORM_SCANNER_ANAT
+    Put<int16_t>(header, 254, 1);   // sform_code
+    Put<float>(header, 256, static_cast<float>(b));
+    Put<float>(header, 260, static_cast<float>(c));
+    Put<float>(header, 264, static_cast<float>(d));
+    for (int r = 0; r < 3; ++r) {
+        Put<float>(header, 268 + 4 * r, static_cast<float>(offset[r]));
+    }
+    std::memcpy(header.data() + 344, "n+1", 4);
+    // 348..351 为扩展标志，保持为 0
+    return header;
+}
+
+bool WriteNifti(const std::filesystem::path &path, const unsigned char *data, size_t size,
+                const VolumeFileDescription &desc, const VoxelFormat &format, bool compress, ThreadPool &pool,
+                const std::function<void(double)> &progress, std::string *error)
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        if (desc.dims[axis] > 32767) {
+            SetError(error, "Volume is too large for NIfTI-1.");
+            return false;
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        SetError(error, "Cannot open file for writing.");
+        return false;
+    }
+
+    // gzip 流压缩的是“头 + 体素”整体
+    const std::vector<unsigned char> header = BuildNiftiHeader(desc, format);
+    if (!compress) {
+        out.write(reinterpret_cast<const char *>(header.data()), static_cast<std::streamsize>(header.size()));
+        out.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+        if (progress) {
+            progress(1.0);
+        }
+        return static_cast<bool>(out);
+    }
+    return WriteDeflateStream(out, header, data, size, StreamWrapper::Gzip, pool, progress, error);
+}
+
+bool WriteMetaImage(const std::filesystem::path &path, const unsigned char *data, size_t size,
+                    const VolumeFileDescription &desc, const VoxelFormat &format, ThreadPool &pool,
+                    const std::function<void(double)> &progress, std::string *error)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        SetError(error, "Cannot open file for writing.");
+        return false;
+    }
+
+    // TransformMatrix 的第 i 行为体素轴 i 的方向（即方向矩阵的第 i 列）
+    std::ostringstream header;
+    header << std::setprecision(17);
+    header << "ObjectType = Image\n"
+           << "NDims = 3\n"
+           << "BinaryData = True\n"
+           << "BinaryDataByteOrderMSB = False\n"
+           << "CompressedData = True\n";
+    out << header.str();
+    header.str(std::string());
+
+    // 压缩后大小要等写完才知道：先写定宽占位，结束后回填（MetaIO 忽略行尾空格）
+    constexpr int SizeFieldWidth = 20;
+    out << "CompressedDataSize = ";
+    const std::streampos sizeField = out.tellp();
+    out << std::string(SizeFieldWidth, ' ') << '\n';
+
+    header << "TransformMatrix =";
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int r = 0; r < 3; ++r) {
+            header << ' ' << desc.direction[r * 3 + axis];
+        }
+    }
+    header << "\nOffset = " << desc.origin[0] << ' ' << desc.origin[1] << ' ' << desc.origin[2]
+           << "\nCenterOfRotation = 0 0 0"
+           << "\nElementSpacing = " << desc.spacing[0] << ' ' << desc.spacing[1] << ' ' << desc.spacing[2]
+           << "\nDimSize = " << desc.dims[0] << ' ' << desc.dims[1] << ' ' << desc.dims[2]
+           << "\nElementType = " << format.metaType
+           << "\nElementDataFile = LOCAL\n";
+    out << header.str();
+
+    const std::streampos dataBegin = out.tellp();
+    if (!WriteDeflateStream(out, {}, data, size, StreamWrapper::Zlib, pool, progress, error)) {
+        return false;
+    }
+    const std::streamoff compressedSize = out.tellp() - dataBegin;
+
+    std::ostringstream sizeText;
+    sizeText << std::left << std::setw(SizeFieldWidth) << compressedSize;
+    out.seekp(sizeField);
+    out << sizeText.str();
+    out.flush();
+    if (!out) {
+        SetError(error, "Cannot write file.");
+        return false;
+    }
+    return true;
+}
+
+bool EndsWith(const std::string &text, const std::string &suffix)
+{
+    if (text.size() < suffix.size()) {
+        return false;
+    }
+    return std::equal(suffix.rbegin(), suffix.rend(), text.rbegin(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+} // namespace
+
+bool WriteCompressedVolume(const std::filesystem::path &path,
+                           const void *voxels,
+                           const VolumeFileDescription &description,
+                           std::string *error,
+                           ThreadPool &pool,
+                           const std::function<void(double)> &progress)
+{
+    if (!voxels || description.dims[0] <= 0 || description.dims[1] <= 0 || description.dims[2] <= 0) {
+        SetError(error, "No volume data.");
+        return false;
+    }
+    const VoxelFormat *format = FindVoxelFormat(description.scalarType);
+    if (!format) {
+        SetError(error, "Unsupported voxel type.");
+        return false;
+    }
+
+    const size_t voxelCount = static_cast<size_t>(description.dims[0]) * description.dims[1] * description.dims[2];
+    const size_t size = voxelCount * format->bytes;
+    const unsigned char *data = static_cast<const unsigned char *>(voxels);
+
+    const std::string fileName = path.filename().u8string();
+    if (EndsWith(fileName, ".nii.gz")) {
+        return WriteNifti(path, data, size, description, *format, true, pool, progress, error);
+    }
+    if (EndsWith(fileName, ".nii")) {
+        return WriteNifti(path, data, size, description, *format, false, pool, progress, error);
+    }
+    if (EndsWith(fileName, ".mha")) {
+        return WriteMetaImage(path, data, size, description, *format, pool, progress, error);
+    }
+    SetError(error, "Unsupported file extension.");
+    return false;
+}
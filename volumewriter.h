@@ -0,0 +1,36 @@
+﻿#ifndef VOLUMEWRITER_H
+#define VOLUMEWRITER_H
+
+#include "threadpool.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+// 待保存体数据的几何信息与体素类型（LPS 物理坐标，与 ITK/DICOM 一致）
+struct VolumeFileDescription
+{
+    int dims[3] = { 0, 0, 0 };
+    double spacing[3] = { 1.0, 1.0, 1.0 };
+    double origin[3] = { 0.0, 0.0, 0.0 };
+    // 行主序，第 c 列为体素轴 c 的方向
+    double direction[9] = { 1.0, 0.0, 0.0,
+                            0.0, 1.0, 0.0,
+                            0.0, 0.0, 1.0 };
+    // VTK 标量类型常量（VTK_UNSIGNED_CHAR / VTK_SHORT / VTK_UNSIGNED_SHORT / VTK_INT / VTK_FLOAT 等）
+    int scalarType = 0;
+};
+
+// 按扩展名保存体数据（标签体或图像）：.nii.gz（gzip）、.nii（不压缩）、.mha（zlib 压缩的 MetaImage）。
+// 数据切成独立的块在线程池上并行 deflate，再拼接成单个标准 gzip / zlib 流，
+// 校验和由各块的 CRC32 / Adler-32 合并得到，任何 zlib 兼容的读取器都能读取。
+// progress 在调用线程上以 [0, 1] 报告已写出的比例。
+bool WriteCompressedVolume(const std::filesystem::path &path,
+                           const void *voxels,
+                           const VolumeFileDescription &description,
+                           std::string *error = nullptr,
+                           ThreadPool &pool = ThreadPool::Global(),
+                           const std::function<void(double)> &progress = {});
+
+#endif // VOLUMEWRITER_H
@@ -1,5 +1,7 @@
 ﻿#include "widget.h"
 #include "./ui_widget.h"
+#include "priorstudyview.h"
+#include "tiledimageview.h"
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1600)
 # pragma execution_character_set("utf-8")
@@ -12,10 +14,25 @@
 #include <QTextCodec>
 #include <QFile>
 #include <QStringList>
+#include <QComboBox>
+#include <QPointer>
+#include <QApplication>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QListWidget>
+#include <QShortcut>
+#include <QKeySequence>
+#include <QInputDialog>
+#include <QFileSystemWatcher>
+#include <QTimer>
 
 #include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <limits>
 
 // VTK module init
 #include <vtkAutoInit.h>
@@ -28,31 +45,29 @@ VTK_MODULE_INIT(vtkRenderingFreeType);
 #include <vtkRenderer.h>
 #include <vtkCommand.h>
 #include <vtkImagePlaneWidget.h>
-#include <vtkOutlineFilter.h>
+#include <vtkOutlineSource.h>
 #include <vtkPolyDataMapper.h>
 #include <vtkActor.h>
 #include <vtkProperty.h>
 #include <vtkCornerAnnotation.h>
 #include <vtkTextProperty.h>
-#include <vtkCellPicker.h>
 #include <vtkInteractorStyleImage.h>
 #include <vtkRenderWindowInteractor.h>
 #include <vtkDistanceWidget.h>
 #include <vtkDistanceRepresentation2D.h>
 #include <vtkProperty2D.h>
-#include <vtkImageReslice.h>
-#include <vtkImageMapToColors.h>
 #include <vtkImageActor.h>
 #include <vtkLookupTable.h>
 #include <vtkMatrix4x4.h>
 #include <vtkImageProperty.h>
-#include <vtkExtractVOI.h>
-#include <vtkImagePermute.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkCellArray.h>
+#include <vtkCoordinate.h>
+#include <vtkPolyDataMapper2D.h>
+#include <vtkMath.h>
 
-#include <itkImageSeriesReader.h>
 #include <itkImageFileReader.h>
-#include <itkGDCMImageIO.h>
-#include <itkGDCMSeriesFileNames.h>
 #include <itkMetaDataObject.h>
 
 Widget::Widget(QWidget *parent)
@@ -70,19 +85,87 @@ Widget::Widget(QWidget *parent)
     , renderer_sagittal(nullptr)
     , renderer_coronal(nullptr)
     , renderer_3d(nullptr)
+    , m_lodIdleTimer(nullptr)
+    , m_lodActive(false)
+    , m_lodInteractions(0)
+    , m_scene3dPending(false)
+    , m_scene3dResetCamera(false)
+    , m_activeMaskLayer(-1)
+    , m_claheEnabled(false)
     , m_axialObserverTag(0)
     , m_sagittalObserverTag(0)
     , m_coronalObserverTag(0)
     , m_axialClickTag(0)
     , m_sagittalClickTag(0)
     , m_coronalClickTag(0)
+    , m_volumeScalarType(VTK_SHORT)
+    , m_windowLevelScale(1.0)
+    , m_streamLastIndex{ 0, 0, 0 }
     , m_patientName("N/A")
     , m_patientID("N/A")
+    , m_volumeDirection{ 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 }
+    , m_maskEditor(&m_idleMaskEditor)
+    , m_strokeViewer(nullptr)
+    , m_roiViewer(nullptr)
+    , m_maskSaving(false)
+    , m_pngExporting(false)
+    , m_folderWatcher(nullptr)
+    , m_watchTimer(nullptr)
+    , m_receivePort(11112)
+    , m_receiveTimer(nullptr)
+    , m_priorView(nullptr)
+    , m_priorLoading(false)
+    , m_registrationCancel(false)
+    , m_registering(false)
+    , m_largeImageView(nullptr)
 {
     ui->setupUi(this);
     connect(ui->btn_open, &QPushButton::clicked, this, &Widget::onOpenDicom);
     connect(ui->btn_measure, &QPushButton::toggled, this, &Widget::onMeasureToggled);
     connect(ui->btn_load_mask, &QPushButton::clicked, this, &Widget::onLoadMask);
+    connect(ui->btn_save_mask, &QPushButton::clicked, this, &Widget::onSaveMask);
+    connect(ui->btn_export_png, &QPushButton::clicked, this, &Widget::onExportPng);
+    connect(ui->btn_watch, &QPushButton::toggled, this, &Widget::onWatchToggled);
+    connect(ui->btn_receive, &QPushButton::toggled, this, &Widget::onReceiveToggled);
+    connect(ui->btn_prior, &QPushButton::clicked, this, &Widget::onOpenPriorStudy);
+    connect(ui->btn_register, &QPushButton::clicked, this, &Widget::onRegisterPrior);
+    connect(ui->list_mask_layers, &QListWidget::currentRowChanged, this, &Widget::onMaskLayerSelected);
+    connect(ui->list_mask_layers, &QListWidget::itemChanged, this, &Widget::onMaskLayerItemChanged);
+    connect(ui->slider_mask_opacity, &QSlider::valueChanged, this, &Widget::onMaskOpacityChanged);
+    connect(ui->btn_remove_mask, &QPushButton::clicked, this, &Widget::onRemoveMaskLayer);
+    connect(ui->combo_preset, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &Widget::onPresetChanged);
+    connect(ui->btn_clahe, &QPushButton::toggled, this, &Widget::onClaheToggled);
+    connect(ui->btn_brush, &QPushButton::toggled, this, &Widget::onMaskToolToggled);
+    connect(ui->btn_erase, &QPushButton::toggled, this, &Widget::onMaskToolToggled);
+    connect(ui->btn_fill, &QPushButton::toggled, this, &Widget::onMaskToolToggled);
+    connect(ui->btn_roi_rect, &QPushButton::toggled, this, &Widget::onRoiToolToggled);
+    connect(ui->btn_roi_ellipse, &QPushButton::toggled, this, &Widget::onRoiToolToggled);
+    connect(ui->btn_roi_lasso, &QPushButton::toggled, this, &Widget::onRoiToolToggled);
+    connect(ui->btn_undo, &QPushButton::clicked, this, &Widget::onMaskUndo);
+    connect(ui->btn_redo, &QPushButton::clicked, this, &Widget::onMaskRedo);
+    connect(new QShortcut(QKeySequence::Undo, this), &QShortcut::activated, this, &Widget::onMaskUndo);
+    connect(new QShortcut(QKeySequence::Redo, this), &QShortcut::activated, this, &Widget::onMaskRedo);
+    SetActiveMaskLayer(-1);
+
+    // 文件系统通知只用于重启去抖定时器，定时器到期（约 1 秒无新变化）时才扫描目录
+    m_folderWatcher = new QFileSystemWatcher(this);
+    m_watchTimer = new QTimer(this);
+    m_watchTimer->setSingleShot(true);
+    m_watchTimer->setInterval(1000);
+    connect(m_folderWatcher, &QFileSystemWatcher::directoryChanged, this, &Widget::onWatchDirectoryChanged);
+    connect(m_watchTimer, &QTimer::timeout, this, &Widget::onWatchTimeout);
+
+    // 接收队列按固定节拍成批处理：每批只扩展一次体数据、重绘一次
+    m_receiveTimer = new QTimer(this);
+    m_receiveTimer->setInterval(250);
+    connect(m_receiveTimer, &QTimer::timeout, this, &Widget::onReceiveTimeout);
+
+    // 交互输入停顿 150 ms 后按完整质量重绘
+    m_lodIdleTimer = new QTimer(this);
+    m_lodIdleTimer->setSingleShot(true);
+    m_lodIdleTimer->setInterval(150);
+    connect(m_lodIdleTimer, &QTimer::timeout, this, &Widget::onInteractionIdle);
     
     view_axial = ui->view_axial;
     view_sagittal = ui->view_sagittal;
@@ -106,16 +189,32 @@ Widget::Widget(QWidget *parent)
     renderer_coronal = vtkRenderer::New();
     renderer_coronal->SetBackground(0.0, 0.0, 1.0);
     renderWindow_coronal->AddRenderer(renderer_coronal);
-    
-    renderWindow_3d = vtkGenericOpenGLRenderWindow::New();
-    view_3d->setRenderWindow(renderWindow_3d);
-    renderer_3d = vtkRenderer::New();
-    renderer_3d->SetBackground(0.0, 0.0, 0.0);
-    renderWindow_3d->AddRenderer(renderer_3d);
+
+    // 3D 视图在首次显示体数据后才创建渲染窗口；隐藏期间不初始化 OpenGL 上下文
+    view_3d->hide();
 }
 
 Widget::~Widget()
 {
+    // 先停止接收，之后不再有关联线程访问接收队列
+    if (m_storeScp) {
+        m_storeScp->Stop();
+    }
+    CancelBackgroundDecode();
+    if (m_maskSaveTask.valid()) {
+        m_maskSaveTask.wait();
+    }
+    if (m_pngExportTask.valid()) {
+        m_pngExportTask.wait();
+    }
+    if (m_priorLoadTask.valid()) {
+        m_priorLoadTask.wait();
+    }
+    m_registrationCancel = true;
+    if (m_registrationTask.valid()) {
+        m_registrationTask.wait();
+    }
+
     if (renderer_axial) {
         renderer_axial->Delete();
     }
@@ -151,55 +250,155 @@ void Widget::onOpenDicom()
     if (dirPath.isEmpty()) {
         return;
     }
+    LoadDicomDirectory(dirPath);
+}
 
-    using ReaderType = itk::ImageSeriesReader<ImageType>;
-    auto reader = ReaderType::New();
-    auto gdcmIO = itk::GDCMImageIO::New();
-    auto fileNames = itk::GDCMSeriesFileNames::New();
-
-    fileNames->SetUseSeriesDetails(true);
-    fileNames->AddSeriesRestriction("0008|0021");
-    fileNames->SetDirectory(dirPath.toStdString());
+void Widget::LoadDicomDirectory(const QString &dirPath)
+{
+    m_loadTimer.start();
 
-    const auto &seriesUIDs = fileNames->GetSeriesUIDs();
-    if (seriesUIDs.empty()) {
+    // 只读文件头的并行扫描，分组规则与 GDCMSeriesFileNames(UseSeriesDetails + 0008|0021) 相同
+    std::vector<std::string> seriesFiles;
+    bool isMultiFrame = false;
+    if (!FindDicomSeries(dirPath.toStdString(), seriesFiles, &isMultiFrame)) {
         QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("No DICOM series found."));
         return;
     }
 
-    reader->SetImageIO(gdcmIO);
-    reader->SetFileNames(fileNames->GetFileNames(seriesUIDs.front()));
+    // 打开其他目录时结束监视；只有内存中的普通序列记录文件列表，供监视模式增量插入
+    if (!m_watchDirectory.isEmpty() && QDir(m_watchDirectory) != QDir(dirPath)) {
+        ui->btn_watch->setChecked(false);
+    }
+    m_loadedDirectory = dirPath;
+    m_loadedSeriesFiles.clear();
+    // 之后收到的实例重新建立体数据，不再插入已被替换的接收序列
+    m_receiveSeries.Clear();
+    // 先归还当前体数据的预算，新序列按全部预算（减去对比研究占用）判断能否常驻内存；
+    // 加载失败时当前体数据仍在显示，按原值重新记入
+    const size_t residentBytes = m_volumeReservation.GetBytes();
+    m_volumeReservation.Reset();
+    UpdateLargeImageView(nullptr);
+
+    // 单文件多帧（Enhanced）对象走逐帧惰性解码路径
+    if (isMultiFrame) {
+        if (!LoadMultiFrameFile(seriesFiles.front())) {
+            m_volumeReservation.Charge(residentBytes);
+        }
+        return;
+    }
+
+    CancelBackgroundDecode();
 
-    try {
-        reader->Update();
-    } catch (const itk::ExceptionObject &ex) {
-        QMessageBox::critical(this, QStringLiteral("Error"), 
-                              QStringLiteral("Read failed: %1").arg(QString::fromLocal8Bit(ex.what())));
+    // 体数据超出剩余内存预算时改走分块模式（优先压缩后留在内存，放不下再落盘），
+    // 避免 AllocateScalars 失败或系统换页；设置 MYDICOMVIEWER_COMPRESS_VOLUMES 时总是压缩常驻
+    VolumeGeometry geometry;
+    DicomVolumeMetadata metadata;
+    const bool hasGeometry = ReadDicomSeriesGeometry(seriesFiles, geometry, &metadata);
+    static const bool alwaysCompress = qEnvironmentVariableIsSet("MYDICOMVIEWER_COMPRESS_VOLUMES");
+    if (hasGeometry && (alwaysCompress || !m_volumeReservation.Acquire(geometry.ByteSize()))) {
+        if (!LoadOutOfCore(seriesFiles, geometry, metadata)) {
+            m_volumeReservation.Charge(residentBytes);
+        }
         return;
     }
 
-    m_patientName = "N/A";
-    m_patientID   = "N/A";
-    try {
-        const auto &dictArray = *(reader->GetMetaDataDictionaryArray());
-        if (!dictArray.empty() && dictArray[0]) {
-            const auto &dict = *dictArray[0];
-            m_patientName = GetDicomValue(dict, "0010|0010");
-            m_patientID   = GetDicomValue(dict, "0010|0020");
-        } else {
-            const auto &dict = gdcmIO->GetMetaDataDictionary();
-            m_patientName = GetDicomValue(dict, "0010|0010");
-            m_patientID   = GetDicomValue(dict, "0010|0020");
+    // 像素类型由序列头决定（uint16 MR、float PET 等保持原生类型）。几何已知时切片在共享解码池上
+    // 并行解码，与后台加载的对比研究交替推进；否则仍由 ITK 读取，缓冲区零拷贝交给 VTK
+    vtkSmartPointer<vtkImageData> vtkImage;
+    if (hasGeometry) {
+        std::string error;
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        vtkImage = DecodeDicomSeries(seriesFiles, geometry, StudyLoadContext::Shared().GetDecodePool(), &error);
+        QApplication::restoreOverrideCursor();
+        if (!vtkImage) {
+            m_volumeReservation.Charge(residentBytes);
+            QMessageBox::critical(this, QStringLiteral("Error"),
+                                  QStringLiteral("Read failed: %1").arg(QString::fromLocal8Bit(error.c_str())));
+            return;
+        }
+    } else {
+        try {
+            vtkImage = LoadDicomSeries(seriesFiles, &metadata);
+        } catch (const itk::ExceptionObject &ex) {
+            m_volumeReservation.Charge(residentBytes);
+            QMessageBox::critical(this, QStringLiteral("Error"), 
+                                  QStringLiteral("Read failed: %1").arg(QString::fromLocal8Bit(ex.what())));
+            return;
+        }
+        // 几何未知时读取前无法判断大小，读取后照实记入预算
+        if (vtkImage) {
+            m_volumeReservation.Charge(static_cast<size_t>(vtkImage->GetNumberOfPoints()) *
+                                       static_cast<size_t>(vtkImage->GetScalarSize()));
         }
-    } catch (...) {
     }
 
-    vtkSmartPointer<vtkImageData> vtkImage = ItkToVtkImage(reader->GetOutput());
+    m_patientName = DecodeDicomString("0010|0010", metadata.patientName);
+    m_patientID   = DecodeDicomString("0010|0020", metadata.patientID);
+    m_modality    = DecodeDicomString("0008|0060", metadata.modality);
+    std::copy(std::begin(metadata.direction), std::end(metadata.direction), m_volumeDirection);
+
     if (!vtkImage) {
+        m_volumeReservation.Charge(residentBytes);
         QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Image conversion failed."));
         return;
     }
 
+    // 新序列解码成功后才释放外存模式的旧存储，失败时旧序列仍可翻层
+    ReleaseVolumeStore();
+    UpdateVolumeHistogram(vtkImage);
+    ShowVolume(vtkImage);
+    m_loadedSeriesFiles = seriesFiles;
+    UpdateLargeImageView(vtkImage);
+}
+
+// 设置环境变量 MYDICOMVIEWER_TIMING 后输出启动与加载各阶段耗时
+static bool StartupTimingEnabled()
+{
+    static const bool enabled = qEnvironmentVariableIsSet("MYDICOMVIEWER_TIMING");
+    return enabled;
+}
+
+// 角标用的中文字体：首次调用时探测一次，找不到时为空
+static const QString &AnnotationFontPath()
+{
+    static const QString path = []() {
+        const QStringList fontPaths = {
+            QStringLiteral("C:/Windows/Fonts/msyh.ttf"),
+            QStringLiteral("C:/Windows/Fonts/simhei.ttf"),
+            QStringLiteral("C:/Windows/Fonts/simsun.ttc"),
+            QStringLiteral("C:/Windows/Fonts/msyhbd.ttf"),
+        };
+        for (const QString &fontPath : fontPaths) {
+            if (QFile::exists(fontPath)) {
+                return fontPath;
+            }
+        }
+        return QString();
+    }();
+    return path;
+}
+
+static vtkSmartPointer<vtkCornerAnnotation> CreateCornerAnnotation()
+{
+    auto annotation = vtkSmartPointer<vtkCornerAnnotation>::New();
+    vtkTextProperty *textProp = annotation->GetTextProperty();
+    textProp->SetColor(1.0, 1.0, 0.0);
+    const QString &fontPath = AnnotationFontPath();
+    if (!fontPath.isEmpty()) {
+        textProp->SetFontFamily(VTK_FONT_FILE);
+        textProp->SetFontFile(fontPath.toStdString().c_str());
+    } else {
+        textProp->SetFontFamilyToTimes();
+    }
+    annotation->SetMaximumFontSize(14);
+    return annotation;
+}
+
+void Widget::ShowVolume(vtkSmartPointer<vtkImageData> vtkImage)
+{
+    QElapsedTimer firstFrameTimer;
+    firstFrameTimer.start();
+
     if (m_distWidgetAxial) {
         m_distWidgetAxial->Off();
         m_distWidgetAxial->SetInteractor(nullptr);
@@ -213,19 +412,8 @@ void Widget::onOpenDicom()
         m_distWidgetCoronal->SetInteractor(nullptr);
     }
 
-    if (m_maskAxial.actor && m_viewerAxial && m_viewerAxial->GetRenderer()) {
-        m_viewerAxial->GetRenderer()->RemoveActor(m_maskAxial.actor);
-    }
-    if (m_maskSagittal.actor && m_viewerSagittal && m_viewerSagittal->GetRenderer()) {
-        m_viewerSagittal->GetRenderer()->RemoveActor(m_maskSagittal.actor);
-    }
-    if (m_maskCoronal.actor && m_viewerCoronal && m_viewerCoronal->GetRenderer()) {
-        m_viewerCoronal->GetRenderer()->RemoveActor(m_maskCoronal.actor);
-    }
-    m_maskAxial = MaskPipeline();
-    m_maskSagittal = MaskPipeline();
-    m_maskCoronal = MaskPipeline();
-    m_maskData = nullptr;
+    ClearMaskLayers();
+    ClearRois();
 
     if (m_viewerAxial) {
         m_viewerAxial->SetInputData(nullptr);
@@ -242,6 +430,8 @@ void Widget::onOpenDicom()
         auto axialWindow = view_axial->renderWindow();
         m_viewerAxial->SetRenderWindow(axialWindow);
         m_viewerAxial->SetupInteractor(axialWindow->GetInteractor());
+        registerProbeObserver(m_viewerAxial);
+        registerInteractionLodObserver(m_viewerAxial);
         m_viewerAxial->SetSliceOrientationToXY();
     }
 
@@ -250,6 +440,8 @@ void Widget::onOpenDicom()
         auto sagittalWindow = view_sagittal->renderWindow();
         m_viewerSagittal->SetRenderWindow(sagittalWindow);
         m_viewerSagittal->SetupInteractor(sagittalWindow->GetInteractor());
+        registerProbeObserver(m_viewerSagittal);
+        registerInteractionLodObserver(m_viewerSagittal);
         m_viewerSagittal->SetSliceOrientationToYZ();
         if (renderer_sagittal) {
             renderer_sagittal->SetBackground(0.0, 1.0, 0.0);
@@ -261,72 +453,42 @@ void Widget::onOpenDicom()
         auto coronalWindow = view_coronal->renderWindow();
         m_viewerCoronal->SetRenderWindow(coronalWindow);
         m_viewerCoronal->SetupInteractor(coronalWindow->GetInteractor());
+        registerProbeObserver(m_viewerCoronal);
+        registerInteractionLodObserver(m_viewerCoronal);
         m_viewerCoronal->SetSliceOrientationToXZ();
         if (renderer_coronal) {
             renderer_coronal->SetBackground(0.0, 0.0, 1.0);
         }
     }
 
-    m_viewerAxial->SetInputData(vtkImage);
-    m_viewerSagittal->SetInputData(vtkImage);
-    m_viewerCoronal->SetInputData(vtkImage);
+    m_viewerAxial->SetInputData(ViewInput(2, vtkImage));
+    m_viewerSagittal->SetInputData(ViewInput(0, vtkImage));
+    m_viewerCoronal->SetInputData(ViewInput(1, vtkImage));
 
-    QString chineseFontPath;
-    QStringList fontPaths;
-    fontPaths << "C:/Windows/Fonts/msyh.ttf";
-    fontPaths << "C:/Windows/Fonts/simhei.ttf";
-    fontPaths << "C:/Windows/Fonts/simsun.ttc";
-    fontPaths << "C:/Windows/Fonts/msyhbd.ttf";
-    
-    for (int i = 0; i < fontPaths.size(); ++i) {
-        if (QFile::exists(fontPaths[i])) {
-            chineseFontPath = fontPaths[i];
-            break;
-        }
-    }
-    
+    // 外存模式下视图输入只含当前切片，滚轮翻页改由滑块驱动
+    const bool viewerScroll = !m_volumeStore;
+    m_viewerAxial->SetSliceScrollOnMouseWheel(viewerScroll);
+    m_viewerSagittal->SetSliceScrollOnMouseWheel(viewerScroll);
+    m_viewerCoronal->SetSliceScrollOnMouseWheel(viewerScroll);
+
+    // 角标只在视图首次创建时建立一次，字体路径在进程内只探测一次
     if (!m_annotAxial) {
-        m_annotAxial = vtkSmartPointer<vtkCornerAnnotation>::New();
-        vtkTextProperty* textProp = m_annotAxial->GetTextProperty();
-        textProp->SetColor(1.0, 1.0, 0.0);
-        if (!chineseFontPath.isEmpty()) {
-            textProp->SetFontFamily(VTK_FONT_FILE);
-            textProp->SetFontFile(chineseFontPath.toStdString().c_str());
-        } else {
-            textProp->SetFontFamilyToTimes();
-        }
-        m_annotAxial->SetMaximumFontSize(14);
+        m_annotAxial = CreateCornerAnnotation();
         m_viewerAxial->GetRenderer()->AddViewProp(m_annotAxial);
     }
     if (!m_annotSagittal) {
-        m_annotSagittal = vtkSmartPointer<vtkCornerAnnotation>::New();
-        vtkTextProperty* textProp = m_annotSagittal->GetTextProperty();
-        textProp->SetColor(1.0, 1.0, 0.0);
-        if (!chineseFontPath.isEmpty()) {
-            textProp->SetFontFamily(VTK_FONT_FILE);
-            textProp->SetFontFile(chineseFontPath.toStdString().c_str());
-        } else {
-            textProp->SetFontFamilyToTimes();
-        }
-        m_annotSagittal->SetMaximumFontSize(14);
+        m_annotSagittal = CreateCornerAnnotation();
         m_viewerSagittal->GetRenderer()->AddViewProp(m_annotSagittal);
     }
     if (!m_annotCoronal) {
-        m_annotCoronal = vtkSmartPointer<vtkCornerAnnotation>::New();
-        vtkTextProperty* textProp = m_annotCoronal->GetTextProperty();
-        textProp->SetColor(1.0, 1.0, 0.0);
-        if (!chineseFontPath.isEmpty()) {
-            textProp->SetFontFamily(VTK_FONT_FILE);
-            textProp->SetFontFile(chineseFontPath.toStdString().c_str());
-        } else {
-            textProp->SetFontFamilyToTimes();
-        }
-        m_annotCoronal->SetMaximumFontSize(14);
+        m_annotCoronal = CreateCornerAnnotation();
         m_viewerCoronal->GetRenderer()->AddViewProp(m_annotCoronal);
     }
 
-    const auto region = reader->GetOutput()->GetLargestPossibleRegion();
-    const auto size = region.GetSize();
+    int size[3];
+    int extent[6];
+    vtkImage->GetDimensions(size);
+    vtkImage->GetExtent(extent);
     int axialMidIndex     = static_cast<int>(size[2] / 2);
     int sagittalMidIndex  = static_cast<int>(size[0] / 2);
     int coronalMidIndex   = static_cast<int>(size[1] / 2);
@@ -348,8 +510,8 @@ void Widget::onOpenDicom()
     disconnect(sliderWindow,   &QSlider::valueChanged, this, nullptr);
     disconnect(sliderLevel,    &QSlider::valueChanged, this, nullptr);
 
-    int axialMin = m_viewerAxial->GetSliceMin();
-    int axialMax = m_viewerAxial->GetSliceMax();
+    int axialMin = extent[4];
+    int axialMax = extent[5];
     sliderAxial->setRange(axialMin, axialMax);
     int axialMid = std::clamp(axialMidIndex, axialMin, axialMax);
     m_viewerAxial->SetSlice(axialMid);
@@ -357,8 +519,8 @@ void Widget::onOpenDicom()
     sliderAxial->setValue(axialMid);
     connect(sliderAxial, &QSlider::valueChanged, this, &Widget::onSliderAxialChanged, Qt::UniqueConnection);
 
-    int sagittalMin = m_viewerSagittal->GetSliceMin();
-    int sagittalMax = m_viewerSagittal->GetSliceMax();
+    int sagittalMin = extent[0];
+    int sagittalMax = extent[1];
     sliderSagittal->setRange(sagittalMin, sagittalMax);
     int sagittalMid = std::clamp(sagittalMidIndex, sagittalMin, sagittalMax);
     m_viewerSagittal->SetSlice(sagittalMid);
@@ -366,8 +528,8 @@ void Widget::onOpenDicom()
     sliderSagittal->setValue(sagittalMid);
     connect(sliderSagittal, &QSlider::valueChanged, this, &Widget::onSliderSagittalChanged, Qt::UniqueConnection);
 
-    int coronalMin = m_viewerCoronal->GetSliceMin();
-    int coronalMax = m_viewerCoronal->GetSliceMax();
+    int coronalMin = extent[2];
+    int coronalMax = extent[3];
     sliderCoronal->setRange(coronalMin, coronalMax);
     int coronalMid = std::clamp(coronalMidIndex, coronalMin, coronalMax);
     m_viewerCoronal->SetSlice(coronalMid);
@@ -375,82 +537,11 @@ void Widget::onOpenDicom()
     sliderCoronal->setValue(coronalMid);
     connect(sliderCoronal, &QSlider::valueChanged, this, &Widget::onSliderCoronalChanged, Qt::UniqueConnection);
 
-    sliderWindow->setRange(1, 3000);
-    sliderWindow->setValue(2000);
-    sliderLevel->setRange(-1000, 1000);
-    sliderLevel->setValue(40);
+    SetupWindowLevelControls();
 
-    auto interactor3D = view_3d->renderWindow()->GetInteractor();
-    if (interactor3D && renderer_3d) {
-        if (!m_planeAxial) {
-            m_planeAxial = vtkSmartPointer<vtkImagePlaneWidget>::New();
-        }
-        if (!m_planeSagittal) {
-            m_planeSagittal = vtkSmartPointer<vtkImagePlaneWidget>::New();
-        }
-        if (!m_planeCoronal) {
-            m_planeCoronal = vtkSmartPointer<vtkImagePlaneWidget>::New();
-        }
-
-        double window = m_viewerAxial->GetColorWindow();
-        double level  = m_viewerAxial->GetColorLevel();
-
-        m_planeAxial->SetInteractor(interactor3D);
-        m_planeAxial->SetInputData(vtkImage);
-        m_planeAxial->SetPlaneOrientationToZAxes();
-        m_planeAxial->SetSliceIndex(axialMid);
-        m_planeAxial->SetWindowLevel(window, level);
-        m_planeAxial->DisplayTextOff();
-        m_planeAxial->SetMarginSizeX(0);
-        m_planeAxial->SetMarginSizeY(0);
-        m_planeAxial->GetPlaneProperty()->SetColor(1.0, 0.0, 0.0);
-        m_planeAxial->On();
-        m_planeAxial->InteractionOff();
-
-        m_planeSagittal->SetInteractor(interactor3D);
-        m_planeSagittal->SetInputData(vtkImage);
-        m_planeSagittal->SetPlaneOrientationToXAxes();
-        m_planeSagittal->SetSliceIndex(sagittalMid);
-        m_planeSagittal->SetWindowLevel(window, level);
-        m_planeSagittal->DisplayTextOff();
-        m_planeSagittal->SetMarginSizeX(0);
-        m_planeSagittal->SetMarginSizeY(0);
-        m_planeSagittal->GetPlaneProperty()->SetColor(0.0, 1.0, 0.0);
-        m_planeSagittal->On();
-        m_planeSagittal->InteractionOff();
-
-        m_planeCoronal->SetInteractor(interactor3D);
-        m_planeCoronal->SetInputData(vtkImage);
-        m_planeCoronal->SetPlaneOrientationToYAxes();
-        m_planeCoronal->SetSliceIndex(coronalMid);
-        m_planeCoronal->SetWindowLevel(window, level);
-        m_planeCoronal->DisplayTextOff();
-        m_planeCoronal->SetMarginSizeX(0);
-        m_planeCoronal->SetMarginSizeY(0);
-        m_planeCoronal->GetPlaneProperty()->SetColor(0.0, 0.0, 1.0);
-        m_planeCoronal->On();
-        m_planeCoronal->InteractionOff();
-
-        auto outlineFilter = vtkSmartPointer<vtkOutlineFilter>::New();
-        outlineFilter->SetInputData(vtkImage);
-        outlineFilter->Update();
-
-        auto outlineMapper = vtkSmartPointer<vtkPolyDataMapper>::New();
-        outlineMapper->SetInputConnection(outlineFilter->GetOutputPort());
-
-        auto outlineActor = vtkSmartPointer<vtkActor>::New();
-        outlineActor->SetMapper(outlineMapper);
-        outlineActor->GetProperty()->SetColor(1.0, 1.0, 1.0);
-
-        if (m_outlineActor) {
-            renderer_3d->RemoveActor(m_outlineActor);
-        }
-        m_outlineActor = outlineActor;
-        renderer_3d->AddActor(m_outlineActor);
-
-        renderer_3d->ResetCamera();
-        renderWindow_3d->Render();
-    }
+    // 3D 场景不在二维首帧的路径上：排到事件循环中，二维视图渲染之后再建立或更新
+    m_scene3dVolume = vtkImage;
+    Schedule3DSceneUpdate(true);
     connect(sliderCoronal, &QSlider::valueChanged, this, &Widget::onSliderCoronalChanged, Qt::UniqueConnection);
     connect(sliderWindow,  &QSlider::valueChanged, this, &Widget::onWindowLevelChanged, Qt::UniqueConnection);
     connect(sliderLevel,   &QSlider::valueChanged, this, &Widget::onWindowLevelChanged, Qt::UniqueConnection);
@@ -527,48 +618,438 @@ void Widget::onOpenDicom()
     m_viewerAxial->Render();
     m_viewerSagittal->Render();
     m_viewerCoronal->Render();
+
+    if (StartupTimingEnabled()) {
+        qInfo("[timing] show volume to first 2D frame: %lld ms", static_cast<long long>(firstFrameTimer.elapsed()));
+        if (m_loadTimer.isValid()) {
+            qInfo("[timing] load to first 2D frame: %lld ms", static_cast<long long>(m_loadTimer.elapsed()));
+        }
+    }
+    m_loadTimer.invalidate();
 }
 
-vtkSmartPointer<vtkImageData> Widget::ItkToVtkImage(ImageType *image)
+void Widget::UpdateVolumeHistogram(vtkImageData *image, vtkIdType firstVoxel, vtkIdType voxelCount)
 {
-    if (!image) {
-        return nullptr;
+    m_histogram = VolumeHistogram();
+    if (image && image->GetPointData()->GetScalars()) {
+        m_volumeScalarType = image->GetScalarType();
+        const vtkIdType totalVoxels = image->GetNumberOfPoints();
+        firstVoxel = std::clamp<vtkIdType>(firstVoxel, 0, totalVoxels);
+        if (voxelCount < 0 || firstVoxel + voxelCount > totalVoxels) {
+            voxelCount = totalVoxels - firstVoxel;
+        }
+        const void *scalars = image->GetScalarPointer();
+        // 直方图只在加载时计算一次，预设切换直接使用缓存结果；按原生类型特化，不做转换
+        switch (image->GetScalarType()) {
+            vtkTemplateMacro(m_histogram = VolumeHistogram::Compute(
+                static_cast<const VTK_TT*>(scalars) + firstVoxel, static_cast<size_t>(voxelCount)));
+        }
+    }
+    m_windowPresets = BuildWindowLevelPresets(m_modality, m_histogram);
+}
+
+bool Widget::LoadMultiFrameFile(const std::string &fileName)
+{
+    CancelBackgroundDecode();
+
+    MultiFrameDicomReader multiFrame;
+    std::string error;
+    if (!multiFrame.Open(fileName, &error)) {
+        QMessageBox::critical(this, QStringLiteral("Error"),
+                              QStringLiteral("Read failed: %1").arg(QString::fromLocal8Bit(error.c_str())));
+        return false;
     }
+    ReleaseVolumeStore();
+    const MultiFrameInfo &info = multiFrame.GetInfo();
 
-    const auto region = image->GetLargestPossibleRegion();
-    const auto size = region.GetSize();
-    const auto spacing = image->GetSpacing();
-    const auto origin = image->GetOrigin();
+    m_patientName = DecodeDicomString("0010|0010", info.patientName);
+    m_patientID   = DecodeDicomString("0010|0020", info.patientID);
+    m_modality    = DecodeDicomString("0008|0060", info.modality);
+    std::fill(std::begin(m_volumeDirection), std::end(m_volumeDirection), 0.0);
+    m_volumeDirection[0] = m_volumeDirection[4] = m_volumeDirection[8] = 1.0;
 
     auto vtkImage = vtkSmartPointer<vtkImageData>::New();
-    vtkImage->SetDimensions(static_cast<int>(size[0]),
-                            static_cast<int>(size[1]),
-                            static_cast<int>(size[2]));
-    vtkImage->SetSpacing(spacing[0], spacing[1], spacing[2]);
-    vtkImage->SetOrigin(origin[0], origin[1], origin[2]);
-    vtkImage->AllocateScalars(VTK_SHORT, 1);
+    vtkImage->SetDimensions(static_cast<int>(info.columns),
+                            static_cast<int>(info.rows),
+                            static_cast<int>(info.frameCount));
+    vtkImage->SetSpacing(info.spacing);
+    vtkImage->SetOrigin(info.origin);
+    vtkImage->AllocateScalars(MultiFrameScalarType(info.outputType), 1);
+    void *volume = vtkImage->GetScalarPointer();
+    const size_t volumeBytes = info.SliceVoxelCount() * info.frameCount * info.OutputPixelSize();
+    std::memset(volume, 0, volumeBytes);
+    // 多帧对象没有外存路径，整体常驻，照实记入共享预算
+    m_volumeReservation.Charge(volumeBytes);
+
+    // 任务持有体数据引用，保证后台线程写入期间缓冲区有效
+    vtkImageData *rawImage = vtkImage.GetPointer();
+    rawImage->Register(nullptr);
+    std::shared_ptr<void> owner(rawImage, [](void *p) { static_cast<vtkImageData*>(p)->UnRegister(nullptr); });
+    m_decodeJob = std::make_unique<MultiFrameDecodeJob>(info, volume, owner);
+
+    // 先同步解码轴位中间层，用它估计窗宽窗位，随即显示
+    const unsigned int midSlice = info.frameCount / 2;
+    m_decodeJob->DecodeSlice(midSlice);
+    UpdateVolumeHistogram(vtkImage, static_cast<vtkIdType>(midSlice) * info.SliceVoxelCount(),
+                          static_cast<vtkIdType>(info.SliceVoxelCount()));
+    ShowVolume(vtkImage);
+
+    QPointer<Widget> guard(this);
+    const unsigned int workers = std::max(1u, ThreadPool::Global().GetThreadCount() - 1);
+    m_decodeJob->SetFocusSlice(static_cast<unsigned int>(std::max(0, m_viewerAxial->GetSlice())));
+    m_decodeJob->Start(ThreadPool::Global(), workers,
+        [guard](unsigned int decoded, unsigned int total) {
+            QMetaObject::invokeMethod(guard, [guard, decoded, total]() {
+                if (guard) {
+                    guard->onMultiFrameProgress(decoded, total);
+                }
+            }, Qt::QueuedConnection);
+        });
+    return true;
+}
+
+void Widget::onMultiFrameProgress(unsigned int decoded, unsigned int total)
+{
+    if (!m_decodeJob || !m_viewerAxial || !m_viewerAxial->GetInput()) {
+        return;
+    }
+
+    vtkImageData *image = m_viewerAxial->GetInput();
+    image->Modified();
+    if (m_planeAxial) {
+        m_planeAxial->UpdatePlacement();
+    }
 
-    const size_t pixelCount = region.GetNumberOfPixels();
-    std::memcpy(vtkImage->GetScalarPointer(),
-                image->GetBufferPointer(),
-                pixelCount * sizeof(PixelType));
+    unsigned int failed = 0;
+    if (decoded >= total) {
+        // 全部帧解码完成后用完整体数据刷新直方图，只更新范围与预设，不改变当前窗宽窗位
+        failed = m_decodeJob->GetFailedCount();
+        UpdateVolumeHistogram(image);
+        SetupWindowLevelControls(false);
+        m_decodeJob.reset();
+    }
 
-    return vtkImage;
+    m_viewerAxial->Render();
+    m_viewerSagittal->Render();
+    m_viewerCoronal->Render();
+    if (renderWindow_3d) {
+        renderWindow_3d->Render();
+    }
+    if (failed > 0) {
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+                             QString("%1 of %2 frames could not be decoded and are shown as blank.")
+                                 .arg(failed).arg(total));
+    }
 }
 
-std::string Widget::GetDicomValue(const itk::MetaDataDictionary &dict,
-                                  const std::string &tagKey) const
+void Widget::CancelBackgroundDecode()
 {
-    using MetaStringType = itk::MetaDataObject<std::string>;
-    auto it = dict.Find(tagKey);
-    if (it == dict.End()) {
-        return "N/A";
+    if (m_decodeJob) {
+        m_decodeJob->Cancel();
+        m_decodeJob->Wait();
+        m_decodeJob.reset();
     }
-    const auto *metaObj = dynamic_cast<const MetaStringType*>(it->second.GetPointer());
-    if (!metaObj) {
-        return "N/A";
+}
+
+bool Widget::LoadOutOfCore(const std::vector<std::string> &fileNames,
+                           const VolumeGeometry &geometry,
+                           const DicomVolumeMetadata &metadata)
+{
+    const uint64_t physical = BrickedVolumeStore::PhysicalMemoryBytes();
+    std::shared_ptr<BrickedVolumeStore> store;
+    std::string error;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+
+    // 先尝试无损压缩后留在内存：写入前按压缩数据的上限加解压缓存预留共享预算，写入完成后收缩到实际大小；
+    // 压缩数据超出上限时写入即失败，只有这种情况才改走落盘后端，序列不会被解码两遍。
+    // 解压缓存取物理内存的 1/32（存储内部会保证至少容纳三个正交平面）
+    m_volumeReservation.Reset();
+    const size_t cacheBudget = physical ? static_cast<size_t>(physical / 32) : static_cast<size_t>(128) << 20;
+    const size_t available = StudyLoadContext::Shared().GetAvailable();
+    if (available > cacheBudget) {
+        std::shared_ptr<CompressedVolumeStore> compressed =
+            CompressedVolumeStore::Create(geometry, cacheBudget, available - cacheBudget);
+        if (compressed &&
+            m_volumeReservation.Acquire(compressed->GetCompressedLimit() + compressed->GetResidentBudget())) {
+            if (StreamDicomSeries(fileNames, *compressed, &error)) {
+                m_volumeReservation.Shrink(compressed->GetCompressedBytes() + compressed->GetResidentBudget());
+                store = compressed;
+            } else {
+                m_volumeReservation.Reset();
+                if (!compressed->IsOverLimit()) {
+                    QApplication::restoreOverrideCursor();
+                    QMessageBox::critical(this, QStringLiteral("Error"),
+                                          QStringLiteral("Read failed: %1").arg(QString::fromLocal8Bit(error.c_str())));
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (!store) {
+        const QString storePath = QDir(QDir::tempPath()).filePath(
+            QStringLiteral("myDicomViewer_%1_%2.bricks")
+                .arg(QCoreApplication::applicationPid())
+                .arg(QDateTime::currentMSecsSinceEpoch()));
+
+        // 常驻砖块预算取物理内存的 1/8
+        const size_t budget = physical ? static_cast<size_t>(physical / 8) : static_cast<size_t>(512) << 20;
+        std::shared_ptr<FileVolumeStore> fileStore =
+            FileVolumeStore::Create(storePath.toStdString(), geometry, budget);
+        if (!fileStore) {
+            QApplication::restoreOverrideCursor();
+            QMessageBox::critical(this, QStringLiteral("Error"),
+                                  QStringLiteral("Cannot create volume store: %1").arg(storePath));
+            return false;
+        }
+        error.clear();
+        if (!StreamDicomSeries(fileNames, *fileStore, &error)) {
+            QApplication::restoreOverrideCursor();
+            QMessageBox::critical(this, QStringLiteral("Error"),
+                                  QStringLiteral("Read failed: %1").arg(QString::fromLocal8Bit(error.c_str())));
+            return false;
+        }
+        store = fileStore;
+    }
+    QApplication::restoreOverrideCursor();
+
+    m_patientName = DecodeDicomString("0010|0010", metadata.patientName);
+    m_patientID   = DecodeDicomString("0010|0020", metadata.patientID);
+    m_modality    = DecodeDicomString("0008|0060", metadata.modality);
+    std::copy(std::begin(metadata.direction), std::end(metadata.direction), m_volumeDirection);
+
+    ReleaseVolumeStore();
+    m_volumeStore = store;
+    for (int axis = 0; axis < 3; ++axis) {
+        m_streamLastIndex[axis] = geometry.dims[axis] / 2;
+        LoadStreamingSlice(axis, geometry.dims[axis] / 2);
+    }
+    UpdateStreamingHistogram();
+
+    // 只带几何信息、不分配标量的占位体数据，供滑块范围与 3D 外框使用
+    auto volumeShape = vtkSmartPointer<vtkImageData>::New();
+    volumeShape->SetDimensions(geometry.dims[0], geometry.dims[1], geometry.dims[2]);
+    volumeShape->SetSpacing(geometry.spacing[0], geometry.spacing[1], geometry.spacing[2]);
+    volumeShape->SetOrigin(geometry.origin[0], geometry.origin[1], geometry.origin[2]);
+    ShowVolume(volumeShape);
+    return true;
+}
+
+void Widget::ReleaseVolumeStore()
+{
+    m_volumeStore.reset();
+    for (int axis = 0; axis < 3; ++axis) {
+        m_streamSlices[axis] = nullptr;
+    }
+}
+
+vtkImageData *Widget::ViewInput(int axis, vtkImageData *volume) const
+{
+    if (m_volumeStore && axis >= 0 && axis < 3 && m_streamSlices[axis]) {
+        return m_streamSlices[axis];
+    }
+    return volume;
+}
+
+void Widget::Schedule3DSceneUpdate(bool resetCamera)
+{
+    m_scene3dResetCamera = m_scene3dResetCamera || resetCamera;
+    if (m_scene3dPending) {
+        return;
+    }
+    m_scene3dPending = true;
+    QTimer::singleShot(0, this, [this]() { Update3DScene(); });
+}
+
+void Widget::Initialize3DScene()
+{
+    if (renderWindow_3d) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    renderWindow_3d = vtkGenericOpenGLRenderWindow::New();
+    view_3d->setRenderWindow(renderWindow_3d);
+    renderer_3d = vtkRenderer::New();
+    renderer_3d->SetBackground(0.0, 0.0, 0.0);
+    renderWindow_3d->AddRenderer(renderer_3d);
+    view_3d->show();
+
+    // 平面的方向、颜色等静态属性只设置一次，之后换数据只更新输入与层号
+    auto interactor3D = view_3d->renderWindow()->GetInteractor();
+    const struct {
+        vtkSmartPointer<vtkImagePlaneWidget> *plane;
+        int axis;
+        double color[3];
+    } planes[] = {
+        { &m_planeSagittal, 0, { 0.0, 1.0, 0.0 } },
+        { &m_planeCoronal, 1, { 0.0, 0.0, 1.0 } },
+        { &m_planeAxial, 2, { 1.0, 0.0, 0.0 } },
+    };
+    for (const auto &entry : planes) {
+        auto plane = vtkSmartPointer<vtkImagePlaneWidget>::New();
+        plane->SetInteractor(interactor3D);
+        plane->SetPlaneOrientation(entry.axis);
+        plane->DisplayTextOff();
+        plane->SetMarginSizeX(0);
+        plane->SetMarginSizeY(0);
+        plane->GetPlaneProperty()->SetColor(entry.color[0], entry.color[1], entry.color[2]);
+        *entry.plane = plane;
+    }
+
+    m_outlineSource = vtkSmartPointer<vtkOutlineSource>::New();
+    auto outlineMapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+    outlineMapper->SetInputConnection(m_outlineSource->GetOutputPort());
+    m_outlineActor = vtkSmartPointer<vtkActor>::New();
+    m_outlineActor->SetMapper(outlineMapper);
+    m_outlineActor->GetProperty()->SetColor(1.0, 1.0, 1.0);
+    renderer_3d->AddActor(m_outlineActor);
+
+    if (StartupTimingEnabled()) {
+        qInfo("[timing] 3D scene initialization: %lld ms", static_cast<long long>(timer.elapsed()));
+    }
+}
+
+void Widget::Update3DScene()
+{
+    m_scene3dPending = false;
+    vtkSmartPointer<vtkImageData> volume = m_scene3dVolume;
+    if (!volume || !m_viewerAxial) {
+        return;
+    }
+    Initialize3DScene();
+
+    const double window = m_viewerAxial->GetColorWindow();
+    const double level = m_viewerAxial->GetColorLevel();
+    const std::pair<vtkImagePlaneWidget *, int> planes[] = {
+        { m_planeSagittal, 0 },
+        { m_planeCoronal, 1 },
+        { m_planeAxial, 2 },
+    };
+    QSlider *sliders[3] = { ui->slider_sagittal, ui->slider_coronal, ui->slider_axial };
+    for (const auto &plane : planes) {
+        plane.first->SetInputData(ViewInput(plane.second, volume));
+        plane.first->SetSliceIndex(sliders[plane.second]->value());
+        plane.first->SetWindowLevel(window, level);
+        plane.first->On();
+        plane.first->InteractionOff();
+    }
+
+    // 外存模式下视图输入只是单层切片，外框取完整体数据的几何范围
+    double bounds[6];
+    if (m_volumeStore) {
+        const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+        for (int axis = 0; axis < 3; ++axis) {
+            bounds[2 * axis] = geometry.origin[axis];
+            bounds[2 * axis + 1] = geometry.origin[axis] + (geometry.dims[axis] - 1) * geometry.spacing[axis];
+        }
+    } else {
+        volume->GetBounds(bounds);
+    }
+    m_outlineSource->SetBounds(bounds);
+
+    if (m_scene3dResetCamera) {
+        renderer_3d->ResetCamera();
+        m_scene3dResetCamera = false;
+    } else {
+        renderer_3d->ResetCameraClippingRange();
+    }
+    renderWindow_3d->Render();
+}
+
+void Widget::GetVolumeDimensions(int dims[3]) const
+{
+    dims[0] = dims[1] = dims[2] = 0;
+    if (m_volumeStore) {
+        const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+        dims[0] = geometry.dims[0];
+        dims[1] = geometry.dims[1];
+        dims[2] = geometry.dims[2];
+    } else if (m_viewerAxial && m_viewerAxial->GetInput()) {
+        m_viewerAxial->GetInput()->GetDimensions(dims);
+    }
+}
+
+void Widget::LoadStreamingSlice(int axis, int index)
+{
+    if (!m_volumeStore || axis < 0 || axis > 2) {
+        return;
+    }
+    const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+    index = std::clamp(index, 0, geometry.dims[axis] - 1);
+
+    vtkSmartPointer<vtkImageData> &slice = m_streamSlices[axis];
+    if (!slice) {
+        slice = vtkSmartPointer<vtkImageData>::New();
+        slice->SetSpacing(geometry.spacing[0], geometry.spacing[1], geometry.spacing[2]);
+        slice->SetOrigin(geometry.origin[0], geometry.origin[1], geometry.origin[2]);
+    }
+
+    // 切片图像的范围只在法线轴上收缩为一层，世界坐标与完整体数据一致
+    int extent[6] = { 0, geometry.dims[0] - 1, 0, geometry.dims[1] - 1, 0, geometry.dims[2] - 1 };
+    extent[2 * axis] = index;
+    extent[2 * axis + 1] = index;
+    slice->SetExtent(extent);
+    slice->AllocateScalars(geometry.scalarType, 1);
+    m_volumeStore->ExtractPlane(axis, index, slice->GetScalarPointer());
+    slice->Modified();
+
+    // 沿滚动方向预读下一层砖块
+    const int step = index - m_streamLastIndex[axis];
+    m_streamLastIndex[axis] = index;
+    if (step != 0) {
+        const int brickSize = m_volumeStore->GetBrickSize();
+        const int layer = index / brickSize + (step > 0 ? 1 : -1);
+        m_volumeStore->Prefetch(axis, step > 0 ? layer * brickSize : layer * brickSize + brickSize - 1);
+    }
+}
+
+void Widget::UpdateStreamingHistogram()
+{
+    if (!m_volumeStore) {
+        return;
+    }
+    // 均匀抽取若干轴位平面统计直方图，无需把整个体数据读入内存
+    const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+    const size_t planeVoxels = m_volumeStore->PlaneVoxelCount(2);
+    const size_t maxSampleVoxels = static_cast<size_t>(32) << 20;
+    const int sampleCount = std::clamp(static_cast<int>(maxSampleVoxels / std::max<size_t>(planeVoxels, 1)),
+                                       1, std::min(16, geometry.dims[2]));
+
+    auto samples = vtkSmartPointer<vtkImageData>::New();
+    samples->SetDimensions(geometry.dims[0], geometry.dims[1], sampleCount);
+    samples->AllocateScalars(geometry.scalarType, 1);
+    auto *dst = static_cast<unsigned char*>(samples->GetScalarPointer());
+    for (int i = 0; i < sampleCount; ++i) {
+        const int z = static_cast<int>((2LL * i + 1) * geometry.dims[2] / (2LL * sampleCount));
+        m_volumeStore->ExtractPlane(2, z, dst + planeVoxels * geometry.bytesPerVoxel * i);
+    }
+    UpdateVolumeHistogram(samples);
+}
+
+void Widget::HandleStreamingWheel(vtkResliceImageViewer *viewer, int step)
+{
+    if (!m_volumeStore || !viewer) {
+        return;
+    }
+    QSlider *slider = nullptr;
+    if (viewer == m_viewerAxial) {
+        slider = ui->slider_axial;
+    } else if (viewer == m_viewerSagittal) {
+        slider = ui->slider_sagittal;
+    } else if (viewer == m_viewerCoronal) {
+        slider = ui->slider_coronal;
     }
-    const std::string &value = metaObj->GetMetaDataObjectValue();
+    if (slider) {
+        slider->setValue(slider->value() + step);
+    }
+}
+
+std::string Widget::DecodeDicomString(const std::string &tagKey,
+                                      const std::string &value) const
+{
     if (value.empty()) {
         return "N/A";
     }
@@ -615,8 +1096,13 @@ std::string Widget::GetDicomValue(const itk::MetaDataDictionary &dict,
 
 void Widget::onSliderAxialChanged(int value)
 {
+    LoadStreamingSlice(2, value);
+    if (m_decodeJob) {
+        m_decodeJob->SetFocusSlice(static_cast<unsigned int>(std::max(0, value)));
+    }
     if (m_viewerAxial) {
         m_viewerAxial->SetSlice(value);
+        UpdateEnhancedSlice(2);
         m_viewerAxial->Render();
     }
     if (m_planeAxial) {
@@ -627,16 +1113,20 @@ void Widget::onSliderAxialChanged(int value)
     }
     
     if (m_maskData) {
-        UpdateMaskSlice(m_viewerAxial, m_maskAxial, "Axial");
+        UpdateMaskSlice(m_viewerAxial, m_maskAxial);
     }
+    UpdateRoi(m_viewerAxial);
+    SyncPriorStudy();
     
     UpdateAnnotations();
 }
 
 void Widget::onSliderSagittalChanged(int value)
 {
+    LoadStreamingSlice(0, value);
     if (m_viewerSagittal) {
         m_viewerSagittal->SetSlice(value);
+        UpdateEnhancedSlice(0);
         m_viewerSagittal->Render();
     }
     if (m_planeSagittal) {
@@ -647,16 +1137,20 @@ void Widget::onSliderSagittalChanged(int value)
     }
     
     if (m_maskData) {
-        UpdateMaskSlice(m_viewerSagittal, m_maskSagittal, "Sagittal");
+        UpdateMaskSlice(m_viewerSagittal, m_maskSagittal);
     }
+    UpdateRoi(m_viewerSagittal);
+    SyncPriorStudy();
     
     UpdateAnnotations();
 }
 
 void Widget::onSliderCoronalChanged(int value)
 {
+    LoadStreamingSlice(1, value);
     if (m_viewerCoronal) {
         m_viewerCoronal->SetSlice(value);
+        UpdateEnhancedSlice(1);
         m_viewerCoronal->Render();
     }
     if (m_planeCoronal) {
@@ -667,8 +1161,10 @@ void Widget::onSliderCoronalChanged(int value)
     }
     
     if (m_maskData) {
-        UpdateMaskSlice(m_viewerCoronal, m_maskCoronal, "Coronal");
+        UpdateMaskSlice(m_viewerCoronal, m_maskCoronal);
     }
+    UpdateRoi(m_viewerCoronal);
+    SyncPriorStudy();
     
     UpdateAnnotations();
 }
@@ -681,22 +1177,29 @@ void Widget::onWindowLevelChanged()
         return;
     }
 
-    const double w = static_cast<double>(sliderWindow->value());
-    const double l = static_cast<double>(sliderLevel->value());
+    const double w = sliderWindow->value() / m_windowLevelScale;
+    const double l = sliderLevel->value() / m_windowLevelScale;
+
+    if (sliderWindow->isSliderDown() || sliderLevel->isSliderDown()) {
+        BeginInteractionLod();
+    }
 
     if (m_viewerAxial) {
         m_viewerAxial->SetColorWindow(w);
         m_viewerAxial->SetColorLevel(l);
+        UpdateEnhancedSlice(2);
         m_viewerAxial->Render();
     }
     if (m_viewerSagittal) {
         m_viewerSagittal->SetColorWindow(w);
         m_viewerSagittal->SetColorLevel(l);
+        UpdateEnhancedSlice(0);
         m_viewerSagittal->Render();
     }
     if (m_viewerCoronal) {
         m_viewerCoronal->SetColorWindow(w);
         m_viewerCoronal->SetColorLevel(l);
+        UpdateEnhancedSlice(1);
         m_viewerCoronal->Render();
     }
 
@@ -709,6 +1212,12 @@ void Widget::onWindowLevelChanged()
     if (m_planeCoronal) {
         m_planeCoronal->SetWindowLevel(w, l);
     }
+    if (m_priorView) {
+        m_priorView->SetWindowLevel(w, l);
+    }
+    if (m_largeImageView && m_largeImageView->HasImage()) {
+        m_largeImageView->SetWindowLevel(w, l);
+    }
 
     if (renderWindow_3d) {
         renderWindow_3d->Render();
@@ -716,6 +1225,89 @@ void Widget::onWindowLevelChanged()
     UpdateAnnotations();
 }
 
+void Widget::SetupWindowLevelControls(bool applyInitialPreset)
+{
+    QSlider *sliderWindow = qobject_cast<QSlider*>(ui->slider_window);
+    QSlider *sliderLevel  = qobject_cast<QSlider*>(ui->slider_level);
+    QComboBox *comboPreset = ui->combo_preset;
+    if (!sliderWindow || !sliderLevel || !comboPreset) {
+        return;
+    }
+
+    QSignalBlocker windowBlocker(sliderWindow);
+    QSignalBlocker levelBlocker(sliderLevel);
+    QSignalBlocker presetBlocker(comboPreset);
+
+    const double currentWindow = sliderWindow->value() / m_windowLevelScale;
+    const double currentLevel = sliderLevel->value() / m_windowLevelScale;
+
+    comboPreset->clear();
+    m_windowLevelScale = 1.0;
+    if (m_histogram.IsEmpty() || m_windowPresets.empty()) {
+        sliderWindow->setRange(1, 3000);
+        sliderWindow->setValue(2000);
+        sliderLevel->setRange(-1000, 1000);
+        sliderLevel->setValue(40);
+        return;
+    }
+
+    // 滑块范围由实际灰度范围决定，而非固定的 CT 范围
+    const double minValue = m_histogram.GetMinimum();
+    const double maxValue = m_histogram.GetMaximum();
+    const double range = maxValue - minValue;
+    // 浮点数据范围较小时放大到至少约 1000 个刻度；范围过大时缩小以免超出 int
+    const bool floating = m_volumeScalarType == VTK_FLOAT || m_volumeScalarType == VTK_DOUBLE;
+    if (range > 0.0) {
+        while (floating && range * m_windowLevelScale < 1000.0) {
+            m_windowLevelScale *= 10.0;
+        }
+        while (range * m_windowLevelScale > 1e8 ||
+               std::max(std::abs(minValue), std::abs(maxValue)) * m_windowLevelScale > 1e9) {
+            m_windowLevelScale /= 10.0;
+        }
+    }
+    const int windowMax = std::max(1, static_cast<int>(std::ceil(range * m_windowLevelScale)));
+    sliderWindow->setRange(1, windowMax);
+    sliderLevel->setRange(static_cast<int>(std::floor(minValue * m_windowLevelScale)),
+                          static_cast<int>(std::ceil(maxValue * m_windowLevelScale)));
+
+    for (const auto &preset : m_windowPresets) {
+        comboPreset->addItem(QString::fromStdString(preset.name));
+    }
+    if (!applyInitialPreset) {
+        comboPreset->setCurrentIndex(-1);
+        sliderWindow->setValue(static_cast<int>(std::lround(currentWindow * m_windowLevelScale)));
+        sliderLevel->setValue(static_cast<int>(std::lround(currentLevel * m_windowLevelScale)));
+        return;
+    }
+    comboPreset->setCurrentIndex(0);
+
+    const WindowLevelPreset &initial = m_windowPresets.front();
+    sliderWindow->setValue(static_cast<int>(std::lround(initial.window * m_windowLevelScale)));
+    sliderLevel->setValue(static_cast<int>(std::lround(initial.level * m_windowLevelScale)));
+}
+
+void Widget::onPresetChanged(int index)
+{
+    if (index < 0 || index >= static_cast<int>(m_windowPresets.size())) {
+        return;
+    }
+    QSlider *sliderWindow = qobject_cast<QSlider*>(ui->slider_window);
+    QSlider *sliderLevel  = qobject_cast<QSlider*>(ui->slider_level);
+    if (!sliderWindow || !sliderLevel) {
+        return;
+    }
+
+    const WindowLevelPreset &preset = m_windowPresets[static_cast<size_t>(index)];
+    {
+        QSignalBlocker windowBlocker(sliderWindow);
+        QSignalBlocker levelBlocker(sliderLevel);
+        sliderWindow->setValue(static_cast<int>(std::lround(preset.window * m_windowLevelScale)));
+        sliderLevel->setValue(static_cast<int>(std::lround(preset.level * m_windowLevelScale)));
+    }
+    onWindowLevelChanged();
+}
+
 void Widget::registerSliceObserver(vtkResliceImageViewer *viewer,
                                    vtkSmartPointer<vtkCallbackCommand> &callback,
                                    unsigned long &observerTag)
@@ -760,6 +1352,10 @@ void Widget::handleSliceInteraction(vtkObject *caller)
     } else if (m_viewerCoronal && m_viewerCoronal == viewerCaller) {
         syncSliderWithViewer(sliderCoronal, m_viewerCoronal);
     }
+    if (m_claheEnabled) {
+        UpdateEnhancedSlice(std::clamp(viewerCaller->GetSliceOrientation(), 0, 2));
+        viewerCaller->Render();
+    }
     UpdateAnnotations();
 }
 
@@ -793,8 +1389,8 @@ void Widget::UpdateAnnotations()
 
     // Update Axial
     if (m_annotAxial) {
-        int sliceMin = m_viewerAxial->GetSliceMin();
-        int sliceMax = m_viewerAxial->GetSliceMax();
+        int sliceMin = ui->slider_axial->minimum();
+        int sliceMax = ui->slider_axial->maximum();
         int totalSlices = sliceMax - sliceMin + 1;
         if (totalSlices < 1) totalSlices = 1;
         int slice = m_viewerAxial->GetSlice() - sliceMin + 1;
@@ -815,14 +1411,14 @@ void Widget::UpdateAnnotations()
 
         double w = m_viewerAxial->GetColorWindow();
         double l = m_viewerAxial->GetColorLevel();
-        QString bottomRight = QString("W: %1  L: %2").arg(static_cast<int>(w)).arg(static_cast<int>(l));
+        QString bottomRight = QString("W: %1  L: %2").arg(w, 0, 'g', 6).arg(l, 0, 'g', 6);
         m_annotAxial->SetText(2, bottomRight.toUtf8().constData());
     }
 
     // Update Sagittal
     if (m_annotSagittal) {
-        int sliceMin = m_viewerSagittal->GetSliceMin();
-        int sliceMax = m_viewerSagittal->GetSliceMax();
+        int sliceMin = ui->slider_sagittal->minimum();
+        int sliceMax = ui->slider_sagittal->maximum();
         int totalSlices = sliceMax - sliceMin + 1;
         if (totalSlices < 1) totalSlices = 1;
         int slice = m_viewerSagittal->GetSlice() - sliceMin + 1;
@@ -843,14 +1439,14 @@ void Widget::UpdateAnnotations()
 
         double w = m_viewerSagittal->GetColorWindow();
         double l = m_viewerSagittal->GetColorLevel();
-        QString bottomRight = QString("W: %1  L: %2").arg(static_cast<int>(w)).arg(static_cast<int>(l));
+        QString bottomRight = QString("W: %1  L: %2").arg(w, 0, 'g', 6).arg(l, 0, 'g', 6);
         m_annotSagittal->SetText(2, bottomRight.toUtf8().constData());
     }
 
     // Update Coronal
     if (m_annotCoronal) {
-        int sliceMin = m_viewerCoronal->GetSliceMin();
-        int sliceMax = m_viewerCoronal->GetSliceMax();
+        int sliceMin = ui->slider_coronal->minimum();
+        int sliceMax = ui->slider_coronal->maximum();
         int totalSlices = sliceMax - sliceMin + 1;
         if (totalSlices < 1) totalSlices = 1;
         int slice = m_viewerCoronal->GetSlice() - sliceMin + 1;
@@ -871,7 +1467,7 @@ void Widget::UpdateAnnotations()
 
         double w = m_viewerCoronal->GetColorWindow();
         double l = m_viewerCoronal->GetColorLevel();
-        QString bottomRight = QString("W: %1  L: %2").arg(static_cast<int>(w)).arg(static_cast<int>(l));
+        QString bottomRight = QString("W: %1  L: %2").arg(w, 0, 'g', 6).arg(l, 0, 'g', 6);
         m_annotCoronal->SetText(2, bottomRight.toUtf8().constData());
     }
 
@@ -918,6 +1514,10 @@ void Widget::OnClickCallback(vtkObject* caller,
         return;
     }
 
+    // 选中编辑或 ROI 工具时左键用于绘制，否则为定位三视图
+    if (self->BeginMaskEdit(sourceViewer, interactor) || self->BeginRoi(sourceViewer, interactor)) {
+        return;
+    }
     self->HandleViewClick(sourceViewer, interactor, renderer);
 }
 
@@ -929,45 +1529,33 @@ void Widget::HandleViewClick(vtkResliceImageViewer *viewer,
         return;
     }
 
-    vtkSmartPointer<vtkCellPicker> picker = vtkSmartPointer<vtkCellPicker>::New();
-    picker->SetTolerance(0.005);
-
     int pos[2];
     interactor->GetEventPosition(pos);
 
-    if (!picker->Pick(pos[0], pos[1], 0, renderer)) {
-        return;
-    }
-
-    double pickPos[3];
-    picker->GetPickPosition(pickPos);
-
-    vtkImageData *imageData = viewer->GetInput();
-    if (!imageData) {
+    int ijk[3];
+    double world[3];
+    // 点在图像外（背景）时不移动十字线
+    if (!viewer->GetInput() || !DisplayToVoxel(viewer, pos[0], pos[1], ijk, world)) {
         return;
     }
 
-    double origin[3];
-    double spacing[3];
-    imageData->GetOrigin(origin);
-    imageData->GetSpacing(spacing);
+    int idxX = ijk[0];
+    int idxY = ijk[1];
+    int idxZ = ijk[2];
 
-    int idxX = static_cast<int>(std::round((pickPos[0] - origin[0]) / spacing[0]));
-    int idxY = static_cast<int>(std::round((pickPos[1] - origin[1]) / spacing[1]));
-    int idxZ = static_cast<int>(std::round((pickPos[2] - origin[2]) / spacing[2]));
-
-    int axialMin = m_viewerAxial ? m_viewerAxial->GetSliceMin() : 0;
-    int axialMax = m_viewerAxial ? m_viewerAxial->GetSliceMax() : 0;
+    // 以体数据范围（即滑块范围）钳制，外存模式下视图输入只含单层
+    int axialMin = ui->slider_axial->minimum();
+    int axialMax = ui->slider_axial->maximum();
     if (idxZ < axialMin) idxZ = axialMin;
     if (idxZ > axialMax) idxZ = axialMax;
 
-    int sagittalMin = m_viewerSagittal ? m_viewerSagittal->GetSliceMin() : 0;
-    int sagittalMax = m_viewerSagittal ? m_viewerSagittal->GetSliceMax() : 0;
+    int sagittalMin = ui->slider_sagittal->minimum();
+    int sagittalMax = ui->slider_sagittal->maximum();
     if (idxX < sagittalMin) idxX = sagittalMin;
     if (idxX > sagittalMax) idxX = sagittalMax;
 
-    int coronalMin = m_viewerCoronal ? m_viewerCoronal->GetSliceMin() : 0;
-    int coronalMax = m_viewerCoronal ? m_viewerCoronal->GetSliceMax() : 0;
+    int coronalMin = ui->slider_coronal->minimum();
+    int coronalMax = ui->slider_coronal->maximum();
     if (idxY < coronalMin) idxY = coronalMin;
     if (idxY > coronalMax) idxY = coronalMax;
 
@@ -982,38 +1570,339 @@ void Widget::HandleViewClick(vtkResliceImageViewer *viewer,
     }
 }
 
-void Widget::onMeasureToggled(bool checked)
+bool Widget::DisplayToWorld(vtkResliceImageViewer *viewer, int displayX, int displayY, double world[3]) const
 {
-    if (checked) {
-        if (!m_viewerAxial || !m_viewerSagittal || !m_viewerCoronal) {
-            QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Please open DICOM images first."));
-            if (auto btn = ui->btn_measure) {
-                btn->setChecked(false);
-            }
-            return;
-        }
+    if (!viewer) {
+        return false;
+    }
+    vtkRenderer *renderer = viewer->GetRenderer();
+    vtkImageData *imageData = viewer->GetInput();
+    if (!renderer || !imageData) {
+        return false;
+    }
 
-        vtkImageData *imageData = m_viewerAxial->GetInput();
-        if (!imageData) {
-            QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Cannot get image data."));
-            if (auto btn = ui->btn_measure) {
-                btn->setChecked(false);
-            }
-            return;
-        }
+    // 利用相机的合成投影矩阵直接反算，无需对场景做射线拾取
+    renderer->SetDisplayPoint(displayX, displayY, 0.0);
+    renderer->DisplayToWorld();
+    double homogeneous[4];
+    renderer->GetWorldPoint(homogeneous);
+    if (homogeneous[3] == 0.0) {
+        return false;
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        world[axis] = homogeneous[axis] / homogeneous[3];
+    }
 
-        double spacing[3];
-        imageData->GetSpacing(spacing);
+    // 视线方向上的深度不确定，取当前切片（SliceOrientation 恰好等于法线轴）
+    const int sliceAxis = std::clamp(viewer->GetSliceOrientation(), 0, 2);
+    world[sliceAxis] = imageData->GetOrigin()[sliceAxis] + viewer->GetSlice() * imageData->GetSpacing()[sliceAxis];
+    return true;
+}
 
-        if (!m_distWidgetAxial) {
-            m_distWidgetAxial = vtkSmartPointer<vtkDistanceWidget>::New();
-            auto rep = vtkSmartPointer<vtkDistanceRepresentation2D>::New();
-            m_distWidgetAxial->SetRepresentation(rep);
-            rep->SetLabelFormat("%-#6.2f mm");
-        }
-        auto axialInteractor = m_viewerAxial->GetRenderWindow() ? 
-                               m_viewerAxial->GetRenderWindow()->GetInteractor() : nullptr;
-        if (axialInteractor) {
+bool Widget::DisplayToVoxel(vtkResliceImageViewer *viewer, int displayX, int displayY,
+                            int ijk[3], double world[3]) const
+{
+    if (!DisplayToWorld(viewer, displayX, displayY, world)) {
+        return false;
+    }
+
+    vtkImageData *imageData = viewer->GetInput();
+    double origin[3];
+    double spacing[3];
+    int extent[6];
+    imageData->GetOrigin(origin);
+    imageData->GetSpacing(spacing);
+    imageData->GetExtent(extent);
+
+    for (int axis = 0; axis < 3; ++axis) {
+        ijk[axis] = static_cast<int>(std::lround((world[axis] - origin[axis]) / spacing[axis]));
+    }
+    ijk[std::clamp(viewer->GetSliceOrientation(), 0, 2)] = viewer->GetSlice();
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (ijk[axis] < extent[2 * axis] || ijk[axis] > extent[2 * axis + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Widget::registerProbeObserver(vtkResliceImageViewer *viewer)
+{
+    if (!viewer || !viewer->GetRenderWindow()) {
+        return;
+    }
+    vtkRenderWindowInteractor *interactor = viewer->GetRenderWindow()->GetInteractor();
+    if (!interactor) {
+        return;
+    }
+
+    if (!m_probeCallback) {
+        m_probeCallback = vtkSmartPointer<vtkCallbackCommand>::New();
+        m_probeCallback->SetCallback(Widget::OnProbeCallback);
+        m_probeCallback->SetClientData(this);
+    }
+
+    // 观察交互器而不是交互样式，避免覆盖样式自身的平移/缩放处理
+    interactor->AddObserver(vtkCommand::MouseMoveEvent, m_probeCallback);
+    interactor->AddObserver(vtkCommand::LeaveEvent, m_probeCallback);
+    interactor->AddObserver(vtkCommand::MouseWheelForwardEvent, m_probeCallback);
+    interactor->AddObserver(vtkCommand::MouseWheelBackwardEvent, m_probeCallback);
+    interactor->AddObserver(vtkCommand::LeftButtonReleaseEvent, m_probeCallback);
+}
+
+void Widget::registerInteractionLodObserver(vtkResliceImageViewer *viewer)
+{
+    if (!viewer || !viewer->GetRenderWindow() || !viewer->GetRenderWindow()->GetInteractor()) {
+        return;
+    }
+    if (!m_lodCallback) {
+        m_lodCallback = vtkSmartPointer<vtkCallbackCommand>::New();
+        m_lodCallback->SetCallback(Widget::OnInteractionLodCallback);
+        m_lodCallback->SetClientData(this);
+    }
+
+    // 交互样式在开始/结束平移、缩放与鼠标调窗时发出事件；拖动中的鼠标移动先于样式处理，
+    // 保证这一帧已按降级质量渲染
+    vtkInteractorObserver *style = viewer->GetInteractorStyle();
+    if (style) {
+        style->AddObserver(vtkCommand::StartInteractionEvent, m_lodCallback);
+        style->AddObserver(vtkCommand::EndInteractionEvent, m_lodCallback);
+    }
+    viewer->GetRenderWindow()->GetInteractor()->AddObserver(vtkCommand::MouseMoveEvent, m_lodCallback, 1.0f);
+}
+
+void Widget::OnInteractionLodCallback(vtkObject*,
+                                      unsigned long eventId,
+                                      void* clientData,
+                                      void*)
+{
+    auto *self = static_cast<Widget*>(clientData);
+    if (!self) {
+        return;
+    }
+    if (eventId == vtkCommand::StartInteractionEvent) {
+        ++self->m_lodInteractions;
+        self->BeginInteractionLod();
+    } else if (eventId == vtkCommand::EndInteractionEvent) {
+        self->m_lodInteractions = std::max(0, self->m_lodInteractions - 1);
+        self->m_lodIdleTimer->start();
+    } else if (self->m_lodInteractions > 0) {
+        self->BeginInteractionLod();
+    }
+}
+
+void Widget::BeginInteractionLod()
+{
+    SetInteractionLod(true);
+    m_lodIdleTimer->start();
+}
+
+void Widget::onInteractionIdle()
+{
+    if (!m_lodActive) {
+        return;
+    }
+    SetInteractionLod(false);
+    m_viewerAxial->Render();
+    m_viewerSagittal->Render();
+    m_viewerCoronal->Render();
+}
+
+void Widget::SetInteractionLod(bool active)
+{
+    if (m_lodActive == active || !m_viewerAxial || !m_viewerSagittal || !m_viewerCoronal) {
+        return;
+    }
+    m_lodActive = active;
+
+    const std::pair<vtkResliceImageViewer *, QVTKOpenGLNativeWidget *> views[] = {
+        { m_viewerAxial, view_axial },
+        { m_viewerSagittal, view_sagittal },
+        { m_viewerCoronal, view_coronal },
+    };
+    for (const auto &view : views) {
+        vtkImageProperty *property = view.first->GetImageActor()->GetProperty();
+        if (active) {
+            property->SetInterpolationTypeToNearest();
+        } else {
+            property->SetInterpolationTypeToLinear();
+        }
+        const EnhancePipeline &enhance = m_enhance[std::clamp(view.first->GetSliceOrientation(), 0, 2)];
+        if (enhance.actor) {
+            enhance.actor->GetProperty()->SetInterpolationType(property->GetInterpolationType());
+        }
+        // 只在设备像素比大于 1 的屏幕上降分辨率：渲染到逻辑像素大小的帧缓冲再由 Qt 放大
+        if (view.second->devicePixelRatioF() > 1.0) {
+            view.second->setEnableHiDPI(!active);
+        }
+    }
+}
+
+vtkResliceImageViewer *Widget::ViewerForInteractor(vtkObject *interactor) const
+{
+    if (!interactor) {
+        return nullptr;
+    }
+    vtkResliceImageViewer *viewers[3] = { m_viewerAxial, m_viewerSagittal, m_viewerCoronal };
+    for (vtkResliceImageViewer *viewer : viewers) {
+        if (viewer && viewer->GetRenderWindow() &&
+            viewer->GetRenderWindow()->GetInteractor() == interactor) {
+            return viewer;
+        }
+    }
+    return nullptr;
+}
+
+vtkCornerAnnotation *Widget::AnnotationForViewer(vtkResliceImageViewer *viewer) const
+{
+    if (!viewer) {
+        return nullptr;
+    }
+    if (viewer == m_viewerAxial) {
+        return m_annotAxial;
+    }
+    if (viewer == m_viewerSagittal) {
+        return m_annotSagittal;
+    }
+    if (viewer == m_viewerCoronal) {
+        return m_annotCoronal;
+    }
+    return nullptr;
+}
+
+void Widget::OnProbeCallback(vtkObject* caller,
+                             unsigned long eventId,
+                             void* clientData,
+                             void*)
+{
+    auto *self = static_cast<Widget*>(clientData);
+    auto *interactor = vtkRenderWindowInteractor::SafeDownCast(caller);
+    if (!self || !interactor) {
+        return;
+    }
+
+    vtkResliceImageViewer *viewer = self->ViewerForInteractor(interactor);
+    if (!viewer) {
+        return;
+    }
+
+    if (eventId == vtkCommand::LeaveEvent) {
+        self->ClearProbe(viewer);
+    } else if (eventId == vtkCommand::MouseWheelForwardEvent) {
+        self->HandleStreamingWheel(viewer, 1);
+    } else if (eventId == vtkCommand::MouseWheelBackwardEvent) {
+        self->HandleStreamingWheel(viewer, -1);
+    } else if (eventId == vtkCommand::LeftButtonReleaseEvent) {
+        self->EndMaskStroke();
+        self->EndRoi();
+    } else {
+        self->ContinueMaskStroke(viewer, interactor);
+        self->ContinueRoi(viewer, interactor);
+        self->HandleProbe(viewer, interactor);
+    }
+}
+
+void Widget::HandleProbe(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor)
+{
+    vtkCornerAnnotation *annot = AnnotationForViewer(viewer);
+    vtkImageData *imageData = viewer ? viewer->GetInput() : nullptr;
+    if (!annot || !imageData || !interactor) {
+        return;
+    }
+
+    int pos[2];
+    interactor->GetEventPosition(pos);
+
+    int ijk[3];
+    double world[3];
+    if (!DisplayToVoxel(viewer, pos[0], pos[1], ijk, world)) {
+        ClearProbe(viewer);
+        return;
+    }
+
+    const double value = imageData->GetScalarComponentAsDouble(ijk[0], ijk[1], ijk[2], 0);
+    const QString valueName = (m_modality == "CT") ? QStringLiteral("HU") : QStringLiteral("Value");
+
+    QString text = QString("Voxel: (%1, %2, %3)\nWorld: (%4, %5, %6) mm\n%7: %8")
+        .arg(ijk[0]).arg(ijk[1]).arg(ijk[2])
+        .arg(world[0], 0, 'f', 1).arg(world[1], 0, 'f', 1).arg(world[2], 0, 'f', 1)
+        .arg(valueName).arg(value, 0, 'g', 6);
+
+    // 多个图层时按图层顺序列出各自的标签值
+    QStringList labels;
+    for (const MaskLayer &layer : m_maskLayers) {
+        int maskExtent[6];
+        layer.labels->GetExtent(maskExtent);
+        if (ijk[0] >= maskExtent[0] && ijk[0] <= maskExtent[1] &&
+            ijk[1] >= maskExtent[2] && ijk[1] <= maskExtent[3] &&
+            ijk[2] >= maskExtent[4] && ijk[2] <= maskExtent[5]) {
+            const double label = layer.labels->GetScalarComponentAsDouble(ijk[0], ijk[1], ijk[2], 0);
+            labels << QString::number(static_cast<int>(label));
+        } else {
+            labels << QStringLiteral("-");
+        }
+    }
+    if (!labels.isEmpty()) {
+        text += QString("\nLabel: %1").arg(labels.join(QStringLiteral(" / ")));
+    }
+
+    annot->SetText(3, text.toUtf8().constData());
+    viewer->Render();
+}
+
+void Widget::ClearProbe(vtkResliceImageViewer *viewer)
+{
+    vtkCornerAnnotation *annot = AnnotationForViewer(viewer);
+    if (!annot) {
+        return;
+    }
+    const char *current = annot->GetText(3);
+    if (current && current[0] != '\0') {
+        annot->SetText(3, "");
+        viewer->Render();
+    }
+}
+
+void Widget::onMeasureToggled(bool checked)
+{
+    if (checked) {
+        if (!m_viewerAxial || !m_viewerSagittal || !m_viewerCoronal) {
+            QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Please open DICOM images first."));
+            if (auto btn = ui->btn_measure) {
+                btn->setChecked(false);
+            }
+            return;
+        }
+        // 测量、掩膜编辑与 ROI 都占用左键，三者互斥
+        for (QPushButton *tool : { ui->btn_brush, ui->btn_erase, ui->btn_fill,
+                                   ui->btn_roi_rect, ui->btn_roi_ellipse, ui->btn_roi_lasso }) {
+            QSignalBlocker blocker(tool);
+            tool->setChecked(false);
+        }
+        ClearRois();
+
+        vtkImageData *imageData = m_viewerAxial->GetInput();
+        if (!imageData) {
+            QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Cannot get image data."));
+            if (auto btn = ui->btn_measure) {
+                btn->setChecked(false);
+            }
+            return;
+        }
+
+        double spacing[3];
+        imageData->GetSpacing(spacing);
+
+        if (!m_distWidgetAxial) {
+            m_distWidgetAxial = vtkSmartPointer<vtkDistanceWidget>::New();
+            auto rep = vtkSmartPointer<vtkDistanceRepresentation2D>::New();
+            m_distWidgetAxial->SetRepresentation(rep);
+            rep->SetLabelFormat("%-#6.2f mm");
+        }
+        auto axialInteractor = m_viewerAxial->GetRenderWindow() ? 
+                               m_viewerAxial->GetRenderWindow()->GetInteractor() : nullptr;
+        if (axialInteractor) {
             m_distWidgetAxial->SetInteractor(axialInteractor);
             m_distWidgetAxial->On();
         }
@@ -1073,150 +1962,248 @@ void Widget::onMeasureToggled(bool checked)
 // ===== Mask overlay implementation =====
 
 void Widget::UpdateMaskSlice(vtkResliceImageViewer *viewer,
-                             MaskPipeline &maskPipe,
-                             const char *viewName)
+                             MaskPipeline &maskPipe)
 {
-    if (!viewer || !maskPipe.actor || !m_maskData) {
+    if (!viewer || !maskPipe.actor || !maskPipe.overlay) {
         return;
     }
 
-    int sliceIndex = viewer->GetSlice();
-    
-    int maskDims[3];
-    m_maskData->GetDimensions(maskDims);
-    
-    QString viewStr(viewName);
-    
-    // Update colorMap if needed
-    if (maskPipe.colorMap) {
-        maskPipe.colorMap->Update();
-    }
-    
-    // Use SetDisplayExtent on 3D colored data to show slice
-    if (viewStr == "Axial") {
-        int z = std::clamp(sliceIndex, 0, maskDims[2] - 1);
-        maskPipe.actor->SetDisplayExtent(0, maskDims[0] - 1, 0, maskDims[1] - 1, z, z);
-    } else if (viewStr == "Sagittal") {
-        int x = std::clamp(sliceIndex, 0, maskDims[0] - 1);
-        maskPipe.actor->SetDisplayExtent(x, x, 0, maskDims[1] - 1, 0, maskDims[2] - 1);
-    } else if (viewStr == "Coronal") {
-        int y = std::clamp(sliceIndex, 0, maskDims[1] - 1);
-        maskPipe.actor->SetDisplayExtent(0, maskDims[0] - 1, y, y, 0, maskDims[2] - 1);
+    int dims[3];
+    GetVolumeDimensions(dims);
+    const int axis = std::clamp(viewer->GetSliceOrientation(), 0, 2);
+    const int slice = std::clamp(viewer->GetSlice(), 0, std::max(0, dims[axis] - 1));
+
+    // 叠加层只覆盖当前切片：extent 在法线轴上收缩为 [slice, slice]
+    int extent[6] = { 0, dims[0] - 1, 0, dims[1] - 1, 0, dims[2] - 1 };
+    extent[2 * axis] = extent[2 * axis + 1] = slice;
+
+    vtkImageData *overlay = maskPipe.overlay;
+    int current[6];
+    overlay->GetExtent(current);
+    if (!std::equal(extent, extent + 6, current) || !overlay->GetPointData()->GetScalars()) {
+        overlay->SetExtent(extent);
+        overlay->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
     }
+    CompositeMaskOverlay(overlay, extent);
+    overlay->Modified();
 
     viewer->Render();
 }
 
-static vtkSmartPointer<vtkLookupTable> CreateMaskLookupTable(double minVal, double maxVal)
+void Widget::CompositeMaskOverlay(vtkImageData *overlay, const int ext[6])
 {
-    vtkSmartPointer<vtkLookupTable> lut = vtkSmartPointer<vtkLookupTable>::New();
-
-    // Discrete label LUT:
-    //   0 -> transparent
-    //   1 -> red
-    //   2 -> green
-    //   3 -> blue
-    //   others -> yellow
-    lut->SetNumberOfTableValues(4);
-    lut->SetRange(0, 3);
-
-    // 0: background - fully transparent
-    lut->SetTableValue(0, 0.0, 0.0, 0.0, 0.0);
-    // 1: label 1 - red
-    lut->SetTableValue(1, 1.0, 0.0, 0.0, 0.7);
-    // 2: label 2 - green
-    lut->SetTableValue(2, 0.0, 1.0, 0.0, 0.7);
-    // 3: label 3 - blue
-    lut->SetTableValue(3, 0.0, 0.0, 1.0, 0.7);
+    if (!overlay || !m_maskLut) {
+        return;
+    }
 
-    lut->Build();
-    
-    return lut;
+    std::vector<MaskOverlayLayer> layers;
+    layers.reserve(m_maskLayers.size());
+    for (const MaskLayer &layer : m_maskLayers) {
+        if (!layer.visible || layer.opacity <= 0.0) {
+            continue;
+        }
+        MaskOverlayLayer entry;
+        entry.labels = layer.labels->GetScalarPointer();
+        entry.wideLabels = layer.labels->GetScalarType() == VTK_SHORT;
+        layer.labels->GetDimensions(entry.dims);
+        entry.opacity = layer.opacity;
+        layers.push_back(entry);
+    }
+
+    int overlayExtent[6];
+    overlay->GetExtent(overlayExtent);
+    CompositeMaskLayers(layers, m_maskLut, ext, overlayExtent,
+                        static_cast<unsigned char *>(overlay->GetScalarPointer()));
 }
 
 void Widget::SetupMaskPipeline()
 {
-    if (!m_maskData) {
+    if (m_maskLayers.empty()) {
         return;
     }
+    if (!m_maskLut) {
+        m_maskLut = CreateMaskLookupTable();
+    }
 
-    double range[2];
-    m_maskData->GetScalarRange(range);
-    vtkSmartPointer<vtkLookupTable> lut = CreateMaskLookupTable(range[0], range[1]);
-
-    // Create shared colorMap for 3D mask data
-    vtkSmartPointer<vtkImageMapToColors> colorMap3D = vtkSmartPointer<vtkImageMapToColors>::New();
-    colorMap3D->SetInputData(m_maskData);
-    colorMap3D->SetLookupTable(lut);
-    colorMap3D->SetOutputFormatToRGBA();
-    colorMap3D->PassAlphaToOutputOn();
-    colorMap3D->Update();
-    
-    vtkImageData* coloredMask = colorMap3D->GetOutput();
-
-    // Axial - use SetDisplayExtent on 3D colored data
-    if (m_viewerAxial) {
-        if (!m_maskAxial.colorMap) {
-            m_maskAxial.colorMap = colorMap3D;  // Share the colorMap
+    // 所有图层与体数据共用几何（加载时已对齐），叠加层沿用首个图层的原点与间距
+    vtkImageData *reference = m_maskLayers.front().labels;
+    for (int axis = 0; axis < 3; ++axis) {
+        vtkResliceImageViewer *viewer = ViewerForAxis(axis);
+        MaskPipeline *maskPipe = MaskPipelineForAxis(axis);
+        if (!viewer || !maskPipe) {
+            continue;
         }
 
-        if (!m_maskAxial.actor) {
-            m_maskAxial.actor = vtkSmartPointer<vtkImageActor>::New();
+        if (!maskPipe->overlay) {
+            maskPipe->overlay = vtkSmartPointer<vtkImageData>::New();
+        }
+        maskPipe->overlay->SetOrigin(reference->GetOrigin());
+        maskPipe->overlay->SetSpacing(reference->GetSpacing());
+
+        if (!maskPipe->actor) {
+            maskPipe->actor = vtkSmartPointer<vtkImageActor>::New();
+            maskPipe->actor->SetInputData(maskPipe->overlay);
+            maskPipe->actor->GetProperty()->SetOpacity(1.0);
+            maskPipe->actor->PickableOff();
         }
-        m_maskAxial.actor->SetInputData(coloredMask);
-        m_maskAxial.actor->GetProperty()->SetOpacity(1.0);
-        m_maskAxial.actor->PickableOff();
-        m_maskAxial.actor->SetVisibility(1);
 
-        vtkRenderer *renderer = m_viewerAxial->GetRenderer();
-        if (renderer && !renderer->HasViewProp(m_maskAxial.actor)) {
-            renderer->AddActor(m_maskAxial.actor);
+        vtkRenderer *renderer = viewer->GetRenderer();
+        if (renderer && !renderer->HasViewProp(maskPipe->actor)) {
+            renderer->AddActor(maskPipe->actor);
         }
     }
 
-    // Sagittal - use SetDisplayExtent on 3D colored data
-    if (m_viewerSagittal) {
-        if (!m_maskSagittal.colorMap) {
-            m_maskSagittal.colorMap = colorMap3D;  // Share the colorMap
-        }
+    RefreshMaskOverlays();
+}
 
-        if (!m_maskSagittal.actor) {
-            m_maskSagittal.actor = vtkSmartPointer<vtkImageActor>::New();
-        }
-        m_maskSagittal.actor->SetInputData(coloredMask);
-        m_maskSagittal.actor->GetProperty()->SetOpacity(1.0);
-        m_maskSagittal.actor->PickableOff();
-        m_maskSagittal.actor->SetVisibility(1);
+void Widget::RefreshMaskOverlays()
+{
+    UpdateMaskSlice(m_viewerAxial, m_maskAxial);
+    UpdateMaskSlice(m_viewerSagittal, m_maskSagittal);
+    UpdateMaskSlice(m_viewerCoronal, m_maskCoronal);
+}
 
-        vtkRenderer *renderer = m_viewerSagittal->GetRenderer();
-        if (renderer && !renderer->HasViewProp(m_maskSagittal.actor)) {
-            renderer->AddActor(m_maskSagittal.actor);
-        }
+vtkResliceImageViewer *Widget::ViewerForAxis(int axis) const
+{
+    switch (axis) {
+    case 0:
+        return m_viewerSagittal;
+    case 1:
+        return m_viewerCoronal;
+    case 2:
+        return m_viewerAxial;
+    default:
+        return nullptr;
     }
+}
 
-    // Coronal - use SetDisplayExtent on 3D colored data
-    if (m_viewerCoronal) {
-        if (!m_maskCoronal.colorMap) {
-            m_maskCoronal.colorMap = colorMap3D;  // Share the colorMap
-        }
+Widget::MaskPipeline *Widget::MaskPipelineForAxis(int axis)
+{
+    switch (axis) {
+    case 0:
+        return &m_maskSagittal;
+    case 1:
+        return &m_maskCoronal;
+    case 2:
+        return &m_maskAxial;
+    default:
+        return nullptr;
+    }
+}
 
-        if (!m_maskCoronal.actor) {
-            m_maskCoronal.actor = vtkSmartPointer<vtkImageActor>::New();
-        }
-        m_maskCoronal.actor->SetInputData(coloredMask);
-        m_maskCoronal.actor->GetProperty()->SetOpacity(1.0);
-        m_maskCoronal.actor->PickableOff();
-        m_maskCoronal.actor->SetVisibility(1);
+void Widget::AddMaskLayer(vtkSmartPointer<vtkImageData> labels, const QString &name)
+{
+    MaskLayer layer;
+    layer.name = name;
+    layer.labels = labels;
+    layer.editor = std::make_unique<MaskEditor>();
+    int dims[3];
+    labels->GetDimensions(dims);
+    layer.editor->Attach(labels->GetScalarPointer(), labels->GetScalarType() == VTK_SHORT,
+                         dims, labels->GetSpacing());
+    m_maskLayers.push_back(std::move(layer));
+
+    SetActiveMaskLayer(static_cast<int>(m_maskLayers.size()) - 1);
+    RefreshMaskLayerList();
+    SetupMaskPipeline();
+}
+
+void Widget::SetActiveMaskLayer(int index)
+{
+    EndMaskStroke();
+    if (index < 0 || index >= static_cast<int>(m_maskLayers.size())) {
+        m_activeMaskLayer = -1;
+        m_maskData = nullptr;
+        m_maskEditor = &m_idleMaskEditor;
+    } else {
+        m_activeMaskLayer = index;
+        m_maskData = m_maskLayers[index].labels;
+        m_maskEditor = m_maskLayers[index].editor.get();
+    }
+    m_strokeViewer = nullptr;
+
+    {
+        QSignalBlocker blocker(ui->slider_mask_opacity);
+        ui->slider_mask_opacity->setValue(m_activeMaskLayer >= 0
+            ? static_cast<int>(std::lround(m_maskLayers[m_activeMaskLayer].opacity * 100.0)) : 100);
+    }
+    ui->slider_mask_opacity->setEnabled(m_activeMaskLayer >= 0);
+    ui->btn_remove_mask->setEnabled(m_activeMaskLayer >= 0);
+    UpdateMaskEditButtons();
+}
 
-        vtkRenderer *renderer = m_viewerCoronal->GetRenderer();
-        if (renderer && !renderer->HasViewProp(m_maskCoronal.actor)) {
-            renderer->AddActor(m_maskCoronal.actor);
+void Widget::ClearMaskLayers()
+{
+    EndMaskStroke();
+    for (int axis = 0; axis < 3; ++axis) {
+        vtkResliceImageViewer *viewer = ViewerForAxis(axis);
+        MaskPipeline *maskPipe = MaskPipelineForAxis(axis);
+        if (maskPipe->actor && viewer && viewer->GetRenderer()) {
+            viewer->GetRenderer()->RemoveActor(maskPipe->actor);
         }
+        *maskPipe = MaskPipeline();
+    }
+    m_maskEditor = &m_idleMaskEditor;
+    m_maskLayers.clear();
+    SetActiveMaskLayer(-1);
+    RefreshMaskLayerList();
+}
+
+void Widget::RefreshMaskLayerList()
+{
+    QSignalBlocker blocker(ui->list_mask_layers);
+    ui->list_mask_layers->clear();
+    for (const MaskLayer &layer : m_maskLayers) {
+        auto *item = new QListWidgetItem(layer.name, ui->list_mask_layers);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(layer.visible ? Qt::Checked : Qt::Unchecked);
+    }
+    ui->list_mask_layers->setCurrentRow(m_activeMaskLayer);
+}
+
+void Widget::onMaskLayerSelected(int row)
+{
+    if (row != m_activeMaskLayer) {
+        SetActiveMaskLayer(row);
+    }
+}
+
+void Widget::onMaskLayerItemChanged(QListWidgetItem *item)
+{
+    const int row = ui->list_mask_layers->row(item);
+    if (row < 0 || row >= static_cast<int>(m_maskLayers.size())) {
+        return;
+    }
+    m_maskLayers[row].visible = item->checkState() == Qt::Checked;
+    RefreshMaskOverlays();
+}
+
+void Widget::onMaskOpacityChanged(int value)
+{
+    if (m_activeMaskLayer < 0) {
+        return;
+    }
+    m_maskLayers[m_activeMaskLayer].opacity = value / 100.0;
+    RefreshMaskOverlays();
+}
+
+void Widget::onRemoveMaskLayer()
+{
+    if (m_activeMaskLayer < 0) {
+        return;
+    }
+    if (m_maskLayers.size() == 1) {
+        ClearMaskLayers();
+        return;
     }
 
-    UpdateMaskSlice(m_viewerAxial, m_maskAxial, "Axial");
-    UpdateMaskSlice(m_viewerSagittal, m_maskSagittal, "Sagittal");
-    UpdateMaskSlice(m_viewerCoronal, m_maskCoronal, "Coronal");
+    EndMaskStroke();
+    const int removed = m_activeMaskLayer;
+    m_maskEditor = &m_idleMaskEditor;
+    m_maskLayers.erase(m_maskLayers.begin() + removed);
+    SetActiveMaskLayer(std::min(removed, static_cast<int>(m_maskLayers.size()) - 1));
+    RefreshMaskLayerList();
+    RefreshMaskOverlays();
 }
 
 void Widget::onLoadMask()
@@ -1233,59 +2220,23 @@ void Widget::onLoadMask()
     }
 
     QString maskPath = QFileDialog::getOpenFileName(this, QStringLiteral("Select Mask File"), QString(),
-        QStringLiteral("NIfTI (*.nii *.nii.gz);;MetaImage (*.mha *.mhd);;All (*.*)"));
+        QStringLiteral("NIfTI (*.nii *.nii.gz);;MetaImage (*.mha *.mhd);;DICOM SEG / RTSTRUCT (*.dcm);;All (*.*)"));
 
     if (maskPath.isEmpty()) {
         return;
     }
-
-    vtkSmartPointer<vtkImageData> maskVtk;
-
-    try {
-        typedef itk::Image<unsigned char, Dimension> MaskTypeUChar;
-        typedef itk::ImageFileReader<MaskTypeUChar> ReaderTypeUChar;
-        ReaderTypeUChar::Pointer reader = ReaderTypeUChar::New();
-        reader->SetFileName(maskPath.toStdString());
-        reader->Update();
-
-        MaskTypeUChar::Pointer itkImage = reader->GetOutput();
-        MaskTypeUChar::RegionType region = itkImage->GetLargestPossibleRegion();
-        MaskTypeUChar::SizeType size = region.GetSize();
-        MaskTypeUChar::SpacingType spacing = itkImage->GetSpacing();
-        MaskTypeUChar::PointType origin = itkImage->GetOrigin();
-
-        maskVtk = vtkSmartPointer<vtkImageData>::New();
-        maskVtk->SetDimensions(static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2]));
-        maskVtk->SetSpacing(spacing[0], spacing[1], spacing[2]);
-        maskVtk->SetOrigin(origin[0], origin[1], origin[2]);
-        maskVtk->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
-
-        std::memcpy(maskVtk->GetScalarPointer(), itkImage->GetBufferPointer(), region.GetNumberOfPixels() * sizeof(unsigned char));
-    } catch (...) {
-        try {
-            typedef itk::Image<short, Dimension> MaskTypeShort;
-            typedef itk::ImageFileReader<MaskTypeShort> ReaderTypeShort;
-            ReaderTypeShort::Pointer reader = ReaderTypeShort::New();
-            reader->SetFileName(maskPath.toStdString());
-            reader->Update();
-
-            MaskTypeShort::Pointer itkImage = reader->GetOutput();
-            MaskTypeShort::RegionType region = itkImage->GetLargestPossibleRegion();
-            MaskTypeShort::SizeType size = region.GetSize();
-            MaskTypeShort::SpacingType spacing = itkImage->GetSpacing();
-            MaskTypeShort::PointType origin = itkImage->GetOrigin();
-
-            maskVtk = vtkSmartPointer<vtkImageData>::New();
-            maskVtk->SetDimensions(static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2]));
-            maskVtk->SetSpacing(spacing[0], spacing[1], spacing[2]);
-            maskVtk->SetOrigin(origin[0], origin[1], origin[2]);
-            maskVtk->AllocateScalars(VTK_SHORT, 1);
-
-            std::memcpy(maskVtk->GetScalarPointer(), itkImage->GetBufferPointer(), region.GetNumberOfPixels() * sizeof(short));
-        } catch (...) {
-        }
+    if (DicomSegReader::IsSegmentationFile(maskPath.toStdString())) {
+        LoadSegmentationMask(maskPath);
+        return;
+    }
+    if (RtStructReader::IsRtStructFile(maskPath.toStdString())) {
+        LoadRtStructMask(maskPath);
+        return;
     }
 
+    double maskDirection[9];
+    vtkSmartPointer<vtkImageData> maskVtk = ReadMaskVolume(maskPath.toStdString(), maskDirection);
+
     if (!maskVtk) {
         QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Failed to read mask file."));
         return;
@@ -1293,44 +2244,56 @@ void Widget::onLoadMask()
 
     int baseDims[3];
     int maskDims[3];
-    baseImage->GetDimensions(baseDims);
+    double baseOrigin[3];
+    double baseSpacing[3];
+    GetVolumeDimensions(baseDims);
     maskVtk->GetDimensions(maskDims);
+    if (m_volumeStore) {
+        const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+        std::copy(std::begin(geometry.origin), std::end(geometry.origin), baseOrigin);
+        std::copy(std::begin(geometry.spacing), std::end(geometry.spacing), baseSpacing);
+    } else {
+        baseImage->GetOrigin(baseOrigin);
+        baseImage->GetSpacing(baseSpacing);
+    }
 
-    if (baseDims[0] != maskDims[0] || baseDims[1] != maskDims[1] || baseDims[2] != maskDims[2]) {
-        QString msg = QString("Mask dimensions mismatch. Base: %1x%2x%3 Mask: %4x%5x%6")
-            .arg(baseDims[0]).arg(baseDims[1]).arg(baseDims[2])
-            .arg(maskDims[0]).arg(maskDims[1]).arg(maskDims[2]);
-        QMessageBox::warning(this, QStringLiteral("Warning"), msg);
+    // 在已配准的对比研究上勾画的掩膜经配准变换映射到当前图像网格
+    const PatientTransform *priorTransform = nullptr;
+    if (m_priorView && m_priorView->HasPatientTransform() &&
+        QMessageBox::question(this, QStringLiteral("Load Mask"),
+                              QStringLiteral("Was this mask drawn on the registered prior study?\n"
+                                             "Choose Yes to map it through the registration.")) == QMessageBox::Yes) {
+        priorTransform = &m_priorView->GetPatientTransform();
     }
 
-    double baseOrigin[3];
-    double baseSpacing[3];
-    baseImage->GetOrigin(baseOrigin);
-    baseImage->GetSpacing(baseSpacing);
-    maskVtk->SetOrigin(baseOrigin);
-    maskVtk->SetSpacing(baseSpacing);
-
-    if (m_maskAxial.actor && m_viewerAxial && m_viewerAxial->GetRenderer()) {
-        m_viewerAxial->GetRenderer()->RemoveActor(m_maskAxial.actor);
-        m_maskAxial.actor = nullptr;
-        m_maskAxial.extractVOI = nullptr;
-        m_maskAxial.colorMap = nullptr;
-    }
-    if (m_maskSagittal.actor && m_viewerSagittal && m_viewerSagittal->GetRenderer()) {
-        m_viewerSagittal->GetRenderer()->RemoveActor(m_maskSagittal.actor);
-        m_maskSagittal.actor = nullptr;
-        m_maskSagittal.extractVOI = nullptr;
-        m_maskSagittal.colorMap = nullptr;
-    }
-    if (m_maskCoronal.actor && m_viewerCoronal && m_viewerCoronal->GetRenderer()) {
-        m_viewerCoronal->GetRenderer()->RemoveActor(m_maskCoronal.actor);
-        m_maskCoronal.actor = nullptr;
-        m_maskCoronal.extractVOI = nullptr;
-        m_maskCoronal.colorMap = nullptr;
-    }
-
-    m_maskData = maskVtk;
-    SetupMaskPipeline();
+    QString resampledNote;
+    if (!priorTransform &&
+        MaskMatchesGrid(maskVtk, maskDirection, baseDims, baseSpacing, baseOrigin, m_volumeDirection)) {
+        // 与图像同一网格（只差文件读写的舍入），沿用图像的几何信息
+        maskVtk->SetOrigin(baseOrigin);
+        maskVtk->SetSpacing(baseSpacing);
+    } else {
+        // 尺寸、原点、间距或方向不同（如翻转或平移的网格）时按两者的真实几何把标签最近邻重采样到图像网格上
+        size_t insideCount = 0;
+        vtkSmartPointer<vtkImageData> resampled = ResampleMaskToGrid(
+            maskVtk, maskDirection, baseDims, baseSpacing, baseOrigin, m_volumeDirection, priorTransform,
+            &insideCount);
+        if (!resampled) {
+            QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Mask has an invalid direction matrix."));
+            return;
+        }
+        if (insideCount == 0) {
+            QMessageBox::warning(this, QStringLiteral("Warning"),
+                QStringLiteral("Mask does not overlap the image; check that both come from the same study."));
+        }
+        maskVtk = resampled;
+        resampledNote = QString("\nResampled from %1 x %2 x %3").arg(maskDims[0]).arg(maskDims[1]).arg(maskDims[2]);
+        if (priorTransform) {
+            resampledNote += QStringLiteral(" through the prior registration");
+        }
+    }
+
+    AddMaskLayer(maskVtk, QFileInfo(maskPath).fileName());
 
 
     if (m_viewerAxial) m_viewerAxial->Render();
@@ -1339,5 +2302,1581 @@ void Widget::onLoadMask()
 
     QMessageBox::information(this, QStringLiteral("Success"), 
         QString("Mask loaded successfully!\nDimensions: %1 x %2 x %3")
-        .arg(maskDims[0]).arg(maskDims[1]).arg(maskDims[2]));
+        .arg(baseDims[0]).arg(baseDims[1]).arg(baseDims[2]) + resampledNote);
+}
+
+void Widget::LoadSegmentationMask(const QString &fileName)
+{
+    DicomSegReader reader;
+    std::string error;
+    if (!reader.Open(fileName.toStdString(), &error)) {
+        QMessageBox::warning(this, QStringLiteral("Error"), QString::fromLocal8Bit(error.c_str()));
+        return;
+    }
+
+    // 段多时只展开选中的段，其余段的帧不解包
+    const std::vector<DicomSegment> &segments = reader.GetSegments();
+    QStringList names;
+    for (const DicomSegment &segment : segments) {
+        names << QString("%1: %2").arg(segment.number).arg(QString::fromStdString(segment.label));
+    }
+    std::vector<size_t> selected;
+    QString selectedName;
+    if (!SelectMaskItems(QStringLiteral("Load Segmentation"), names, selected, selectedName)) {
+        return;
+    }
+    QString layerName = QFileInfo(fileName).fileName();
+    if (!selectedName.isEmpty()) {
+        layerName += QStringLiteral(" - ") + selectedName;
+    }
+
+    const SegmentationGrid grid = CurrentMaskGrid();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    size_t insideCount = 0;
+    vtkSmartPointer<vtkImageData> labels = reader.DecodeSegments(selected, grid, &insideCount, &error);
+    QApplication::restoreOverrideCursor();
+    if (!labels) {
+        QMessageBox::warning(this, QStringLiteral("Error"), QString::fromLocal8Bit(error.c_str()));
+        return;
+    }
+    if (insideCount == 0) {
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+            QStringLiteral("Segmentation does not overlap the image; check that both come from the same study."));
+    }
+
+    AddMaskLayer(labels, layerName);
+
+    if (m_viewerAxial) m_viewerAxial->Render();
+    if (m_viewerSagittal) m_viewerSagittal->Render();
+    if (m_viewerCoronal) m_viewerCoronal->Render();
+
+    QMessageBox::information(this, QStringLiteral("Success"),
+        QString("Segmentation loaded: %1 segment(s), %2 voxels\nDimensions: %3 x %4 x %5")
+        .arg(selected.size()).arg(insideCount).arg(grid.dims[0]).arg(grid.dims[1]).arg(grid.dims[2]));
+}
+
+void Widget::LoadRtStructMask(const QString &fileName)
+{
+    RtStructReader reader;
+    std::string error;
+    if (!reader.Open(fileName.toStdString(), &error)) {
+        QMessageBox::warning(this, QStringLiteral("Error"), QString::fromLocal8Bit(error.c_str()));
+        return;
+    }
+
+    const std::vector<RtStructRoi> &rois = reader.GetRois();
+    QStringList names;
+    for (const RtStructRoi &roi : rois) {
+        names << QString("%1: %2").arg(roi.number).arg(QString::fromStdString(roi.name));
+    }
+    std::vector<size_t> selected;
+    QString selectedName;
+    if (!SelectMaskItems(QStringLiteral("Load RT Structure Set"), names, selected, selectedName)) {
+        return;
+    }
+    QString layerName = reader.GetStructureSetLabel().empty() ? QFileInfo(fileName).fileName()
+                                                              : QString::fromStdString(reader.GetStructureSetLabel());
+    if (!selectedName.isEmpty()) {
+        layerName += QStringLiteral(" - ") + selectedName;
+    }
+
+    const SegmentationGrid grid = CurrentMaskGrid();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    size_t voxelCount = 0;
+    vtkSmartPointer<vtkImageData> labels = m_rtStructCache.BuildLabels(reader, selected, grid, &voxelCount, &error);
+    QApplication::restoreOverrideCursor();
+    if (!labels) {
+        QMessageBox::warning(this, QStringLiteral("Error"), QString::fromLocal8Bit(error.c_str()));
+        return;
+    }
+    if (voxelCount == 0) {
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+            QStringLiteral("Structure set does not overlap the image; check that both come from the same study."));
+    }
+
+    AddMaskLayer(labels, layerName);
+
+    if (m_viewerAxial) m_viewerAxial->Render();
+    if (m_viewerSagittal) m_viewerSagittal->Render();
+    if (m_viewerCoronal) m_viewerCoronal->Render();
+
+    QMessageBox::information(this, QStringLiteral("Success"),
+        QString("Structure set loaded: %1 ROI(s), %2 voxels\nDimensions: %3 x %4 x %5")
+        .arg(selected.size()).arg(voxelCount).arg(grid.dims[0]).arg(grid.dims[1]).arg(grid.dims[2]));
+}
+
+SegmentationGrid Widget::CurrentMaskGrid() const
+{
+    SegmentationGrid grid;
+    GetVolumeDimensions(grid.dims);
+    if (m_volumeStore) {
+        const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+        std::copy(std::begin(geometry.origin), std::end(geometry.origin), grid.origin);
+        std::copy(std::begin(geometry.spacing), std::end(geometry.spacing), grid.spacing);
+    } else if (m_viewerAxial && m_viewerAxial->GetInput()) {
+        m_viewerAxial->GetInput()->GetOrigin(grid.origin);
+        m_viewerAxial->GetInput()->GetSpacing(grid.spacing);
+    }
+    std::copy(std::begin(m_volumeDirection), std::end(m_volumeDirection), grid.direction);
+    return grid;
+}
+
+bool Widget::SelectMaskItems(const QString &title, const QStringList &names, std::vector<size_t> &selected,
+                             QString &selectedName)
+{
+    selected.clear();
+    selectedName.clear();
+    if (names.size() > 1) {
+        const QStringList items = QStringList{ QString("All (%1)").arg(names.size()) } + names;
+        bool ok = false;
+        const QString item = QInputDialog::getItem(this, title, QStringLiteral("Load:"), items, 0, false, &ok);
+        if (!ok) {
+            return false;
+        }
+        const int choice = items.indexOf(item);
+        if (choice > 0) {
+            selected.push_back(static_cast<size_t>(choice - 1));
+            selectedName = names[choice - 1];
+            return true;
+        }
+    }
+    for (int i = 0; i < names.size(); ++i) {
+        selected.push_back(static_cast<size_t>(i));
+    }
+    return true;
+}
+
+// ===== Mask editing =====
+
+bool Widget::ActiveMaskTool(MaskEditor::Tool &tool) const
+{
+    if (ui->btn_brush->isChecked()) {
+        tool = MaskEditor::Tool::Paint;
+    } else if (ui->btn_erase->isChecked()) {
+        tool = MaskEditor::Tool::Erase;
+    } else if (ui->btn_fill->isChecked()) {
+        tool = MaskEditor::Tool::Fill;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool Widget::EnsureEditableMask()
+{
+    if (m_maskData) {
+        return true;
+    }
+    vtkImageData *baseImage = m_viewerAxial ? m_viewerAxial->GetInput() : nullptr;
+    if (!baseImage) {
+        return false;
+    }
+
+    // 尚未加载掩膜时按体数据尺寸新建一个空白标签体
+    int dims[3];
+    GetVolumeDimensions(dims);
+    auto mask = vtkSmartPointer<vtkImageData>::New();
+    mask->SetDimensions(dims);
+    mask->SetSpacing(baseImage->GetSpacing());
+    mask->SetOrigin(baseImage->GetOrigin());
+    mask->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+    std::memset(mask->GetScalarPointer(), 0, static_cast<size_t>(mask->GetNumberOfPoints()));
+
+    AddMaskLayer(mask, QStringLiteral("Untitled"));
+    return true;
+}
+
+bool Widget::BeginMaskEdit(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor)
+{
+    MaskEditor::Tool tool;
+    if (!ActiveMaskTool(tool)) {
+        return false;
+    }
+    if (m_maskSaving || !viewer || !interactor || !EnsureEditableMask()) {
+        return true;
+    }
+
+    int pos[2];
+    interactor->GetEventPosition(pos);
+    int ijk[3];
+    double world[3];
+    if (!DisplayToVoxel(viewer, pos[0], pos[1], ijk, world)) {
+        return true;
+    }
+
+    const int axis = std::clamp(viewer->GetSliceOrientation(), 0, 2);
+    const int label = ui->spin_brush_label->value();
+    MaskRegion dirty;
+    if (tool == MaskEditor::Tool::Fill) {
+        m_maskEditor->Fill(label, axis, ijk, dirty);
+    } else if (m_maskEditor->BeginStroke(tool, label, ui->spin_brush_size->value(), axis, ijk, dirty)) {
+        m_strokeViewer = viewer;
+    }
+    RecolorMaskRegion(dirty);
+    UpdateMaskEditButtons();
+    return true;
+}
+
+void Widget::ContinueMaskStroke(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor)
+{
+    if (!m_maskEditor->IsStroking() || viewer != m_strokeViewer || !interactor) {
+        return;
+    }
+
+    int pos[2];
+    interactor->GetEventPosition(pos);
+    int ijk[3];
+    double world[3];
+    if (!DisplayToVoxel(viewer, pos[0], pos[1], ijk, world)) {
+        return;
+    }
+
+    MaskRegion dirty;
+    m_maskEditor->StrokeTo(ijk, dirty);
+    RecolorMaskRegion(dirty);
+}
+
+void Widget::EndMaskStroke()
+{
+    if (!m_maskEditor->IsStroking()) {
+        return;
+    }
+    m_maskEditor->EndStroke();
+    m_strokeViewer = nullptr;
+    UpdateMaskEditButtons();
+}
+
+void Widget::RecolorMaskRegion(const MaskRegion &region)
+{
+    if (region.IsEmpty() || m_maskLayers.empty()) {
+        return;
+    }
+
+    // 只重新合成各视图当前切片与脏区相交的矩形，并只重绘这些视图
+    for (int axis = 0; axis < 3; ++axis) {
+        vtkResliceImageViewer *viewer = ViewerForAxis(axis);
+        MaskPipeline *maskPipe = MaskPipelineForAxis(axis);
+        if (!viewer || !maskPipe->overlay || !maskPipe->overlay->GetPointData()->GetScalars()) {
+            continue;
+        }
+        int extent[6];
+        maskPipe->overlay->GetExtent(extent);
+        bool intersects = true;
+        for (int a = 0; a < 3; ++a) {
+            extent[2 * a] = std::max(extent[2 * a], region.extent[2 * a]);
+            extent[2 * a + 1] = std::min(extent[2 * a + 1], region.extent[2 * a + 1]);
+            intersects = intersects && extent[2 * a] <= extent[2 * a + 1];
+        }
+        if (!intersects) {
+            continue;
+        }
+        CompositeMaskOverlay(maskPipe->overlay, extent);
+        maskPipe->overlay->Modified();
+        viewer->Render();
+    }
+}
+
+void Widget::UpdateMaskEditButtons()
+{
+    ui->btn_undo->setEnabled(m_maskEditor->CanUndo());
+    ui->btn_redo->setEnabled(m_maskEditor->CanRedo());
+    ui->btn_save_mask->setEnabled(!m_maskSaving);
+}
+
+void Widget::onMaskToolToggled(bool checked)
+{
+    if (!checked) {
+        return;
+    }
+    auto *source = qobject_cast<QPushButton *>(sender());
+    for (QPushButton *tool : { ui->btn_brush, ui->btn_erase, ui->btn_fill,
+                               ui->btn_roi_rect, ui->btn_roi_ellipse, ui->btn_roi_lasso }) {
+        if (tool != source) {
+            QSignalBlocker blocker(tool);
+            tool->setChecked(false);
+        }
+    }
+    ClearRois();
+    if (ui->btn_measure->isChecked()) {
+        ui->btn_measure->setChecked(false);
+    }
+}
+
+void Widget::onMaskUndo()
+{
+    if (m_maskSaving) {
+        return;
+    }
+    MaskRegion dirty;
+    if (m_maskEditor->Undo(dirty)) {
+        RecolorMaskRegion(dirty);
+    }
+    UpdateMaskEditButtons();
+}
+
+void Widget::onMaskRedo()
+{
+    if (m_maskSaving) {
+        return;
+    }
+    MaskRegion dirty;
+    if (m_maskEditor->Redo(dirty)) {
+        RecolorMaskRegion(dirty);
+    }
+    UpdateMaskEditButtons();
+}
+
+// ===== ROI statistics =====
+
+// 法线为 axis 的切片平面内的两轴，按升序（与 SliceIntegralImage 一致）
+static void RoiPlaneAxes(int axis, int &uAxis, int &vAxis)
+{
+    uAxis = axis == 0 ? 1 : 0;
+    vAxis = axis == 2 ? 1 : 2;
+}
+
+Widget::RoiOverlay *Widget::RoiOverlayForAxis(int axis)
+{
+    switch (axis) {
+    case 0:
+        return &m_roiSagittal;
+    case 1:
+        return &m_roiCoronal;
+    case 2:
+        return &m_roiAxial;
+    default:
+        return nullptr;
+    }
+}
+
+bool Widget::ActiveRoiShape(RoiShape &shape) const
+{
+    if (ui->btn_roi_rect->isChecked()) {
+        shape = RoiShape::Rectangle;
+    } else if (ui->btn_roi_ellipse->isChecked()) {
+        shape = RoiShape::Ellipse;
+    } else if (ui->btn_roi_lasso->isChecked()) {
+        shape = RoiShape::Lasso;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Widget::onRoiToolToggled(bool checked)
+{
+    if (!checked) {
+        // 与关闭测量时隐藏标尺一致，关闭 ROI 工具即移除各视图的 ROI
+        ClearRois();
+        return;
+    }
+    auto *source = qobject_cast<QPushButton *>(sender());
+    for (QPushButton *tool : { ui->btn_roi_rect, ui->btn_roi_ellipse, ui->btn_roi_lasso,
+                               ui->btn_brush, ui->btn_erase, ui->btn_fill }) {
+        if (tool != source) {
+            QSignalBlocker blocker(tool);
+            tool->setChecked(false);
+        }
+    }
+    EndMaskStroke();
+    if (ui->btn_measure->isChecked()) {
+        ui->btn_measure->setChecked(false);
+    }
+}
+
+bool Widget::BeginRoi(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor)
+{
+    RoiShape shape;
+    if (!ActiveRoiShape(shape)) {
+        return false;
+    }
+    if (!viewer || !interactor) {
+        return true;
+    }
+
+    // 起点须落在图像内，拖动过程中允许移出图像（统计时裁剪）
+    int pos[2];
+    interactor->GetEventPosition(pos);
+    int ijk[3];
+    double world[3];
+    if (!DisplayToVoxel(viewer, pos[0], pos[1], ijk, world)) {
+        return true;
+    }
+
+    const int axis = std::clamp(viewer->GetSliceOrientation(), 0, 2);
+    int uAxis;
+    int vAxis;
+    RoiPlaneAxes(axis, uAxis, vAxis);
+    vtkImageData *image = viewer->GetInput();
+    const std::array<double, 2> point = {
+        (world[uAxis] - image->GetOrigin()[uAxis]) / image->GetSpacing()[uAxis],
+        (world[vAxis] - image->GetOrigin()[vAxis]) / image->GetSpacing()[vAxis],
+    };
+
+    RoiOverlay *roi = RoiOverlayForAxis(axis);
+    roi->shape = shape;
+    roi->points.assign(shape == RoiShape::Lasso ? 1 : 2, point);
+    m_roiViewer = viewer;
+    UpdateRoi(viewer);
+    return true;
+}
+
+void Widget::ContinueRoi(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor)
+{
+    if (!m_roiViewer || viewer != m_roiViewer || !interactor) {
+        return;
+    }
+
+    int pos[2];
+    interactor->GetEventPosition(pos);
+    double world[3];
+    if (!DisplayToWorld(viewer, pos[0], pos[1], world)) {
+        return;
+    }
+
+    const int axis = std::clamp(viewer->GetSliceOrientation(), 0, 2);
+    int uAxis;
+    int vAxis;
+    RoiPlaneAxes(axis, uAxis, vAxis);
+    vtkImageData *image = viewer->GetInput();
+    const std::array<double, 2> point = {
+        (world[uAxis] - image->GetOrigin()[uAxis]) / image->GetSpacing()[uAxis],
+        (world[vAxis] - image->GetOrigin()[vAxis]) / image->GetSpacing()[vAxis],
+    };
+
+    RoiOverlay *roi = RoiOverlayForAxis(axis);
+    if (roi->shape == RoiShape::Lasso) {
+        // 移动不足半个体素时不记录，轨迹点数随路径长度而不是事件数增长
+        const std::array<double, 2> &last = roi->points.back();
+        if (std::hypot(point[0] - last[0], point[1] - last[1]) < 0.5) {
+            return;
+        }
+        roi->points.push_back(point);
+    } else {
+        roi->points[1] = point;
+    }
+    UpdateRoi(viewer);
+}
+
+void Widget::EndRoi()
+{
+    m_roiViewer = nullptr;
+}
+
+void Widget::UpdateRoi(vtkResliceImageViewer *viewer)
+{
+    vtkImageData *image = viewer ? viewer->GetInput() : nullptr;
+    vtkRenderer *renderer = viewer ? viewer->GetRenderer() : nullptr;
+    if (!image || !renderer) {
+        return;
+    }
+    const int axis = std::clamp(viewer->GetSliceOrientation(), 0, 2);
+    RoiOverlay *roi = RoiOverlayForAxis(axis);
+    if (roi->points.empty()) {
+        return;
+    }
+
+    if (!roi->outlineActor) {
+        roi->outline = vtkSmartPointer<vtkPolyData>::New();
+        auto coordinate = vtkSmartPointer<vtkCoordinate>::New();
+        coordinate->SetCoordinateSystemToWorld();
+        auto mapper = vtkSmartPointer<vtkPolyDataMapper2D>::New();
+        mapper->SetInputData(roi->outline);
+        mapper->SetTransformCoordinate(coordinate);
+        roi->outlineActor = vtkSmartPointer<vtkActor2D>::New();
+        roi->outlineActor->SetMapper(mapper);
+        roi->outlineActor->GetProperty()->SetColor(1.0, 1.0, 0.0);
+        roi->outlineActor->PickableOff();
+
+        roi->label = vtkSmartPointer<vtkTextActor>::New();
+        roi->label->GetPositionCoordinate()->SetCoordinateSystemToWorld();
+        roi->label->GetTextProperty()->SetColor(1.0, 1.0, 0.0);
+        roi->label->GetTextProperty()->SetFontSize(12);
+        roi->label->PickableOff();
+    }
+    if (!renderer->HasViewProp(roi->outlineActor)) {
+        renderer->AddActor2D(roi->outlineActor);
+        renderer->AddActor2D(roi->label);
+    }
+
+    const std::vector<std::array<double, 2>> &p = roi->points;
+    const double uLow = std::min(p[0][0], p.back()[0]);
+    const double uHigh = std::max(p[0][0], p.back()[0]);
+    const double vLow = std::min(p[0][1], p.back()[1]);
+    const double vHigh = std::max(p[0][1], p.back()[1]);
+
+    // 轮廓：矩形四角、椭圆 64 段折线、套索轨迹，均首尾闭合
+    std::vector<std::array<double, 2>> contour;
+    if (roi->shape == RoiShape::Rectangle) {
+        contour = { { uLow, vLow }, { uHigh, vLow }, { uHigh, vHigh }, { uLow, vHigh } };
+    } else if (roi->shape == RoiShape::Ellipse) {
+        const int segments = 64;
+        for (int i = 0; i < segments; ++i) {
+            const double angle = 2.0 * vtkMath::Pi() * i / segments;
+            contour.push_back({ 0.5 * (uLow + uHigh) + 0.5 * (uHigh - uLow) * std::cos(angle),
+                                0.5 * (vLow + vHigh) + 0.5 * (vHigh - vLow) * std::sin(angle) });
+        }
+    } else {
+        contour = p;
+    }
+
+    double origin[3];
+    double spacing[3];
+    image->GetOrigin(origin);
+    image->GetSpacing(spacing);
+    int uAxis;
+    int vAxis;
+    RoiPlaneAxes(axis, uAxis, vAxis);
+    double world[3];
+    world[axis] = origin[axis] + viewer->GetSlice() * spacing[axis];
+
+    auto points = vtkSmartPointer<vtkPoints>::New();
+    auto lines = vtkSmartPointer<vtkCellArray>::New();
+    double labelU = contour.front()[0];
+    double labelV = contour.front()[1];
+    lines->InsertNextCell(static_cast<int>(contour.size()) + 1);
+    for (const std::array<double, 2> &point : contour) {
+        world[uAxis] = origin[uAxis] + point[0] * spacing[uAxis];
+        world[vAxis] = origin[vAxis] + point[1] * spacing[vAxis];
+        lines->InsertCellPoint(points->InsertNextPoint(world));
+        labelU = std::max(labelU, point[0]);
+        labelV = std::max(labelV, point[1]);
+    }
+    lines->InsertCellPoint(0);
+    roi->outline->SetPoints(points);
+    roi->outline->SetLines(lines);
+
+    // 积分图按层缓存：拖动时矩形每次只查四个角，椭圆与套索逐行查跨度
+    RoiStatistics stats;
+    if (const SliceIntegralImage *table = roi->statistics.Get(image, axis, viewer->GetSlice())) {
+        if (roi->shape == RoiShape::Rectangle) {
+            stats = table->Rectangle(static_cast<int>(std::ceil(uLow)), static_cast<int>(std::ceil(vLow)),
+                                     static_cast<int>(std::floor(uHigh)), static_cast<int>(std::floor(vHigh)));
+        } else if (roi->shape == RoiShape::Ellipse) {
+            stats = table->Ellipse(0.5 * (uLow + uHigh), 0.5 * (vLow + vHigh),
+                                   0.5 * (uHigh - uLow), 0.5 * (vHigh - vLow));
+        } else {
+            stats = table->Polygon(p);
+        }
+    }
+
+    const QString valueName = (m_modality == "CT") ? QStringLiteral("HU") : QStringLiteral("Value");
+    const double area = static_cast<double>(stats.count) * spacing[uAxis] * spacing[vAxis];
+    const QString text = QString("Mean %1: %2\nSD: %3\nArea: %4 mm2 (%5 px)")
+        .arg(valueName).arg(stats.mean, 0, 'f', 1).arg(stats.stdDev, 0, 'f', 1)
+        .arg(area, 0, 'f', 1).arg(stats.count);
+    roi->label->SetInput(text.toUtf8().constData());
+    world[uAxis] = origin[uAxis] + labelU * spacing[uAxis];
+    world[vAxis] = origin[vAxis] + labelV * spacing[vAxis];
+    roi->label->GetPositionCoordinate()->SetValue(world);
+
+    viewer->Render();
+}
+
+void Widget::ClearRois()
+{
+    m_roiViewer = nullptr;
+    for (int axis = 0; axis < 3; ++axis) {
+        vtkResliceImageViewer *viewer = ViewerForAxis(axis);
+        RoiOverlay *roi = RoiOverlayForAxis(axis);
+        const bool shown = roi->outlineActor && viewer && viewer->GetRenderer() &&
+                           viewer->GetRenderer()->HasViewProp(roi->outlineActor);
+        if (shown) {
+            viewer->GetRenderer()->RemoveActor2D(roi->outlineActor);
+            viewer->GetRenderer()->RemoveActor2D(roi->label);
+        }
+        *roi = RoiOverlay();
+        if (shown && viewer->GetInput()) {
+            viewer->Render();
+        }
+    }
+}
+
+// ===== Mask export =====
+
+void Widget::onSaveMask()
+{
+    if (!m_maskData) {
+        QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("No mask to save."));
+        return;
+    }
+    if (m_maskSaving) {
+        return;
+    }
+
+    QString maskPath = QFileDialog::getSaveFileName(this, QStringLiteral("Save Mask File"), QString(),
+        QStringLiteral("NIfTI (*.nii.gz *.nii);;MetaImage (*.mha)"));
+    if (maskPath.isEmpty()) {
+        return;
+    }
+    if (!maskPath.endsWith(".nii.gz", Qt::CaseInsensitive) && !maskPath.endsWith(".nii", Qt::CaseInsensitive) &&
+        !maskPath.endsWith(".mha", Qt::CaseInsensitive)) {
+        maskPath += QStringLiteral(".nii.gz");
+    }
+    if (m_maskEditor->IsStroking()) {
+        EndMaskStroke();
+    }
+
+    VolumeFileDescription description;
+    m_maskData->GetDimensions(description.dims);
+    m_maskData->GetSpacing(description.spacing);
+    m_maskData->GetOrigin(description.origin);
+    std::copy(std::begin(m_volumeDirection), std::end(m_volumeDirection), description.direction);
+    description.scalarType = m_maskData->GetScalarType();
+
+    // 任务持有掩膜引用：保存期间切换体数据或重新加载掩膜不会释放正在写出的缓冲区
+    vtkSmartPointer<vtkImageData> mask = m_maskData;
+    const std::filesystem::path filePath(maskPath.toStdWString());
+    m_maskSaving = true;
+    UpdateMaskEditButtons();
+
+    QPointer<Widget> guard(this);
+    m_maskSaveTask = ThreadPool::Global().Submit([guard, mask, description, filePath, maskPath]() {
+        std::string error;
+        const bool ok = WriteCompressedVolume(filePath, mask->GetScalarPointer(), description, &error,
+            ThreadPool::Global(), [guard](double fraction) {
+                QMetaObject::invokeMethod(guard, [guard, fraction]() {
+                    if (guard) {
+                        guard->onMaskSaveProgress(fraction);
+                    }
+                }, Qt::QueuedConnection);
+            });
+        const QString message = QString::fromStdString(error);
+        QMetaObject::invokeMethod(guard, [guard, ok, maskPath, message]() {
+            if (guard) {
+                guard->onMaskSaveFinished(ok, maskPath, message);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void Widget::onMaskSaveProgress(double fraction)
+{
+    if (m_maskSaving) {
+        ui->btn_save_mask->setText(QString("Saving %1%").arg(static_cast<int>(fraction * 100.0)));
+    }
+}
+
+void Widget::onMaskSaveFinished(bool ok, const QString &filePath, const QString &error)
+{
+    m_maskSaving = false;
+    ui->btn_save_mask->setText(QStringLiteral("Save Mask"));
+    UpdateMaskEditButtons();
+
+    if (!ok) {
+        QMessageBox::warning(this, QStringLiteral("Error"),
+                             QStringLiteral("Failed to save mask: %1").arg(error));
+        return;
+    }
+    QMessageBox::information(this, QStringLiteral("Success"),
+                             QStringLiteral("Mask saved to %1").arg(QDir::toNativeSeparators(filePath)));
+}
+
+// ===== Batch PNG export =====
+
+void Widget::onExportPng()
+{
+    if (m_pngExporting) {
+        return;
+    }
+    int dims[3];
+    GetVolumeDimensions(dims);
+    if (dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0) {
+        QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Please open DICOM images first."));
+        return;
+    }
+    if (m_decodeJob) {
+        QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Volume is still decoding."));
+        return;
+    }
+
+    bool ok = false;
+    const int step = QInputDialog::getInt(this, QStringLiteral("Export PNG"), QStringLiteral("Export every Nth slice:"),
+                                          1, 1, std::max({ dims[0], dims[1], dims[2] }), 1, &ok);
+    if (!ok) {
+        return;
+    }
+    const QString directory = QFileDialog::getExistingDirectory(this, QStringLiteral("Select Output Directory"));
+    if (directory.isEmpty()) {
+        return;
+    }
+    if (m_maskEditor->IsStroking()) {
+        EndMaskStroke();
+    }
+
+    // 与视图一致：当前滑块窗宽窗位，可见图层按当前不透明度合成
+    auto options = std::make_shared<SliceExportOptions>();
+    options->outputDirectory = directory;
+    options->step = step;
+    options->window = ui->slider_window->value() / m_windowLevelScale;
+    options->level = ui->slider_level->value() / m_windowLevelScale;
+
+    // 导出期间仍可编辑或移除图层，因此对可见图层做快照
+    std::vector<vtkSmartPointer<vtkImageData>> masks;
+    for (const MaskLayer &layer : m_maskLayers) {
+        if (!layer.visible || layer.opacity <= 0.0) {
+            continue;
+        }
+        vtkSmartPointer<vtkImageData> snapshot = vtkSmartPointer<vtkImageData>::New();
+        snapshot->DeepCopy(layer.labels);
+        MaskOverlayLayer entry;
+        entry.labels = snapshot->GetScalarPointer();
+        entry.wideLabels = snapshot->GetScalarType() == VTK_SHORT;
+        snapshot->GetDimensions(entry.dims);
+        entry.opacity = layer.opacity;
+        options->masks.push_back(entry);
+        masks.push_back(snapshot);
+    }
+    vtkSmartPointer<vtkLookupTable> lut;
+    if (!options->masks.empty()) {
+        lut = vtkSmartPointer<vtkLookupTable>::New();
+        lut->DeepCopy(m_maskLut);
+        options->lut = lut;
+    }
+
+    std::shared_ptr<BrickedVolumeStore> store = m_volumeStore;
+    vtkSmartPointer<vtkImageData> volume = store ? nullptr : m_viewerAxial->GetInput();
+    m_pngExporting = true;
+    ui->btn_export_png->setEnabled(false);
+
+    QPointer<Widget> guard(this);
+    m_pngExportTask = ThreadPool::Global().Submit([guard, options, masks, lut, store, volume, directory]() {
+        auto progress = [guard](double fraction) {
+            QMetaObject::invokeMethod(guard, [guard, fraction]() {
+                if (guard) {
+                    guard->onExportPngProgress(fraction);
+                }
+            }, Qt::QueuedConnection);
+        };
+        std::string error;
+        const bool ok = store ? ExportSlicesToPng(*store, *options, &error, ThreadPool::Global(), progress)
+                              : ExportSlicesToPng(volume, *options, &error, ThreadPool::Global(), progress);
+        const QString message = QString::fromStdString(error);
+        QMetaObject::invokeMethod(guard, [guard, ok, directory, message]() {
+            if (guard) {
+                guard->onExportPngFinished(ok, directory, message);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void Widget::onExportPngProgress(double fraction)
+{
+    if (m_pngExporting) {
+        ui->btn_export_png->setText(QString("%1%").arg(static_cast<int>(fraction * 100.0)));
+    }
+}
+
+void Widget::onExportPngFinished(bool ok, const QString &directory, const QString &error)
+{
+    m_pngExporting = false;
+    ui->btn_export_png->setText(QStringLiteral("导出"));
+    ui->btn_export_png->setEnabled(true);
+
+    if (!ok) {
+        QMessageBox::warning(this, QStringLiteral("Error"),
+                             QStringLiteral("Failed to export PNG: %1").arg(error));
+        return;
+    }
+    QMessageBox::information(this, QStringLiteral("Success"),
+                             QStringLiteral("Slices exported to %1").arg(QDir::toNativeSeparators(directory)));
+}
+
+// ===== Watch folder =====
+
+void Widget::onWatchToggled(bool checked)
+{
+    if (!checked) {
+        StopWatching();
+        return;
+    }
+
+    int dims[3];
+    GetVolumeDimensions(dims);
+    const bool hasVolume = dims[0] > 0 && dims[1] > 0 && dims[2] > 0;
+    if (m_volumeStore || m_decodeJob || (hasVolume && m_loadedSeriesFiles.empty())) {
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+                             QStringLiteral("Watch mode only supports in-memory single-frame series."));
+        QSignalBlocker blocker(ui->btn_watch);
+        ui->btn_watch->setChecked(false);
+        return;
+    }
+
+    // 已打开序列时监视其目录，否则选择一个（可以为空的）接收目录，首批文件到达后自动打开
+    QString directory = hasVolume ? m_loadedDirectory : QString();
+    if (directory.isEmpty()) {
+        directory = QFileDialog::getExistingDirectory(this, QStringLiteral("Select Folder to Watch"));
+    }
+    if (directory.isEmpty() || !m_folderWatcher->addPath(directory)) {
+        QSignalBlocker blocker(ui->btn_watch);
+        ui->btn_watch->setChecked(false);
+        return;
+    }
+
+    m_watchDirectory = directory;
+    m_watchPending.clear();
+    m_watchSeries.Clear();
+    if (hasVolume) {
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        m_watchSeries.Reset(m_loadedSeriesFiles, true, ThreadPool::Global());
+        QApplication::restoreOverrideCursor();
+    }
+    // 立即扫描一次，打开目录之后到达的文件也能补上
+    m_watchTimer->start(0);
+}
+
+void Widget::StopWatching()
+{
+    if (m_watchTimer) {
+        m_watchTimer->stop();
+    }
+    if (m_folderWatcher && !m_watchDirectory.isEmpty()) {
+        m_folderWatcher->removePath(m_watchDirectory);
+    }
+    m_watchDirectory.clear();
+    m_watchPending.clear();
+    m_watchSeries.Clear();
+}
+
+void Widget::onWatchDirectoryChanged()
+{
+    m_watchTimer->start(1000);
+}
+
+void Widget::onWatchTimeout()
+{
+    if (m_watchDirectory.isEmpty()) {
+        return;
+    }
+    // 后台导出/保存仍在读取体数据或掩膜时不能重新分配，稍后再试
+    if (m_maskSaving || m_pngExporting || m_maskEditor->IsStroking()) {
+        m_watchTimer->start(1000);
+        return;
+    }
+
+    // 扫描器仍在写入的文件大小会变化：两次检查之间大小不变才解析
+    const std::vector<std::string> files =
+        DicomDirectoryScanner::ListFiles(m_watchDirectory.toStdString(), false);
+    std::vector<std::string> stable;
+    bool waiting = false;
+    for (const std::string &fileName : files) {
+        if (m_watchSeries.IsKnown(fileName)) {
+            continue;
+        }
+        const qint64 size = QFileInfo(QString::fromStdString(fileName)).size();
+        auto it = m_watchPending.find(fileName);
+        if (it != m_watchPending.end() && it->second == size && size > 0) {
+            stable.push_back(fileName);
+            m_watchPending.erase(it);
+        } else {
+            m_watchPending[fileName] = size;
+            waiting = true;
+        }
+    }
+
+    if (m_watchSeries.IsEmpty()) {
+        // 尚无体数据：等目录中的文件全部稳定后按普通方式打开
+        if (!stable.empty() && !waiting) {
+            std::vector<std::string> seriesFiles;
+            if (FindDicomSeries(m_watchDirectory.toStdString(), seriesFiles)) {
+                LoadDicomDirectory(m_watchDirectory);
+                if (m_loadedSeriesFiles.empty()) {
+                    ui->btn_watch->setChecked(false);
+                    QMessageBox::warning(this, QStringLiteral("Warning"),
+                                         QStringLiteral("Watch mode only supports in-memory single-frame series."));
+                    return;
+                }
+                m_watchSeries.Reset(m_loadedSeriesFiles, true, ThreadPool::Global());
+                // 目录中其余文件（其他序列等）记为已知，之后只处理新到达的文件
+                IncrementalDicomSeries::Update ignored;
+                m_watchSeries.AddFiles(files, ThreadPool::Global(), ignored);
+                m_watchPending.clear();
+            }
+        }
+    } else if (!stable.empty()) {
+        IncrementalDicomSeries::Update update;
+        vtkImageData *image = m_viewerAxial ? m_viewerAxial->GetInput() : nullptr;
+        if (image && m_watchSeries.AddFiles(stable, ThreadPool::Global(), update)) {
+            // 只解码新到达的文件，按体数据当前的像素类型读取
+            const int scalarType = image->GetScalarType();
+            int dims[3];
+            image->GetDimensions(dims);
+            InsertIncomingSlices(update, [&](size_t i, void *dst) {
+                vtkSmartPointer<vtkImageData> slice;
+                try {
+                    slice = LoadDicomSeries({ update.insertedSlices[i].second }, nullptr, scalarType);
+                } catch (const itk::ExceptionObject &) {
+                    return false;
+                }
+                int sliceDims[3];
+                if (!slice || slice->GetScalarType() != scalarType) {
+                    return false;
+                }
+                slice->GetDimensions(sliceDims);
+                if (sliceDims[0] != dims[0] || sliceDims[1] != dims[1]) {
+                    return false;
+                }
+                std::memcpy(dst, slice->GetScalarPointer(),
+                            static_cast<size_t>(dims[0]) * dims[1] * slice->GetScalarSize());
+                return true;
+            });
+            m_loadedSeriesFiles = m_watchSeries.GetFileNames();
+        }
+    }
+
+    if (waiting) {
+        m_watchTimer->start(1000);
+    }
+}
+
+// 按 oldToNew 把已有切片搬到扩展后体数据中的新位置，新切片位置填 0
+static vtkSmartPointer<vtkDataArray> ExpandSlices(vtkDataArray *source, const int dims[3],
+                                                  const std::vector<int> &oldToNew, int depth)
+{
+    vtkSmartPointer<vtkDataArray> expanded;
+    expanded.TakeReference(vtkDataArray::CreateDataArray(source->GetDataType()));
+    expanded->SetNumberOfComponents(source->GetNumberOfComponents());
+    const size_t sliceTuples = static_cast<size_t>(dims[0]) * dims[1];
+    expanded->SetNumberOfTuples(static_cast<vtkIdType>(sliceTuples * depth));
+
+    const size_t sliceBytes = sliceTuples * source->GetNumberOfComponents() * source->GetDataTypeSize();
+    auto *dst = static_cast<unsigned char *>(expanded->GetVoidPointer(0));
+    const auto *src = static_cast<const unsigned char *>(source->GetVoidPointer(0));
+    std::memset(dst, 0, sliceBytes * depth);
+    ThreadPool::Global().ParallelFor(0, oldToNew.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            std::memcpy(dst + sliceBytes * oldToNew[i], src + sliceBytes * i, sliceBytes);
+        }
+    }, 8);
+    return expanded;
+}
+
+void Widget::InsertIncomingSlices(const IncrementalDicomSeries::Update &update,
+                                  const std::function<bool(size_t, void *)> &decodeSlice)
+{
+    vtkImageData *image = m_viewerAxial ? m_viewerAxial->GetInput() : nullptr;
+    if (!image || m_volumeStore || update.insertedSlices.empty()) {
+        return;
+    }
+    int dims[3];
+    image->GetDimensions(dims);
+    if (static_cast<int>(update.oldToNew.size()) != dims[2]) {
+        return;
+    }
+
+    // 新切片直接解码到扩展后体数据中的位置，解码失败的层清零
+    vtkSmartPointer<vtkDataArray> scalars =
+        ExpandSlices(image->GetPointData()->GetScalars(), dims, update.oldToNew, update.depth);
+    const size_t sliceBytes = static_cast<size_t>(dims[0]) * dims[1] * scalars->GetDataTypeSize();
+    auto *voxels = static_cast<unsigned char *>(scalars->GetVoidPointer(0));
+    ThreadPool::Global().ParallelFor(0, update.insertedSlices.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            unsigned char *dst = voxels + sliceBytes * update.insertedSlices[i].first;
+            if (!decodeSlice(i, dst)) {
+                std::memset(dst, 0, sliceBytes);
+            }
+        }
+    });
+
+    double spacing[3];
+    image->GetSpacing(spacing);
+    if (update.sliceSpacing > 0.0) {
+        spacing[2] = update.sliceSpacing;
+    }
+    double origin[3];
+    image->GetOrigin(origin);
+    if (update.hasOrigin) {
+        std::copy(update.origin, update.origin + 3, origin);
+    }
+
+    image->SetDimensions(dims[0], dims[1], update.depth);
+    image->SetSpacing(spacing);
+    image->SetOrigin(origin);
+    image->GetPointData()->SetScalars(scalars);
+    image->Modified();
+    // 体数据随插入的切片变大，预算按新的大小记入
+    m_volumeReservation.Charge(sliceBytes * static_cast<size_t>(update.depth));
+
+    // 掩膜图层随体数据插入空白切片；切片索引改变后旧的撤销记录不再有效
+    EndMaskStroke();
+    const int newDims[3] = { dims[0], dims[1], update.depth };
+    for (MaskLayer &layer : m_maskLayers) {
+        int layerDims[3];
+        layer.labels->GetDimensions(layerDims);
+        if (layerDims[0] != dims[0] || layerDims[1] != dims[1] || layerDims[2] != dims[2]) {
+            continue;
+        }
+        vtkSmartPointer<vtkDataArray> labels =
+            ExpandSlices(layer.labels->GetPointData()->GetScalars(), dims, update.oldToNew, update.depth);
+        layer.labels->SetDimensions(newDims[0], newDims[1], newDims[2]);
+        layer.labels->SetSpacing(spacing);
+        layer.labels->SetOrigin(origin);
+        layer.labels->GetPointData()->SetScalars(labels);
+        layer.labels->Modified();
+        layer.editor->Attach(layer.labels->GetScalarPointer(), layer.labels->GetScalarType() == VTK_SHORT,
+                             newDims, spacing);
+    }
+
+    // 轴位保持在原来那张切片上，滑块范围随层数扩展
+    const int oldAxial = std::clamp(ui->slider_axial->value(), 0, dims[2] - 1);
+    const int axial = update.oldToNew[oldAxial];
+    {
+        QSignalBlocker blocker(ui->slider_axial);
+        ui->slider_axial->setRange(0, update.depth - 1);
+        ui->slider_axial->setValue(axial);
+    }
+    m_viewerAxial->SetSlice(axial);
+
+    // 矢状/冠状视图的图像范围沿 Z 变长，重置相机使新切片可见
+    for (vtkResliceImageViewer *viewer : { m_viewerSagittal.GetPointer(), m_viewerCoronal.GetPointer() }) {
+        if (viewer) {
+            viewer->SetSlice(viewer->GetSlice());
+            viewer->GetRenderer()->ResetCamera();
+        }
+    }
+
+    // 直方图按新数据重算，保留当前窗宽窗位
+    UpdateVolumeHistogram(image);
+    SetupWindowLevelControls(false);
+
+    // 3D 切片平面与外框随后在事件循环中更新，保持相机不变
+    m_scene3dVolume = image;
+    Schedule3DSceneUpdate(false);
+
+    if (!m_maskLayers.empty()) {
+        SetupMaskPipeline();
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        UpdateRoi(ViewerForAxis(axis));
+    }
+    UpdateMaskEditButtons();
+    onWindowLevelChanged();
+    UpdateAnnotations();
+
+    m_viewerAxial->Render();
+    m_viewerSagittal->Render();
+    m_viewerCoronal->Render();
+}
+
+
+// ===== DICOM receiver =====
+
+void Widget::onReceiveToggled(bool checked)
+{
+    if (!checked) {
+        StopReceiving();
+        return;
+    }
+
+    bool ok = false;
+    const int port = QInputDialog::getInt(this, QStringLiteral("DICOM Receiver"), QStringLiteral("Listen port:"),
+                                          m_receivePort, 1, 65535, 1, &ok);
+    if (!ok) {
+        QSignalBlocker blocker(ui->btn_receive);
+        ui->btn_receive->setChecked(false);
+        return;
+    }
+
+    // 回调在关联线程上执行，只把实例移入队列，入队后立即应答发送方，不等待界面
+    m_storeScp = std::make_unique<DicomStoreScp>();
+    std::string error;
+    const bool started = m_storeScp->Start(static_cast<unsigned short>(port),
+        [this](ReceivedDicomInstance &&instance) {
+            std::lock_guard<std::mutex> lock(m_receiveMutex);
+            m_receivedInstances.push_back(std::move(instance));
+            return true;
+        }, &error);
+    if (!started) {
+        m_storeScp.reset();
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+                             QStringLiteral("Cannot start DICOM receiver: %1").arg(QString::fromStdString(error)));
+        QSignalBlocker blocker(ui->btn_receive);
+        ui->btn_receive->setChecked(false);
+        return;
+    }
+    m_receivePort = port;
+    ui->btn_receive->setToolTip(QStringLiteral("C-STORE SCP listening on port %1").arg(port));
+    m_receiveTimer->start();
+}
+
+void Widget::StopReceiving()
+{
+    if (m_storeScp) {
+        m_storeScp->Stop();
+        m_storeScp.reset();
+    }
+    ui->btn_receive->setToolTip(QString());
+    // 已应答成功的实例仍在队列中：定时器继续运行，取空后自行停止
+}
+
+void Widget::onReceiveTimeout()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_receiveMutex);
+        if (m_receivedInstances.empty()) {
+            if (!m_storeScp) {
+                m_receiveTimer->stop();
+            }
+            return;
+        }
+    }
+    // 后台导出/保存仍在读取体数据或掩膜时不能重新分配，留在队列中下次再取
+    if (m_maskSaving || m_pngExporting || m_maskEditor->IsStroking()) {
+        return;
+    }
+
+    std::vector<ReceivedDicomInstance> batch;
+    {
+        std::lock_guard<std::mutex> lock(m_receiveMutex);
+        batch.swap(m_receivedInstances);
+    }
+    // 只有单帧、灰度、原生编码的实例能作为切片显示
+    batch.erase(std::remove_if(batch.begin(), batch.end(),
+                               [](const ReceivedDicomInstance &instance) { return !instance.IsDisplayableSlice(); }),
+                batch.end());
+    if (batch.empty()) {
+        return;
+    }
+
+    vtkImageData *image = m_viewerAxial ? m_viewerAxial->GetInput() : nullptr;
+    if (m_receiveSeries.IsEmpty() || !image) {
+        ShowReceivedSeries(batch);
+        return;
+    }
+
+    // 其他序列与重复发送的实例由 AddHeaders 过滤
+    std::unordered_map<std::string, const ReceivedDicomInstance *> bySop;
+    std::vector<DicomFileHeader> headers;
+    headers.reserve(batch.size());
+    for (const ReceivedDicomInstance &instance : batch) {
+        bySop.emplace(instance.header.fileName, &instance);
+        headers.push_back(instance.header);
+    }
+    IncrementalDicomSeries::Update update;
+    if (!m_receiveSeries.AddHeaders(std::move(headers), update)) {
+        return;
+    }
+    int dims[3];
+    image->GetDimensions(dims);
+    const int scalarType = image->GetScalarType();
+    InsertIncomingSlices(update, [&](size_t i, void *dst) {
+        const ReceivedDicomInstance &instance = *bySop.at(update.insertedSlices[i].second);
+        return static_cast<int>(instance.header.columns) == dims[0] &&
+               static_cast<int>(instance.header.rows) == dims[1] &&
+               DecodeReceivedSlice(instance, scalarType, dst);
+    });
+}
+
+void Widget::ShowReceivedSeries(std::vector<ReceivedDicomInstance> &instances)
+{
+    // 第一个实例所在的序列成为接收序列，同批其他序列的实例忽略
+    const std::string key = DicomDirectoryScanner::SeriesKey(instances.front().header, true);
+    std::unordered_map<std::string, const ReceivedDicomInstance *> bySop;
+    std::vector<const ReceivedDicomInstance *> members;
+    std::vector<DicomFileHeader> headers;
+    for (const ReceivedDicomInstance &instance : instances) {
+        if (DicomDirectoryScanner::SeriesKey(instance.header, true) == key &&
+            bySop.emplace(instance.header.fileName, &instance).second) {
+            members.push_back(&instance);
+            headers.push_back(instance.header);
+        }
+    }
+    DicomDirectoryScanner::SortSeries(headers);
+
+    // 几何与 ImageSeriesReader 一致：原点取首张切片的 IPP，层间距取前两张切片 IPP 的距离
+    const DicomFileHeader &first = headers.front();
+    const DicomPixelModule &pixels = bySop.at(first.fileName)->pixels;
+    const int columns = static_cast<int>(first.columns);
+    const int rows = static_cast<int>(first.rows);
+    double sliceSpacing = 0.0;
+    if (headers.size() > 1 && first.hasPosition && headers[1].hasPosition) {
+        double distance = 0.0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const double d = headers[1].position[axis] - first.position[axis];
+            distance += d * d;
+        }
+        sliceSpacing = std::sqrt(distance);
+    }
+    if (sliceSpacing <= 0.0) {
+        sliceSpacing = std::atof(first.sliceThickness.c_str());
+    }
+
+    const int scalarType = SelectReceivedScalarType(members);
+    auto vtkImage = vtkSmartPointer<vtkImageData>::New();
+    vtkImage->SetDimensions(columns, rows, static_cast<int>(headers.size()));
+    vtkImage->SetSpacing(pixels.pixelSpacing[1], pixels.pixelSpacing[0], sliceSpacing > 0.0 ? sliceSpacing : 1.0);
+    if (first.hasPosition) {
+        vtkImage->SetOrigin(first.position[0], first.position[1], first.position[2]);
+    }
+    vtkImage->AllocateScalars(scalarType, 1);
+    const size_t sliceBytes = static_cast<size_t>(columns) * rows * vtkImage->GetScalarSize();
+    auto *voxels = static_cast<unsigned char *>(vtkImage->GetScalarPointer());
+    ThreadPool::Global().ParallelFor(0, headers.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const ReceivedDicomInstance &instance = *bySop.at(headers[i].fileName);
+            unsigned char *dst = voxels + sliceBytes * i;
+            if (instance.header.columns != first.columns || instance.header.rows != first.rows ||
+                !DecodeReceivedSlice(instance, scalarType, dst)) {
+                std::memset(dst, 0, sliceBytes);
+            }
+        }
+    });
+
+    // 与打开新目录相同：结束后台解码、外存模式与目录监视
+    CancelBackgroundDecode();
+    ReleaseVolumeStore();
+    m_volumeReservation.Charge(sliceBytes * headers.size());
+    UpdateLargeImageView(nullptr);
+    ui->btn_watch->setChecked(false);
+    m_loadedDirectory.clear();
+    m_loadedSeriesFiles.clear();
+
+    m_patientName = DecodeDicomString("0010|0010", first.patientName);
+    m_patientID   = DecodeDicomString("0010|0020", first.patientID);
+    m_modality    = DecodeDicomString("0008|0060", first.modality);
+    // 方向矩阵（行主序）的三列依次为行方向、列方向与切片法向
+    const double *row = first.orientation;
+    const double *column = first.orientation + 3;
+    const double normal[3] = { row[1] * column[2] - row[2] * column[1],
+                               row[2] * column[0] - row[0] * column[2],
+                               row[0] * column[1] - row[1] * column[0] };
+    for (int r = 0; r < 3; ++r) {
+        m_volumeDirection[r * 3 + 0] = row[r];
+        m_volumeDirection[r * 3 + 1] = column[r];
+        m_volumeDirection[r * 3 + 2] = normal[r];
+    }
+
+    m_receiveSeries.Reset(std::move(headers), true);
+    UpdateVolumeHistogram(vtkImage);
+    ShowVolume(vtkImage);
+}
+
+// ===== Prior study =====
+
+void Widget::onOpenPriorStudy()
+{
+    if (m_priorLoading) {
+        return;
+    }
+    const QString dirPath = QFileDialog::getExistingDirectory(this, QStringLiteral("Select Prior Study Directory"));
+    if (dirPath.isEmpty()) {
+        return;
+    }
+
+    if (!m_priorView) {
+        m_priorView = new PriorStudyView(this);
+    }
+    // 先释放旧的对比研究，其预算可用于新的加载
+    m_priorView->ClearStudy();
+    m_priorView->ShowLoadProgress(0, 0);
+    m_priorView->show();
+    m_priorView->raise();
+
+    m_priorLoading = true;
+    ui->btn_prior->setEnabled(false);
+    QPointer<Widget> guard(this);
+    const std::string directory = dirPath.toStdString();
+    m_priorLoadTask = ThreadPool::Global().Submit([guard, directory]() {
+        auto progress = [guard](size_t decoded, size_t total) {
+            QMetaObject::invokeMethod(guard, [guard, decoded, total]() {
+                if (guard) {
+                    guard->onPriorLoadProgress(decoded, total);
+                }
+            }, Qt::QueuedConnection);
+        };
+        auto study = std::make_shared<LoadedStudy>(LoadStudyInMemory(directory, progress));
+        QMetaObject::invokeMethod(guard, [guard, study]() {
+            if (guard) {
+                guard->onPriorLoadFinished(study);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void Widget::onPriorLoadProgress(size_t decoded, size_t total)
+{
+    if (m_priorLoading && m_priorView) {
+        m_priorView->ShowLoadProgress(decoded, total);
+    }
+}
+
+void Widget::onPriorLoadFinished(const std::shared_ptr<LoadedStudy> &study)
+{
+    m_priorLoading = false;
+    ui->btn_prior->setEnabled(true);
+    if (!study->image) {
+        m_priorView->setWindowTitle(QStringLiteral("Prior"));
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+                             QStringLiteral("Prior study load failed: %1")
+                                 .arg(QString::fromLocal8Bit(study->error.c_str())));
+        return;
+    }
+
+    const QString title = QString::fromStdString(DecodeDicomString("0010|0010", study->metadata.patientName)) +
+                          QStringLiteral(" ") +
+                          QString::fromStdString(DecodeDicomString("0008|0060", study->metadata.modality));
+    m_priorView->SetStudy(std::move(*study), title.trimmed());
+    m_priorView->show();
+    if (m_viewerAxial) {
+        m_priorView->SetWindowLevel(m_viewerAxial->GetColorWindow(), m_viewerAxial->GetColorLevel());
+    }
+    SyncPriorStudy();
+}
+
+bool Widget::CurrentPatientPoint(double lps[3]) const
+{
+    double origin[3];
+    double spacing[3];
+    if (m_volumeStore) {
+        const VolumeGeometry &geometry = m_volumeStore->GetGeometry();
+        std::copy(std::begin(geometry.origin), std::end(geometry.origin), origin);
+        std::copy(std::begin(geometry.spacing), std::end(geometry.spacing), spacing);
+    } else if (m_viewerAxial && m_viewerAxial->GetInput()) {
+        m_viewerAxial->GetInput()->GetOrigin(origin);
+        m_viewerAxial->GetInput()->GetSpacing(spacing);
+    } else {
+        return false;
+    }
+
+    // P = O + D * (S * ijk)，ijk 按轴依次为矢状、冠状、轴位滑块
+    const double ijk[3] = { static_cast<double>(ui->slider_sagittal->value()),
+                            static_cast<double>(ui->slider_coronal->value()),
+                            static_cast<double>(ui->slider_axial->value()) };
+    for (int r = 0; r < 3; ++r) {
+        lps[r] = origin[r];
+        for (int c = 0; c < 3; ++c) {
+            lps[r] += m_volumeDirection[r * 3 + c] * spacing[c] * ijk[c];
+        }
+    }
+    return true;
+}
+
+void Widget::SyncPriorStudy()
+{
+    if (!m_priorView || !m_priorView->HasStudy() || !m_priorView->isVisible()) {
+        return;
+    }
+    double lps[3];
+    if (CurrentPatientPoint(lps)) {
+        m_priorView->SyncToPatientPoint(lps);
+    }
+}
+
+void Widget::onRegisterPrior()
+{
+    if (m_registering) {
+        return;
+    }
+    if (!m_priorView || !m_priorView->HasStudy()) {
+        QMessageBox::warning(this, QStringLiteral("Warning"), QStringLiteral("Load a prior study first."));
+        return;
+    }
+    if (m_volumeStore || !m_viewerAxial || !m_viewerAxial->GetInput()) {
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+                             QStringLiteral("Registration needs the current series loaded in memory."));
+        return;
+    }
+
+    bool ok = false;
+    const QStringList items{ QStringLiteral("Rigid"), QStringLiteral("Affine") };
+    const QString item = QInputDialog::getItem(this, QStringLiteral("Register Prior Study"),
+                                               QStringLiteral("Transform:"), items, 0, false, &ok);
+    if (!ok) {
+        return;
+    }
+    auto options = std::make_shared<RegistrationOptions>();
+    options->affine = item == items[1];
+
+    // 体数据以引用计数持有，配准期间换序列也不会释放正在读取的缓冲区
+    vtkSmartPointer<vtkImageData> fixed = m_viewerAxial->GetInput();
+    vtkSmartPointer<vtkImageData> moving = m_priorView->GetStudy().image;
+    auto directions = std::make_shared<std::array<double, 18>>();
+    std::copy(std::begin(m_volumeDirection), std::end(m_volumeDirection), directions->begin());
+    std::copy(std::begin(m_priorView->GetStudy().metadata.direction),
+              std::end(m_priorView->GetStudy().metadata.direction), directions->begin() + 9);
+
+    m_registering = true;
+    m_registerButtonText = ui->btn_register->text();
+    m_registrationCancel = false;
+    ui->btn_register->setEnabled(false);
+    QPointer<Widget> guard(this);
+    std::atomic<bool> *cancel = &m_registrationCancel;
+    m_registrationTask = ThreadPool::Global().Submit([guard, options, fixed, moving, directions, cancel]() {
+        auto progress = [guard](double fraction) {
+            QMetaObject::invokeMethod(guard, [guard, fraction]() {
+                if (guard) {
+                    guard->onRegistrationProgress(fraction);
+                }
+            }, Qt::QueuedConnection);
+        };
+        PatientTransform transform;
+        double metric = 0.0;
+        std::string error;
+        const bool ok = RegisterVolumes(fixed, directions->data(), moving, directions->data() + 9, *options,
+                                        transform, &error, &metric, progress, cancel);
+        const QString message = QString::fromLocal8Bit(error.c_str());
+        QMetaObject::invokeMethod(guard, [guard, ok, transform, metric, message, fixed, moving]() {
+            if (guard) {
+                guard->onRegistrationFinished(ok, transform, metric, message, fixed, moving);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void Widget::onRegistrationProgress(double fraction)
+{
+    if (m_registering) {
+        ui->btn_register->setText(QString("%1%").arg(static_cast<int>(fraction * 100.0)));
+    }
+}
+
+void Widget::onRegistrationFinished(bool ok, const PatientTransform &transform, double metric,
+                                    const QString &error, const vtkSmartPointer<vtkImageData> &fixed,
+                                    const vtkSmartPointer<vtkImageData> &moving)
+{
+    m_registering = false;
+    ui->btn_register->setText(m_registerButtonText);
+    ui->btn_register->setEnabled(true);
+
+    if (!ok) {
+        QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Registration failed: %1").arg(error));
+        return;
+    }
+    // 配准期间当前序列或对比研究已被替换、关闭时结果作废
+    if (!m_viewerAxial || m_viewerAxial->GetInput() != fixed.GetPointer() ||
+        !m_priorView || m_priorView->GetStudy().image.GetPointer() != moving.GetPointer()) {
+        return;
+    }
+
+    m_priorView->SetPatientTransform(transform);
+    SyncPriorStudy();
+    // 以当前十字位置处的位移概括配准结果
+    double point[3] = { 0.0, 0.0, 0.0 };
+    double mapped[3];
+    CurrentPatientPoint(point);
+    transform.Apply(point, mapped);
+    const double shift = std::sqrt((mapped[0] - point[0]) * (mapped[0] - point[0]) +
+                                   (mapped[1] - point[1]) * (mapped[1] - point[1]) +
+                                   (mapped[2] - point[2]) * (mapped[2] - point[2]));
+    QMessageBox::information(this, QStringLiteral("Success"),
+                             QStringLiteral("Prior study registered.\nMetric: %1\nDisplacement at current position: %2 mm")
+                                 .arg(metric, 0, 'f', 4)
+                                 .arg(shift, 0, 'f', 1));
+}
+
+// ===== 大图模式 =====
+
+void Widget::UpdateLargeImageView(vtkImageData *image)
+{
+    if (!TiledImageView::IsLargePlanarImage(image)) {
+        if (m_largeImageView) {
+            m_largeImageView->ClearImage();
+            m_largeImageView->hide();
+        }
+        return;
+    }
+
+    if (!m_largeImageView) {
+        m_largeImageView = new TiledImageView(this);
+    }
+    std::string error;
+    if (!m_largeImageView->SetImage(image, QString::fromStdString(m_patientName), &error)) {
+        QMessageBox::warning(this, QStringLiteral("Warning"),
+                             QStringLiteral("Cannot open large image view: %1").arg(QString::fromStdString(error)));
+        return;
+    }
+    if (m_viewerAxial) {
+        m_largeImageView->SetWindowLevel(m_viewerAxial->GetColorWindow(), m_viewerAxial->GetColorLevel());
+    }
+    m_largeImageView->show();
+    m_largeImageView->raise();
+}
+
+// ===== CLAHE 显示模式 =====
+
+void Widget::onClaheToggled(bool checked)
+{
+    m_claheEnabled = checked;
+    if (!checked) {
+        m_claheCache.Clear();
+    }
+    RefreshEnhancedSlices();
+}
+
+void Widget::RefreshEnhancedSlices()
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        UpdateEnhancedSlice(axis);
+        if (vtkResliceImageViewer *viewer = ViewerForAxis(axis)) {
+            if (viewer->GetInput()) {
+                viewer->Render();
+            }
+        }
+    }
+}
+
+void Widget::UpdateEnhancedSlice(int axis)
+{
+    vtkResliceImageViewer *viewer = ViewerForAxis(axis);
+    EnhancePipeline &enhance = m_enhance[axis];
+    vtkImageData *input = viewer ? viewer->GetInput() : nullptr;
+    if (!m_claheEnabled || !input) {
+        if (enhance.actor) {
+            enhance.actor->VisibilityOff();
+        }
+        return;
+    }
+
+    // 与视图相同的输入（外存模式下是当前单层），只处理当前显示的一层
+    const int slice = viewer->GetSlice();
+    int width = 0;
+    int height = 0;
+    const std::vector<unsigned char> *pixels =
+        m_claheCache.Get(input, axis, slice, viewer->GetColorWindow(), viewer->GetColorLevel(),
+                         m_claheParameters, width, height);
+    if (!pixels) {
+        if (enhance.actor) {
+            enhance.actor->VisibilityOff();
+        }
+        return;
+    }
+
+    if (!enhance.image) {
+        enhance.image = vtkSmartPointer<vtkImageData>::New();
+    }
+    int extent[6];
+    input->GetExtent(extent);
+    extent[2 * axis] = extent[2 * axis + 1] = slice;
+    int current[6];
+    enhance.image->GetExtent(current);
+    enhance.image->SetOrigin(input->GetOrigin());
+    enhance.image->SetSpacing(input->GetSpacing());
+    if (!std::equal(extent, extent + 6, current) || !enhance.image->GetPointData()->GetScalars()) {
+        enhance.image->SetExtent(extent);
+        enhance.image->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+    }
+    std::copy(pixels->begin(), pixels->end(), static_cast<unsigned char *>(enhance.image->GetScalarPointer()));
+    enhance.image->Modified();
+
+    if (!enhance.actor) {
+        enhance.actor = vtkSmartPointer<vtkImageActor>::New();
+        enhance.actor->SetInputData(enhance.image);
+        // 结果已是 0～255 的显示灰度，按恒等映射显示
+        enhance.actor->GetProperty()->SetColorWindow(255.0);
+        enhance.actor->GetProperty()->SetColorLevel(127.5);
+        enhance.actor->PickableOff();
+    }
+    vtkRenderer *renderer = viewer->GetRenderer();
+    if (renderer && !renderer->HasViewProp(enhance.actor)) {
+        // 插在原图之后、掩膜叠加层之前
+        MaskPipeline *maskPipe = MaskPipelineForAxis(axis);
+        if (maskPipe && maskPipe->actor && renderer->HasViewProp(maskPipe->actor)) {
+            renderer->RemoveActor(maskPipe->actor);
+            renderer->AddActor(enhance.actor);
+            renderer->AddActor(maskPipe->actor);
+        } else {
+            renderer->AddActor(enhance.actor);
+        }
+    }
+    enhance.actor->VisibilityOn();
 }
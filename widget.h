@@ -2,27 +2,51 @@
 #define WIDGET_H
 
 #include <QWidget>
+#include <QElapsedTimer>
 
 #include <vtkSmartPointer.h>
 #include <vtkResliceImageViewer.h>
 #include <vtkImageData.h>
 #include <vtkCallbackCommand.h>
 #include <vtkCornerAnnotation.h>
-#include <vtkCellPicker.h>
 #include <vtkDistanceWidget.h>
 #include <vtkDistanceRepresentation2D.h>
 #include <vtkProperty2D.h>
-#include <vtkImageReslice.h>
-#include <vtkImageMapToColors.h>
 #include <vtkImageActor.h>
-#include <vtkExtractVOI.h>
-#include <vtkImagePermute.h>
+#include <vtkActor2D.h>
+#include <vtkPolyData.h>
+#include <vtkTextActor.h>
 
 #include <itkImage.h>
 #include <itkMetaDataObject.h>
 #include <itkImageFileReader.h>
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "volumehistogram.h"
+#include "multiframereader.h"
+#include "dicomscanner.h"
+#include "dicomvolumeloader.h"
+#include "maskeditor.h"
+#include "volumewriter.h"
+#include "maskoverlay.h"
+#include "dicomseg.h"
+#include "rtstruct.h"
+#include "sliceexporter.h"
+#include "incrementalseries.h"
+#include "dicomstorescp.h"
+#include "roistatistics.h"
+#include "studyloader.h"
+#include "imageregistration.h"
+#include "contrastenhancement.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -37,8 +61,15 @@ class vtkRenderer;
 class vtkObject;
 class vtkImagePlaneWidget;
 class vtkActor;
+class vtkOutlineSource;
+class vtkLookupTable;
 
 class QSlider;
+class QListWidgetItem;
+class QFileSystemWatcher;
+class QTimer;
+class PriorStudyView;
+class TiledImageView;
 
 class Widget : public QWidget
 {
@@ -56,15 +87,54 @@ private slots:
     void onWindowLevelChanged();
     void onMeasureToggled(bool checked);
     void onLoadMask();
+    void onPresetChanged(int index);
+    void onClaheToggled(bool checked);
+    void onMaskToolToggled(bool checked);
+    void onRoiToolToggled(bool checked);
+    void onMaskUndo();
+    void onMaskRedo();
+    void onSaveMask();
+    void onMaskLayerSelected(int row);
+    void onMaskLayerItemChanged(QListWidgetItem *item);
+    void onMaskOpacityChanged(int value);
+    void onRemoveMaskLayer();
+    void onExportPng();
+    void onWatchToggled(bool checked);
+    void onWatchDirectoryChanged();
+    void onWatchTimeout();
+    void onReceiveToggled(bool checked);
+    void onReceiveTimeout();
+    void onOpenPriorStudy();
+    void onRegisterPrior();
 
 private:
-    using PixelType = short;
     static constexpr unsigned int Dimension = 3;
-    using ImageType = itk::Image<PixelType, Dimension>;
 
-    vtkSmartPointer<vtkImageData> ItkToVtkImage(ImageType *image);
-    std::string GetDicomValue(const itk::MetaDataDictionary &dict,
-                              const std::string &tagKey) const;
+    std::string DecodeDicomString(const std::string &tagKey,
+                                  const std::string &value) const;
+
+    void LoadDicomDirectory(const QString &dirPath);
+    bool LoadMultiFrameFile(const std::string &fileName);
+    void ShowVolume(vtkSmartPointer<vtkImageData> vtkImage);
+    // 按体数据原生标量类型统计直方图，可只统计一段连续体素（如多帧首个解码切片）
+    void UpdateVolumeHistogram(vtkImageData *image, vtkIdType firstVoxel = 0,
+                               vtkIdType voxelCount = -1);
+    void onMultiFrameProgress(unsigned int decoded, unsigned int total);
+    void CancelBackgroundDecode();
+
+    // 外存模式：体数据超出内存预算时写入分块存储，三个视图各自只持有当前切片
+    bool LoadOutOfCore(const std::vector<std::string> &fileNames,
+                       const VolumeGeometry &geometry,
+                       const DicomVolumeMetadata &metadata);
+    void ReleaseVolumeStore();
+    void LoadStreamingSlice(int axis, int index);
+    void UpdateStreamingHistogram();
+    void HandleStreamingWheel(vtkResliceImageViewer *viewer, int step);
+    vtkImageData *ViewInput(int axis, vtkImageData *volume) const;
+    void Schedule3DSceneUpdate(bool resetCamera);
+    void Initialize3DScene();
+    void Update3DScene();
+    void GetVolumeDimensions(int dims[3]) const;
     void registerSliceObserver(vtkResliceImageViewer *viewer,
                                vtkSmartPointer<vtkCallbackCommand> &callback,
                                unsigned long &observerTag);
@@ -110,22 +180,38 @@ private:
     vtkSmartPointer<vtkImagePlaneWidget> m_planeCoronal;
 
     // 3D 视图中的立方体外框
+    vtkSmartPointer<vtkOutlineSource> m_outlineSource;
     vtkSmartPointer<vtkActor> m_outlineActor;
 
+    // 3D 场景延后到二维首帧之后、在事件循环里建立与更新；多次请求合并为一次
+    vtkSmartPointer<vtkImageData> m_scene3dVolume;
+    bool m_scene3dPending;
+    bool m_scene3dResetCamera;
+    // 从开始加载目录计时，到首个二维帧渲染完成（MYDICOMVIEWER_TIMING）
+    QElapsedTimer m_loadTimer;
+
     // 距离测量工具
     vtkSmartPointer<vtkDistanceWidget> m_distWidgetAxial;
     vtkSmartPointer<vtkDistanceWidget> m_distWidgetSagittal;
     vtkSmartPointer<vtkDistanceWidget> m_distWidgetCoronal;
 
-    // 掩膜数据
+    // 掩膜图层：可同时加载多个标签体，各自有不透明度、可见性与撤销历史
+    struct MaskLayer {
+        QString name;
+        vtkSmartPointer<vtkImageData> labels;
+        double opacity = 1.0;
+        bool visible = true;
+        std::unique_ptr<MaskEditor> editor;
+    };
+    std::vector<MaskLayer> m_maskLayers;
+    int m_activeMaskLayer;
+
+    // 当前图层的标签体（编辑与保存的对象）
     vtkSmartPointer<vtkImageData> m_maskData;
 
-    // 掩膜管线结构体（每个视图需要独立管线）
+    // 每个视图一个叠加层：overlay 只含当前切片，由所有可见图层一次合成为 RGBA
     struct MaskPipeline {
-        vtkSmartPointer<vtkImageReslice> reslice;
-        vtkSmartPointer<vtkExtractVOI> extractVOI;
-        vtkSmartPointer<vtkImagePermute> permute;
-        vtkSmartPointer<vtkImageMapToColors> colorMap;
+        vtkSmartPointer<vtkImageData> overlay;
         vtkSmartPointer<vtkImageActor> actor;
     };
 
@@ -133,6 +219,19 @@ private:
     MaskPipeline m_maskSagittal;
     MaskPipeline m_maskCoronal;
 
+    // CLAHE 显示模式：每个视图一个只含当前切片的 8 位图像，盖在原图之上、掩膜之下；
+    // 由窗宽窗位映射后的灰度计算，按层与参数缓存，不修改体数据。下标为轴（0=X, 1=Y, 2=Z）
+    struct EnhancePipeline {
+        vtkSmartPointer<vtkImageData> image;
+        vtkSmartPointer<vtkImageActor> actor;
+    };
+    EnhancePipeline m_enhance[3];
+    bool m_claheEnabled;
+    ClaheParameters m_claheParameters;
+    ClaheSliceCache m_claheCache;
+    void UpdateEnhancedSlice(int axis);
+    void RefreshEnhancedSlices();
+
     vtkSmartPointer<vtkCallbackCommand> m_axialSliceCallback;
     vtkSmartPointer<vtkCallbackCommand> m_sagittalSliceCallback;
     vtkSmartPointer<vtkCallbackCommand> m_coronalSliceCallback;
@@ -150,12 +249,54 @@ private:
     // DICOM 元数据缓存
     std::string m_patientName;
     std::string m_patientID;
+    std::string m_modality;
+    // 体数据方向矩阵（行主序，LPS），保存掩膜时写入文件头
+    double m_volumeDirection[9];
+
+    // 当前体数据的直方图与窗宽窗位预设（加载时计算一次，切换预设无需重算）
+    VolumeHistogram m_histogram;
+    std::vector<WindowLevelPreset> m_windowPresets;
+    int m_volumeScalarType;
+    // 窗宽窗位滑块为整数：浮点数据（如 SUV）按此倍数放大映射到滑块刻度
+    double m_windowLevelScale;
+
+    void SetupWindowLevelControls(bool applyInitialPreset = true);
+
+    // 内存中体数据占用的共享预算（与对比研究共用），剩余预算放不下时改走外存模式
+    StudyMemoryReservation m_volumeReservation;
+
+    // 多帧 DICOM 后台逐帧解码任务
+    std::unique_ptr<MultiFrameDecodeJob> m_decodeJob;
+
+    // 外存分块存储及按轴（0=X 矢状, 1=Y 冠状, 2=Z 轴位）的单切片视图输入
+    std::shared_ptr<BrickedVolumeStore> m_volumeStore;
+    vtkSmartPointer<vtkImageData> m_streamSlices[3];
+    int m_streamLastIndex[3];
 
     void UpdateAnnotations();
-    void UpdateMaskSlice(vtkResliceImageViewer *viewer,
-                        MaskPipeline &maskPipe,
-                        const char *viewName);
+    // 按视图当前切片重新合成整张叠加层
+    void UpdateMaskSlice(vtkResliceImageViewer *viewer, MaskPipeline &maskPipe);
     void SetupMaskPipeline();
+    void AddMaskLayer(vtkSmartPointer<vtkImageData> labels, const QString &name);
+    // 读取 DICOM SEG：选择要加载的段后按帧位置映射到当前图像网格，作为一个图层加入
+    void LoadSegmentationMask(const QString &fileName);
+    // 读取 RTSTRUCT：选择要加载的 ROI 后把轮廓栅格化到当前图像网格，作为一个图层加入
+    void LoadRtStructMask(const QString &fileName);
+    // 当前图像的网格几何（外存模式取体数据仓库的几何）
+    SegmentationGrid CurrentMaskGrid() const;
+    // 多个段/ROI 时让用户选择全部或其中一个；取消时返回 false，selectedName 为单选时的名称
+    bool SelectMaskItems(const QString &title, const QStringList &names, std::vector<size_t> &selected,
+                         QString &selectedName);
+    // 栅格化过的 ROI 按结构集 UID 缓存，重复加载同一结构集时不再扫描转换
+    RtStructRasterCache m_rtStructCache;
+    void SetActiveMaskLayer(int index);
+    void ClearMaskLayers();
+    void RefreshMaskLayerList();
+    void RefreshMaskOverlays();
+    MaskPipeline *MaskPipelineForAxis(int axis);
+    vtkResliceImageViewer *ViewerForAxis(int axis) const;
+    // 在叠加层 extent 内合成 ext 子区域（ext 已与叠加层相交）
+    void CompositeMaskOverlay(vtkImageData *overlay, const int ext[6]);
     
     static void OnClickCallback(vtkObject* caller,
                                 unsigned long eventId,
@@ -164,5 +305,148 @@ private:
     void HandleViewClick(vtkResliceImageViewer *viewer,
                          vtkRenderWindowInteractor *interactor,
                          vtkRenderer *renderer);
+
+    // 鼠标位置实时探针（体素索引 / 世界坐标 / HU / 掩膜标签）
+    static void OnProbeCallback(vtkObject* caller,
+                                unsigned long eventId,
+                                void* clientData,
+                                void* callData);
+    void registerProbeObserver(vtkResliceImageViewer *viewer);
+    void HandleProbe(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor);
+    void ClearProbe(vtkResliceImageViewer *viewer);
+    vtkCornerAnnotation *AnnotationForViewer(vtkResliceImageViewer *viewer) const;
+    vtkResliceImageViewer *ViewerForInteractor(vtkObject *interactor) const;
+
+    // 显示坐标 -> 世界坐标 -> 体素索引，只依赖相机与图像几何，O(1)
+    bool DisplayToVoxel(vtkResliceImageViewer *viewer, int displayX, int displayY,
+                        int ijk[3], double world[3]) const;
+    // 显示坐标 -> 当前切片平面上的世界坐标，不检查是否落在图像内
+    bool DisplayToWorld(vtkResliceImageViewer *viewer, int displayX, int displayY, double world[3]) const;
+
+    vtkSmartPointer<vtkCallbackCommand> m_probeCallback;
+
+    // 交互期间的降级渲染：拖动窗宽窗位滑块或在二维视图中平移、缩放时改用最近邻采样，
+    // 高分屏上按逻辑像素渲染；输入停顿片刻后恢复原分辨率与线性插值并重绘一帧
+    static void OnInteractionLodCallback(vtkObject* caller,
+                                         unsigned long eventId,
+                                         void* clientData,
+                                         void* callData);
+    void registerInteractionLodObserver(vtkResliceImageViewer *viewer);
+    void BeginInteractionLod();
+    void SetInteractionLod(bool active);
+    void onInteractionIdle();
+
+    vtkSmartPointer<vtkCallbackCommand> m_lodCallback;
+    QTimer *m_lodIdleTimer;
+    bool m_lodActive;
+    // 正在进行的平移/缩放/拖动窗宽窗位（交互样式的 Start/EndInteractionEvent 计数）
+    int m_lodInteractions;
+
+    // 掩膜编辑：左键按下开始一笔，拖动续画，抬起结束；叠加层只按脏区重新合成。
+    // m_maskEditor 指向当前图层的编辑器，无图层时指向空闲编辑器
+    MaskEditor m_idleMaskEditor;
+    MaskEditor *m_maskEditor;
+    vtkSmartPointer<vtkLookupTable> m_maskLut;
+    vtkResliceImageViewer *m_strokeViewer;
+
+    bool ActiveMaskTool(MaskEditor::Tool &tool) const;
+    bool EnsureEditableMask();
+    bool BeginMaskEdit(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor);
+    void ContinueMaskStroke(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor);
+    void EndMaskStroke();
+    void RecolorMaskRegion(const MaskRegion &region);
+    void UpdateMaskEditButtons();
+
+    // 矩形 / 椭圆 / 套索 ROI：每个视图保留一个，拖动与翻层时由该层的积分图实时统计均值与标准差。
+    // points 为切片平面内的连续体素坐标 (u, v)：矩形与椭圆是两个对角点，套索是鼠标轨迹
+    enum class RoiShape { Rectangle, Ellipse, Lasso };
+    struct RoiOverlay {
+        RoiShape shape = RoiShape::Rectangle;
+        std::vector<std::array<double, 2>> points;
+        vtkSmartPointer<vtkPolyData> outline;
+        vtkSmartPointer<vtkActor2D> outlineActor;
+        vtkSmartPointer<vtkTextActor> label;
+        RoiStatisticsCache statistics;
+    };
+    RoiOverlay m_roiAxial;
+    RoiOverlay m_roiSagittal;
+    RoiOverlay m_roiCoronal;
+    vtkResliceImageViewer *m_roiViewer;
+
+    RoiOverlay *RoiOverlayForAxis(int axis);
+    bool ActiveRoiShape(RoiShape &shape) const;
+    bool BeginRoi(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor);
+    void ContinueRoi(vtkResliceImageViewer *viewer, vtkRenderWindowInteractor *interactor);
+    void EndRoi();
+    // 按视图当前切片重画轮廓并重新统计
+    void UpdateRoi(vtkResliceImageViewer *viewer);
+    void ClearRois();
+
+    // 掩膜在线程池上后台压缩保存，期间禁止编辑以保证写出的是一致快照
+    std::future<void> m_maskSaveTask;
+    bool m_maskSaving;
+    void onMaskSaveProgress(double fraction);
+    void onMaskSaveFinished(bool ok, const QString &filePath, const QString &error);
+
+    // 批量导出 PNG：与命令行共用 ExportSlicesToPng，在线程池上后台运行
+    std::future<void> m_pngExportTask;
+    bool m_pngExporting;
+    void onExportPngProgress(double fraction);
+    void onExportPngFinished(bool ok, const QString &directory, const QString &error);
+
+    // 监视目录：新文件大小稳定后只解析其文件头，按切片位置原地插入当前体数据
+    QString m_loadedDirectory;
+    std::vector<std::string> m_loadedSeriesFiles;
+    QFileSystemWatcher *m_folderWatcher;
+    QTimer *m_watchTimer;
+    QString m_watchDirectory;
+    IncrementalDicomSeries m_watchSeries;
+    // 尚未稳定的新文件 -> 上次看到的大小
+    std::unordered_map<std::string, qint64> m_watchPending;
+    void StopWatching();
+    // 把 update 描述的新切片插入当前体数据：decodeSlice(i, dst) 在线程池上并行调用，
+    // 把 insertedSlices[i] 按体数据的标量类型写入 dst，失败时该层保持为 0
+    void InsertIncomingSlices(const IncrementalDicomSeries::Update &update,
+                              const std::function<bool(size_t, void *)> &decodeSlice);
+
+    // DICOM 网络接收：存储服务在关联线程上解析实例后放入队列，界面定时成批取出，
+    // 首批建立体数据，之后按切片位置原地插入，像素直接从接收缓冲区解码，不经过磁盘
+    std::unique_ptr<DicomStoreScp> m_storeScp;
+    int m_receivePort;
+    QTimer *m_receiveTimer;
+    std::mutex m_receiveMutex;
+    std::vector<ReceivedDicomInstance> m_receivedInstances;
+    IncrementalDicomSeries m_receiveSeries;
+    void StopReceiving();
+    void ShowReceivedSeries(std::vector<ReceivedDicomInstance> &instances);
+
+    // 对比研究：在线程池上后台加载，切片解码与当前研究共用有界解码池，
+    // 滑块与窗宽窗位变化时按病人坐标同步到对比窗口
+    PriorStudyView *m_priorView;
+    std::future<void> m_priorLoadTask;
+    bool m_priorLoading;
+    void onPriorLoadProgress(size_t decoded, size_t total);
+    void onPriorLoadFinished(const std::shared_ptr<LoadedStudy> &study);
+    // 三个滑块所指体素中心的病人坐标
+    bool CurrentPatientPoint(double lps[3]) const;
+    void SyncPriorStudy();
+
+    // 对比研究到当前研究的刚体 / 仿射配准：在线程池上后台运行，结果只作用于联动定位与掩膜映射，
+    // 不重采样任何一方的原始体数据
+    std::future<void> m_registrationTask;
+    std::atomic<bool> m_registrationCancel;
+    bool m_registering;
+    // 配准期间按钮显示进度，结束后恢复 .ui 中的原文字
+    QString m_registerButtonText;
+    void onRegistrationProgress(double fraction);
+    // fixed / moving 为发起配准时的两幅图像，期间任一被替换则结果作废。
+    // 以引用计数传入，回调处理前两者不会被释放，新图像不会复用同一地址而误通过比较
+    void onRegistrationFinished(bool ok, const PatientTransform &transform, double metric,
+                                const QString &error, const vtkSmartPointer<vtkImageData> &fixed,
+                                const vtkSmartPointer<vtkImageData> &moving);
+
+    // 大图模式：单帧大尺寸图像另开瓦片金字塔窗口显示，窗宽窗位跟随主窗口
+    TiledImageView *m_largeImageView;
+    void UpdateLargeImageView(vtkImageData *image);
 };
 #endif // WIDGET_H
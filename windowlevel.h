@@ -0,0 +1,21 @@
+﻿#ifndef WINDOWLEVEL_H
+#define WINDOWLEVEL_H
+
+#include <cstddef>
+
+// 与 vtkImageMapToWindowLevelColors 相同的映射：(v - (L - W/2)) / W * 255，钳制到 [0, 255]。
+// 把 src 起相隔 stride 个元素的 count 个值映射为 8 位灰度；lower = L - W/2，scale = 255 / W
+template <typename T>
+inline void WindowLevelRow(const T *src, std::ptrdiff_t stride, int count, double lower, double scale,
+                           unsigned char *dst)
+{
+    for (int i = 0; i < count; ++i) {
+        const double value = (static_cast<double>(src[i * stride]) - lower) * scale;
+        // NaN 落入第一个分支映射为黑色
+        dst[i] = !(value > 0.0) ? 0
+               : value >= 255.0 ? 255
+               : static_cast<unsigned char>(value + 0.5);
+    }
+}
+
+#endif // WINDOWLEVEL_H